@@ -205,7 +205,7 @@ void ide_read(struct disk *hd, uint32_t lba, void *buf, uint32_t sec_cnt)
         /*********************   阻塞自己的时机  ***********************
         在硬盘已经开始工作(开始在内部读数据或写数据)后才能阻塞自己,现在硬盘已经开始忙了,
         将自己阻塞,等待硬盘完成读操作后通过中断处理程序唤醒自己*/
-        sema_down(&hd->my_channel->disk_done);
+        sema_down_io(&hd->my_channel->disk_done);
         /*************************************************************/
 
         /* 4 检测硬盘状态是否可读 */
@@ -261,7 +261,7 @@ void ide_write(struct disk *hd, uint32_t lba, void *buf, uint32_t sec_cnt)
         write2sector(hd, (void *)((uint32_t)buf + secs_done * 512), secs_op);
 
         // 在硬盘相应期间阻塞自己
-        sema_down(&hd->my_channel->disk_done);
+        sema_down_io(&hd->my_channel->disk_done);
 
         secs_done += secs_op;
     }
@@ -4,6 +4,10 @@
 #include "sync.h"
 #include "bitmap.h"
 
+#define BITMAP_DIRTY_MAX 8 // 每个分区最多暂存的脏位图扇区数
+
+struct journal;
+
 // 描述分区
 struct partition
 {
@@ -16,6 +20,15 @@ struct partition
     struct bitmap block_bitmap; // 块位图
     struct bitmap inode_bitmap; // i节点位图
     struct list open_inodes;    // 本分区打开的i节点队列
+    struct rwlock bitmap_lock;  // 保护块位图, inode位图和下面的脏扇区集合
+    struct journal *journal;    // 本分区的元数据日志, 没有日志时为NULL
+
+    uint32_t bitmap_dirty_lba[BITMAP_DIRTY_MAX]; // 待回写的位图扇区lba集合
+    uint32_t bitmap_dirty_cnt;                   // 集合中的脏扇区个数
+    uint32_t bitmap_sync_cnt;                    // 位图被修改的次数(bitmap_sync调用次数)
+    uint32_t bitmap_io_cnt;                      // 位图实际写盘的扇区数
+    uint32_t bitmap_last_sync;                   // 最近一次文件系统操作修改位图的次数
+    uint32_t bitmap_last_io;                     // 最近一次文件系统操作位图写盘的扇区数
 };
 
 // 描述硬盘
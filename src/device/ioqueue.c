@@ -36,7 +36,7 @@ static void ioq_wait(struct task_struct **waiter)
 {
    ASSERT(*waiter == NULL && waiter != NULL);
    *waiter = running_thread();
-   thread_block(TASK_BLOCKED);
+   thread_block_io(TASK_BLOCKED);
 }
 
 /* 唤醒waiter */
@@ -58,6 +58,8 @@ char ioq_getchar(struct ioqueue *ioq)
     * 也就是唤醒当前线程自己*/
    while (ioq_empty(ioq))
    { // 这里执行的加锁解锁操作为什么 没有在整个函数的开头和结尾，而却是在这里
+      if (thread_group_exiting())
+         return 0; // 主线程正在退出, 不再等待, 调用者应检查thread_group_exiting
       lock_acquire(&ioq->lock);
       ioq_wait(&ioq->consumer);
       lock_release(&ioq->lock);
@@ -97,6 +99,16 @@ void ioq_putchar(struct ioqueue *ioq, char byte)
    }
 }
 
+/* 唤醒在ioq上等待, 属于地址空间mm的消费者. 主线程退出时调用 */
+void ioq_wake_group(struct ioqueue *ioq, struct mm_struct *mm)
+{
+   ASSERT(intr_get_status() == INTR_OFF);
+   if (ioq->consumer != NULL && ioq->consumer->mm == mm)
+   {
+      wakeup(&ioq->consumer);
+   }
+}
+
 uint32_t ioq_length(struct ioqueue *ioq)
 {
    uint32_t len = 0;
@@ -32,5 +32,6 @@ void ioqueue_init(struct ioqueue *ioq);
 bool ioq_full(struct ioqueue *ioq);
 char ioq_getchar(struct ioqueue *ioq);
 void ioq_putchar(struct ioqueue *ioq, char byte);
+void ioq_wake_group(struct ioqueue *ioq, struct mm_struct *mm);
 uint32_t ioq_length(struct ioqueue *ioq);
 #endif
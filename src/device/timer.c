@@ -6,21 +6,50 @@
 #include "debug.h"
 #include "string.h"
 #include "stdio-kernel.h"
+#include "smp.h"
 
 #define IRQ0_FREQUENCY 100 // 1秒100个时钟中断
 #define INPUT_FREQUENCY 1193180
-#define COUNTER0_VALUE INPUT_FREQUENCY / IRQ0_FREQUENCY
+#define COUNTER0_VALUE (INPUT_FREQUENCY / IRQ0_FREQUENCY)
 #define CONTRER0_PORT 0x40
 #define COUNTER0_NO 0
-#define COUNTER_MODE 2
+#define COUNTER_MODE 2   // 周期模式, 计数到0后自动重装
+#define ONESHOT_MODE 0   // 单次模式, 计数到0时产生一次中断后停止
 #define READ_WRITE_LATCH 3
 #define PIT_CONTROL_PORT 0x43
+#define PIT_LATCH_COUNTER0 0x00 // 锁存计数器0当前值的控制字
+/* 计数器是16位的, 单次模式一次最多睡眠的嘀嗒数, 65535 / 11931 = 5, 约50毫秒 */
+#define NOHZ_MAX_TICKS (0xFFFF / COUNTER0_VALUE)
 
 #define mil_seconds_per_intr (1000 / IRQ0_FREQUENCY) // 1个时钟中断10毫秒, 1000/100
 
 uint32_t volatile ticks = 0; // ticks是内核自中断开启以来总共的嘀嗒数
 tm_t time;
 
+/* 时间轮, 第1层tv1, 第2到5层tvn[0..3] */
+static struct list tv1[TVR_SIZE];
+static struct list tvn[TVN_LEVELS][TVN_SIZE];
+static uint32_t timer_jiffies; // 时间轮下一个要处理的嘀嗒, 比它小的到期时间都已处理
+
+/* 无时钟滴答的空闲(tickless idle): 系统空闲时停止周期性时钟中断, 把PIT设为单次模式,
+ * 在最近的定时器到期时才产生中断, 醒来后补上停止期间经过的嘀嗒 */
+static bool tick_stopped;      // 周期性时钟中断是否已停止
+static uint32_t nohz_counts;   // 单次模式设置的计数值
+static uint32_t nohz_remainder; // 上次补嘀嗒时不足一个嘀嗒的计数, 累计到下次, 避免时间漂移
+static uint32_t last_aging;    // 上一次优先级老化时的ticks
+
+/* 时钟源: 用PIT校准rdtsc的频率, 提供纳秒级的单调时钟.
+ * 周期数换算为纳秒: ns = cycles * tsc_mult >> tsc_shift, 避免64位除法 */
+#define CALIBRATE_COUNTS (5 * COUNTER0_VALUE) // 校准用的PIT计数, 约50毫秒
+uint32_t tsc_khz;           // tsc的频率, 为0表示校准失败, 退回到用ticks计时
+static uint32_t tsc_mult;
+static uint32_t tsc_shift;
+static uint64_t tsc_base;   // 单调时钟0点处的tsc
+static uint32_t boot_epoch; // 单调时钟0点时的墙上时间, 1970年以来的秒数
+
+/* a在b之后(含相等), 考虑了ticks回绕 */
+#define time_after_eq(a, b) ((int32_t)((a) - (b)) >= 0)
+
 #define READ_COMS(addr) ({ \
    outb(0x70, addr);       \
    inb(0x71);              \
@@ -48,31 +77,184 @@ static void get_cur_time(void)
    BCD_TO_BIN(time.year);
 }
 
-// 得到系统当前的时间输出，只能计算本月内的时间，如果今天31号，但系统已经运行了48小时
-// 那么得到的系统时间就是 33号 hhhhhhhhhhhhhhh, 这边只简单实现一下
-// 这里个函数不对， ticks太多了，不知道为什么
+static bool is_leap_year(uint32_t year)
+{
+   return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+/* 每月的天数, 闰年二月另加1 */
+static const uint8_t days_in_month[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+static uint32_t month_days(uint32_t year, uint32_t month)
+{
+   return days_in_month[month - 1] + (month == 2 && is_leap_year(year) ? 1 : 0);
+}
+
+/* 把RTC读出的时间换算成1970-01-01 00:00:00以来的秒数, RTC只有年份的后两位, 按20xx年处理 */
+static uint32_t rtc_to_epoch(tm_t *tm)
+{
+   uint32_t year = 2000 + tm->year;
+   uint32_t days = 0, y = 1970, m = 1;
+   for (y = 1970; y < year; y++)
+   {
+      days += is_leap_year(y) ? 366 : 365;
+   }
+   for (m = 1; m < (uint32_t)tm->month; m++)
+   {
+      days += month_days(year, m);
+   }
+   days += tm->day - 1;
+   return days * DAY + tm->hour * HOUR + tm->min * MINUTE + tm->sec;
+}
+
+/* 由1970年以来的秒数得到当前时间, 直接使用ticks推算时无法进位到天, 月, 年 */
 void sys_date(void)
 {
-   uint32_t sec_already = ticks / 100;
-   uint32_t add_hour = sec_already / HOUR;
-   uint32_t add_min = (sec_already - (add_hour * HOUR)) / MINUTE;
-   uint32_t add_sec = sec_already - (add_hour * HOUR) - (add_min * MINUTE);
+   struct timespec now;
+   sys_clock_gettime(CLOCK_REALTIME, &now);
+
+   uint32_t days = now.tv_sec / DAY;
+   uint32_t secs = now.tv_sec % DAY;
+   uint32_t year = 1970, month = 1;
+   while (days >= (is_leap_year(year) ? 366U : 365U))
+   {
+      days -= is_leap_year(year) ? 366 : 365;
+      year++;
+   }
+   while (days >= month_days(year, month))
+   {
+      days -= month_days(year, month);
+      month++;
+   }
 
-   time.sec += add_hour;
-   time.min += (add_min);
-   time.hour += (add_hour);
+   printk("Current_Time: %d/%d/%d %d:%d:%d\n", year, month, days + 1, secs / HOUR, secs % HOUR / MINUTE, secs % MINUTE);
+}
 
-   printk("Current_Time: %d/%d/%d %d:%d:%d\n", time.year, time.month, time.day, time.hour, time.min, time.sec);
+/* 初始化定时器, 到期时调用function(arg) */
+void ktimer_init(struct ktimer *timer, timer_func *function, void *arg)
+{
+   timer->function = function;
+   timer->arg = arg;
+   timer->expires = 0;
+   timer->pending = false;
+   elem_init(&timer->entry);
+}
+
+/* 按到期时间把定时器挂到时间轮对应的槽上 */
+static void internal_add_timer(struct ktimer *timer)
+{
+   uint32_t expires = timer->expires;
+   uint32_t idx = expires - timer_jiffies;
+   struct list *vec;
+
+   if ((int32_t)idx < 0)
+   { // 已经过期, 放到下一个要处理的槽
+      vec = &tv1[timer_jiffies & TVR_MASK];
+   }
+   else if (idx < TVR_SIZE)
+   {
+      vec = &tv1[expires & TVR_MASK];
+   }
+   else
+   {
+      uint32_t level = 0;
+      while (level < TVN_LEVELS - 1 && idx >= (1U << (TVR_BITS + (level + 1) * TVN_BITS)))
+      {
+         level++;
+      }
+      vec = &tvn[level][(expires >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK];
+   }
+   list_append(vec, &timer->entry);
+   timer->pending = true;
+}
+
+/**
+ * @brief timer_add启动定时器, 在ticks到达expires时调用其函数. 定时器已启动时先将其停止
+ *
+ * @param timer 用ktimer_init初始化过的定时器, 到期前其内存必须一直有效
+ * @param expires 到期时的ticks
+ */
+void timer_add(struct ktimer *timer, uint32_t expires)
+{
+   enum intr_status old_status = intr_disable();
+   if (timer->pending)
+   {
+      list_remove(&timer->entry);
+   }
+   timer->expires = expires;
+   internal_add_timer(timer);
+   intr_set_status(old_status);
+}
+
+/* 停止定时器, 定时器原来在等待到期则返回true */
+bool timer_del(struct ktimer *timer)
+{
+   enum intr_status old_status = intr_disable();
+   bool pending = timer->pending;
+   if (pending)
+   {
+      list_remove(&timer->entry);
+      timer->pending = false;
+   }
+   intr_set_status(old_status);
+   return pending;
+}
+
+/* 把第level+2层index号槽中的定时器重新分散到下面的层, 返回index */
+static uint32_t cascade(uint32_t level, uint32_t index)
+{
+   struct list *vec = &tvn[level][index];
+   while (!list_empty(vec))
+   {
+      struct ktimer *timer = elem2entry(struct ktimer, entry, list_pop(vec));
+      internal_add_timer(timer);
+   }
+   return index;
+}
+
+/* 处理时间轮中所有已到期的定时器, 在时钟中断中调用 */
+static void run_timers(void)
+{
+   while (time_after_eq(ticks, timer_jiffies))
+   {
+      uint32_t index = timer_jiffies & TVR_MASK;
+      /* 第1层转完一圈, 从上一层取下一批定时器, 上一层也转完一圈时再向上取 */
+      if (index == 0)
+      {
+         uint32_t level = 0;
+         while (level < TVN_LEVELS && cascade(level, (timer_jiffies >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK) == 0)
+         {
+            level++;
+         }
+      }
+      timer_jiffies++;
+
+      struct list *vec = &tv1[index];
+      while (!list_empty(vec))
+      {
+         struct ktimer *timer = elem2entry(struct ktimer, entry, list_pop(vec));
+         timer->pending = false;
+         timer->function(timer->arg);
+      }
+   }
+}
+
+/* 睡眠定时器到期, 唤醒睡眠的线程 */
+static void sleep_timeout(void *arg)
+{
+   thread_unblock((struct task_struct *)arg);
 }
 
 /* 以tick为单位的sleep,任何时间形式的sleep会转换此ticks形式 */
 static void ticks_to_sleep(uint32_t sleep_ticks)
 {
-   uint32_t Old_ticks = ticks;
-
-   /* 若间隔的ticks数不够便让出cpu */
-   while (ticks - Old_ticks < sleep_ticks)
-      thread_yield();
+   /* 睡眠期间线程阻塞, 不在就绪队列中, 由时间轮上的定时器到期时唤醒 */
+   struct ktimer timer;
+   ktimer_init(&timer, sleep_timeout, running_thread());
+   enum intr_status old_status = intr_disable();
+   timer_add(&timer, ticks + sleep_ticks);
+   thread_block(TASK_BLOCKED);
+   intr_set_status(old_status);
 }
 
 /* 把操作的计数器counter_no、读写锁属性rwl、计数器模式counter_mode写入模式控制寄存器并赋予初始值counter_value */
@@ -92,6 +274,174 @@ static void frequency_set(uint8_t counter_port,
    outb(counter_port, (uint8_t)(counter_value >> 8));
 }
 
+/* 把停止时钟期间经过的counts个计数补到ticks上, 并恢复周期性时钟中断 */
+static void tick_restart(uint32_t counts)
+{
+   counts += nohz_remainder;
+   ticks += counts / COUNTER0_VALUE;
+   nohz_remainder = counts % COUNTER0_VALUE;
+   tick_stopped = false;
+   frequency_set(CONTRER0_PORT, COUNTER0_NO, READ_WRITE_LATCH, COUNTER_MODE, COUNTER0_VALUE);
+}
+
+/* 读取计数器0的当前值 */
+static uint16_t pit_read_counter(void)
+{
+   outb(PIT_CONTROL_PORT, PIT_LATCH_COUNTER0);
+   uint8_t low = inb(CONTRER0_PORT);
+   uint8_t high = inb(CONTRER0_PORT);
+   return ((uint16_t)high << 8) | low;
+}
+
+/* 用PIT计数器0校准tsc的频率: 单次模式下数CALIBRATE_COUNTS个PIT时钟, 同时记下经过的cpu周期数 */
+static void tsc_calibrate(void)
+{
+   frequency_set(CONTRER0_PORT, COUNTER0_NO, READ_WRITE_LATCH, ONESHOT_MODE, CALIBRATE_COUNTS);
+   uint64_t start = rdtsc();
+   uint16_t prev = CALIBRATE_COUNTS, cur;
+   /* 计数到0后会从0xFFFF继续减, 看到计数变大或为0说明已经数完 */
+   while ((cur = pit_read_counter()) != 0 && cur <= prev)
+   {
+      prev = cur;
+   }
+   uint64_t cycles = rdtsc() - start;
+
+   /* 单位是kHz时商不会超过32位 */
+   tsc_khz = div64_32(cycles * INPUT_FREQUENCY, CALIBRATE_COUNTS * 1000, NULL);
+   if (tsc_khz == 0)
+   {
+      return;
+   }
+
+   /* tsc_mult = 10^6 * 2^tsc_shift / tsc_khz, 在不超过32位的前提下取尽量大的tsc_shift以保证精度 */
+   tsc_shift = 32;
+   while ((((uint64_t)NSEC_PER_MSEC << tsc_shift) >> 32) >= tsc_khz)
+   {
+      tsc_shift--;
+   }
+   tsc_mult = div64_32((uint64_t)NSEC_PER_MSEC << tsc_shift, tsc_khz, NULL);
+   tsc_base = rdtsc();
+}
+
+/* 把cycles个cpu周期换算成纳秒, 按高低32位分开乘, 避免96位的中间结果 */
+static uint64_t cycles_to_ns(uint64_t cycles)
+{
+   uint32_t low = (uint32_t)cycles, high = (uint32_t)(cycles >> 32);
+   uint64_t ns = ((uint64_t)low * tsc_mult) >> tsc_shift;
+   if (high != 0)
+   {
+      ns += ((uint64_t)high * tsc_mult) << (32 - tsc_shift);
+   }
+   return ns;
+}
+
+/* 开机(时钟源校准)以来经过的纳秒数, 单调递增 */
+uint64_t ktime_get_ns(void)
+{
+   if (tsc_khz == 0)
+   {
+      return (uint64_t)ticks * (NSEC_PER_SEC / IRQ0_FREQUENCY);
+   }
+   return cycles_to_ns(rdtsc() - tsc_base);
+}
+
+/**
+ * @brief sys_clock_gettime读取时钟
+ *
+ * @param clock_id CLOCK_MONOTONIC为开机以来的时间, CLOCK_REALTIME为墙上时间
+ * @param tp 输出参数, 存储秒和纳秒
+ * @return int32_t 成功返回0, clock_id不支持返回-1
+ */
+int32_t sys_clock_gettime(int32_t clock_id, struct timespec *tp)
+{
+   if (tp == NULL || (clock_id != CLOCK_REALTIME && clock_id != CLOCK_MONOTONIC))
+   {
+      return -1;
+   }
+   uint32_t nsec;
+   uint32_t sec = div64_32(ktime_get_ns(), NSEC_PER_SEC, &nsec);
+   if (clock_id == CLOCK_REALTIME)
+   {
+      sec += boot_epoch;
+   }
+   tp->tv_sec = sec;
+   tp->tv_nsec = nsec;
+   return 0;
+}
+
+/**
+ * @brief timer_next_event返回到下一个定时器到期还有多少嘀嗒, 最多查看limit个嘀嗒.
+ *        只需扫描第1层接下来的limit个槽; 第1层转完一圈时上层的定时器会落下来, 所以最多睡到那时
+ */
+static uint32_t timer_next_event(uint32_t limit)
+{
+   uint32_t delta = 0;
+   while (delta < limit)
+   {
+      uint32_t index = (timer_jiffies + delta) & TVR_MASK;
+      if ((index == 0 && delta != 0) || !list_empty(&tv1[index]))
+      {
+         break;
+      }
+      delta++;
+   }
+   /* timer_jiffies是下一个要处理的嘀嗒, 比ticks大1 */
+   return timer_jiffies + delta - ticks;
+}
+
+/**
+ * @brief tick_nohz_idle_enter在idle线程hlt之前调用, 若最近的定时器在1个嘀嗒以后才到期,
+ *        就停止周期性时钟中断, 把PIT设为单次模式在该定时器到期时中断.
+ *        当前嘀嗒已经过的计数先记入nohz_remainder, 单次计数相应减少, 中断仍落在嘀嗒的边界上
+ */
+void tick_nohz_idle_enter(void)
+{
+   ASSERT(intr_get_status() == INTR_OFF);
+   /* 多处理器时其它cpu上的任务随时可能添加定时器, 而只有bsp的PIT驱动时间轮, 不能停止 */
+   if (cpu_count > 1)
+   {
+      return;
+   }
+   uint32_t sleep_ticks = timer_next_event(NOHZ_MAX_TICKS);
+   if (sleep_ticks <= 1 || tick_stopped)
+   {
+      return;
+   }
+   if (sleep_ticks > NOHZ_MAX_TICKS)
+   {
+      sleep_ticks = NOHZ_MAX_TICKS;
+   }
+   /* 周期模式下计数器从COUNTER0_VALUE减到1后重装, 切换模式前读出当前嘀嗒已经过的计数 */
+   uint16_t current = pit_read_counter();
+   uint32_t elapsed = current != 0 && current <= COUNTER0_VALUE ? COUNTER0_VALUE - current : 0;
+   nohz_remainder += elapsed;
+   nohz_counts = sleep_ticks * COUNTER0_VALUE - elapsed;
+   tick_stopped = true;
+   frequency_set(CONTRER0_PORT, COUNTER0_NO, READ_WRITE_LATCH, ONESHOT_MODE, nohz_counts);
+}
+
+/**
+ * @brief tick_nohz_idle_exit在idle线程被中断唤醒后调用. 若唤醒它的不是时钟中断(例如键盘, 硬盘),
+ *        根据计数器的剩余值补上已经过的嘀嗒, 恢复周期性时钟中断, 并处理这期间到期的定时器.
+ *        若单次计数已经数完, 时钟中断已挂起, 开中断后就会进入intr_timer_handler, 由它补上整段嘀嗒
+ */
+void tick_nohz_idle_exit(void)
+{
+   ASSERT(intr_get_status() == INTR_OFF);
+   if (!tick_stopped)
+   {
+      return;
+   }
+   uint16_t left = pit_read_counter();
+   /* 计数器到0时单次中断已经挂起, 之后从0xFFFF继续减. 这里不补, 否则中断处理函数会再补一次 */
+   if (left == 0 || left > nohz_counts)
+   {
+      return;
+   }
+   tick_restart(nohz_counts - left);
+   run_timers();
+}
+
 /* 时钟的中断处理函数 */
 static void intr_timer_handler(int vectorNum)
 {
@@ -100,10 +450,27 @@ static void intr_timer_handler(int vectorNum)
    ASSERT(cur_thread->stack_magic == 0x19870916); // 检查栈是否溢出
 
    cur_thread->elapsed_ticks++; // 记录此线程占用的cpu时间嘀
-   ticks++;                     // 从内核第一次处理时间中断后开始至今的滴哒数,内核态和用户态总共的嘀哒数
+   if (tick_stopped)
+   { // 单次模式的中断, 补上睡眠期间的嘀嗒
+      tick_restart(nohz_counts);
+   }
+   else
+   {
+      ticks++; // 从内核第一次处理时间中断后开始至今的滴哒数,内核态和用户态总共的嘀哒数
+   }
+
+   /* 调用到期的定时器 */
+   run_timers();
+
+   /* 定期把被降级的任务恢复到静态优先级 */
+   if (ticks - last_aging >= MLFQ_AGING_TICKS)
+   {
+      last_aging = ticks;
+      thread_aging();
+   }
 
-   if (cur_thread->ticks == 0)
-   { // 若进程时间片用完就开始调度新的进程上cpu
+   if (cur_thread->ticks == 0 || need_resched)
+   { // 若进程时间片用完或有更高优先级的任务被唤醒, 就开始调度新的进程上cpu
       schedule();
    }
    else
@@ -116,10 +483,27 @@ static void intr_timer_handler(int vectorNum)
 void timer_init()
 {
    put_str("timer_init start\n");
+   /* 先用PIT校准tsc, 再读RTC作为墙上时间的起点 */
+   tsc_calibrate();
+   get_cur_time();
+   boot_epoch = rtc_to_epoch(&time);
    /* 设置8253的定时周期,也就是发中断的周期 */
    frequency_set(CONTRER0_PORT, COUNTER0_NO, READ_WRITE_LATCH, COUNTER_MODE, COUNTER0_VALUE);
+   /* 初始化时间轮 */
+   uint32_t slot = 0, level = 0;
+   while (slot < TVR_SIZE)
+   {
+      list_init(&tv1[slot++]);
+   }
+   for (level = 0; level < TVN_LEVELS; level++)
+   {
+      for (slot = 0; slot < TVN_SIZE; slot++)
+      {
+         list_init(&tvn[level][slot]);
+      }
+   }
+   timer_jiffies = ticks;
    register_handler(0x20, intr_timer_handler);
-   get_cur_time();
    put_str("timer_init done\n");
 }
 
@@ -1,6 +1,7 @@
 #ifndef __DEVICE_TIME_H
 #define __DEVICE_TIME_H
 #include "stdint.h"
+#include "list.h"
 
 typedef struct timer
 {
@@ -14,8 +15,83 @@ typedef struct timer
 
 #define MINUTE 60
 #define HOUR (60 * MINUTE)
+#define DAY (24 * HOUR)
+
+#define NSEC_PER_SEC 1000000000
+#define NSEC_PER_MSEC 1000000
+
+/* clock_gettime的时钟 */
+enum clock_id
+{
+    CLOCK_REALTIME,  // 墙上时间, 1970-01-01 00:00:00 UTC以来的时间
+    CLOCK_MONOTONIC  // 开机以来的时间, 不受修改时间影响
+};
+
+struct timespec
+{
+    uint32_t tv_sec;
+    uint32_t tv_nsec;
+};
+
+/* 读取时间戳计数器, 开机以来cpu经过的周期数 */
+static inline uint64_t rdtsc(void)
+{
+    uint32_t low, high;
+    asm volatile("rdtsc"
+                 : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+/* 64位除以32位, 内核没有64位除法的库函数, 直接用divl. 要求商不超过32位, 即n的高32位小于base */
+static inline uint32_t div64_32(uint64_t n, uint32_t base, uint32_t *rem)
+{
+    uint32_t quot, r;
+    asm("divl %4"
+        : "=a"(quot), "=d"(r)
+        : "0"((uint32_t)n), "1"((uint32_t)(n >> 32)), "rm"(base));
+    if (rem != NULL)
+        *rem = r;
+    return quot;
+}
+
+/**
+ * 分层时间轮(hierarchical timer wheel)
+ *
+ * 第1层有256个槽, 每个槽对应一个嘀嗒; 第2到5层各有64个槽, 每个槽分别对应2^8, 2^14, 2^20, 2^26个嘀嗒.
+ * 定时器按到期时间离现在的远近挂到某一层的某个槽上, 添加和删除都是O(1).
+ * 第1层每转一圈, 把上一层当前槽中的定时器重新分散到下层(cascade), 到期的定时器在时钟中断中被调用
+ */
+#define TVR_BITS 8
+#define TVN_BITS 6
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_MASK (TVR_SIZE - 1)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TVN_LEVELS 4
+
+/* 定时器到期时调用的函数, 在时钟中断处理程序中以关中断的状态执行, 不能阻塞 */
+typedef void timer_func(void *arg);
+
+struct ktimer
+{
+    struct list_elem entry; // 用于时间轮的槽
+    uint32_t expires;       // 到期时的ticks
+    timer_func *function;
+    void *arg;
+    bool pending; // 是否在时间轮中
+};
+
+extern uint32_t volatile ticks;
+extern uint32_t tsc_khz; // tsc的频率, 为0表示校准失败
 
 void timer_init(void);
+void ktimer_init(struct ktimer *timer, timer_func *function, void *arg);
+void timer_add(struct ktimer *timer, uint32_t expires);
+bool timer_del(struct ktimer *timer);
+void tick_nohz_idle_enter(void);
+uint64_t ktime_get_ns(void);
+int32_t sys_clock_gettime(int32_t clock_id, struct timespec *tp);
+void tick_nohz_idle_exit(void);
 void mtime_sleep(uint32_t m_seconds);
 void sys_date();
 #endif
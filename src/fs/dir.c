@@ -10,6 +10,7 @@
 #include "string.h"
 #include "interrupt.h"
 #include "super_block.h"
+#include "journal.h"
 
 // 在fs.c中声明
 extern struct partition *cur_part;
@@ -80,72 +81,150 @@ void create_dir_entry(char *filename, uint32_t inode_no, uint8_t file_type, stru
 }
 
 /**
- * @brief search_dir_entry用于在partition指向的分区中pdir指向的目录中寻找名称为name的文件或者目录, 找到后将其目录项存入dir_e中
+ * @brief dir_block_entries返回目录一个块中可以存放的目录项个数.
+ *        内联目录只有第0块, 由虚拟的"."和"..", 加上inode中能放下的目录项组成
  *
- * @details 一个目录文件用一个inode存储, 一个inode中有12个直接块, 即12个一级文件数据块地址, 1个间接项,
- *          即二级文件数块地址，这里地址存放了128个一级文件数据块地址(一扇区
- *          因此存储一个文件, 最多用 12 + 128(512 / 4，一个扇区 512 字节, 一个地址 4 字节) = 140个块
- *          因此, 存储目录文件最多需要140个块. 而这140个块中, 每个块内包含的都是目录项, 所以逐块检查目录项.
- *          即逐个读取块, 然后检查其中的目录项
+ * @param part 目录所在分区
+ * @param dir_inode 目录的inode
+ * @return uint32_t 目录项个数
+ */
+uint32_t dir_block_entries(struct partition *part, struct inode *dir_inode)
+{
+    uint32_t dir_entry_size = part->sb->dir_entry_size;
+    if (dir_inode->i_flags & INODE_INLINE)
+        return 2 + INODE_INLINE_SIZE / dir_entry_size;
+    return SECTOR_SIZE / dir_entry_size;
+}
+
+/**
+ * @brief dir_block_read把目录的第block_idx块读入buf. 内联目录的第0块不读硬盘, 而是在buf中构造:
+ *        前两项是由i_no和i_parent生成的"."和"..", 之后是inode中存放的目录项
  *
- * @param partition 指向要寻找的文件或者目录在的扇区
- * @param dir 指向要寻找的文件或者目录在的父目录
- * @param name 要寻找的文件或者目录的名称
- * @param dir_e 存储寻找到的文件或者目录的目录项
- * @return true 若在dir指向的文件之找到了要寻找的目录或者文件, 则返回true
- * @return false 若在dir指向的文件之没有找到要寻找的目录或者文件, 则返回false
+ * @param part 目录所在分区
+ * @param dir_inode 目录的inode
+ * @param block_idx 目录内的块号
+ * @param buf 存放读出的块, 至少SECTOR_SIZE字节
+ * @return true 读出成功
+ * @return false 该块不存在
  */
-bool search_dir_entry(struct partition *partition, struct dir *pdir, const char *name, struct dir_entry *dir_e)
+bool dir_block_read(struct partition *part, struct inode *dir_inode, uint32_t block_idx, void *buf)
 {
-    // 12个直接块地址大小+128个间接块地址大小,共560字节 */
-    uint32_t *all_blocks = (uint32_t *)sys_malloc(48 + 512);
-    if (all_blocks == NULL)
+    if (dir_inode->i_flags & INODE_INLINE)
     {
-        printk("search_dir_entry: sys_malloc for all_blocks failed");
-        return false;
+        if (block_idx != 0)
+            return false;
+        uint32_t inline_cnt = INODE_INLINE_SIZE / part->sb->dir_entry_size;
+        struct dir_entry *p_de = (struct dir_entry *)buf;
+        memset(buf, 0, SECTOR_SIZE);
+        create_dir_entry(".", dir_inode->i_no, FT_DIRECTORY, p_de);
+        create_dir_entry("..", dir_inode->i_parent, FT_DIRECTORY, p_de + 1);
+        memcpy(p_de + 2, dir_inode->i_sectors, inline_cnt * part->sb->dir_entry_size);
+        return true;
     }
 
-    uint32_t block_idx = 0;
-    while (block_idx < 12)
+    int32_t block_lba = bmap(part, dir_inode, block_idx, false);
+    if (block_lba <= 0)
+        return false;
+    journal_read(part, block_lba, buf, 1);
+    return true;
+}
+
+/**
+ * @brief dir_block_write把dir_block_read读出并修改过的块写回. 内联目录只把"."和".."之后的目录项
+ *        拷回inode, inode需要调用者同步
+ *
+ * @param part 目录所在分区
+ * @param dir_inode 目录的inode
+ * @param block_idx 目录内的块号, 该块必须已经存在
+ * @param buf 块的内容
+ */
+static void dir_block_write(struct partition *part, struct inode *dir_inode, uint32_t block_idx, void *buf)
+{
+    if (dir_inode->i_flags & INODE_INLINE)
     {
-        all_blocks[block_idx] = pdir->inode->i_sectors[block_idx];
-        block_idx++;
+        ASSERT(block_idx == 0);
+        uint32_t inline_cnt = INODE_INLINE_SIZE / part->sb->dir_entry_size;
+        memcpy(dir_inode->i_sectors, (struct dir_entry *)buf + 2, inline_cnt * part->sb->dir_entry_size);
+        return;
     }
 
-    if (pdir->inode->i_sectors[12] != 0)
+    int32_t block_lba = bmap(part, dir_inode, block_idx, false);
+    ASSERT(block_lba > 0);
+    journal_write(part, block_lba, buf, 1);
+}
+
+/**
+ * @brief dir_inline_expand在内联目录放不下新目录项时调用, 把目录项(包括"."和"..")迁移到新分配的第0块中,
+ *        此后目录和普通目录一样使用数据块. inode需要调用者同步
+ *
+ * @param part 目录所在分区
+ * @param dir_inode 内联目录的inode
+ * @param io_buf 调用者提供的缓冲区, 至少SECTOR_SIZE字节
+ * @return true 迁移成功
+ * @return false 分配块失败, 目录保持内联
+ */
+static bool dir_inline_expand(struct partition *part, struct inode *dir_inode, void *io_buf)
+{
+    ASSERT(dir_inode->i_flags & INODE_INLINE);
+    uint32_t saved[INODE_BLOCK_PTRS];
+    dir_block_read(part, dir_inode, 0, io_buf);
+    memcpy(saved, dir_inode->i_sectors, INODE_INLINE_SIZE);
+
+    // i_sectors恢复为块地址数组
+    memset(dir_inode->i_sectors, 0, INODE_INLINE_SIZE);
+    dir_inode->i_flags &= ~INODE_INLINE;
+    int32_t block_lba = bmap(part, dir_inode, 0, true);
+    if (block_lba == -1)
     {
-        // 若含有一级间接块表
-        ide_read(partition->my_disk, pdir->inode->i_sectors[12], all_blocks + 12, 1);
+        memcpy(dir_inode->i_sectors, saved, INODE_INLINE_SIZE);
+        dir_inode->i_flags |= INODE_INLINE;
+        return false;
     }
-    /* 至此,all_blocks存储的是该文件或目录的所有扇区地址 */
+    dir_inode->i_parent = 0;
+    journal_write(part, block_lba, io_buf, 1);
+    return true;
+}
 
+/**
+ * @brief dir_entry_lookup在目录inode中查找名为name的目录项, 调用者须持有dir_inode的读锁或写锁
+ *
+ * @details 目录只使用12个直接块和一级间接块, 最多DIR_MAX_BLOCKS(140)个块, 每个块内包含的都是目录项, 所以逐块检查目录项.
+ *          块地址由bmap得到, 一级间接块在第一次用到时读入inode的间接块缓存, 之后不再读硬盘
+ *
+ * @param partition 指向要寻找的文件或者目录在的扇区
+ * @param dir_inode 要寻找的文件或者目录所在的父目录的inode
+ * @param name 要寻找的文件或者目录的名称
+ * @param dir_e 存储寻找到的文件或者目录的目录项
+ * @return true 若在目录中找到了要寻找的目录或者文件, 则返回true
+ * @return false 若在目录中没有找到要寻找的目录或者文件, 则返回false
+ */
+static bool dir_entry_lookup(struct partition *partition, struct inode *dir_inode, const char *name, struct dir_entry *dir_e)
+{
     /* 写目录项的时候已保证目录项不跨扇区,
      * 这样读目录项时容易处理, 只申请容纳1个扇区的内存 */
     uint8_t *buf = (uint8_t *)sys_malloc(SECTOR_SIZE);
+    if (buf == NULL)
+    {
+        printk("dir_entry_lookup: sys_malloc for buf failed");
+        return false;
+    }
     struct dir_entry *p_de = (struct dir_entry *)buf;
 
     uint32_t dir_entry_size = partition->sb->dir_entry_size;
     // 1扇区内可容纳的目录项数量
-    uint32_t dir_entry_cnt = SECTOR_SIZE / dir_entry_size;
-
-    /**
-     * @brief 一个目录文件数据块的地址用一个inode存储, 一个inode中有12个直接索引块, 1个间接索引表（128）,
-     *     一个inode里面所有的文件数据块地址一共是140个,这140个lba地址已经存储在all_blocks里面,我们使用
-     *      这些地址遍历每一个目录文件数据块，再数据块里面找出 name 文件
-     */
-    uint32_t block_cnt = 140;
-    block_idx = 0;
+    uint32_t dir_entry_cnt = dir_block_entries(partition, dir_inode);
+
+    uint32_t block_idx = 0;
 
     // 从文件数据块中查找目录项
-    while (block_idx < block_cnt)
+    while (block_idx < DIR_MAX_BLOCKS)
     {
-        // 块地址为 0 时表示该块中无数据， 继续再其它块中找
-        if (all_blocks[block_idx] == 0)
+        // 块不存在时表示该块中无数据， 继续再其它块中找
+        if (!dir_block_read(partition, dir_inode, block_idx, buf))
         {
             block_idx++;
             continue;
         }
-        ide_read(partition->my_disk, all_blocks[block_idx], buf, 1);
 
         uint32_t dir_entry_idx = 0;
         // 遍历文件数据块中所有目录项
@@ -155,7 +234,6 @@ bool search_dir_entry(struct partition *partition, struct dir *pdir, const char
             {
                 memcpy(dir_e, p_de, dir_entry_size);
                 sys_free(buf);
-                sys_free(all_blocks);
                 return true;
             }
             dir_entry_idx++;
@@ -167,17 +245,40 @@ bool search_dir_entry(struct partition *partition, struct dir *pdir, const char
     }
 
     sys_free(buf);
-    sys_free(all_blocks);
     return false;
 }
 
 /**
- * @brief sync_dir_entry将p_de指向的目录项写入到其父目录中(parent_dir指向的目录), 并把内容持久化到硬盘
+ * @brief search_dir_entry用于在partition指向的分区中pdir指向的目录中寻找名称为name的文件或者目录, 找到后将其目录项存入dir_e中.
+ *        查找期间持有目录的读锁, 多个任务可以同时在同一目录中查找, 但不会看到写了一半的目录项
+ *
+ * @param partition 指向要寻找的文件或者目录在的扇区
+ * @param dir 指向要寻找的文件或者目录在的父目录
+ * @param name 要寻找的文件或者目录的名称
+ * @param dir_e 存储寻找到的文件或者目录的目录项
+ * @return true 若在dir指向的文件之找到了要寻找的目录或者文件, 则返回true
+ * @return false 若在dir指向的文件之没有找到要寻找的目录或者文件, 则返回false
+ */
+bool search_dir_entry(struct partition *partition, struct dir *pdir, const char *name, struct dir_entry *dir_e)
+{
+    read_lock(&pdir->inode->i_rwlock);
+    bool found = dir_entry_lookup(partition, pdir->inode, name, dir_e);
+    read_unlock(&pdir->inode->i_rwlock);
+    return found;
+}
+
+/**
+ * @brief dir_entry_insert将p_de指向的目录项写入到其父目录中(parent_dir指向的目录), 并把内容持久化到硬盘
  *         // 写入的过程中会修改目录文件的大小，可能需要扩充文件，所以需要申请空闲块，修改空闲块位图
  *         // 关于位图与目录文件数据的修改是直接同步到硬盘的
  *
- * @details sync_dir_entry的具体流程就是首先从磁盘中读出来目录的inode到内存中, 根据inode,遍历整个目录，
- *          把文件的部分挨个读入内存，找出空的位置，把目录项写入，然后就完成了持久化到硬盘。
+ * @details 从目录的第一个块开始顺序检查:
+ *              1. 块已经存在, 将其读入内存, 在其中找空的目录项位置, 找到就写入目录项并同步该块.
+ *                 因为有可能会删除文件, 所以目录文件中的目录项表并不是连续的, 所以得一个个检查
+ *              2. 块还不存在, 说明前面的块都已经装满了目录项, 由bmap分配该块(以及需要的一级间接块),
+ *                 将目录项写入新块的开头
+ *              3. 内联目录只有第0块, 放不下时先迁移到数据块中, 再按上面的步骤查找
+ *          i_sectors和i_size的修改由调用者同步到硬盘
  *
  * @param parent_dir 指向目录项的父目录
  * @param p_de 指向需要写入到磁盘中的目录项
@@ -185,7 +286,7 @@ bool search_dir_entry(struct partition *partition, struct dir *pdir, const char
  * @return true 同步成功
  * @return false 同步失败
  */
-bool sync_dir_entry(struct dir *parent_dir, struct dir_entry *p_de, void *io_buf)
+static bool dir_entry_insert(struct dir *parent_dir, struct dir_entry *p_de, void *io_buf)
 {
     struct inode *dir_inode = parent_dir->inode;            // 目录的inode
     uint32_t dir_size = dir_inode->i_size;                  // inode大小
@@ -193,119 +294,33 @@ bool sync_dir_entry(struct dir *parent_dir, struct dir_entry *p_de, void *io_buf
     // 因为是目录，目录里面只有目录项这种大小固定的元素， 按规则应该被整除
     ASSERT(dir_size % dir_entry_size == 0);
 
-    uint32_t dir_entry_per_sec = (SECTOR_SIZE / dir_entry_size); // 一个扇区里存储目录项的理论最大数量
-
-    int32_t block_lba = -1; // 将要存储目录项的lba地址, 初始化为0
-    uint8_t block_idx = 0;
-    uint32_t all_blocks_lba[140] = {0};
-
-    // 注意, 这里不需要读出全部的140个块, 读出前12个直接块就可以直接开始搜索了
-    // 前12个块是直接块, 所以直接复制lba地址即可
-    while (block_idx < 12)
-    {
-        all_blocks_lba[block_idx] = dir_inode->i_sectors[block_idx];
-        block_idx++;
-    }
-
-    // 注意:
-    //      1. 一个文件(包括目录文件)最多占用140个块, 一个块512字节, 所以一个文件最大71680字节
-    //         但是并不是所有文件(包括目录)文件会用完这140个块, 所以优先从前面的12个块开始搜索
-    //         即直接开始搜索, 而非读取完目录项的140个块之后再开始检查. 当然如果12个块搜索结束，
-    //         还没有找到合适的位置，那么还是需要填满all_blocks_lba数组的
-    //
-    //      2. 并且, 有可能存在一个情况, 就是目录文件本身可能一开始只用了第一个直接块. 那么在这个
-    //         时候, 后面的11个直接块, 包括一级间接块里面其实都是没有记录块的地址的. 此时, 如果
-    //         我们要向一个没有分配的块中写入的目录项的话, 还需要先分配一个块, 然后把该块的LBA地址
-    //         写入到inode.i_sectors[0-11]或者inode.i_sectors[12]一级间接块中
-    //      3. 最后, 因为有可能会删除文件, 所以目录文件中的目录项表并不是连续的, 所以得一个个检查
-
-    // 综上, 下面这部分循找空余位置的代码, 逻辑就是从第一个直接块开始顺序检查
-    // 如果:
-    //      1. lba不为0, 说明这个文件数据块上有数据，遍历这个数据块，看看是否能找到空余空间，存储新的目录项
-    //
-    //
-    //      2. 某个直接块的lba为0, 则表示前面的直接块都已经装满了目录项了, 此块空间未分配, 则此时需要重新分配一个快
-    //         而后将需要写入的目录项写入到新增的块中
-    //          2.1.a 若此时新分配的数据块，在前 11个直接块索引表中有空位, 则把数据块地址直接写入空位就好
-    //          2.1.b 若前面的 12个直接块索引表刚好满了, 则需要建立一级间接索引块表。在第一次申请的lba地址建立间接表
-    //              再申请一个块，作为文件数据块，而后将文件数据块的lba地址写入到一级间接表中, 持久化间接表
-    //          2.1.c 若此时 13个数据块都已经填充满, 将数据块地址写入到间接表里面中， 持久化间接表
-    //
-    //          2.2 在新的内存块里面，写入目录项, 持久化到硬盘
-    block_idx = 0;
-    int32_t block_bitmap_idx = -1;
+    int32_t block_lba = -1; // 将要存储目录项的lba地址
+    uint32_t block_idx = 0;
     // dir_e用来在io_buf中遍历目录项
     struct dir_entry *dir_e = (struct dir_entry *)io_buf;
-    bool full_all_blocks_lba = true;
-    while (block_idx < 140)
-    { // 文件(包括目录)最大支持12个直接块+128个间接块＝140个块
-        block_bitmap_idx = -1;
-        if (full_all_blocks_lba && block_idx >= 12)
-        {
-            // 此时的情况是，遍历了12个文件数据块，还没有找到空闲位置，那么我们从补充整个间接块的地址到内存
-            full_all_blocks_lba = false;
-            ide_read(cur_part->my_disk, dir_inode->i_sectors[12], all_blocks_lba + 12, 1);
-        }
+    while (block_idx < DIR_MAX_BLOCKS)
+    { // 目录最大支持12个直接块+128个间接块＝140个块
+        // 一个扇区里存储目录项的理论最大数量, 内联目录迁移后会变化
+        uint32_t dir_entry_per_sec = dir_block_entries(cur_part, dir_inode);
+
         // 情况 2 , 数据块没分配, 此时分配一个新的块, 然后将目录项写入其中
-        if (all_blocks_lba[block_idx] == 0)
+        if (!dir_block_read(cur_part, dir_inode, block_idx, io_buf))
         {
-            block_lba = block_bitmap_alloc(cur_part);
+            block_lba = bmap(cur_part, dir_inode, block_idx, true);
             if (block_lba == -1)
             {
-                printk("alloc block bitmap for sync_dir_entry failed\n");
+                printk("alloc block bitmap for dir_entry_insert failed\n");
                 return false;
             }
-            // 每分配一个块就同步一次block_bitmap
-            block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-            bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-
-            block_bitmap_idx = -1;
-            if (block_idx < 12)
-            { // 2.1.a 若为直接块
-                dir_inode->i_sectors[block_idx] = all_blocks_lba[block_idx] = block_lba;
-            }
-            else if (block_idx == 12)
-            {                                         // 2.1.b 若是尚未分配一级间接块表(block_idx等于12表示第0个间接块地址为0)
-                dir_inode->i_sectors[12] = block_lba; // 将上面分配的块做为一级间接块表地址
-                block_lba = -1;
-                block_lba = block_bitmap_alloc(cur_part); // 再分配一个块做为第0个间接块
-                if (block_lba == -1)
-                {
-                    // 申请内存失败，回滚操作
-                    block_bitmap_idx = dir_inode->i_sectors[12] - cur_part->sb->data_start_lba; //(神来执笔)
-                    bitmap_set(&cur_part->block_bitmap, block_bitmap_idx, 0);
-                    bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-                    dir_inode->i_sectors[12] = 0;
-                    printk("alloc block bitmap for sync_dir_entry failed\n");
-                    return false;
-                }
-
-                // 持久化刚才申请的第0个间接块
-                block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-                bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-
-                /* 把新分配的第0个间接块地址写入一级间接块表 */
-                all_blocks_lba[12] = block_lba;
-                ide_write(cur_part->my_disk, dir_inode->i_sectors[12], all_blocks_lba + 12, 1);
-            }
-            else
-            {
-                //  2.1.c  间接块没有分配
-                all_blocks_lba[block_idx] = block_lba;
-                /* 把新分配的第[block_idx - 12]个间接块地址写入一级间接块表 */
-                ide_write(cur_part->my_disk, dir_inode->i_sectors[12], all_blocks_lba + 12, 1);
-            }
-            //  2.1.c 将新目录项p_de写入新分配的文件数据块 */
+            // 将新目录项p_de写入新分配的文件数据块
             memset(io_buf, 0, 512);
             memcpy(io_buf, p_de, dir_entry_size);
-            ide_write(cur_part->my_disk, all_blocks_lba[block_idx], io_buf, 1);
+            journal_write(cur_part, block_lba, io_buf, 1);
             dir_inode->i_size += dir_entry_size;
             return true;
         }
 
-        /* 情况 1,若第block_idx块已存在,将其读进内存,然后在该块中查找空目录项 */
-        ide_read(cur_part->my_disk, all_blocks_lba[block_idx], io_buf, 1);
-        /* 在扇区内查找空目录项 */
+        /* 情况 1,若第block_idx块已存在,已读进内存,在该块中查找空目录项 */
         uint8_t dir_entry_idx = 0;
         while (dir_entry_idx < dir_entry_per_sec)
         {
@@ -314,13 +329,23 @@ bool sync_dir_entry(struct dir *parent_dir, struct dir_entry *p_de, void *io_buf
                 // FT_UNKNOWN为0,无论是初始化或是删除文件后,都会将f_type置为FT_UNKNOWN.
                 memcpy(dir_e + dir_entry_idx, p_de, dir_entry_size);
                 // 把修改了的数据块同步到硬盘
-                ide_write(cur_part->my_disk, all_blocks_lba[block_idx], io_buf, 1);
+                dir_block_write(cur_part, dir_inode, block_idx, io_buf);
 
                 dir_inode->i_size += dir_entry_size;
                 return true;
             }
             dir_entry_idx++;
         }
+        // 情况 3, 内联目录已满, 迁移到数据块后重新在第0块中查找
+        if (dir_inode->i_flags & INODE_INLINE)
+        {
+            if (!dir_inline_expand(cur_part, dir_inode, io_buf))
+            {
+                printk("alloc block bitmap for dir_entry_insert failed\n");
+                return false;
+            }
+            continue;
+        }
         block_idx++;
     }
     printk("directory is full!\n");
@@ -328,31 +353,49 @@ bool sync_dir_entry(struct dir *parent_dir, struct dir_entry *p_de, void *io_buf
 }
 
 /**
- * @description:  在分区part中，把目录pdir中编号为inode_no的目录项删除
+ * @brief sync_dir_entry将p_de指向的目录项写入到其父目录中, 并把父目录的inode同步到硬盘.
+ *        整个过程持有父目录的写锁: 先确认目录中没有同名的目录项再写入, 这样两个任务同时创建同名文件时只有一个会成功
+ *
+ * @param parent_dir 指向目录项的父目录
+ * @param p_de 指向需要写入到磁盘中的目录项
+ * @param io_buf 调用者提供的缓冲区, 至少1024字节, inode_sync跨扇区时要用到两个扇区
+ * @return true 同步成功
+ * @return false 已存在同名的目录项或同步失败
+ */
+bool sync_dir_entry(struct dir *parent_dir, struct dir_entry *p_de, void *io_buf)
+{
+    struct inode *dir_inode = parent_dir->inode;
+    struct dir_entry exist;
+    bool ok = false;
+
+    write_lock(&dir_inode->i_rwlock);
+    if (dir_entry_lookup(cur_part, dir_inode, p_de->filename, &exist))
+        printk("sync_dir_entry: %s already exists\n", p_de->filename);
+    else if (dir_entry_insert(parent_dir, p_de, io_buf))
+    {
+        memset(io_buf, 0, SECTOR_SIZE * 2);
+        inode_sync(cur_part, dir_inode, io_buf);
+        ok = true;
+    }
+    write_unlock(&dir_inode->i_rwlock);
+    return ok;
+}
+
+/**
+ * @description:  在分区part中，把目录dir_inode中编号为inode_no的目录项删除, 调用者须持有dir_inode的写锁
  * @param {partition} *part     分区
- * @param {dir} *pdir   父目录
+ * @param {inode} *dir_inode   父目录的inode
  * @param {uint32_t} inode_no   inode号
  * @param {void} *io_buf    I/O磁盘的缓存区
  * @return {*} true 表示删除成功
  */
-bool delete_dir_entry(struct partition *part, struct dir *pdir, uint32_t inode_no, void *io_buf)
+static bool dir_entry_remove(struct partition *part, struct inode *dir_inode, uint32_t inode_no, void *io_buf)
 {
-    struct inode *dir_inode = pdir->inode;
-    uint32_t block_idx = 0, all_blocks[140] = {0};
-    // a. 收集目录文件的全部数据块地址
-    while (block_idx < 12)
-    {
-        all_blocks[block_idx] = dir_inode->i_sectors[block_idx];
-        block_idx++;
-    }
-    if (dir_inode->i_sectors[12] != 0)
-    {
-        ide_read(part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
-    }
+    uint32_t block_idx = 0;
 
     /* 目录项在存储时保证不会跨扇区 */
     uint32_t dir_entry_size = part->sb->dir_entry_size;
-    uint32_t dir_entry_per_sec = (SECTOR_SIZE / dir_entry_size); // 每扇区最大存储的目录项数目
+    uint32_t dir_entry_per_sec = dir_block_entries(part, dir_inode); // 每扇区最大存储的目录项数目
     struct dir_entry *dir_e = (struct dir_entry *)io_buf;
     struct dir_entry *dir_entry_found = NULL; // 存储被删除目录项地址
     uint8_t dir_entry_idx, dir_entry_cnt;     // 当前扇区目录项索引指针, 当前扇区目录项数目
@@ -360,18 +403,17 @@ bool delete_dir_entry(struct partition *part, struct dir *pdir, uint32_t inode_n
 
     // 遍历所有数据块, 寻找目录项
     block_idx = 0;
-    while (block_idx < 140)
+    while (block_idx < DIR_MAX_BLOCKS)
     {
         is_dir_first_block = false;
-        if (all_blocks[block_idx] == 0)
+        dir_entry_idx = dir_entry_cnt = 0;
+        memset(io_buf, 0, SECTOR_SIZE);
+        // 从硬盘里得到数据块
+        if (!dir_block_read(part, dir_inode, block_idx, io_buf))
         {
             block_idx++;
             continue;
         }
-        dir_entry_idx = dir_entry_cnt = 0;
-        memset(io_buf, 0, SECTOR_SIZE);
-        // 从硬盘里得到数据块
-        ide_read(part->my_disk, all_blocks[block_idx], io_buf, 1);
 
         // 遍历数据块里的目录项, 统计该扇区的目录项数量及是否有待删除的目录项
         while (dir_entry_idx < dir_entry_per_sec)
@@ -413,57 +455,14 @@ bool delete_dir_entry(struct partition *part, struct dir *pdir, uint32_t inode_n
         // 除目录第1扇区外, 若该扇区上只有该目录项自己, 则将整个扇区回收
         if (dir_entry_cnt == 1 && !is_dir_first_block)
         {
-            // a 在块位图中回收该块
-            uint32_t block_bitmap_idx = all_blocks[block_idx] - part->sb->data_start_lba;
-            bitmap_set(&part->block_bitmap, block_bitmap_idx, 0);
-            bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-
-            // b 将块地址从数组i_sectors或索引表中去掉
-            if (block_idx < 12)
-            {
-                dir_inode->i_sectors[block_idx] = 0;
-            }
-            else
-            {
-                // 在一级间接索引表中擦除该间接块地址
-
-                /*先判断一级间接索引表中间接块的数量,如果仅有这1个间接块,连同间接索引表所在的块一同回收 */
-                uint32_t indirect_blocks = 0;
-                uint32_t indirect_block_idx = 12;
-                while (indirect_block_idx < 140)
-                {
-                    if (all_blocks[indirect_block_idx] != 0)
-                    {
-                        indirect_blocks++;
-                    }
-                }
-
-                ASSERT(indirect_blocks >= 1); // 包括当前间接块
-
-                if (indirect_blocks > 1)
-                {
-                    // 间接索引表中还包括其它间接块,仅在索引表中擦除当前这个间接块地址
-                    all_blocks[block_idx] = 0;
-                    ide_write(part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
-                }
-                else
-                {
-                    // 间接索引表中就当前这1个间接块,直接把间接索引表所在的块回收,然后擦除间接索引表块地址
-                    /* 回收间接索引表所在的块 */
-                    block_bitmap_idx = dir_inode->i_sectors[12] - part->sb->data_start_lba;
-                    bitmap_set(&part->block_bitmap, block_bitmap_idx, 0);
-                    bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-
-                    /* 将间接索引表地址清0 */
-                    dir_inode->i_sectors[12] = 0;
-                }
-            }
+            // 在块位图中回收该块, 并将块地址从i_sectors或间接块中去掉, 间接块因此变空时一并回收
+            bmap_clear(part, dir_inode, block_idx);
         }
         else
         {
             // 仅将该目录项清空
             memset(dir_entry_found, 0, dir_entry_size);
-            ide_write(part->my_disk, all_blocks[block_idx], io_buf, 1);
+            dir_block_write(part, dir_inode, block_idx, io_buf);
         }
 
         // 更新i结点信息并且同步到硬盘
@@ -478,6 +477,22 @@ bool delete_dir_entry(struct partition *part, struct dir *pdir, uint32_t inode_n
     return false;
 }
 
+/**
+ * @description:  在分区part中，把目录pdir中编号为inode_no的目录项删除. 删除期间持有目录的写锁
+ * @param {partition} *part     分区
+ * @param {dir} *pdir   父目录
+ * @param {uint32_t} inode_no   inode号
+ * @param {void} *io_buf    I/O磁盘的缓存区
+ * @return {*} true 表示删除成功, false表示目录项已不存在(例如已被别的任务删除)
+ */
+bool delete_dir_entry(struct partition *part, struct dir *pdir, uint32_t inode_no, void *io_buf)
+{
+    write_lock(&pdir->inode->i_rwlock);
+    bool ok = dir_entry_remove(part, pdir->inode, inode_no, io_buf);
+    write_unlock(&pdir->inode->i_rwlock);
+    return ok;
+}
+
 /**
  * @description: 读目录， 每次都读取下一个目录项
  *
@@ -488,30 +503,18 @@ bool delete_dir_entry(struct partition *part, struct dir *pdir, uint32_t inode_n
  * @param {dir*} dir 需要读取的目录
  * @return {*} 成功返回1个目录项, 失败返回NULL
  */
-struct dir_entry *dir_read(struct dir *dir)
+static struct dir_entry *dir_read_locked(struct dir *dir)
 {
     dir_entry_t *dir_e = (dir_entry_t *)dir->dir_buf;
     inode_t *dir_inode = dir->inode;
 
-    uint32_t all_block[140] = {0};
-
-    // 复制140个数据块地址
     uint32_t block_idx = 0, dir_entry_idx = 0;
-    while (block_idx < 12)
-    {
-        all_block[block_idx] = dir_inode->i_sectors[block_idx];
-        block_idx++;
-    }
-
-    // 复制一级间接块
-    if (dir_inode->i_sectors[12] != 0)
-        ide_read(cur_part->my_disk, dir_inode->i_sectors[12], all_block + 12, 1);
 
     // 逐块遍历目录项
     block_idx = 0;
     uint32_t cur_dir_entry_pos = 0;
     uint32_t dir_entry_size = cur_part->sb->dir_entry_size;
-    uint32_t dir_entey_per_sce = SECTOR_SIZE / dir_entry_size;
+    uint32_t dir_entey_per_sce = dir_block_entries(cur_part, dir_inode);
 
     while (dir->dir_pos < dir_inode->i_size)
     {
@@ -519,14 +522,15 @@ struct dir_entry *dir_read(struct dir *dir)
         if (dir->dir_pos >= dir_inode->i_size)
             return NULL;
 
-        if (all_block[block_idx] == 0)
+        memset(dir_e, 0, SECTOR_SIZE);
+        if (!dir_block_read(cur_part, dir_inode, block_idx, dir_e))
         {
             block_idx++;
+            if (block_idx >= DIR_MAX_BLOCKS)
+                return NULL;
             continue;
         }
 
-        memset(dir_e, 0, SECTOR_SIZE);
-        ide_read(cur_part->my_disk, all_block[block_idx], dir_e, 1);
         dir_entry_idx = 0;
         // 遍历本块的所以目录项
         while (dir_entry_idx < dir_entey_per_sce)
@@ -551,6 +555,15 @@ struct dir_entry *dir_read(struct dir *dir)
     return NULL;
 }
 
+/* 读取下一个目录项, 读取期间持有目录的读锁 */
+struct dir_entry *dir_read(struct dir *dir)
+{
+    read_lock(&dir->inode->i_rwlock);
+    struct dir_entry *dir_e = dir_read_locked(dir);
+    read_unlock(&dir->inode->i_rwlock);
+    return dir_e;
+}
+
 /**
  * @brief 判断目录是否为空
  *
@@ -576,9 +589,9 @@ int32_t dir_remove(struct dir *parent_dir, struct dir *child_dir)
 {
     inode_t *child_dir_inode = child_dir->inode;
 
-    // 确保是空目录, 此时只有i_sectors[0]表示的块中有'.'和'..'
+    // 确保是空目录, 此时只有i_sectors[0]表示的块中有'.'和'..', 内联目录则没有数据块
     int32_t block_idx = 1;
-    while (block_idx < 12)
+    while (!(child_dir_inode->i_flags & INODE_INLINE) && block_idx < INODE_DIRECT_BLOCKS)
     {
         ASSERT(child_dir_inode->i_sectors[block_idx] == 0);
         block_idx++;
@@ -591,14 +604,20 @@ int32_t dir_remove(struct dir *parent_dir, struct dir *child_dir)
         return -1;
     }
 
-    // 在父目录中删除子目录对应的目录项
-    delete_dir_entry(cur_part, parent_dir, child_dir_inode->i_no, io_buf);
-
-    // 回收inode中i_sector所占用的扇区 : 1.修改inode_bitmap 2.
-    //  修改inode_bitmap 和 block_bitmap
-    inode_release(cur_part, child_dir->inode->i_no);
+    /* 持有子目录的写锁直到回收完毕: 检查为空之后, 别的任务不能再往其中创建文件 */
+    int32_t ret = -1;
+    write_lock(&child_dir_inode->i_rwlock);
+    // 在父目录中删除子目录对应的目录项, 不存在说明已被别的任务删除
+    if (dir_is_empty(child_dir) && delete_dir_entry(cur_part, parent_dir, child_dir_inode->i_no, io_buf))
+    {
+        // 回收inode中i_sector所占用的扇区 : 1.修改inode_bitmap 2.
+        //  修改inode_bitmap 和 block_bitmap
+        inode_release(cur_part, child_dir->inode->i_no);
+        ret = 0;
+    }
+    write_unlock(&child_dir_inode->i_rwlock);
 
     sys_free(io_buf);
 
-    return 0;
+    return ret;
 }
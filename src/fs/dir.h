@@ -37,5 +37,7 @@ bool delete_dir_entry(struct partition *part, struct dir *pdir, uint32_t inode_n
 struct dir_entry *dir_read(struct dir *dir);
 bool dir_is_empty(struct dir *dir);
 int32_t dir_remove(struct dir *parent_dir, struct dir *child_dir);
+uint32_t dir_block_entries(struct partition *part, struct inode *dir_inode);
+bool dir_block_read(struct partition *part, struct inode *dir_inode, uint32_t block_idx, void *buf);
 
 #endif
\ No newline at end of file
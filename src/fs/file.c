@@ -9,76 +9,456 @@
 #include "string.h"
 #include "thread.h"
 #include "global.h"
+#include "journal.h"
+#include "pipe.h"
 
-// 文件表
-struct file file_table[MAX_FILE_OPEN];
+/**
+ * 文件表
+ *
+ * 文件结构按页分配, 每次文件表用完时再申请一页, 最多MAX_FILE_CHUNKS页. 空闲的文件结构用f_next串成链表,
+ * 分配和释放都是O(1). 文件结构带有引用计数, 多个文件描述符(fork, dup, dup2, 管道的两端)可以共享同一个文件结构.
+ * 标准输入输出使用静态的控制台文件, 不参与引用计数
+ */
+struct file console_files[3] = {
+    {stdin_no, CONSOLE_FLAG, NULL, 1, NULL},
+    {stdout_no, CONSOLE_FLAG, NULL, 1, NULL},
+    {stderr_no, CONSOLE_FLAG, NULL, 1, NULL}};
+static struct file *file_chunks[MAX_FILE_CHUNKS]; // 已分配的文件表页
+static uint32_t file_chunk_cnt;                   // 已分配的文件表页数
+static struct file *file_free_list;               // 空闲文件结构链表
 
 /**
- * @brief get_free_slot_in_global用于从全局文件表中找到一个空位
+ * @brief file_alloc从文件表中分配一个文件结构, 空闲链表为空时为文件表扩充一页
  *
- * @return int32_t 若文件表中有空闲的, 则返回空闲的文件表的索引; （要存在文件描述符数组）
- *          若无空闲的位置, 则返回-1
+ * @return struct file* 引用计数为1的文件结构; 文件表已满时返回NULL
  */
-int32_t get_free_slot_in_global(void)
+struct file *file_alloc(void)
 {
-    uint32_t fd_idx = 3;
-    while (fd_idx < MAX_FILE_OPEN)
+    enum intr_status old_status = intr_disable();
+    if (file_free_list == NULL)
     {
-        if (file_table[fd_idx].fd_inode == NULL) // 找到了空位置
-            break;
+        struct file *chunk = NULL;
+        if (file_chunk_cnt < MAX_FILE_CHUNKS)
+            chunk = get_kernel_pages(1);
+        if (chunk == NULL)
+        {
+            intr_set_status(old_status);
+            printk("exceed max open files\n");
+            return NULL;
+        }
+        file_chunks[file_chunk_cnt++] = chunk;
+        uint32_t file_idx = FILE_CHUNK_FILES;
+        while (file_idx-- > 0)
+        {
+            chunk[file_idx].f_next = file_free_list;
+            file_free_list = &chunk[file_idx];
+        }
+    }
+    struct file *file = file_free_list;
+    file_free_list = file->f_next;
+    intr_set_status(old_status);
+
+    memset(file, 0, sizeof(struct file));
+    file->f_count = 1;
+    return file;
+}
+
+// 增加文件结构的引用计数
+struct file *file_get(struct file *file)
+{
+    if (file->fd_flag != CONSOLE_FLAG)
+        file->f_count++;
+    return file;
+}
+
+/**
+ * @brief file_put减少文件结构的引用计数, 最后一个引用消失时关闭文件(管道则释放环形缓冲区),
+ *        并把文件结构还给文件表
+ *
+ * @param file 文件结构
+ */
+void file_put(struct file *file)
+{
+    if (file->fd_flag == CONSOLE_FLAG)
+        return;
+    ASSERT(file->f_count > 0);
+    if (--file->f_count > 0)
+        return;
+
+    if (file->fd_flag == PIPE_FLAG)
+        mfree_page(PF_KERNEL, file->fd_inode, 1);
+    else if (file->fd_inode != NULL)
+        file_close(file);
+    file->fd_inode = NULL;
+
+    enum intr_status old_status = intr_disable();
+    file->f_next = file_free_list;
+    file_free_list = file;
+    intr_set_status(old_status);
+}
 
-        fd_idx++;
+// 判断inode_no号文件是否被某个文件结构打开
+bool file_inode_in_use(uint32_t inode_no)
+{
+    uint32_t chunk_idx = 0;
+    while (chunk_idx < file_chunk_cnt)
+    {
+        struct file *chunk = file_chunks[chunk_idx++];
+        uint32_t file_idx = 0;
+        while (file_idx < FILE_CHUNK_FILES)
+        {
+            struct file *file = &chunk[file_idx++];
+            if (file->f_count > 0 && file->fd_flag != PIPE_FLAG && file->fd_inode != NULL && file->fd_inode->i_no == inode_no)
+                return true;
+        }
     }
-    if (fd_idx == MAX_FILE_OPEN)
+    return false;
+}
+
+// 在内核堆中申请内存, 用户进程调用时也从内核堆中分配, 所有进程的描述符表都由内核管理
+static void *files_kmalloc(uint32_t size)
+{
+    struct task_struct *cur = running_thread();
+    uint32_t *cur_pagedir_bak = cur->pgdir;
+    cur->pgdir = NULL;
+    void *vaddr = sys_malloc(size);
+    cur->pgdir = cur_pagedir_bak;
+    return vaddr;
+}
+
+// 释放files_kmalloc申请的内存
+static void files_kfree(void *vaddr)
+{
+    struct task_struct *cur = running_thread();
+    uint32_t *cur_pagedir_bak = cur->pgdir;
+    cur->pgdir = NULL;
+    sys_free(vaddr);
+    cur->pgdir = cur_pagedir_bak;
+}
+
+/**
+ * @brief files_alloc创建容量为max_fds的文件描述符表, 所有描述符都为空
+ *
+ * @param max_fds 容量, 必须是32的倍数
+ * @return struct files_struct* 失败返回NULL
+ */
+static struct files_struct *files_alloc(uint32_t max_fds)
+{
+    struct files_struct *files = files_kmalloc(sizeof(struct files_struct));
+    if (files == NULL)
+        return NULL;
+    files->fd = files_kmalloc(max_fds * sizeof(struct file *));
+    files->open_fds = files_kmalloc(max_fds / 32 * sizeof(uint32_t));
+    if (files->fd == NULL || files->open_fds == NULL)
     {
-        printk("exceed max open files\n");
-        return -1;
+        if (files->fd != NULL)
+            files_kfree(files->fd);
+        if (files->open_fds != NULL)
+            files_kfree(files->open_fds);
+        files_kfree(files);
+        return NULL;
     }
-    return fd_idx;
+    files->max_fds = max_fds;
+    files->next_fd = 0;
+    files->users = 1;
+    return files;
+}
+
+// 释放文件描述符表本身占用的内存, 不关闭其中的文件
+static void files_free(struct files_struct *files)
+{
+    files_kfree(files->fd);
+    files_kfree(files->open_fds);
+    files_kfree(files);
+}
+
+// 在描述符表中记录fd指向file
+static void fd_set_file(struct files_struct *files, uint32_t fd, struct file *file)
+{
+    files->fd[fd] = file;
+    files->open_fds[fd / 32] |= (1 << (fd % 32));
 }
 
 /**
- * @brief pcb_fd_install用于将全局文件表索引安装到用户进程的文件描述符数组中
+ * @brief files_expand把描述符表扩大到至少能容纳描述符fd, 容量成倍增长
  *
- * @param globa_fd_idx 要安装的全局文件描述符表
- * @return int32_t 若成功安装到用户文件描述符数组中, 则返回用户文件描述符数组的索引(文件描述符), 若失败则返回-1
+ * @param files 描述符表
+ * @param fd 需要容纳的描述符
+ * @return int32_t 成功返回0, 超过MAX_FILES_OPEN_PER_PROC或内存不足返回-1
  */
-int32_t pcb_fd_install(int32_t global_fd_idx)
+static int32_t files_expand(struct files_struct *files, uint32_t fd)
+{
+    if (fd >= MAX_FILES_OPEN_PER_PROC)
+        return -1;
+    uint32_t max_fds = files->max_fds;
+    while (max_fds <= fd)
+        max_fds *= 2;
+
+    struct file **new_fd = files_kmalloc(max_fds * sizeof(struct file *));
+    uint32_t *new_open_fds = files_kmalloc(max_fds / 32 * sizeof(uint32_t));
+    if (new_fd == NULL || new_open_fds == NULL)
+    {
+        if (new_fd != NULL)
+            files_kfree(new_fd);
+        if (new_open_fds != NULL)
+            files_kfree(new_open_fds);
+        return -1;
+    }
+    // sys_malloc返回的内存已清0, 只需复制旧的部分
+    memcpy(new_fd, files->fd, files->max_fds * sizeof(struct file *));
+    memcpy(new_open_fds, files->open_fds, files->max_fds / 32 * sizeof(uint32_t));
+    files_kfree(files->fd);
+    files_kfree(files->open_fds);
+    files->fd = new_fd;
+    files->open_fds = new_open_fds;
+    files->max_fds = max_fds;
+    return 0;
+}
+
+// 返回当前进程的描述符表, 第一次使用时才创建, 并让0, 1, 2指向控制台
+static struct files_struct *current_files(void)
 {
     struct task_struct *cur = running_thread();
-    uint8_t local_fd_idx = 3; // 跨过stdin stdout stderr
+    if (cur->files == NULL)
+    {
+        struct files_struct *files = files_alloc(FDS_INIT_NR);
+        if (files == NULL)
+            return NULL;
+        uint32_t std_fd = stdin_no;
+        while (std_fd <= stderr_no)
+        {
+            fd_set_file(files, std_fd, &console_files[std_fd]);
+            std_fd++;
+        }
+        files->next_fd = 3;
+        cur->files = files;
+    }
+    return cur->files;
+}
 
-    while (local_fd_idx < MAX_FILES_OPEN_PER_PROC)
+/**
+ * @brief fd_find_free从start开始查找最小的空闲描述符. 按字扫描位图, 跳过全1的字,
+ *        在第一个有0位的字中用bsf找到最低的0位
+ *
+ * @return int32_t 空闲描述符; 描述符表已满返回-1
+ */
+static int32_t fd_find_free(struct files_struct *files, uint32_t start)
+{
+    uint32_t word_idx = start / 32;
+    // 第一个字中start之前的位视为已使用
+    uint32_t mask = (1 << (start % 32)) - 1;
+    while (word_idx < files->max_fds / 32)
     {
-        if (cur->fd_table[local_fd_idx] == -1)
+        uint32_t free_bits = ~(files->open_fds[word_idx] | mask);
+        if (free_bits != 0)
+            return word_idx * 32 + __builtin_ctz(free_bits);
+        mask = 0;
+        word_idx++;
+    }
+    return -1;
+}
+
+/**
+ * @brief pcb_fd_install用于将文件结构安装到当前进程的文件描述符表中, 占用最小的空闲描述符.
+ *        文件结构的引用由描述符接管, 不增加引用计数
+ *
+ * @param file 要安装的文件结构
+ * @return int32_t 若成功安装到用户文件描述符数组中, 则返回文件描述符, 若失败则返回-1
+ */
+int32_t pcb_fd_install(struct file *file)
+{
+    struct files_struct *files = current_files();
+    if (files == NULL)
+    {
+        printk("pcb_fd_install: sys_malloc for files_struct failed\n");
+        return -1;
+    }
+
+    int32_t fd = fd_find_free(files, files->next_fd);
+    if (fd == -1)
+    {
+        fd = files->max_fds;
+        if (files_expand(files, fd) == -1)
         {
-            cur->fd_table[local_fd_idx] = global_fd_idx;
-            break;
+            printk("exceed max open files_per_proc\n");
+            return -1;
         }
-        local_fd_idx++;
     }
+    fd_set_file(files, fd, file);
+    files->next_fd = fd + 1;
+    return fd;
+}
+
+/**
+ * @brief fd2file将当前进程的文件描述符转换为文件结构
+ *
+ * @param fd 文件描述符
+ * @return struct file* fd未打开时返回NULL
+ */
+struct file *fd2file(int32_t fd)
+{
+    struct files_struct *files = running_thread()->files;
+    if (fd < 0)
+        return NULL;
+    if (files == NULL)
+        return fd <= stderr_no ? &console_files[fd] : NULL;
+    if ((uint32_t)fd >= files->max_fds)
+        return NULL;
+    return files->fd[fd];
+}
+
+// 把描述符fd从当前进程的描述符表中去掉, 不减少文件结构的引用计数
+void fd_uninstall(int32_t fd)
+{
+    struct files_struct *files = current_files();
+    ASSERT(files != NULL && fd >= 0 && (uint32_t)fd < files->max_fds);
+    files->fd[fd] = NULL;
+    files->open_fds[fd / 32] &= ~(1 << (fd % 32));
+    if ((uint32_t)fd < files->next_fd)
+        files->next_fd = fd;
+}
+
+/**
+ * @brief sys_dup复制文件描述符, 新描述符与old_fd指向同一个文件结构, 共享读写位置
+ *
+ * @param old_fd 被复制的文件描述符
+ * @return int32_t 成功返回最小的空闲描述符, 失败返回-1
+ */
+int32_t sys_dup(int32_t old_fd)
+{
+    struct file *file = fd2file(old_fd);
+    if (file == NULL)
+        return -1;
+    int32_t new_fd = pcb_fd_install(file);
+    if (new_fd != -1)
+        file_get(file);
+    return new_fd;
+}
+
+/**
+ * @brief fd_replace让当前进程的描述符fd指向file, 并增加file的引用计数; fd原来打开的文件被关闭
+ *
+ * @param fd 目标文件描述符
+ * @param file 文件结构
+ * @return int32_t 成功返回fd, 失败返回-1
+ */
+int32_t fd_replace(int32_t fd, struct file *file)
+{
+    if (fd < 0 || fd >= MAX_FILES_OPEN_PER_PROC)
+        return -1;
+    struct files_struct *files = current_files();
+    if (files == NULL || ((uint32_t)fd >= files->max_fds && files_expand(files, fd) == -1))
+        return -1;
 
-    if (local_fd_idx == MAX_FILES_OPEN_PER_PROC)
+    // 先增加引用再关闭旧文件, fd原本就指向file时不会提前释放
+    file_get(file);
+    struct file *old_file = files->fd[fd];
+    fd_set_file(files, fd, file);
+    if (old_file != NULL)
+        file_put(old_file);
+    return fd;
+}
+
+/**
+ * @brief sys_dup2让new_fd指向old_fd所指的文件结构, new_fd原来打开的文件先被关闭
+ *
+ * @param old_fd 被复制的文件描述符
+ * @param new_fd 目标文件描述符
+ * @return int32_t 成功返回new_fd, 失败返回-1
+ */
+int32_t sys_dup2(int32_t old_fd, int32_t new_fd)
+{
+    struct file *file = fd2file(old_fd);
+    if (file == NULL)
+        return -1;
+    if (old_fd == new_fd)
+        return new_fd;
+    return fd_replace(new_fd, file);
+}
+
+/**
+ * @brief files_dup为fork出的子进程复制父进程的描述符表, 子进程的描述符与父进程指向相同的文件结构
+ *
+ * @param child 子进程, 其pcb是从父进程复制来的, files仍指向父进程的描述符表
+ * @return int32_t 成功返回0, 失败返回-1
+ */
+int32_t files_dup(struct task_struct *child)
+{
+    struct files_struct *parent_files = child->files;
+    if (parent_files == NULL)
+        return 0;
+
+    struct files_struct *files = files_alloc(parent_files->max_fds);
+    if (files == NULL)
     {
-        printk("exceed max open files_per_proc\n");
+        child->files = NULL;
         return -1;
     }
+    memcpy(files->fd, parent_files->fd, files->max_fds * sizeof(struct file *));
+    memcpy(files->open_fds, parent_files->open_fds, files->max_fds / 32 * sizeof(uint32_t));
+    files->next_fd = parent_files->next_fd;
 
-    return local_fd_idx;
+    uint32_t fd = 0;
+    while (fd < files->max_fds)
+    {
+        if (files->fd[fd] != NULL)
+            file_get(files->fd[fd]);
+        fd++;
+    }
+    child->files = files;
+    return 0;
+}
+
+/**
+ * @brief files_share让clone出的线程与当前进程共用描述符表, 此后任一方打开或关闭的描述符另一方都能看到
+ *
+ * @param child 新线程
+ * @return int32_t 成功返回0, 当前进程的描述符表创建失败返回-1
+ */
+int32_t files_share(struct task_struct *child)
+{
+    // 描述符表是第一次打开文件时才创建的, 这里必须先建好, 否则双方会各自创建一张
+    struct files_struct *files = current_files();
+    if (files == NULL)
+        return -1;
+    files->users++;
+    child->files = files;
+    return 0;
+}
+
+// 关闭进程打开的所有文件, 并释放其描述符表. 描述符表还有别的线程在用时只解除本任务的引用
+void files_release(struct task_struct *pthread)
+{
+    struct files_struct *files = pthread->files;
+    if (files == NULL)
+        return;
+    pthread->files = NULL;
+    if (--files->users > 0)
+        return;
+
+    uint32_t fd = 0;
+    while (fd < files->max_fds)
+    {
+        if (files->fd[fd] != NULL)
+            file_put(files->fd[fd]);
+        fd++;
+    }
+    files_free(files);
 }
 
 /**
  * @brief inode_bitmap_alloc 在inode位图中设置一位为1，分配一个inode, 修改的是内存的inode位图，没有同步
- *      到硬盘
+ *      到硬盘. 分区的两个位图都由part->bitmap_lock保护, 查找空闲位和置位期间持有写锁
  * @param part 需要分配inode的分区
  * @return int32_t 若分配成功,得到inode表的index; 若分配失败, 则返回-1
  */
 int32_t inode_bitmap_alloc(struct partition *part)
 {
+    write_lock(&part->bitmap_lock);
     int32_t bit_idx = bitmap_scan(&part->inode_bitmap, 1);
-    if (bit_idx == -1)
-        return -1;
-    bitmap_set(&part->inode_bitmap, bit_idx, 1);
+    if (bit_idx != -1)
+        bitmap_set(&part->inode_bitmap, bit_idx, 1);
+    write_unlock(&part->bitmap_lock);
     return bit_idx;
 }
 
@@ -91,20 +471,57 @@ int32_t inode_bitmap_alloc(struct partition *part)
  */
 int32_t block_bitmap_alloc(struct partition *part)
 {
+    write_lock(&part->bitmap_lock);
+    // 日志区中还有旧内容的已释放块在检查点之前不能分配, 查找时跳过
+    journal_mask_freed(part, 1);
     int32_t bit_idx = bitmap_scan(&part->block_bitmap, 1);
+    if (bit_idx != -1)
+        bitmap_set(&part->block_bitmap, bit_idx, 1);
+    journal_mask_freed(part, 0);
+    write_unlock(&part->bitmap_lock);
     if (bit_idx == -1)
     {
         return -1;
     }
-    bitmap_set(&part->block_bitmap, bit_idx, 1);
 
     return (part->sb->data_start_lba + bit_idx);
 }
 
+/**
+ * @brief bitmap_free在内存中的btmp位图里回收第bit_idx位, 不同步到硬盘, 用于分配后又失败的回滚
+ *
+ * @param part 位图所在的分区
+ * @param bit_idx 要回收的位
+ * @param btmp INODE_BITMAP或BLOCK_BITMAP
+ */
+void bitmap_free(struct partition *part, uint32_t bit_idx, uint8_t btmp)
+{
+    write_lock(&part->bitmap_lock);
+    bitmap_set(btmp == INODE_BITMAP ? &part->inode_bitmap : &part->block_bitmap, bit_idx, 0);
+    write_unlock(&part->bitmap_lock);
+}
+
+/**
+ * @brief block_bitmap_free回收分区中lba所在的块, 并同步块位图.
+ *        被回收的块之后可能被分配给普通文件直接写入, 因此还要撤销日志中暂存的该块内容,
+ *        日志区中还有其旧内容时, 该块在检查点之后才会被重新分配
+ *
+ * @param part 块所在的分区
+ * @param lba 要回收的块的lba扇区地址
+ */
+void block_bitmap_free(struct partition *part, uint32_t lba)
+{
+    uint32_t bit_idx = lba - part->sb->data_start_lba;
+    // 先撤销日志中的内容, 日志区中有旧内容的块在位图清0之前就要被分配过程跳过
+    journal_revoke(part, lba);
+    bitmap_free(part, bit_idx, BLOCK_BITMAP);
+    bitmap_sync(part, bit_idx, BLOCK_BITMAP);
+}
+
 /**
  * @brief file_create用于在parent_dir执行的目录中创建一个名为filename的一般文件. 注意, 创建好的文件默认处于打开状态
  *        因此创建的文件对应的inode会被插入到current_partition.open_inode_list,
- *        而且还会把刚打开的文件添加到系统的文件描述符表（file_table）中
+ *        而且还会把刚打开的文件添加到系统的文件表中
  *
  * @details 创建一个普通文件, 需要如下的几步:
  *              1. 在当前分区中申请一个inode, 此时首先需要向inode_bitmap中申请获得一个inode号, 用来操作inode_table
@@ -145,7 +562,7 @@ int32_t file_create(struct dir *parent_dir, char *filename, uint8_t flag)
     }
 
     /* 此inode要从堆中申请内存,不可生成局部变量(函数退出时会释放)
-     * 因为file_table数组中的文件描述符的inode指针要指向它.*/
+     * 因为文件表中的文件结构的inode指针要指向它.*/
     // 此处修改PCB为了使得inode申请在内核堆空间，这样inode队列就可以共享给每个进程使用了，况且inode这样的内核数据理应由内核管理
     struct task_struct *cur = running_thread();
     uint32_t user_pgdir_bk = (uint32_t)cur->pgdir;
@@ -159,21 +576,31 @@ int32_t file_create(struct dir *parent_dir, char *filename, uint8_t flag)
         goto rollback;
     }
     inode_init(inode_no, new_file_inode); // 初始化i结点
+    // 分区支持内联数据时, 新文件的数据先存放在inode中, 写满后再迁移到数据块
+    if (cur_part->sb->features & FS_FEAT_INLINE)
+        new_file_inode->i_flags |= INODE_INLINE;
 
-    /* 返回的是filew文件的下标，这一步是新建立inode关联到file_table文件表 */
+    /* 从文件表中分配文件结构，这一步是新建立inode关联到文件表 */
     // 为什么这样做？ 我其实不知道，但是我猜因为刚创建文件默认打开
-    int fd_idx = get_free_slot_in_global();
-    if (fd_idx == -1)
+    struct file *file = file_alloc();
+    if (file == NULL)
     {
-        printk("exceed max open files\n");
         rollback_step = 2;
         goto rollback;
     }
     // 新创建的文件默认打开，则为新文件注册文件描述符
-    file_table[fd_idx].fd_inode = new_file_inode;
-    file_table[fd_idx].fd_pos = 0;
-    file_table[fd_idx].fd_flag = flag;
-    file_table[fd_idx].fd_inode->write_deny = false;
+    file->fd_inode = new_file_inode;
+    file->fd_pos = 0;
+    file->fd_flag = flag;
+    file->fd_inode->write_deny = false;
+
+    /* 将创建的文件i结点添加到 open_inodes链表中. 目录项一旦写入别的任务就能打开此文件,
+     * 那时它必须已在链表中, 否则会从硬盘再读入一份 */
+    inode_list_add(cur_part, new_file_inode);
+
+    // c 把新创建文件的 i 结点内容同步到硬盘, 同样要在目录项写入之前
+    memset(io_buf, 0, 1024);
+    inode_sync(cur_part, new_file_inode, io_buf);
 
     // 创造 新建文件的目录项
     struct dir_entry new_dir_entry;
@@ -182,7 +609,8 @@ int32_t file_create(struct dir *parent_dir, char *filename, uint8_t flag)
     create_dir_entry(filename, inode_no, FT_REGULAR, &new_dir_entry);
 
     // 上面的操作都发送在内存里面，下面把inode_bitmap, inode, 目录的数据块 ，目录的inode 持久化到硬盘
-    /* a 在目录parent_dir下安装目录项new_dir_entry, 写入硬盘后返回true,否则false */
+    /* a 在目录parent_dir下安装目录项new_dir_entry, 写入硬盘后返回true,否则false
+     * b 父目录 i 结点的内容由sync_dir_entry同步到硬盘 */
     if (!sync_dir_entry(parent_dir, &new_dir_entry, io_buf))
     {
         printk("sync dir_entry to disk failed\n");
@@ -190,42 +618,38 @@ int32_t file_create(struct dir *parent_dir, char *filename, uint8_t flag)
         goto rollback;
     }
 
-    // b 把父目录 i 结点的内容同步到硬盘
-    memset(io_buf, 0, 1024);
-    inode_sync(cur_part, parent_dir->inode, io_buf);
-
-    // c 把新创建文件的 i 结点内容同步到硬盘
-    memset(io_buf, 0, 1024);
-    inode_sync(cur_part, new_file_inode, io_buf);
-
     // d 将inode_bitmap位图同步到硬盘
     bitmap_sync(cur_part, inode_no, INODE_BITMAP);
 
-    // e 将创建的文件i结点添加到 open_inodes链表中
-    list_push(&cur_part->open_inodes, &new_file_inode->inode_tag);
-    new_file_inode->i_open_cnts = 1;
-
     sys_free(io_buf);
-    return pcb_fd_install(fd_idx);
+    int32_t fd = pcb_fd_install(file);
+    // 文件已经建好, 只是描述符表满了, 关闭文件即可
+    if (fd == -1)
+        file_put(file);
+    return fd;
 
 rollback:
     // 释放资源是依次释放的, 申请的顺序是:
     //      1. inode_bitmap
     //      2. 内核线程堆中的inode内存
-    //      3. 系统全局的open_file_table中的一个free slot
+    //      3. 系统全局文件表中的一个文件结构
     // 所以释放资源的时候, 倒序释放
     switch (rollback_step)
     {
     case 3:
-        /* 失败时,将file_table中的相应位清空 */
-        memset(&file_table[fd_idx], 0, sizeof(struct file));
+        /* 失败时,将文件结构还给文件表, inode从open_inodes中去掉并释放 */
+        file->fd_inode = NULL;
+        file_put(file);
+        inode_close(new_file_inode);
+        bitmap_free(cur_part, inode_no, INODE_BITMAP);
+        break;
     case 2:
         cur->pgdir = NULL;
         sys_free(new_file_inode);
         cur->pgdir = (uint32_t *)user_pgdir_bk;
     case 1:
         /* 如果新文件的i结点创建失败,之前位图中分配的inode_no也要恢复 */
-        bitmap_set(&cur_part->inode_bitmap, inode_no, 0);
+        bitmap_free(cur_part, inode_no, INODE_BITMAP);
         break;
     }
     sys_free(io_buf);
@@ -246,19 +670,16 @@ rollback:
  */
 int32_t file_open(uint32_t inode_no, uint8_t flag)
 {
-    int fd_idx = get_free_slot_in_global();
-    if (fd_idx == -1)
-    {
-        printk("exceed max open files\n");
+    struct file *file = file_alloc();
+    if (file == NULL)
         return -1;
-    }
-    file_table[fd_idx].fd_inode = inode_open(cur_part, inode_no);
+    file->fd_inode = inode_open(cur_part, inode_no);
     // 每次打开文件， 把 fd_pos置为0,让文件内的指针指向开头
-    file_table[fd_idx].fd_pos = 0;
-    file_table[fd_idx].fd_flag = flag;
+    file->fd_pos = 0;
+    file->fd_flag = flag;
 
     // 检测文件是否要重复写
-    bool *write_deny = &file_table[fd_idx].fd_inode->write_deny;
+    bool *write_deny = &file->fd_inode->write_deny;
     if ((flag & O_WRONLY) || (flag & O_RDWR))
     {
         // 只要关于写文件, 判断是否有其他进程写此文件.若是读文件，不考虑 write_deny
@@ -274,12 +695,19 @@ int32_t file_open(uint32_t inode_no, uint8_t flag)
         { // 已经有人写了
             intr_set_status(old_status);
             printk("file cant's be write now, try again later\n");
+            // 别人的写标志不能清掉, 只关闭inode
+            inode_close(file->fd_inode);
+            file->fd_inode = NULL;
+            file_put(file);
             return -1;
         }
     }
 
-    // 在进程空间注册自己的 fd_idx
-    return pcb_fd_install(fd_idx);
+    // 在进程空间注册自己的文件结构
+    int32_t fd = pcb_fd_install(file);
+    if (fd == -1)
+        file_put(file);
+    return fd;
 }
 
 /**
@@ -301,287 +729,264 @@ int32_t file_close(struct file *file)
     return 0;
 }
 
+static uint32_t bitmap_write_dirty(struct partition *partition);
+
 /**
  * @brief bitmap_sync用于将内存中的bitmap的bit_idx位的值同步到（硬盘中）partition指向的分区中
  *      硬盘中的位图需要修改的位置，我们可以用 bit_idx / 4096 来确定对于硬盘中块位图lba的偏移(单位:扇区) A
  *      内存中的偏移需要用字节来衡量，把上面 (bit_idx / 4096) * 512就是对于内存中块位图的字节偏移 B
  *      把内存中的B位置直接写入硬盘中的A位置，就完成了块位图的同步
+ *
+ *      一次文件系统操作(例如写入一个大文件)往往会连续修改同一个位图扇区很多次, 若每次都写盘, 同一扇区会被反复写入.
+ *      因此这里只把A记入分区的脏扇区集合, 由bitmap_flush在操作结束时统一写盘, 每个脏扇区只写一次
  * @param partition 要写入的bitmap所在的分区
  * @param bit_idx 要写入的位
  * @param btmp 要写入的位图的标志（inode_bitmap 或 block_bitmap）
  */
 void bitmap_sync(struct partition *partition, uint32_t bit_idx, uint8_t btmp)
 {
+    write_lock(&partition->bitmap_lock);
     // off_sec是要写入的位(bit_idx)相对于parition->sb->block_bitmap_lba或者partition->sb->inode_bitmap_lba的扇区偏移数
     uint32_t off_sec = bit_idx / 4096;
-    // off_size是要写入的位(bit_idx)相对于parition->block_bitmap.bits或者partition->inode_bitmap.bits的字节偏移数
-    uint32_t off_size = off_sec * BLOCK_SIZE;
-
-    uint32_t sec_lba;    // 需要同步位图的某一扇区号
-    uint8_t *bitmap_off; // 扇区内的偏移
+    uint32_t sec_lba; // 需要同步位图的某一扇区号
 
     switch (btmp)
     {
     case INODE_BITMAP:
         sec_lba = partition->sb->inode_bitmap_lba + off_sec;
-        bitmap_off = partition->inode_bitmap.bits + off_size;
         break;
     case BLOCK_BITMAP:
         sec_lba = partition->sb->block_bitmap_lba + off_sec;
-        bitmap_off = partition->block_bitmap.bits + off_size;
         break;
     default:
         PANIC("Invalid bitmap type");
         break;
     }
 
-    ide_write(partition->my_disk, sec_lba, bitmap_off, 1);
+    partition->bitmap_sync_cnt++;
+
+    // 该扇区已经是脏的, 无需重复记录
+    uint32_t idx = 0;
+    while (idx < partition->bitmap_dirty_cnt)
+    {
+        if (partition->bitmap_dirty_lba[idx] == sec_lba)
+        {
+            write_unlock(&partition->bitmap_lock);
+            return;
+        }
+        idx++;
+    }
+
+    // 集合已满则先回写, 腾出位置
+    if (partition->bitmap_dirty_cnt == BITMAP_DIRTY_MAX)
+        bitmap_write_dirty(partition);
+
+    partition->bitmap_dirty_lba[partition->bitmap_dirty_cnt++] = sec_lba;
+    write_unlock(&partition->bitmap_lock);
 }
 
 /**
- * @brief file_write用于将buf中的count个字节写入到file指向的文件
+ * @brief bitmap_flush将partition中所有被bitmap_sync标记为脏的位图扇区写入硬盘, 每个扇区只写一次.
+ *        在每个会修改位图的文件系统操作(创建,写入,删除文件,创建,删除目录)结束时调用
  *
- * @param file 需要写入的文件描述符
- * @param buf 需要写入文件的数据
- * @param count 需要写入的字节数
- * @return int32_t 若写入成功则返回写入的字节数; 若失败则返回-1
+ * @param partition 需要回写位图的分区
+ * @return uint32_t 本次写入硬盘的扇区数
  */
-int32_t file_write(struct file *file, const void *buf, uint32_t count)
+uint32_t bitmap_flush(struct partition *partition)
 {
-    // a. 判断是否会写超
-    //  目前inode的13个数据块中前12个是直接数据块, 第13个是一个一级数据块, 所以目前最大支持写入的字节数是max_byte
-    uint32_t max_bytes = (12 + 512 / 4) * BLOCK_SIZE;
-    if (file->fd_inode->i_size + count > max_bytes)
-    {
-        printk("file_write: exceed maximum of file %d bytes, trying to make a file %d bytes", max_bytes, file->fd_inode->i_size + count);
-        return -1;
-    }
+    write_lock(&partition->bitmap_lock);
+    uint32_t flushed = bitmap_write_dirty(partition);
+    write_unlock(&partition->bitmap_lock);
+    return flushed;
+}
 
-    uint32_t *all_blocks = (uint32_t *)sys_malloc(BLOCK_SIZE + 48); // 用来记录文件数据块的地址
-    if (all_blocks == NULL)
+/* 写回脏的位图扇区, 调用者须持有partition->bitmap_lock的写锁. 写盘期间位图不能被修改, 否则写出的扇区新旧混杂 */
+static uint32_t bitmap_write_dirty(struct partition *partition)
+{
+    struct super_block *sb = partition->sb;
+    uint32_t flushed = partition->bitmap_dirty_cnt;
+    uint32_t idx = 0;
+    while (idx < partition->bitmap_dirty_cnt)
     {
-        printk("file_write: sys_malloc for all_blocks failed\n");
-        return -1;
-    }
-    int32_t block_lba = -1;        // 块地址,lba地址
-    uint32_t block_bitmap_idx = 0; // 记录空闲块对应于block_bitmap中的索引,做为参数传给bitmap_sync
-    int32_t indirect_block_table;  // 用来获取一级间接表地址
-    uint32_t block_idx;            // 块索引
+        uint32_t sec_lba = partition->bitmap_dirty_lba[idx];
+        uint8_t *bitmap_off; // 扇区在内存位图中的起始地址
 
-    /* b.判断文件是否是第一次写,如果是,先为其分配一个块，这里是否可以用文件Size == 0 来判断 */
-    if (file->fd_inode->i_sectors[0] == 0)
-    {
-        block_lba = block_bitmap_alloc(cur_part);
-        if (block_lba == -1)
+        // 根据lba落在哪个位图的范围内, 找到内存中对应的位图扇区
+        if (sec_lba >= sb->block_bitmap_lba && sec_lba < sb->block_bitmap_lba + sb->block_bitmap_sects)
+            bitmap_off = partition->block_bitmap.bits + (sec_lba - sb->block_bitmap_lba) * BLOCK_SIZE;
+        else
         {
-            printk("file_write: block_bitmap_alloc failed\n");
-            return -1;
+            ASSERT(sec_lba >= sb->inode_bitmap_lba && sec_lba < sb->inode_bitmap_lba + sb->inode_bitmap_sects);
+            bitmap_off = partition->inode_bitmap.bits + (sec_lba - sb->inode_bitmap_lba) * BLOCK_SIZE;
         }
-        file->fd_inode->i_sectors[0] = block_lba;
 
-        /* 把分配一个块就将位图同步到硬盘 */
-        block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-        ASSERT(block_bitmap_idx != 0);
-        bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
+        // 位图扇区也是元数据, 经日志写回
+        journal_write(partition, sec_lba, bitmap_off, 1);
+        idx++;
     }
-    // 未写入时， 文件占用的块数 + 1
-    uint32_t file_has_used_blocks = file->fd_inode->i_size / BLOCK_SIZE + 1;
-    // 写入后， 文件占用的块数 + 1
-    uint32_t file_will_use_blocks = (file->fd_inode->i_size + count) / BLOCK_SIZE + 1;
-    ASSERT(file_will_use_blocks <= 140);
-    /* 通过此增量判断是否需要分配扇区,如增量为0,表示原扇区够用 */
-    uint32_t add_blocks = file_will_use_blocks - file_has_used_blocks;
+    partition->bitmap_dirty_cnt = 0;
+    partition->bitmap_io_cnt += flushed;
+    return flushed;
+}
 
-    // c.把可能用到的块地址收集到all_blocks,(系统中块大小等于扇区大小)
+/**
+ * @brief bitmap_op_done在一次文件系统操作结束时调用, 回写脏的位图扇区,
+ *        并记录本次操作修改位图的次数和实际写盘的扇区数, 供bitmap_io_report查看
+ *
+ * @param partition 操作的分区
+ * @param sync_before 操作开始时partition->bitmap_sync_cnt的值
+ */
+void bitmap_op_done(struct partition *partition, uint32_t sync_before)
+{
+    uint32_t io_before = partition->bitmap_io_cnt;
+    bitmap_flush(partition);
+    partition->bitmap_last_sync = partition->bitmap_sync_cnt - sync_before;
+    partition->bitmap_last_io = partition->bitmap_io_cnt - io_before;
+}
 
-    if (add_blocks == 0)
+/**
+ * @brief bitmap_io_report打印分区位图的I/O统计: 位图修改次数和实际写盘扇区数
+ *
+ * @param partition 需要打印统计的分区
+ */
+void bitmap_io_report(struct partition *partition)
+{
+    printk("%s bitmap io: %d updates, %d sector writes (last op: %d updates, %d sector writes)\n",
+           partition->name, partition->bitmap_sync_cnt, partition->bitmap_io_cnt,
+           partition->bitmap_last_sync, partition->bitmap_last_io);
+}
+
+/**
+ * @brief file_inline_expand在内联文件放不下新数据时调用, 把inode中的数据迁移到新分配的第0块中,
+ *        此后文件和普通文件一样使用数据块. inode需要调用者同步
+ *
+ * @param part 文件所在分区
+ * @param inode 内联文件的inode
+ * @param io_buf 调用者提供的缓冲区, 至少BLOCK_SIZE字节
+ * @return true 迁移成功
+ * @return false 分配块失败, 文件保持内联
+ */
+static bool file_inline_expand(struct partition *part, struct inode *inode, void *io_buf)
+{
+    ASSERT(inode->i_flags & INODE_INLINE);
+    memset(io_buf, 0, BLOCK_SIZE);
+    memcpy(io_buf, inode->i_sectors, inode->i_size);
+
+    // i_sectors恢复为块地址数组
+    memset(inode->i_sectors, 0, INODE_INLINE_SIZE);
+    inode->i_flags &= ~INODE_INLINE;
+    if (inode->i_size == 0)
+        return true; // 还没有数据, 写入时再分配块
+
+    int32_t block_lba = bmap(part, inode, 0, true);
+    if (block_lba == -1)
     {
-        // 在同一扇区内写入数据,不涉及到分配新扇区
-        if (file_has_used_blocks <= 12) // 文件数据量将在12块之内
-        {
-            block_idx = file_has_used_blocks - 1; // 文件数据量将在12块之内
-            all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-        }
-        else
-        {
-            /* 未写入新数据之前已经占用了间接块,需要将间接块地址读进来 */
-            ASSERT(file->fd_inode->i_sectors[12] != 0);
-            indirect_block_table = file->fd_inode->i_sectors[12];
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-        }
+        memcpy(inode->i_sectors, io_buf, inode->i_size);
+        inode->i_flags |= INODE_INLINE;
+        return false;
     }
-    else
-    {
-        // 需要分配新块, 有三种情况
+    ide_write(part->my_disk, block_lba, io_buf, 1);
+    return true;
+}
 
-        /* 第一种情况:12个直接块地址 够分配使用*/
-        if (file_will_use_blocks <= 12)
-        {
-            // 1. 先将有剩余空间的可继续用的扇区地址写入all_blocks
-            block_idx = file_has_used_blocks - 1;
-            ASSERT(file->fd_inode->i_sectors[block_idx] != 0);
-            all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-
-            /*2. 再将未来要用的扇区分配好后写入all_blocks */
-            block_idx = file_has_used_blocks; // 指向第一个要分配的新扇区
-            while (block_idx < file_will_use_blocks)
-            {
-                block_lba = block_bitmap_alloc(cur_part);
-                if (block_lba == -1)
-                {
-                    printk("file_write: block_bitmap_alloc for situation 1 failed\n");
-                    return -1;
-                }
-
-                // 写文件时,不应该存在块未使用但已经分配扇区的情况,当文件删除时,就会把块地址清0
-                ASSERT(file->fd_inode->i_sectors[block_idx] == 0); // 确保尚未分配扇区地址
-                file->fd_inode->i_sectors[block_idx] = all_blocks[block_idx] = block_lba;
-
-                // 分配一个块，就同步一次块位图到硬盘
-                block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-                bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-
-                block_idx++; // 下一个分配的新扇区
-            }
-        }
-        else if (file_has_used_blocks <= 12 && file_will_use_blocks > 12)
-        {
-            /* 第二种情况: 旧数据在12个直接块内,新数据将使用间接块, 简介块未分配*/
-
-            // 1.先将有剩余空间的可继续用的扇区地址收集到all_blocks
-            block_idx = file_has_used_blocks - 1; // 指向旧数据所在的最后一个扇区
-            all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-
-            // 2.创建一级间接地址表
-            block_lba = block_bitmap_alloc(cur_part);
-            if (block_lba == -1)
-            {
-                printk("file_write: block_bitmap_alloc for indirect_table situation 2 failed\n ");
-                return -1;
-            }
-            ASSERT(file->fd_inode->i_sectors[12] == 0); // 确保一级间接块表未分配
-            // 分配一级间接块索引
-            indirect_block_table = file->fd_inode->i_sectors[12] = block_lba;
-
-            // 3. 申请块，存储地址
-            block_idx = file_has_used_blocks; // 第一个未使用的块,即本文件最后一个已经使用的直接块的下一块
-            while (block_idx < file_will_use_blocks)
-            {
-                block_lba = block_bitmap_alloc(cur_part);
-                if (block_lba == -1)
-                {
-                    printk("file_write: block_bitmap_alloc for situation 2 failed\n");
-                    return -1;
-                }
-
-                if (block_idx < 12)
-                {
-                    // 新创建的0~11块直接存入all_blocks数组
-                    ASSERT(file->fd_inode->i_sectors[block_idx] == 0); // 确保尚未分配扇区地址
-                    file->fd_inode->i_sectors[block_idx] = all_blocks[block_idx] = block_lba;
-                }
-                else
-                {
-                    // 简介块会直接同步到硬盘
-                    all_blocks[block_idx] = block_lba;
-                }
-
-                /* 每分配一个块就将位图同步到硬盘 */
-                block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-                bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-                block_idx++; // 下一个新扇区
-            }
-            ide_write(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-        }
-        else if (file_has_used_blocks > 12)
-        {
-            /* 第三种情况:新数据占据间接块*/
-
-            ASSERT(file->fd_inode->i_sectors[12] != 0);           // 已经具备了一级间接块表
-            indirect_block_table = file->fd_inode->i_sectors[12]; // 获取一级间接表地址
-
-            // 1.已使用的间接块也将被读入all_blocks
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-
-            // 2. 申请数据块
-            block_idx = file_has_used_blocks; // 第一个未使用的间接块,即已经使用的间接块的下一块
-            while (block_idx < file_will_use_blocks)
-            {
-                block_lba = block_bitmap_alloc(cur_part);
-                if (block_lba == -1)
-                {
-                    printk("file_write: block_bitmap_alloc for situation 3 failed\n");
-                    return -1;
-                }
-                all_blocks[block_idx++] = block_lba;
-
-                /* 每分配一个块就将空闲块位图同步到硬盘 */
-                block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-                bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-            }
-
-            // 3. 同步间接表
-            ide_write(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-        }
+/**
+ * @brief file_write用于将buf中的count个字节写入到file指向的文件
+ *
+ * @details 数据块的地址由bmap得到, 写到尚未分配的块时由bmap分配数据块以及沿途需要的间接块.
+ *          bmap会缓存经过的间接块, 所以连续写入时只有第一次进入某个间接块的范围才需要读硬盘.
+ *          内联文件写入后仍能放在inode中时直接写入inode, 否则先迁移到数据块
+ *
+ * @param file 需要写入的文件描述符
+ * @param buf 需要写入文件的数据
+ * @param count 需要写入的字节数
+ * @return int32_t 若写入成功则返回写入的字节数; 若失败则返回-1
+ */
+int32_t file_write(struct file *file, const void *buf, uint32_t count)
+{
+    struct inode *inode = file->fd_inode;
+    // a. 判断是否会写超, 文件最多使用12个直接块和一, 二, 三级间接块索引的块
+    uint32_t max_bytes = INODE_MAX_BLOCKS * BLOCK_SIZE;
+    if (count > max_bytes || inode->i_size > max_bytes - count)
+    {
+        printk("file_write: exceed maximum of file %d bytes, trying to make a file %d bytes", max_bytes, inode->i_size + count);
+        return -1;
     }
 
-    // d. 把buf写入硬盘
+    // b. 把buf写入硬盘
     uint8_t *io_buf = sys_malloc(BLOCK_SIZE); //  写硬盘的缓冲区
     if (io_buf == NULL)
     {
         printk("file_write: sys_malloc for io_buf failed\n");
         return -1;
     }
-    bool first_write_block = true; // 含有剩余空间的扇区标识
 
-    file->fd_pos = file->fd_inode->i_size - 1; // 置fd_pos为文件大小-1,下面在写数据时随时更新
-                                               // 每次都是追加写？，这样有些功能无法实现吧
+    file->fd_pos = inode->i_size - 1; // 置fd_pos为文件大小-1,下面在写数据时随时更新
+                                      // 每次都是追加写？，这样有些功能无法实现吧
 
     const uint8_t *src = buf;   // src 指向 buf中带写入的数据
     uint32_t bytes_written = 0; // 用来记录已写入数据大小
+
+    if (inode->i_flags & INODE_INLINE)
+    {
+        if (inode->i_size + count <= INODE_INLINE_SIZE)
+        { // 数据直接写入inode, 随inode一起同步, 不占用数据块
+            memcpy((uint8_t *)inode->i_sectors + inode->i_size, src, count);
+            inode->i_size += count;
+            file->fd_pos += count;
+            bytes_written = count;
+        }
+        else if (!file_inline_expand(cur_part, inode, io_buf))
+        {
+            printk("file_write: move inline data to block failed\n");
+            sys_free(io_buf);
+            return -1;
+        }
+    }
     uint32_t size_left = count; // 记录未写入数据大小
     uint32_t sec_idx;           // 用来索引扇区
-    uint32_t sec_lba;           // 扇区地址
+    int32_t sec_lba;            // 扇区地址
     uint32_t sec_off_bytes;     // 扇区内字节偏移量
     uint32_t sec_left_bytes;    // 扇区内剩余空闲字节量
     uint32_t chunk_size;        // 每次写入硬盘的字节数量
     while (bytes_written < count)
     {
-        memset(io_buf, 0, BLOCK_SIZE);
-        sec_idx = file->fd_inode->i_size / BLOCK_SIZE; // 追加写
-        sec_lba = all_blocks[sec_idx];                 //// 本次ide_write写入的磁盘块的地址
+        sec_idx = inode->i_size / BLOCK_SIZE; // 追加写
+        // 得到本次写入的块的地址, 块还不存在就分配
+        sec_lba = bmap(cur_part, inode, sec_idx, true);
+        if (sec_lba == -1)
+        {
+            printk("file_write: bmap for block %d failed\n", sec_idx);
+            break;
+        }
 
         // file->fd_inode->i_size表示文件目前的大小,所以整除之后得到的值就是表示上一次写到最后一个块的哪
         // 所以, sec_off_bytes主要给第一次接着写入没有写完的块用的, 后面因为每次都是写入的整个块
         // 所以第二次写入块的时候, sec_off_bytes就是0, 表示本次写入块从哪里开始写
-        sec_off_bytes = file->fd_inode->i_size % BLOCK_SIZE;
-        sec_left_bytes = 512 - sec_off_bytes;
+        sec_off_bytes = inode->i_size % BLOCK_SIZE;
+        sec_left_bytes = BLOCK_SIZE - sec_off_bytes;
 
         // 判断此次写入的数据的大小，还是第一次会有区别
         chunk_size = size_left < sec_left_bytes ? size_left : sec_left_bytes;
 
-        // 第一次写的时候，需要把最后一个扇区从磁盘读出来，写在它的后面
-        if (first_write_block)
-        {
+        // 接着上次没写满的块写的时候，需要把这个块从磁盘读出来，写在它的后面
+        if (sec_off_bytes != 0)
             ide_read(cur_part->my_disk, sec_lba, io_buf, 1);
-            first_write_block = false;
-        }
+        else
+            memset(io_buf, 0, BLOCK_SIZE);
 
         // 写入缓冲区，由缓冲区写入硬盘
         memcpy(io_buf + sec_off_bytes, src, chunk_size);
         ide_write(cur_part->my_disk, sec_lba, io_buf, 1);
 
-        // printk("file_write:data write at 0x%x\n", sec_lba);
-
         // 准备下一轮数据
         src += chunk_size;
-        file->fd_inode->i_size += chunk_size;
+        inode->i_size += chunk_size;
         file->fd_pos += chunk_size;
         bytes_written += chunk_size;
         size_left -= chunk_size;
     }
 
-    // e. 同步文件的inode
+    // c. 同步文件的inode, 即使中途失败, 已经分配的块也记录在了i_sectors中
     void *inode_buf = sys_malloc(BLOCK_SIZE * 2);
     if (inode_buf == NULL)
     {
@@ -590,13 +995,14 @@ int32_t file_write(struct file *file, const void *buf, uint32_t count)
     }
     else
     {
-        inode_sync(cur_part, file->fd_inode, inode_buf);
+        inode_sync(cur_part, inode, inode_buf);
         sys_free(inode_buf);
     }
 
     // 释放缓冲区
-    sys_free(all_blocks);
     sys_free(io_buf);
+    if (bytes_written == 0 && count != 0)
+        return -1;
     return bytes_written;
 }
 
@@ -630,96 +1036,39 @@ int32_t file_read(struct file *file, void *buf, uint32_t count)
         return -1;
     }
 
-    uint32_t *all_blocks = (uint32_t *)sys_malloc(BLOCK_SIZE + 48);
-    if (all_blocks == NULL)
-    {
-        printk("%s: sys_malloc for io_buf failed\n", __func__);
-        return -1;
-    }
-
-    uint32_t block_read_start_idx = file->fd_pos / BLOCK_SIZE;        // 数据块起始地址
-    uint32_t block_read_end_idx = (file->fd_pos + size) / BLOCK_SIZE; // 数据块的终止地址
-
-    uint32_t read_block = block_read_start_idx - block_read_end_idx; // 需要读数据所占的扇区数
-    ASSERT(block_read_start_idx < 139 && block_read_end_idx < 139);
-
-    int32_t indirect_block_table; // 用来获取一级间接表地址
-    uint32_t block_idx;           // 获取待读的块地址
+    // 用来索引扇区, 扇区地址, 扇区内字节偏移量, 扇区内剩余字节量, 每次从硬盘读入的字节数量
+    uint32_t sec_idx, sec_off_bytes, sec_left_bytes, chunk_size;
+    int32_t sec_lba;
+    uint32_t bytes_read = 0; // 已读入字节数
 
-    // 构建all_blocks块地址数组,读文件所属的得到要读数据的地址
-    if (read_block == 0)
+    // 内联文件的数据就在inode中
+    if (file->fd_inode->i_flags & INODE_INLINE)
     {
-        // 在一扇区内读数据, 不涉及跨扇区
-        ASSERT(block_read_end_idx == block_read_start_idx)
-        if (block_read_end_idx < 12)
-        { // 在12个直接块之内
-            block_idx = block_read_end_idx;
-            all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-        }
-        else
-        { // 将一级简介块存储的块地址存入all_blocks
-            indirect_block_table = file->fd_inode->i_sectors[12];
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-        }
+        memcpy(buf_dst, (uint8_t *)file->fd_inode->i_sectors + file->fd_pos, size);
+        file->fd_pos += size;
+        bytes_read = size;
     }
-    else
-    {
-        // 需要跨扇区读取数据
 
-        // 情况1 起始块和终止块属于直接块, 数据结束所在的块属于直接块
-        if (block_read_end_idx < 12)
-        {
-            block_idx = block_read_start_idx;
-            while (block_idx <= block_read_end_idx)
-            {
-                all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-                block_idx++;
-            }
-        }
-        // 情况2 待入读数据跨越直接快和间接块两类, 所以两种地址都需要存储
-        else if (block_read_start_idx < 12 && block_read_end_idx >= 12)
-        { // a. 首先记录直接块的地址在all_blocks中
-            block_idx = block_read_start_idx;
-            while (block_idx < 12)
-            {
-                all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-                block_idx++;
-            }
-            ASSERT(file->fd_inode->i_sectors[12] != 0);
-
-            // b. 再记录一级间接地址在all_blocks中
-            indirect_block_table = file->fd_inode->i_sectors[12];
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-
-        } // 情况3 需要读入的数据块的地址是间接地址
-        else
-        {
-            // 确保存在间接块
-            ASSERT(file->fd_inode->i_sectors[12] != 0);
-
-            indirect_block_table = file->fd_inode->i_sectors[12];
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-        }
-    }
-
-    // 地址已经获取得到, 开始读数据
-    // 用来索引扇区, 扇区地址, 扇区内字节偏移量, 扇区内剩余字节量, 每次从硬盘读入的字节数量
-    uint32_t sec_idx, sec_lba, sec_off_bytes, sec_left_bytes, chunk_size;
-    uint32_t bytes_read = 0; // 已读入字节数
-
-    // 和写文件十分相似
+    // 和写文件十分相似, 块地址由bmap得到
     while (bytes_read < size)
     {
         sec_idx = file->fd_pos / BLOCK_SIZE;
-        sec_lba = all_blocks[sec_idx];
+        sec_lba = bmap(cur_part, file->fd_inode, sec_idx, false);
+        if (sec_lba == -1)
+        {
+            printk("%s: bmap for block %d failed\n", __func__, sec_idx);
+            break;
+        }
 
         sec_off_bytes = file->fd_pos % BLOCK_SIZE;
-        sec_left_bytes = 512 - sec_off_bytes;
+        sec_left_bytes = BLOCK_SIZE - sec_off_bytes;
 
         chunk_size = size_left < sec_left_bytes ? size_left : sec_left_bytes;
 
         memset(io_buf, 0, BLOCK_SIZE);
-        ide_read(cur_part->my_disk, sec_lba, io_buf, 1);
+        // 块地址为0说明该块从未写入过, 读出的内容为0
+        if (sec_lba != 0)
+            ide_read(cur_part->my_disk, sec_lba, io_buf, 1);
         memcpy(buf_dst, io_buf + sec_off_bytes, chunk_size);
 
         buf_dst += chunk_size;
@@ -728,7 +1077,8 @@ int32_t file_read(struct file *file, void *buf, uint32_t count)
         size_left -= chunk_size;
     }
 
-    sys_free(all_blocks);
     sys_free(io_buf);
+    if (bytes_read == 0)
+        return -1;
     return bytes_read;
-}
\ No newline at end of file
+}
@@ -4,18 +4,44 @@
 #include "ide.h"
 #include "dir.h"
 #include "global.h"
-#define MAX_FILE_OPEN 32 // 系统可打开的最大文件数
+
+#define FILE_CHUNK_FILES (PG_SIZE / sizeof(struct file))       // 文件表每次扩充一页, 一页可容纳的文件结构数
+#define MAX_FILE_CHUNKS 16                                     // 文件表最多扩充的页数
+#define MAX_FILE_OPEN (MAX_FILE_CHUNKS * FILE_CHUNK_FILES)     // 系统可打开的最大文件数
+#define CONSOLE_FLAG 0xFFFE                                    // fd_flag: 标准输入输出使用的控制台文件
+
+#define FDS_INIT_NR 32                // 进程文件描述符表的初始容量, 不够时成倍扩大
+#define MAX_FILES_OPEN_PER_PROC 1024  // 每个进程最多可打开的文件数
 
 // 文件结构
 struct file
 {
     // 记录当前文件操作的偏移地址， 以0为起始，最大为文件大小 - 1
+    // 控制台文件用它记录自己是标准输入, 标准输出还是标准错误
     uint32_t fd_pos;
     // 文件打开的标志
     uint32_t fd_flag;
     struct inode *fd_inode;
+    // 引用计数, 进程的文件描述符每指向一次加1, fork, dup, dup2都会增加它, 减为0时才真正关闭文件
+    uint32_t f_count;
+    // 空闲时用于文件表的空闲链表
+    struct file *f_next;
 };
 typedef struct file file_t;
+
+/**
+ * 进程的文件描述符表, 位于内核堆中, 不占用pcb所在的页.
+ * open_fds位图记录哪些描述符已被使用, 分配描述符时从next_fd开始按字扫描位图, 找到第一个0位.
+ * 容量不够时成倍扩大, 最多MAX_FILES_OPEN_PER_PROC个
+ */
+struct files_struct
+{
+    uint32_t max_fds;   // fd数组的容量, 是32的倍数
+    uint32_t next_fd;   // 比它小的描述符都已被使用, 查找空闲描述符从这里开始
+    struct file **fd;   // 文件描述符 -> 文件结构
+    uint32_t *open_fds; // 已使用描述符的位图, 每个uint32_t记录32个描述符
+    uint32_t users;     // 共享此表的任务数, 进程clone出的线程与进程共用一张表
+};
 // 标准输入输出描述符
 enum std_fd
 {
@@ -31,13 +57,31 @@ enum bitmap_type
     BLOCK_BITMAP, // 块位图
 };
 
-extern struct file file_table[MAX_FILE_OPEN];
+extern struct file console_files[3];
+
+struct task_struct;
 
 void bitmap_sync(struct partition *part, uint32_t bit_idx, uint8_t btmp);
+uint32_t bitmap_flush(struct partition *part);
+void bitmap_op_done(struct partition *part, uint32_t sync_before);
+void bitmap_io_report(struct partition *part);
 int32_t block_bitmap_alloc(struct partition *part);
+void block_bitmap_free(struct partition *part, uint32_t lba);
 int32_t inode_bitmap_alloc(struct partition *part);
-int32_t pcb_fd_install(int32_t globa_fd_i);
-int32_t get_free_slot_in_global(void);
+void bitmap_free(struct partition *part, uint32_t bit_idx, uint8_t btmp);
+struct file *file_alloc(void);
+struct file *file_get(struct file *file);
+void file_put(struct file *file);
+bool file_inode_in_use(uint32_t inode_no);
+int32_t pcb_fd_install(struct file *file);
+struct file *fd2file(int32_t fd);
+void fd_uninstall(int32_t fd);
+int32_t fd_replace(int32_t fd, struct file *file);
+int32_t sys_dup(int32_t old_fd);
+int32_t sys_dup2(int32_t old_fd, int32_t new_fd);
+int32_t files_dup(struct task_struct *child);
+int32_t files_share(struct task_struct *child);
+void files_release(struct task_struct *pthread);
 int32_t file_create(struct dir *parent_dir, char *filename, uint8_t flag);
 int32_t file_open(uint32_t inode_no, uint8_t flag);
 int32_t file_close(struct file *file);
@@ -16,6 +16,7 @@
 #include "thread.h"
 #include "ioqueue.h"
 #include "pipe.h"
+#include "journal.h"
 // 在ide.c中声明
 extern uint8_t channel_cnt;
 extern struct ide_channel channels[2]; ///< 系统当前最大支持两个 ide 通道
@@ -71,6 +72,14 @@ static bool mount_partition(struct list_elem *pelem, int arg)
         ide_read(hd, cur_part->start_lba + 1, sb_buf, 1);
         // 把sb_buf中超级块的星系复制到分区的超级块sb中
         memcpy(cur_part->sb, sb_buf, sizeof(struct super_block));
+        // 旧版本格式化的分区没有特性字段
+        if (cur_part->sb->feature_magic != FS_FEATURE_MAGIC)
+            cur_part->sb->features = 0;
+
+        rwlock_init(&cur_part->bitmap_lock);
+
+        /* 重放日志, 必须在读入位图之前完成, 因为日志中可能有位图扇区的新内容 */
+        journal_recover(cur_part);
 
         /**********     将硬盘上的块位图读入到内存    ****************/
         cur_part->block_bitmap.bits = (uint8_t *)sys_malloc(sb_buf->block_bitmap_sects * SECTOR_SIZE);
@@ -138,12 +147,14 @@ static void partition_format(struct partition *part)
     uint32_t boot_sector_sects = 1;
     // 超级块占用的扇区数
     uint32_t super_block_sects = 1;
+    // 元数据日志占用的扇区数
+    uint32_t journal_sects = JOURNAL_SECTS;
     // I结点位图占用的扇区数.规定每个分区最多支持4096个文件
     uint32_t inode_bitmap_sects = DIV_ROUND_UP(MAX_FILES_PER_PART, BITS_PER_SECTOR);
     // inode表占用的扇区数
-    uint32_t inode_table_sects = DIV_ROUND_UP(((sizeof(struct inode)) * MAX_FILES_PER_PART), SECTOR_SIZE);
+    uint32_t inode_table_sects = DIV_ROUND_UP(((sizeof(struct disk_inode)) * MAX_FILES_PER_PART), SECTOR_SIZE);
     // 已使用的扇区数
-    uint32_t used_sects = boot_sector_sects + super_block_sects + inode_bitmap_sects + inode_table_sects;
+    uint32_t used_sects = boot_sector_sects + super_block_sects + journal_sects + inode_bitmap_sects + inode_table_sects;
     // 空闲的扇区数
     uint32_t free_sects = part->sec_cnt - used_sects;
 
@@ -157,12 +168,21 @@ static void partition_format(struct partition *part)
 
     /* 超级块初始化 */
     struct super_block sb;
+    memset(&sb, 0, sizeof(struct super_block));
     sb.magic = 0x19590318;
     sb.sec_cnt = part->sec_cnt;
     sb.inode_cnt = MAX_FILES_PER_PART;
     sb.part_lba_base = part->start_lba;
 
-    sb.block_bitmap_lba = sb.part_lba_base + 2; // 第0块是引导块,第1块是超级块
+    sb.feature_magic = FS_FEATURE_MAGIC;
+    sb.features = FS_FEAT_INLINE;
+    // 一次删除操作可能修改全部块位图扇区, 放不进一次提交时不使用日志
+    if (JOURNAL_RELEASE_CREDITS(&sb) <= JOURNAL_MAX_BLOCKS)
+        sb.features |= FS_FEAT_JOURNAL;
+    sb.journal_lba = sb.part_lba_base + 2; // 第0块是引导块,第1块是超级块,之后是日志区
+    sb.journal_sects = journal_sects;
+
+    sb.block_bitmap_lba = sb.journal_lba + sb.journal_sects;
     sb.block_bitmap_sects = block_bitmap_sects;
 
     sb.inode_bitmap_lba = sb.block_bitmap_lba + sb.block_bitmap_sects;
@@ -176,7 +196,7 @@ static void partition_format(struct partition *part)
     sb.dir_entry_size = sizeof(struct dir_entry);
 
     printk("%s info:\n", part->name);
-    printk("   magic:0x%x\n   part_lba_base:0x%x\n   all_sectors:0x%x\n   inode_cnt:0x%x\n   block_bitmap_lba:0x%x\n   block_bitmap_sectors:0x%x\n   inode_bitmap_lba:0x%x\n   inode_bitmap_sectors:0x%x\n   inode_table_lba:0x%x\n   inode_table_sectors:0x%x\n   data_start_lba:0x%x\n", sb.magic, sb.part_lba_base, sb.sec_cnt, sb.inode_cnt, sb.block_bitmap_lba, sb.block_bitmap_sects, sb.inode_bitmap_lba, sb.inode_bitmap_sects, sb.inode_table_lba, sb.inode_table_sects, sb.data_start_lba);
+    printk("   magic:0x%x\n   part_lba_base:0x%x\n   all_sectors:0x%x\n   inode_cnt:0x%x\n   block_bitmap_lba:0x%x\n   block_bitmap_sectors:0x%x\n   inode_bitmap_lba:0x%x\n   inode_bitmap_sectors:0x%x\n   inode_table_lba:0x%x\n   inode_table_sectors:0x%x\n   data_start_lba:0x%x\n   journal_lba:0x%x\n   journal_sectors:0x%x\n", sb.magic, sb.part_lba_base, sb.sec_cnt, sb.inode_cnt, sb.block_bitmap_lba, sb.block_bitmap_sects, sb.inode_bitmap_lba, sb.inode_bitmap_sects, sb.inode_table_lba, sb.inode_table_sects, sb.data_start_lba, sb.journal_lba, sb.journal_sects);
 
     struct disk *hd = part->my_disk;
     /*******************************
@@ -229,7 +249,7 @@ static void partition_format(struct partition *part)
      ***************************************/
     /* 准备写inode_table中的第0项,即根目录所在的inode */
     memset(buf, 0, buf_size); // 先清空缓冲区buf
-    struct inode *i = (struct inode *)buf;
+    struct disk_inode *i = (struct disk_inode *)buf;
     i->i_size = sb.dir_entry_size * 2;   // .和..
     i->i_no = 0;                         // 根目录占inode数组中第0个inode
     i->i_sectors[0] = sb.data_start_lba; // 由于上面的memset,i_sectors数组的其它元素都初始化为0
@@ -256,6 +276,13 @@ static void partition_format(struct partition *part)
     /* sb.data_start_lba已经分配给了根目录,里面是根目录的目录项 */
     ide_write(hd, sb.data_start_lba, buf, 1);
 
+    /***************************************
+     * 6 清空日志超级块, 挂载时再初始化日志区
+     * 否则可能重放该分区上次格式化时残留的日志
+     ***************************************/
+    memset(buf, 0, buf_size);
+    ide_write(hd, sb.journal_lba, buf, 1);
+
     printk("   root_dir_lba:0x%x\n", sb.data_start_lba);
     printk("%s format done\n", part->name);
     sys_free(buf);
@@ -396,6 +423,31 @@ static int search_file(const char *pathname, struct path_search_record *searched
     return dir_e.i_no;
 }
 
+/**
+ * @brief fs_op_begin在会修改元数据的文件系统操作开始时调用, 开启一个日志事务.
+ *        须在获取目录, inode等其它锁之前调用
+ *
+ * @param credits 本次操作最多修改的元数据扇区数
+ * @return uint32_t 操作开始时的位图修改计数, 交给fs_op_end统计本次操作的位图I/O
+ */
+static uint32_t fs_op_begin(uint32_t credits)
+{
+    journal_begin(cur_part, credits);
+    return cur_part->bitmap_sync_cnt;
+}
+
+/**
+ * @brief fs_op_end在文件系统操作结束时调用: 本次操作修改的位图扇区统一写出, 然后结束日志事务
+ *
+ * @param bitmap_sync_before fs_op_begin的返回值
+ * @param credits 传给fs_op_begin的预留扇区数
+ */
+static void fs_op_end(uint32_t bitmap_sync_before, uint32_t credits)
+{
+    bitmap_op_done(cur_part, bitmap_sync_before);
+    journal_end(cur_part, credits);
+}
+
 /* 打开或创建文件成功后,返回文件描述符,否则返回-1 */
 // brief: 函数在查找pathname, 如果文件不存在也没有要求创建， 回返回 -1，如果文件要创建，或者文件存在 返回 句柄
 int32_t sys_open(const char *pathname, uint8_t flags)
@@ -457,9 +509,12 @@ int32_t sys_open(const char *pathname, uint8_t flags)
     {
     case O_CREAT:
         printk("creating file\n");
+        uint32_t bitmap_sync_before = fs_op_begin(JOURNAL_OP_CREDITS);
         // 给文件创建inode,在目录里面记录该文件
         fd = file_create(searched_record.parent_dir, (strrchr(pathname, '/') + 1), flags);
         dir_close(searched_record.parent_dir);
+        // 创建文件过程中的修改作为一个事务
+        fs_op_end(bitmap_sync_before, JOURNAL_OP_CREDITS);
         break;
     default:
         /* 其余情况均为打开已存在文件:
@@ -467,8 +522,8 @@ int32_t sys_open(const char *pathname, uint8_t flags)
         fd = file_open(inode_no, flags);
     }
 
-    /* 此fd是指任务pcb->fd_table数组中的元素下标,
-     * 并不是指全局file_table中的下标 */
+    /* 此fd是指任务描述符表pcb->files中的下标,
+     * 描述符指向的文件结构在全局文件表中 */
     return fd;
 }
 
@@ -548,50 +603,20 @@ void filesys_init()
     // 将当前分区的根目录打开
     open_root_dir(cur_part);
 
-    // 初始化文件表
-    uint32_t fd_idx = 0;
-    while (fd_idx < MAX_FILE_OPEN)
-    {
-        file_table[fd_idx++].fd_inode = NULL;
-    }
+    // 文件表在第一次打开文件时才分配
     printk("filesystem_init done!\n");
 }
 
-/**
- * @brief fd_local2global将进程的文件描述符 转换到文件表下标
- *
- * @param local_fd 文件描述符
- * @return uint32_t 全局文件表的下标
- */
-uint32_t fd_local2global(uint32_t local_fd)
-{
-    struct task_struct *cur = running_thread();
-    int32_t global_fd = cur->fd_table[local_fd];
-    ASSERT(global_fd >= 0 && global_fd < MAX_FILE_OPEN);
-    return (uint32_t)global_fd;
-}
-
 // 关闭文件描述符fd指向的文件，成功返回0， 否则返回 -1
 int32_t sys_close(int32_t fd)
 {
-    int ret = -1; // 默认返回失败
-    if (fd > 2)
-    {
-        uint32_t _fd = fd_local2global(fd);
-        if (is_pipe(fd))
-        {
-            if (--file_table[_fd].fd_pos == 0)
-            {
-                mfree_page(PF_KERNEL, file_table[_fd].fd_inode, 1);
-                file_table[_fd].fd_inode = NULL;
-            }
-            ret = 0;
-        }
-        else
-            ret = file_close(&file_table[_fd]);
-        running_thread()->fd_table[fd] = -1; // 标记为空
-    }
-    return ret;
+    struct file *file = fd2file(fd);
+    if (file == NULL)
+        return -1;
+    // 文件结构可能还被其它描述符(dup, fork, 管道的另一端)引用, 最后一个引用关闭时才真正关闭文件
+    fd_uninstall(fd);
+    file_put(file);
+    return 0;
 }
 
 /**
@@ -606,34 +631,52 @@ int32_t sys_close(int32_t fd)
  */
 int32_t sys_write(int32_t fd, const void *buf, uint32_t count)
 {
-    if (fd < 0)
+    struct file *wr_file = fd2file(fd);
+    if (wr_file == NULL)
     {
         printk("sys_write: fd error\n");
         return -1;
     }
     // 写 到 显示屏上
-    if (fd == stdout_no)
+    if (wr_file->fd_flag == CONSOLE_FLAG)
     {
-        if (is_pipe(fd))
-        {
-            return pipe_write(fd, buf, count);
-        }
-        else
+        if (wr_file->fd_pos == stdin_no)
         {
-            char tmp_buf[1024] = {0};
-            memcpy(tmp_buf, buf, count);
-            console_put_str(tmp_buf);
-            return count;
+            printk("sys_write: can't write to stdin\n");
+            return -1;
         }
+        char tmp_buf[1024] = {0};
+        memcpy(tmp_buf, buf, count);
+        console_put_str(tmp_buf);
+        return count;
     }
-    else if (is_pipe(fd))
+    else if (wr_file->fd_flag == PIPE_FLAG)
         return pipe_write(fd, buf, count);
 
-    uint32_t _fd = fd_local2global(fd);
-    struct file *wr_file = &file_table[_fd];
     if (wr_file->fd_flag & O_WRONLY || wr_file->fd_flag & O_RDWR)
     {
-        uint32_t bytes_written = file_write(wr_file, buf, count);
+        // 每段写入一个事务, 使一个事务修改的元数据不超过预留的扇区数
+        uint32_t bytes_written = 0;
+        while (bytes_written < count)
+        {
+            uint32_t chunk = count - bytes_written;
+            if (chunk > FS_WRITE_CHUNK)
+                chunk = FS_WRITE_CHUNK;
+            uint32_t bitmap_sync_before = fs_op_begin(JOURNAL_OP_CREDITS);
+            // 写文件会修改i_size和块索引, 与读者和其它写者互斥
+            write_lock(&wr_file->fd_inode->i_rwlock);
+            int32_t ret = file_write(wr_file, (const uint8_t *)buf + bytes_written, chunk);
+            write_unlock(&wr_file->fd_inode->i_rwlock);
+            // 本段写入分配数据块时修改的位图扇区统一写出, 每个扇区只写一次
+            fs_op_end(bitmap_sync_before, JOURNAL_OP_CREDITS);
+            if (ret == -1)
+                break;
+            bytes_written += ret;
+            if ((uint32_t)ret < chunk)
+                break;
+        }
+        if (bytes_written == 0 && count != 0)
+            return -1;
         return bytes_written;
     }
     else
@@ -654,33 +697,30 @@ int32_t sys_read(int32_t fd, void *buf, uint32_t count)
 {
     ASSERT(buf != NULL)
     int ret = -1;
-    if (fd < 0 || fd == stdout_no || fd == stderr_no)
+    struct file *rd_file = fd2file(fd);
+    if (rd_file == NULL || (rd_file->fd_flag == CONSOLE_FLAG && rd_file->fd_pos != stdin_no))
         printk("sys_read: fd error\n");
-    else if (fd == stdin_no)
+    else if (rd_file->fd_flag == CONSOLE_FLAG)
     {
-        if (is_pipe(fd))
-        {
-            return pipe_write(fd, buf, count);
-        }
-        else
+        char *buffer = buf;
+        uint32_t bytes_read = 0;
+        while (bytes_read < count)
         {
-            char *buffer = buf;
-            uint32_t bytes_read = 0;
-            while (bytes_read < count)
-            {
-                *buffer = ioq_getchar(&kbd_buf);
-                bytes_read++;
-                buffer++;
-            }
-            ret = (bytes_read == 0 ? -1 : (int32_t)bytes_read);
+            *buffer = ioq_getchar(&kbd_buf);
+            if (thread_group_exiting())
+                break;
+            bytes_read++;
+            buffer++;
         }
+        ret = (bytes_read == 0 ? -1 : (int32_t)bytes_read);
     }
-    else if (is_pipe(fd))
+    else if (rd_file->fd_flag == PIPE_FLAG)
         return pipe_read(fd, buf, count);
     else
     {
-        uint32_t _fd = fd_local2global(fd);
-        ret = file_read(&file_table[_fd], buf, count);
+        read_lock(&rd_file->fd_inode->i_rwlock);
+        ret = file_read(rd_file, buf, count);
+        read_unlock(&rd_file->fd_inode->i_rwlock);
     }
     return ret;
 }
@@ -694,15 +734,14 @@ int32_t sys_read(int32_t fd, void *buf, uint32_t count)
  */
 int32_t sys_Iseek(int32_t fd, int32_t offset, uint8_t whence)
 {
-    if (fd < 0)
+    struct file *pf = fd2file(fd);
+    if (pf == NULL || pf->fd_flag == CONSOLE_FLAG || pf->fd_flag == PIPE_FLAG)
     {
         printk("sys_Iseek: fd error\n");
         return -1;
     }
 
     ASSERT(whence > 0 && whence < 4);
-    uint32_t _fd = fd_local2global(fd);
-    struct file *pf = &file_table[_fd];
     int32_t new_pos = 0;                               // 记录新的偏移量
     int32_t file_size = (int32_t)pf->fd_inode->i_size; // 文件大小
 
@@ -756,22 +795,12 @@ int32_t sys_unlink(const char *pathname)
     }
 
     /* 检查是否在已打开文件列表(文件表)中 */
-    uint32_t file_idx = 0;
-    while (file_idx < MAX_FILE_OPEN)
-    {
-        if (file_table[file_idx].fd_inode != NULL && (uint32_t)inode_no == file_table[file_idx].fd_inode->i_no)
-        {
-            break;
-        }
-        file_idx++;
-    }
-    if (file_idx < MAX_FILE_OPEN)
+    if (file_inode_in_use(inode_no))
     {
         dir_close(searched_record.parent_dir);
         printk("file %S is in use, not allow to delete!\n", pathname);
         return -1;
     }
-    ASSERT(file_idx == MAX_FILE_OPEN);
 
     // 为delete_dir_entry申请缓冲区
     void *io_buf = sys_malloc(SECTOR_SIZE + SECTOR_SIZE);
@@ -783,12 +812,22 @@ int32_t sys_unlink(const char *pathname)
     }
 
     struct dir *parent_dir = searched_record.parent_dir;
-    delete_dir_entry(cur_part, parent_dir, inode_no, io_buf);
-    inode_release(cur_part, inode_no);
+    int32_t ret = 0;
+    uint32_t credits = JOURNAL_RELEASE_CREDITS(cur_part->sb);
+    uint32_t bitmap_sync_before = fs_op_begin(credits);
+    // 目录项删除成功的任务才回收inode, 同时删除同一文件的其它任务在这里失败
+    if (delete_dir_entry(cur_part, parent_dir, inode_no, io_buf))
+        inode_release(cur_part, inode_no);
+    else
+    {
+        printk("file %s not found!\n", pathname);
+        ret = -1;
+    }
+    fs_op_end(bitmap_sync_before, credits);
     sys_free(io_buf);
     dir_close(searched_record.parent_dir);
 
-    return 0;
+    return ret;
 }
 
 /**
@@ -799,12 +838,14 @@ int32_t sys_unlink(const char *pathname)
 int32_t sys_mkdir(const char *pathname)
 {
     uint8_t rollback_step = 0; // 用于操作失败时回滚各资源状态
+    uint32_t bitmap_sync_before = fs_op_begin(JOURNAL_OP_CREDITS);
 
     // 1.创建IO缓存区, 用来读写磁盘
     void *io_buf = sys_malloc(SECTOR_SIZE * 2);
     if (io_buf == NULL)
     {
         printk("sys_mkdir: sys_malloc for io_buf failed\n");
+        fs_op_end(bitmap_sync_before, JOURNAL_OP_CREDITS);
         return -1;
     }
 
@@ -847,40 +888,53 @@ int32_t sys_mkdir(const char *pathname)
 
     struct inode new_dir_inode;
     inode_init(inode_no, &new_dir_inode); // 初始化i结点
-    // 4. 为新目录分配数据块
     uint32_t block_bitmap_idx = 0; // 用来记录block对应于block_bitmap中的索引
     int32_t block_lba = -1;
-    /* 为目录分配一个块,用来写入目录.和.. */
-    block_lba = block_bitmap_alloc(cur_part);
-    if (block_lba == -1)
+    if (cur_part->sb->features & FS_FEAT_INLINE)
     {
-        printk("%s: allocate block for directory_%s failed\n", __func__, dirname);
-        rollback_step = 2;
-        goto rollback;
+        // 4-5. 新目录内联在inode中, 不分配数据块. "."就是自己, ".."记录在i_parent中
+        new_dir_inode.i_flags |= INODE_INLINE;
+        new_dir_inode.i_parent = parent_dir->inode->i_no;
+    }
+    else
+    {
+        // 4. 为新目录分配数据块
+        /* 为目录分配一个块,用来写入目录.和.. */
+        block_lba = block_bitmap_alloc(cur_part);
+        if (block_lba == -1)
+        {
+            printk("%s: allocate block for directory_%s failed\n", __func__, dirname);
+            rollback_step = 2;
+            goto rollback;
+        }
+        new_dir_inode.i_sectors[0] = block_lba;
+        /* 每分配一个块就将位图同步到硬盘 */
+        block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
+        ASSERT(block_bitmap_idx != 0);
+
+        // 5. 为新目录中创建两个目录项 "." 和 ".." 并同步到硬盘
+        /* 将当前目录的目录项'.'和'..'写入目录 */
+        memset(io_buf, 0, SECTOR_SIZE * 2); // 清空io_buf
+        struct dir_entry *p_de = (struct dir_entry *)io_buf;
+
+        /* 初始化当前目录"." */
+        memcpy(p_de->filename, ".", 1);
+        p_de->i_no = inode_no;
+        p_de->f_type = FT_DIRECTORY;
+
+        p_de++;
+        /* 初始化当前目录".." */
+        create_dir_entry("..", parent_dir->inode->i_no, FT_DIRECTORY, p_de);
+        journal_write(cur_part, new_dir_inode.i_sectors[0], io_buf, 1);
     }
-    new_dir_inode.i_sectors[0] = block_lba;
-    /* 每分配一个块就将位图同步到硬盘 */
-    block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-    ASSERT(block_bitmap_idx != 0);
-
-    // 5. 为新目录中创建两个目录项 "." 和 ".." 并同步到硬盘
-    /* 将当前目录的目录项'.'和'..'写入目录 */
-    memset(io_buf, 0, SECTOR_SIZE * 2); // 清空io_buf
-    struct dir_entry *p_de = (struct dir_entry *)io_buf;
-
-    /* 初始化当前目录"." */
-    memcpy(p_de->filename, ".", 1);
-    p_de->i_no = inode_no;
-    p_de->f_type = FT_DIRECTORY;
-
-    p_de++;
-    /* 初始化当前目录".." */
-    create_dir_entry("..", parent_dir->inode->i_no, FT_DIRECTORY, p_de);
-    ide_write(cur_part->my_disk, new_dir_inode.i_sectors[0], io_buf, 1);
 
     new_dir_inode.i_size = 2 * cur_part->sb->dir_entry_size;
 
-    // 6. 在新目录的父目录中添加新目录项的目录项 并同步到硬盘
+    /* 将新创建目录的inode同步到硬盘. 目录项一旦写入父目录就可能被别的任务打开, 所以inode要先写 */
+    memset(io_buf, 0, SECTOR_SIZE * 2);
+    inode_sync(cur_part, &new_dir_inode, io_buf);
+
+    // 6. 在新目录的父目录中添加新目录项的目录项 并同步到硬盘, 父目录的inode也一并同步
     struct dir_entry new_dir_entry;
     memset(&new_dir_entry, 0, sizeof(struct dir_entry));
     create_dir_entry(dirname, inode_no, FT_DIRECTORY, &new_dir_entry);
@@ -893,18 +947,12 @@ int32_t sys_mkdir(const char *pathname)
     }
 
     // 7. 同步块位图到硬盘
-    bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-
-    /* 父目录的inode同步到硬盘 */
-    memset(io_buf, 0, SECTOR_SIZE * 2);
-    inode_sync(cur_part, parent_dir->inode, io_buf);
-
-    /* 将新创建目录的inode同步到硬盘 */
-    memset(io_buf, 0, SECTOR_SIZE * 2);
-    inode_sync(cur_part, &new_dir_inode, io_buf);
+    if (block_lba != -1)
+        bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
 
     /* 将inode位图同步到硬盘 */
     bitmap_sync(cur_part, inode_no, INODE_BITMAP);
+    fs_op_end(bitmap_sync_before, JOURNAL_OP_CREDITS);
 
     sys_free(io_buf);
 
@@ -918,14 +966,17 @@ rollback: // 因为某步骤操作失败而回滚
     {
     case 3:
         // 回收块
-        bitmap_set(&cur_part->block_bitmap, block_bitmap_idx, 0);
+        if (block_lba != -1)
+            bitmap_free(cur_part, block_bitmap_idx, BLOCK_BITMAP);
     case 2:
-        bitmap_set(&cur_part->inode_bitmap, inode_no, 0); // 如果新文件的inode创建失败,之前位图中分配的inode_no也要恢复
+        bitmap_free(cur_part, inode_no, INODE_BITMAP); // 如果新文件的inode创建失败,之前位图中分配的inode_no也要恢复
     case 1:
         /* 关闭所创建目录的父目录 */
         dir_close(searched_record.parent_dir);
         break;
     }
+    // 回滚后的位图状态也要写回, sync_dir_entry可能已经标记过脏扇区
+    fs_op_end(bitmap_sync_before, JOURNAL_OP_CREDITS);
     sys_free(io_buf);
     return -1;
 }
@@ -1040,8 +1091,11 @@ int32_t sys_rmdir(const char *pathname)
             }
             else
             {
+                uint32_t credits = JOURNAL_RELEASE_CREDITS(cur_part->sb);
+                uint32_t bitmap_sync_before = fs_op_begin(credits);
                 if (!dir_remove(searched_record.parent_dir, dir))
                     ret_val = 0;
+                fs_op_end(bitmap_sync_before, credits);
             }
             dir_close(dir);
         }
@@ -1063,11 +1117,10 @@ static uint32_t get_parent_dir_inode_nr(uint32_t child_inode_nr, void *io_buf)
 {
     struct inode *child_dir_inode = inode_open(cur_part, child_inode_nr);
     // 目录中的目录项 “..” 中包括父亲目录 inode 编号, ".."位于目录的 第0块
-    uint32_t block_lba = child_dir_inode->i_sectors[0];
-    ASSERT(block_lba >= cur_part->sb->data_start_lba);
+    bool found = dir_block_read(cur_part, child_dir_inode, 0, io_buf);
+    ASSERT(found);
     inode_close(child_dir_inode);
 
-    ide_read(cur_part->my_disk, block_lba, io_buf, 1);
     struct dir_entry *dir_e = (struct dir_entry *)io_buf;
 
     // 创建文件后, 第一个目录项是"." 第二个是".."
@@ -1088,32 +1141,14 @@ static uint32_t get_parent_dir_inode_nr(uint32_t child_inode_nr, void *io_buf)
 static int32_t get_child_dir_name(uint32_t p_inode_nr, uint32_t c_inode_nr, char *path, void *io_buf)
 {
     struct inode *parent_dir_inode = inode_open(cur_part, p_inode_nr);
-    // 得到所有块地址
-    uint32_t block_idx = 0, block_cnt = 12;
-    uint32_t all_blocks_lba[140] = {0};
-    // 直接块
-    while (block_idx < block_cnt)
-    {
-        all_blocks_lba[block_idx] = parent_dir_inode->i_sectors[block_idx];
-        block_idx++;
-    }
-    // 间接块
-    if (parent_dir_inode->i_sectors[12])
-    {
-        ide_read(cur_part->my_disk, parent_dir_inode->i_sectors[12], all_blocks_lba + 12, 1);
-        block_cnt = 140;
-    }
-    inode_close(parent_dir_inode);
-
-    block_idx = 0;
+    // 逐块遍历父目录
+    uint32_t block_idx = 0;
     dir_entry_t *de = (dir_entry_t *)io_buf;
-    uint32_t dir_entry_size = cur_part->sb->dir_entry_size;
-    uint32_t dir_entry_pre_sec = SECTOR_SIZE / dir_entry_size;
-    while (block_idx < block_cnt)
+    uint32_t dir_entry_pre_sec = dir_block_entries(cur_part, parent_dir_inode);
+    while (block_idx < DIR_MAX_BLOCKS)
     {
-        if (all_blocks_lba[block_idx])
+        if (dir_block_read(cur_part, parent_dir_inode, block_idx, io_buf))
         {
-            ide_read(cur_part->my_disk, all_blocks_lba[block_idx], io_buf, 1);
             // 逐个遍历目录项
             uint32_t de_idx = 0;
             while (de_idx < dir_entry_pre_sec)
@@ -1122,6 +1157,7 @@ static int32_t get_child_dir_name(uint32_t p_inode_nr, uint32_t c_inode_nr, char
                 {
                     strcat(path, "/");
                     strcat(path, (de + de_idx)->filename);
+                    inode_close(parent_dir_inode);
                     return 0;
                 }
                 de_idx++;
@@ -1129,6 +1165,7 @@ static int32_t get_child_dir_name(uint32_t p_inode_nr, uint32_t c_inode_nr, char
         }
         block_idx++;
     }
+    inode_close(parent_dir_inode);
     return -1;
 }
 
@@ -1265,3 +1302,15 @@ int32_t sys_stat(const char *path, struct stat *buf)
     dir_close(search_record.parent_dir);
     return ret;
 }
+
+/**
+ * @brief sys_sync将内存中所有尚未写回的元数据写回硬盘. 脏位图扇区在每个操作结束时已经写出,
+ *        这里提交日志中暂存的扇区并做检查点, journal_sync会等正在进行的操作结束
+ *
+ * @return int32_t 总是返回0
+ */
+int32_t sys_sync(void)
+{
+    journal_sync(cur_part);
+    return 0;
+}
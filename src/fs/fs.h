@@ -7,6 +7,7 @@
 #define SECTOR_SIZE 512         // 扇区字节大小
 #define BLOCK_SIZE SECTOR_SIZE  // 块字节大小
 #define MAX_PATH_LEN 512        //  路径最大长度
+#define FS_WRITE_CHUNK 4096     // sys_write每个日志事务最多写入的字节数, 见JOURNAL_OP_CREDITS
 
 // 文件类型
 enum file_types
@@ -52,13 +53,6 @@ struct path_search_record
 
 typedef struct path_search_record path_search_record_t;
 
-/**
- * @brief fd_local2global将进程的文件描述符 转换到文件表下标
- *
- * @param local_fd 文件描述符
- * @return uint32_t 全局文件表的下标
- */
-uint32_t fd_local2global(uint32_t local_fd);
 void filesys_init(void);
 int32_t path_depth_cnt(char *pathname);
 char *path_parse(char *pathname, char *name_store);
@@ -77,6 +71,7 @@ int32_t sys_rmdir(const char *pathname);
 char *sys_getcwd(char *buf, uint32_t size);
 int32_t sys_chdir(const char *path);
 int32_t sys_stat(const char *path, struct stat *buf);
+int32_t sys_sync(void);
 
 extern struct partition *cur_part;
 
@@ -9,9 +9,13 @@
 #include "stdio-kernel.h"
 #include "string.h"
 #include "super_block.h"
+#include "journal.h"
 
 // inode相当于文件描述符，里面有操作文件描述符的资源
 
+/* 保护所有分区的open_inodes链表和inode的i_open_cnts. inode_close只知道inode不知道分区, 所以用一把全局的锁 */
+static struct spinlock open_inodes_lock;
+
 // 用来定位在磁盘上的inode位置
 struct inode_position
 {
@@ -27,7 +31,7 @@ static void inode_locate(struct partition *part, uint32_t inode_no, struct inode
     ASSERT(inode_no < 4096);
     uint32_t inode_table_lba = part->sb->inode_table_lba;
 
-    uint32_t inode_size = sizeof(struct inode);
+    uint32_t inode_size = sizeof(struct disk_inode);
     uint32_t off_size = inode_no * inode_size; // 第inode_no号I结点相对于inode_table_lba的字节偏移量
     uint32_t off_sec = off_size / 512;         // 第inode_no号I结点相对于inode_table_lba的扇区偏移量
     uint32_t off_size_in_sec = off_size % 512; // 待查找的inode所在扇区中的偏移地址
@@ -47,42 +51,67 @@ static void inode_locate(struct partition *part, uint32_t inode_no, struct inode
 void inode_sync(struct partition *part, struct inode *inode, void *io_buf)
 {
     // io_buf是用于硬盘io的缓冲区
-    uint8_t inode_no = inode->i_no;
+    uint32_t inode_no = inode->i_no;
     struct inode_position inode_pos;
     inode_locate(part, inode_no, &inode_pos); // inode位置信息会存入inode_pos
     ASSERT(inode_pos.sec_lba <= (part->start_lba + part->sec_cnt));
 
-    /* 硬盘中的inode中的成员 inode_tag 和 i_open_cnts是不需要的,
-     * 它们只在内存中记录链表位置和被多少进程共享 */
-    struct inode pure_inode;
-    memcpy(&pure_inode, inode, sizeof(struct inode));
-
-    /* 以下inode的三个成员只存在于内存中,现在将inode同步到硬盘,清掉这三项即可 */
-    pure_inode.i_open_cnts = 0;
-    pure_inode.write_deny = false; // 置为false,以保证在硬盘中读出时为可写
-    pure_inode.inode_tag.prev = pure_inode.inode_tag.next = NULL;
+    /* 内存中inode的成员 inode_tag, i_open_cnts, write_deny和间接块缓存是不需要写入硬盘的,
+     * 它们只在内存中记录链表位置和被多少进程共享, 只把硬盘inode需要的成员拷贝出来 */
+    struct disk_inode pure_inode;
+    pure_inode.i_no = inode->i_no;
+    pure_inode.i_size = inode->i_size;
+    pure_inode.i_flags = inode->i_flags;
+    pure_inode.i_parent = inode->i_parent;
+    memcpy(pure_inode.i_sectors, inode->i_sectors, sizeof(pure_inode.i_sectors));
 
     char *inode_buf = (char *)io_buf;
     if (inode_pos.two_sec)
     { // 若是跨了两个扇区,就要读出两个扇区再写入两个扇区
 
         /* 读写硬盘是以扇区为单位,若写入的数据小于一扇区,要将原硬盘上的内容先读出来再和新数据拼成一扇区后再写入  */
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 2); // inode在format中写入硬盘时是连续写入的,所以读入2块扇区
+        journal_read(part, inode_pos.sec_lba, inode_buf, 2); // inode在format中写入硬盘时是连续写入的,所以读入2块扇区
 
         /* 开始将待写入的inode拼入到这2个扇区中的相应位置 */
-        memcpy((inode_buf + inode_pos.off_size), &pure_inode, sizeof(struct inode));
+        memcpy((inode_buf + inode_pos.off_size), &pure_inode, sizeof(struct disk_inode));
 
         /* 将拼接好的数据再写入磁盘 */
-        ide_write(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
+        journal_write(part, inode_pos.sec_lba, inode_buf, 2);
     }
     else
     { // 若只是一个扇区
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
-        memcpy((inode_buf + inode_pos.off_size), &pure_inode, sizeof(struct inode));
-        ide_write(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
+        journal_read(part, inode_pos.sec_lba, inode_buf, 1);
+        memcpy((inode_buf + inode_pos.off_size), &pure_inode, sizeof(struct disk_inode));
+        journal_write(part, inode_pos.sec_lba, inode_buf, 1);
     }
 }
 
+/* 在part的open_inodes链表中查找inode_no, 找到则打开数加1. 调用者须持有open_inodes_lock */
+static struct inode *inode_list_find(struct partition *part, uint32_t inode_no)
+{
+    struct list_elem *elem = part->open_inodes.head.next;
+    while (elem != &part->open_inodes.tail)
+    {
+        struct inode *inode_found = elem2entry(struct inode, inode_tag, elem);
+        if (inode_found->i_no == inode_no)
+        {
+            inode_found->i_open_cnts++;
+            return inode_found;
+        }
+        elem = elem->next;
+    }
+    return NULL;
+}
+
+/* 把新建的inode加入part的open_inodes链表, 打开数为1 */
+void inode_list_add(struct partition *part, struct inode *inode)
+{
+    enum intr_status old_status = spin_lock_irqsave(&open_inodes_lock);
+    list_push(&part->open_inodes, &inode->inode_tag);
+    inode->i_open_cnts = 1;
+    spin_unlock_irqrestore(&open_inodes_lock, old_status);
+}
+
 /**
  * @brief   把文件的inode读入内存
  *          inode_open用于打开partition指向的分区中编号为inode_no的inode. 为了加快文件读取速度, 减少磁盘IO
@@ -97,18 +126,11 @@ void inode_sync(struct partition *part, struct inode *inode, void *io_buf)
 struct inode *inode_open(struct partition *part, uint32_t inode_no)
 {
     // 先在已经打开 inode 链表找inode, 此链表是为提速创建的缓冲区
-    struct list_elem *elem = part->open_inodes.head.next;
-    struct inode *inode_found;
-    while (elem != &part->open_inodes.tail)
-    {
-        inode_found = elem2entry(struct inode, inode_tag, elem);
-        if (inode_found->i_no == inode_no)
-        {
-            inode_found->i_open_cnts++;
-            return inode_found;
-        }
-        elem = elem->next;
-    }
+    enum intr_status old_status = spin_lock_irqsave(&open_inodes_lock);
+    struct inode *inode_found = inode_list_find(part, inode_no);
+    spin_unlock_irqrestore(&open_inodes_lock, old_status);
+    if (inode_found != NULL)
+        return inode_found;
 
     /*由于open_inodes链表中找不到,下面从硬盘上读入此inode并加入到此链表 */
     struct inode_position inode_pos;
@@ -133,21 +155,42 @@ struct inode *inode_open(struct partition *part, uint32_t inode_no)
         inode_buf = (char *)sys_malloc(1024);
         /* i结点表是被partition_format函数连续写入扇区的,
          * 所以下面可以连续读出来 */
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
+        journal_read(part, inode_pos.sec_lba, inode_buf, 2);
     }
     else
     {
         inode_buf = (char *)sys_malloc(512);
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
+        journal_read(part, inode_pos.sec_lba, inode_buf, 1);
     }
 
-    memcpy(inode_found, inode_buf + inode_pos.off_size, sizeof(struct inode));
+    struct disk_inode *d_inode = (struct disk_inode *)(inode_buf + inode_pos.off_size);
+    inode_found->i_no = d_inode->i_no;
+    inode_found->i_size = d_inode->i_size;
+    inode_found->i_flags = d_inode->i_flags;
+    inode_found->i_parent = d_inode->i_parent;
+    memcpy(inode_found->i_sectors, d_inode->i_sectors, sizeof(inode_found->i_sectors));
+    rwlock_init(&inode_found->i_rwlock);
+    lock_init(&inode_found->i_indirect_lock);
+    sys_free(inode_buf);
 
-    /* 因为一会很可能要用到此inode,故将其插入到队首便于提前检索到 */
-    list_push(&part->open_inodes, &inode_found->inode_tag);
-    inode_found->i_open_cnts = 1;
+    /* 读硬盘时会让出cpu, 其间别的任务可能已经打开了同一个inode, 再查一次, 保证每个inode在内存中只有一份 */
+    old_status = spin_lock_irqsave(&open_inodes_lock);
+    struct inode *inode_raced = inode_list_find(part, inode_no);
+    if (inode_raced == NULL)
+    {
+        /* 因为一会很可能要用到此inode,故将其插入到队首便于提前检索到 */
+        list_push(&part->open_inodes, &inode_found->inode_tag);
+        inode_found->i_open_cnts = 1;
+    }
+    spin_unlock_irqrestore(&open_inodes_lock, old_status);
 
-    sys_free(inode_buf);
+    if (inode_raced != NULL)
+    {
+        cur->pgdir = NULL;
+        sys_free(inode_found);
+        cur->pgdir = cur_pagedir_bak;
+        return inode_raced;
+    }
     return inode_found;
 }
 
@@ -155,22 +198,35 @@ struct inode *inode_open(struct partition *part, uint32_t inode_no)
 void inode_close(struct inode *inode)
 {
     // 若没有进程再打开此文件，将此 inode 去掉并释放空间
-    enum intr_status old_status = intr_disable();
-    if (--inode->i_open_cnts == 0)
+    enum intr_status old_status = spin_lock_irqsave(&open_inodes_lock);
+    bool last = (--inode->i_open_cnts == 0);
+    if (last)
     {
         // 将I结点从part->open_inodes中去掉
         list_remove(&inode->inode_tag);
+    }
+    spin_unlock_irqrestore(&open_inodes_lock, old_status);
+
+    // sys_free可能睡眠, 不能持有自旋锁
+    if (last)
+    {
         /* inode_open时为实现inode被所有进程共享,
          * 已经在sys_malloc为inode分配了内核空间,
          * 释放inode时也要确保释放的是内核内存池 */
         struct task_struct *cur = running_thread();
         uint32_t *cur_pagedir_bak = cur->pgdir;
         cur->pgdir = NULL;
+        // 间接块缓存同样位于内核空间
+        uint32_t cache_idx = 0;
+        while (cache_idx < INDIRECT_CACHE_NR)
+        {
+            if (inode->i_indirect[cache_idx] != NULL)
+                sys_free(inode->i_indirect[cache_idx]);
+            cache_idx++;
+        }
         sys_free(inode);
         cur->pgdir = cur_pagedir_bak;
     }
-
-    intr_set_status(old_status);
 }
 
 /* 初始化new_inode */
@@ -178,17 +234,30 @@ void inode_init(uint32_t inode_no, struct inode *new_inode)
 {
     new_inode->i_no = inode_no;
     new_inode->i_size = 0;
+    new_inode->i_flags = 0;
+    new_inode->i_parent = 0;
     new_inode->i_open_cnts = 0;
     new_inode->write_deny = false;
 
     // 初始化块索引素质i_sector
     uint8_t sec_idx = 0;
-    while (sec_idx < 13)
+    while (sec_idx < INODE_BLOCK_PTRS)
     {
-        /* i_sectors[12]为一级间接块地址 */
+        /* i_sectors[12-14]为一, 二, 三级间接块地址 */
         new_inode->i_sectors[sec_idx] = 0;
         sec_idx++;
     }
+
+    // 间接块缓存为空
+    uint32_t cache_idx = 0;
+    while (cache_idx < INDIRECT_CACHE_NR)
+    {
+        new_inode->i_indirect[cache_idx] = NULL;
+        cache_idx++;
+    }
+    new_inode->i_indirect_clock = 0;
+    rwlock_init(&new_inode->i_rwlock);
+    lock_init(&new_inode->i_indirect_lock);
 }
 
 // 在硬盘分区的inode表上, 把inode_no号的inode清空为0 / 清空inode_no号对应的inode实体
@@ -204,74 +273,397 @@ static void inode_delete(struct partition *part, uint32_t inode_no, void *io_buf
     if (inode_pos.two_sec)
     { // inode跨扇区,读入2个扇区
         /* 将原硬盘上的内容先读出来 */
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
+        journal_read(part, inode_pos.sec_lba, inode_buf, 2);
         /* 将inode_buf清0 */
-        memset((inode_buf + inode_pos.off_size), 0, sizeof(struct inode));
+        memset((inode_buf + inode_pos.off_size), 0, sizeof(struct disk_inode));
         /* 用清0的内存数据覆盖磁盘 */
-        ide_write(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
+        journal_write(part, inode_pos.sec_lba, inode_buf, 2);
     }
     else
     { // 未跨扇区,只读入1个扇区就好
         /* 将原硬盘上的内容先读出来 */
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
+        journal_read(part, inode_pos.sec_lba, inode_buf, 1);
         /* 将inode_buf清0 */
-        memset((inode_buf + inode_pos.off_size), 0, sizeof(struct inode));
+        memset((inode_buf + inode_pos.off_size), 0, sizeof(struct disk_inode));
         /* 用清0的内存数据覆盖磁盘 */
-        ide_write(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
+        journal_write(part, inode_pos.sec_lba, inode_buf, 1);
     }
 }
 
+/* 在内核空间中分配内存, 使inode的间接块缓存被所有任务共享 */
+static void *inode_kmalloc(uint32_t size)
+{
+    struct task_struct *cur = running_thread();
+    uint32_t *cur_pagedir_bak = cur->pgdir;
+    cur->pgdir = NULL;
+    void *vaddr = sys_malloc(size);
+    cur->pgdir = cur_pagedir_bak;
+    return vaddr;
+}
+
 /**
- * @description: 依次回收: inode中i_sectors[]中存储的数据块，一级间接索引块表本身的扇区地址(空闲块位图)，inode_table, inode位图
- * @param {partition*} part  需要操作的分区
- * @param {uint32_t} inode_no  inode表下标
+ * @brief indirect_get返回lba处间接块在内存中的内容. 先在inode的间接块缓存中查找,
+ *        找不到时淘汰最久未使用的缓存项, 再从硬盘读入. 返回的表只保证在下一次indirect_get之前有效
+ *
+ * @param part 分区
+ * @param inode 间接块所属的inode
+ * @param lba 间接块的lba地址
+ * @param new_table 为true表示该间接块是刚分配的, 不必读硬盘, 内容直接清0
+ * @return uint32_t* 间接块中的块地址数组, 失败返回NULL
  */
-void inode_release(struct partition *part, uint32_t inode_no)
+static uint32_t *indirect_get(struct partition *part, struct inode *inode, uint32_t lba, bool new_table)
 {
-    struct inode *inode_to_del = inode_open(part, inode_no);
-    ASSERT(inode_to_del->i_no == inode_no);
+    struct indirect_table *table;
+    uint32_t cache_idx = 0;
+    inode->i_indirect_clock++;
 
-    // 收集inode所通向的数据块的地址
-    uint8_t block_idx = 0, block_cnt = 12;
-    uint32_t blocks_bitmap_idx;
-    uint32_t all_blocks[140] = {0};
+    // 1 先在缓存中查找
+    while (cache_idx < INDIRECT_CACHE_NR)
+    {
+        table = inode->i_indirect[cache_idx];
+        if (table != NULL && table->lba == lba)
+        {
+            table->last_use = inode->i_indirect_clock;
+            if (new_table)
+                memset(table->entry, 0, sizeof(table->entry));
+            return table->entry;
+        }
+        cache_idx++;
+    }
 
-    // a. 先把前12个直接块存入 all_blocks
-    while (block_idx < 12)
+    // 2 未命中, 选一个缓存项: 优先用未分配或空闲的, 否则淘汰最久未使用的
+    uint32_t victim_idx = 0;
+    cache_idx = 0;
+    while (cache_idx < INDIRECT_CACHE_NR)
     {
-        all_blocks[block_idx] = inode_to_del->i_sectors[block_idx];
-        block_idx++;
+        table = inode->i_indirect[cache_idx];
+        if (table == NULL || table->lba == 0)
+        {
+            victim_idx = cache_idx;
+            break;
+        }
+        if (table->last_use < inode->i_indirect[victim_idx]->last_use)
+            victim_idx = cache_idx;
+        cache_idx++;
+    }
+
+    struct indirect_table *victim = inode->i_indirect[victim_idx];
+    if (victim == NULL)
+    {
+        victim = (struct indirect_table *)inode_kmalloc(sizeof(struct indirect_table));
+        if (victim == NULL)
+        {
+            printk("indirect_get: sys_malloc for indirect table failed\n");
+            return NULL;
+        }
+        inode->i_indirect[victim_idx] = victim;
+    }
+
+    victim->lba = lba;
+    victim->last_use = inode->i_indirect_clock;
+    if (new_table)
+        memset(victim->entry, 0, sizeof(victim->entry));
+    else
+        journal_read(part, lba, victim->entry, 1);
+    return victim->entry;
+}
+
+/* 间接块lba已被回收, 从inode的缓存中去掉 */
+static void indirect_forget(struct inode *inode, uint32_t lba)
+{
+    uint32_t cache_idx = 0;
+    while (cache_idx < INDIRECT_CACHE_NR && inode->i_indirect[cache_idx] != NULL)
+    {
+        if (inode->i_indirect[cache_idx]->lba == lba)
+            inode->i_indirect[cache_idx]->lba = 0;
+        cache_idx++;
+    }
+}
+
+/* 分配一个块并同步块位图, 失败返回-1 */
+static int32_t bmap_alloc_block(struct partition *part)
+{
+    int32_t block_lba = block_bitmap_alloc(part);
+    if (block_lba == -1)
+        return -1;
+    bitmap_sync(part, block_lba - part->sb->data_start_lba, BLOCK_BITMAP);
+    return block_lba;
+}
+
+/**
+ * @brief bmap_path计算文件的第file_block块在索引树中的位置
+ *
+ * @param file_block 文件内的块号, 必须已经不小于INODE_DIRECT_BLOCKS
+ * @param offsets 依次存放从顶层间接块到最底层间接块中的下标
+ * @return uint32_t 间接的级数1~3, i_sectors[INODE_DIRECT_BLOCKS + 级数 - 1]是顶层间接块
+ */
+static uint32_t bmap_path(uint32_t file_block, uint32_t offsets[3])
+{
+    uint32_t depth;
+    file_block -= INODE_DIRECT_BLOCKS;
+    if (file_block < INODE_SINGLE_BLOCKS)
+        depth = 1;
+    else if ((file_block -= INODE_SINGLE_BLOCKS) < INODE_DOUBLE_BLOCKS)
+        depth = 2;
+    else
+    {
+        file_block -= INODE_DOUBLE_BLOCKS;
+        ASSERT(file_block < INODE_TRIPLE_BLOCKS);
+        depth = 3;
+    }
+
+    // 从最底层往上, 每层取file_block的7位
+    uint32_t level = depth;
+    while (level > 0)
+    {
+        offsets[--level] = file_block % PTRS_PER_BLOCK;
+        file_block /= PTRS_PER_BLOCK;
+    }
+    return depth;
+}
+
+/* bmap中经间接块映射的部分, 参数和返回值同bmap, 调用者须持有inode->i_indirect_lock */
+static int32_t bmap_indirect(struct partition *part, struct inode *inode, uint32_t file_block, bool create)
+{
+    int32_t block_lba;
+    uint32_t offsets[3];
+    uint32_t depth = bmap_path(file_block, offsets);
+    uint32_t *root = &inode->i_sectors[INODE_DIRECT_BLOCKS + depth - 1];
+    bool new_table = false; // 当前这一层间接块是否是刚分配的
+
+    // 顶层间接块
+    if (*root == 0)
+    {
+        if (!create)
+            return 0;
+        block_lba = bmap_alloc_block(part);
+        if (block_lba == -1)
+            return -1;
+        *root = block_lba;
+        new_table = true;
+    }
+
+    uint32_t table_lba = *root;
+    uint32_t level = 0;
+    while (level < depth)
+    {
+        uint32_t *table = indirect_get(part, inode, table_lba, new_table);
+        if (table == NULL)
+            return -1;
+        if (new_table)
+        { // 新分配的间接块先清0写回, 避免其中残留的旧数据被当作块地址
+            journal_write(part, table_lba, table, 1);
+            new_table = false;
+        }
+
+        uint32_t next_lba = table[offsets[level]];
+        if (next_lba == 0)
+        {
+            if (!create)
+                return 0;
+            block_lba = bmap_alloc_block(part);
+            if (block_lba == -1)
+                return -1;
+            next_lba = table[offsets[level]] = block_lba;
+            journal_write(part, table_lba, table, 1);
+            // 除最底层外, 新分配的都是下一层间接块
+            new_table = (level + 1 < depth);
+        }
+        table_lba = next_lba;
+        level++;
+    }
+    return table_lba;
+}
+
+/**
+ * @brief bmap把文件的第file_block块映射为硬盘上的lba地址. 0~11块是直接块, 之后依次经一, 二, 三级间接块索引.
+ *        经过的间接块都缓存在inode中, 同一范围内的块再次映射时不用读硬盘.
+ *        create为true时, 沿途缺少的间接块和数据块都会分配, 修改过的间接块经日志写回, i_sectors的修改需要调用者inode_sync
+ *
+ * @param part inode所在分区
+ * @param inode 文件的inode
+ * @param file_block 文件内的块号
+ * @param create 块不存在时是否分配
+ * @return int32_t 数据块的lba地址; 若块不存在且create为false返回0; 失败返回-1
+ */
+int32_t bmap(struct partition *part, struct inode *inode, uint32_t file_block, bool create)
+{
+    ASSERT(!(inode->i_flags & INODE_INLINE)); // 内联的inode没有数据块
+    if (file_block >= INODE_MAX_BLOCKS)
+        return -1;
+
+    int32_t block_lba;
+    if (file_block < INODE_DIRECT_BLOCKS)
+    {
+        if (inode->i_sectors[file_block] == 0 && create)
+        {
+            block_lba = bmap_alloc_block(part);
+            if (block_lba == -1)
+                return -1;
+            inode->i_sectors[file_block] = block_lba;
+        }
+        return inode->i_sectors[file_block];
+    }
+
+    /* 间接块缓存的查找和替换会修改inode, 多个读者可能同时映射同一个inode, 所以沿索引树查找期间持有i_indirect_lock */
+    lock_acquire(&inode->i_indirect_lock);
+    block_lba = bmap_indirect(part, inode, file_block, create);
+    lock_release(&inode->i_indirect_lock);
+    return block_lba;
+}
+
+/* 判断间接块是否已经没有任何块地址 */
+static bool indirect_empty(uint32_t *table)
+{
+    uint32_t idx = 0;
+    while (idx < PTRS_PER_BLOCK)
+    {
+        if (table[idx] != 0)
+            return false;
+        idx++;
+    }
+    return true;
+}
+
+/**
+ * @brief bmap_clear回收文件的第file_block块, 并把它从索引中去掉. 若某个间接块因此变空, 间接块也一并回收.
+ *        i_sectors的修改需要调用者inode_sync
+ *
+ * @param part inode所在分区
+ * @param inode 文件的inode
+ * @param file_block 文件内的块号
+ */
+void bmap_clear(struct partition *part, struct inode *inode, uint32_t file_block)
+{
+    ASSERT(file_block < INODE_MAX_BLOCKS);
+    if (file_block < INODE_DIRECT_BLOCKS)
+    {
+        if (inode->i_sectors[file_block] != 0)
+        {
+            block_bitmap_free(part, inode->i_sectors[file_block]);
+            inode->i_sectors[file_block] = 0;
+        }
+        return;
     }
-    // b. 如果一级间接块表存在, 将其128个数据块地址读到all_blocks[12~], 并释放一级间接块表所占的扇区
-    if (inode_to_del->i_sectors[12] != 0)
+
+    uint32_t offsets[3];
+    uint32_t path_lba[3]; // 从顶层到底层经过的各间接块
+    uint32_t depth = bmap_path(file_block, offsets);
+    uint32_t *root = &inode->i_sectors[INODE_DIRECT_BLOCKS + depth - 1];
+    uint32_t table_lba = *root;
+    uint32_t level = 0;
+    while (level < depth)
     {
-        ide_read(part->my_disk, inode_to_del->i_sectors[12], all_blocks + 12, 1);
-        block_cnt = 140;
-
-        // 回收一级间接块占用的扇区
-        blocks_bitmap_idx = inode_to_del->i_sectors[12] - part->sb->data_start_lba;
-        ASSERT(blocks_bitmap_idx > 0);
-        bitmap_set(&part->block_bitmap, blocks_bitmap_idx, 0);
-        bitmap_sync(part, blocks_bitmap_idx, BLOCK_BITMAP);
+        if (table_lba == 0)
+            return; // 块本来就不存在
+        uint32_t *table = indirect_get(part, inode, table_lba, false);
+        if (table == NULL)
+            return;
+        path_lba[level] = table_lba;
+        table_lba = table[offsets[level]];
+        level++;
     }
+    if (table_lba == 0)
+        return;
+    block_bitmap_free(part, table_lba);
 
-    // c inode通向的数据块的地址已经收集在了all_blocks中, 下面逐个回收
-    block_idx = 0;
-    while (block_idx < block_cnt)
+    // 从底层往上逐层清除, 间接块清除后仍有其它块地址就写回并停止, 变空就回收后继续清除上一层
+    while (level > 0)
     {
-        if (all_blocks[block_idx] != 0)
+        level--;
+        uint32_t *table = indirect_get(part, inode, path_lba[level], false);
+        if (table == NULL)
+            return;
+        table[offsets[level]] = 0;
+        if (!indirect_empty(table))
         {
-            blocks_bitmap_idx = all_blocks[block_idx] - part->sb->data_start_lba;
+            journal_write(part, path_lba[level], table, 1);
+            return;
+        }
+        indirect_forget(inode, path_lba[level]);
+        block_bitmap_free(part, path_lba[level]);
+    }
+    *root = 0;
+}
+
+/**
+ * @brief indirect_release回收第depth级间接块lba所索引的全部块, 以及它自身
+ *
+ * @param part 分区
+ * @param inode 间接块所属的inode
+ * @param lba 间接块地址
+ * @param depth 1表示其中存放的是数据块地址, 2, 3表示其中存放的是下一级间接块地址
+ */
+static void indirect_release(struct partition *part, struct inode *inode, uint32_t lba, uint32_t depth)
+{
+    // 递归过程中缓存项会被替换, 因此把间接块的内容复制一份
+    uint32_t *table = (uint32_t *)sys_malloc(BLOCK_SIZE);
+    uint32_t *cached = indirect_get(part, inode, lba, false);
+    if (table == NULL || cached == NULL)
+    {
+        printk("indirect_release: can't read indirect block 0x%x, blocks leaked\n", lba);
+        if (table != NULL)
+            sys_free(table);
+        return;
+    }
+    memcpy(table, cached, BLOCK_SIZE);
 
-            ASSERT(blocks_bitmap_idx > 0);
-            bitmap_set(&part->block_bitmap, blocks_bitmap_idx, 0);
-            bitmap_sync(cur_part, blocks_bitmap_idx, BLOCK_BITMAP);
+    uint32_t idx = 0;
+    while (idx < PTRS_PER_BLOCK)
+    {
+        if (table[idx] != 0)
+        {
+            if (depth > 1)
+                indirect_release(part, inode, table[idx], depth - 1);
+            else
+                block_bitmap_free(part, table[idx]);
+        }
+        idx++;
+    }
+    sys_free(table);
+
+    indirect_forget(inode, lba);
+    block_bitmap_free(part, lba);
+}
+
+/**
+ * @description: 依次回收: inode中i_sectors[]中存储的数据块，各级间接块本身的扇区地址(空闲块位图)，inode_table, inode位图.
+ *               调用者须保证没有别的任务在使用此inode: 文件已不在使用中, 或目录的写锁已被调用者持有
+ * @param {partition*} part  需要操作的分区
+ * @param {uint32_t} inode_no  inode表下标
+ */
+void inode_release(struct partition *part, uint32_t inode_no)
+{
+    struct inode *inode_to_del = inode_open(part, inode_no);
+    ASSERT(inode_to_del->i_no == inode_no);
+
+    // 1 回收inode通向的所有数据块和间接块, 数据内联在inode中时没有块需要回收
+    uint32_t block_idx = 0;
+    while (!(inode_to_del->i_flags & INODE_INLINE) && block_idx < INODE_DIRECT_BLOCKS)
+    {
+        if (inode_to_del->i_sectors[block_idx] != 0)
+        {
+            ASSERT(inode_to_del->i_sectors[block_idx] > part->sb->data_start_lba);
+            block_bitmap_free(part, inode_to_del->i_sectors[block_idx]);
+            inode_to_del->i_sectors[block_idx] = 0;
         }
         block_idx++;
     }
+    // i_sectors[12], [13], [14]分别是1, 2, 3级间接块
+    uint32_t depth = 1;
+    while (!(inode_to_del->i_flags & INODE_INLINE) && depth <= 3)
+    {
+        block_idx = INODE_DIRECT_BLOCKS + depth - 1;
+        if (inode_to_del->i_sectors[block_idx] != 0)
+        {
+            indirect_release(part, inode_to_del, inode_to_del->i_sectors[block_idx], depth);
+            inode_to_del->i_sectors[block_idx] = 0;
+        }
+        depth++;
+    }
 
     // 2 在inode位图中 回收inode
-    bitmap_set(&part->inode_bitmap, inode_no, 0);
+    bitmap_free(part, inode_no, INODE_BITMAP);
     bitmap_sync(cur_part, inode_no, INODE_BITMAP);
 
     /******     以下inode_delete是调试用的    ******
@@ -4,7 +4,47 @@
 #include "list.h"
 #include "ide.h"
 
-// inode结构,文件最大支持140个扇区, 70MB
+#define INODE_DIRECT_BLOCKS 12                      // 直接块个数
+#define INODE_BLOCK_PTRS 15                         // i_sectors的元素个数
+#define PTRS_PER_BLOCK (512 / sizeof(uint32_t))     // 一个间接块中可以存放的块地址个数, 128
+#define INODE_SINGLE_BLOCKS (PTRS_PER_BLOCK)                                     // 一级间接块能索引的块数
+#define INODE_DOUBLE_BLOCKS (PTRS_PER_BLOCK * PTRS_PER_BLOCK)                    // 二级间接块能索引的块数
+#define INODE_TRIPLE_BLOCKS (PTRS_PER_BLOCK * PTRS_PER_BLOCK * PTRS_PER_BLOCK)   // 三级间接块能索引的块数
+// 文件最多能使用的数据块数, 12 + 128 + 128^2 + 128^3 = 2113676块, 约1GB
+#define INODE_MAX_BLOCKS (INODE_DIRECT_BLOCKS + INODE_SINGLE_BLOCKS + INODE_DOUBLE_BLOCKS + INODE_TRIPLE_BLOCKS)
+// 目录最多使用的数据块数, 目录只使用直接块和一级间接块, 遍历目录项时只需检查这140个块
+#define DIR_MAX_BLOCKS (INODE_DIRECT_BLOCKS + INODE_SINGLE_BLOCKS)
+
+#define INODE_INLINE 0x1                            // i_flags: 数据内联存放在i_sectors中, 不占用数据块
+#define INODE_INLINE_SIZE (INODE_BLOCK_PTRS * sizeof(uint32_t)) // 内联数据的最大字节数, 60
+
+#define INDIRECT_CACHE_NR 4 // 每个打开的inode缓存的间接块个数, 三级间接块一次映射要用到3个
+
+/**
+ * 硬盘上的inode, 76字节.
+ * 与旧版本的布局兼容: 旧版本直接把内存中的struct inode写入硬盘, i_open_cnts和write_deny写入时总是清0,
+ * inode_tag的两个指针写入时也被清为NULL, 所以旧分区上i_flags为0, i_sectors[13], i_sectors[14]也为0
+ */
+struct disk_inode
+{
+    uint32_t i_no;
+    uint32_t i_size;
+    uint32_t i_flags;  // 文件标志, INODE_XXX
+    uint32_t i_parent; // 内联目录的父目录inode编号, 即目录项".."; 其它情况为0
+    /* i_sectors[0-11]是直接块, i_sectors[12]是一级间接块, i_sectors[13]是二级间接块, i_sectors[14]是三级间接块.
+     * 设置了INODE_INLINE时, i_sectors整个用来存放文件数据(普通文件), 或除"."和".."外的目录项(目录) */
+    uint32_t i_sectors[INODE_BLOCK_PTRS];
+};
+
+// 内存中缓存的一个间接块
+struct indirect_table
+{
+    uint32_t lba;      // 间接块的lba地址, 0表示该缓存项空闲
+    uint32_t last_use; // 最近一次使用的时间, 用于LRU替换
+    uint32_t entry[PTRS_PER_BLOCK];
+};
+
+// 内存中的inode结构
 struct inode
 {
     uint32_t i_no; // inode 编号
@@ -12,17 +52,31 @@ struct inode
     /* 当此inode是文件时,i_size是指文件大小,
     若此inode是目录,i_size是指该目录下所有目录项大小之和*/
     uint32_t i_size;
+    uint32_t i_flags;  // 文件标志
+    uint32_t i_parent; // 同struct disk_inode
 
     uint32_t i_open_cnts; // 记录此文件被打开的次数
     bool write_deny;      // 写文件不能并行, 进程写文件前检查此标志
 
-    uint32_t i_sectors[13]; /* i_sectors[0-11]是直接块, i_sectors[12]用来存储一级间接块指针 */
+    uint32_t i_sectors[INODE_BLOCK_PTRS]; // 同struct disk_inode
     struct list_elem inode_tag;
+
+    /* 间接块缓存, 映射过一次的间接块常驻内存, 以后映射同一范围的块不再需要读硬盘.
+     * 缓存项在第一次使用时才分配, inode关闭时释放 */
+    struct indirect_table *i_indirect[INDIRECT_CACHE_NR];
+    uint32_t i_indirect_clock; // LRU时钟, 每访问一次缓存加1
+    struct lock i_indirect_lock; // 保护间接块缓存, 持有读锁的多个任务可能同时映射块
+
+    /* 读写锁: 查找目录项, 读目录和读文件持有读锁, 可以并行; 增删目录项, 写文件持有写锁 */
+    struct rwlock i_rwlock;
 };
 typedef struct inode inode_t;
 struct inode *inode_open(struct partition *part, uint32_t inode_no);
+void inode_list_add(struct partition *part, struct inode *inode);
 void inode_sync(struct partition *part, struct inode *inode, void *io_buf);
 void inode_init(uint32_t inode_no, struct inode *new_inode);
 void inode_close(struct inode *inode);
 void inode_release(struct partition *part, uint32_t inode_no);
-#endif
\ No newline at end of file
+int32_t bmap(struct partition *part, struct inode *inode, uint32_t file_block, bool create);
+void bmap_clear(struct partition *part, struct inode *inode, uint32_t file_block);
+#endif
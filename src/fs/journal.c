@@ -0,0 +1,737 @@
+#include "journal.h"
+#include "fs.h"
+#include "super_block.h"
+#include "stdio-kernel.h"
+#include "memory.h"
+#include "debug.h"
+#include "string.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "global.h"
+#ifdef JOURNAL_CRASH_TEST
+#include "inode.h"
+#include "dir.h"
+#include "file.h"
+#include "stdio.h"
+#endif
+
+#ifdef JOURNAL_CRASH_TEST
+// 崩溃注入点, 只在测试日志恢复时设置
+enum journal_crash_point journal_crash_point = JOURNAL_CRASH_NONE;
+#endif
+
+/**
+ * @brief journal_kmalloc在内核堆中分配内存. 日志中暂存的扇区在所有进程之间共享,
+ *        因此和inode一样, 需要临时将当前任务的pgdir置为NULL, 使sys_malloc从内核内存池分配
+ *
+ * @param size 需要分配的字节数
+ * @return void* 分配到的内存, 失败返回NULL
+ */
+static void *journal_kmalloc(uint32_t size)
+{
+    struct task_struct *cur = running_thread();
+    uint32_t *cur_pagedir_bak = cur->pgdir;
+    cur->pgdir = NULL;
+    void *addr = sys_malloc(size);
+    cur->pgdir = cur_pagedir_bak;
+    return addr;
+}
+
+/* 释放journal_kmalloc分配的内存 */
+static void journal_kfree(void *addr)
+{
+    struct task_struct *cur = running_thread();
+    uint32_t *cur_pagedir_bak = cur->pgdir;
+    cur->pgdir = NULL;
+    sys_free(addr);
+    cur->pgdir = cur_pagedir_bak;
+}
+
+#ifdef JOURNAL_CRASH_TEST
+/* 模拟掉电: 关中断停机, 此后的磁盘写入都不会发生 */
+static void journal_crash(const char *where)
+{
+    intr_disable();
+    printk("journal: crash injected %s, reboot to recover\n", where);
+    while (1)
+        asm volatile("hlt");
+}
+#endif
+
+/* 在plist中找到lba对应的暂存扇区, 找不到返回NULL */
+static struct journal_buf *journal_find(struct list *plist, uint32_t lba)
+{
+    struct list_elem *elem = plist->head.next;
+    while (elem != &plist->tail)
+    {
+        struct journal_buf *jb = elem2entry(struct journal_buf, buf_tag, elem);
+        if (jb->lba == lba)
+            return jb;
+        elem = elem->next;
+    }
+    return NULL;
+}
+
+/* 查找lba对应的最新暂存扇区: 未提交的比正在提交的新, 正在提交的比等待检查点的新 */
+static struct journal_buf *journal_lookup(struct journal *j, uint32_t lba)
+{
+    struct journal_buf *jb = journal_find(&j->running, lba);
+    if (jb == NULL)
+        jb = journal_find(&j->committing, lba);
+    if (jb == NULL)
+        jb = journal_find(&j->checkpoint, lba);
+    return jb;
+}
+
+/* 计算一条提交记录的校验和, buf指向描述块, 其后紧跟nr_blocks个数据扇区 */
+static uint32_t journal_checksum(void *buf, uint32_t nr_blocks, uint32_t seq)
+{
+    uint32_t *word = (uint32_t *)buf;
+    uint32_t cnt = (nr_blocks + 1) * (SECTOR_SIZE / 4);
+    uint32_t sum = seq;
+    while (cnt--)
+    {
+        sum = (sum << 1 | sum >> 31) ^ *word;
+        word++;
+    }
+    return sum;
+}
+
+/* 将日志超级块写入硬盘, start_seq之前的提交记录全部作废 */
+static void journal_write_super(struct partition *part, uint32_t start_seq)
+{
+    struct journal *j = part->journal;
+    struct journal_super *js = (struct journal_super *)journal_kmalloc(SECTOR_SIZE);
+    if (js == NULL)
+        PANIC("journal: alloc memory failed!");
+    js->magic = JOURNAL_MAGIC;
+    js->type = JOURNAL_SUPER;
+    js->start_seq = start_seq;
+    ide_write(part->my_disk, j->lba, js, 1);
+    journal_kfree(js);
+}
+
+/* 记录一个已释放但在日志区中还有旧内容的块, 检查点之前不能重新分配 */
+static void journal_hold_freed(struct journal *j, uint32_t lba)
+{
+    enum intr_status old_status = intr_disable();
+    ASSERT(j->freed_cnt < JOURNAL_SECTS);
+    j->freed[j->freed_cnt++] = lba;
+    intr_set_status(old_status);
+}
+
+/* 检查点之后, 已提交的事务释放的块不会再被重放覆盖, 可以重新分配了 */
+static void journal_release_freed(struct journal *j)
+{
+    enum intr_status old_status = intr_disable();
+    uint32_t idx = 0;
+    while (j->freed_committed + idx < j->freed_cnt)
+    {
+        j->freed[idx] = j->freed[j->freed_committed + idx];
+        idx++;
+    }
+    j->freed_cnt = idx;
+    j->freed_committed = 0;
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief journal_mask_freed在分配块时调用: 先把检查点之前不能重新分配的块在块位图中置1, 使查找空闲位时跳过它们,
+ *        找到空闲块后再清0恢复. 调用者须持有part->bitmap_lock的写锁
+ *
+ * @param part 分配块的分区
+ * @param value 1表示屏蔽, 0表示恢复
+ */
+void journal_mask_freed(struct partition *part, uint8_t value)
+{
+    struct journal *j = part->journal;
+    if (j == NULL)
+        return;
+    enum intr_status old_status = intr_disable();
+    uint32_t idx = 0;
+    while (idx < j->freed_cnt)
+    {
+        bitmap_set(&part->block_bitmap, j->freed[idx] - part->sb->data_start_lba, value);
+        idx++;
+    }
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief journal_recover在挂载分区时调用, 为分区建立日志, 并重放日志区中所有完整的提交记录.
+ *        提交块不完整或校验和不对的记录以及其后的记录都被丢弃, 它们对应的事务在崩溃前还没有提交.
+ *        若某个lba在后面的提交记录中被撤销了, 则前面记录中该lba的内容不再写回
+ *
+ * @param part 挂载的分区
+ */
+void journal_recover(struct partition *part)
+{
+    struct super_block *sb = part->sb;
+    part->journal = NULL;
+    if (!(sb->features & FS_FEAT_JOURNAL))
+    {
+        printk("%s: no journal, metadata is written synchronously\n", part->name);
+        return;
+    }
+    // 一次删除操作的修改必须能放进一次提交, 块位图过大的分区不使用日志
+    if (JOURNAL_RELEASE_CREDITS(sb) > JOURNAL_MAX_BLOCKS)
+    {
+        printk("%s: block bitmap too large for journal, metadata is written synchronously\n", part->name);
+        return;
+    }
+
+    struct journal *j = (struct journal *)journal_kmalloc(sizeof(struct journal));
+    if (j == NULL)
+        PANIC("journal: alloc memory failed!");
+    memset(j, 0, sizeof(struct journal));
+    j->lba = sb->journal_lba;
+    j->sects = sb->journal_sects;
+    list_init(&j->running);
+    list_init(&j->committing);
+    list_init(&j->checkpoint);
+    rwlock_init(&j->updates);
+    part->journal = j;
+
+    // 把整个日志区读入内存, 在内存中解析
+    uint8_t *log = (uint8_t *)journal_kmalloc(j->sects * SECTOR_SIZE);
+    if (log == NULL)
+        PANIC("journal: alloc memory failed!");
+    ide_read(part->my_disk, j->lba, log, j->sects);
+
+    struct journal_super *js = (struct journal_super *)log;
+    if (js->magic != JOURNAL_MAGIC || js->type != JOURNAL_SUPER)
+    { // 新格式化的分区, 日志区还未初始化
+        j->seq = 1;
+        j->head = 1;
+        journal_write_super(part, j->seq);
+        journal_kfree(log);
+        printk("%s: journal created\n", part->name);
+        return;
+    }
+
+    /* 1 扫描日志区, 找出所有完整的提交记录, 统计撤销记录数 */
+    uint32_t seq = js->start_seq;
+    uint32_t pos = 1, trans = 0, revokes = 0;
+    while (pos + 2 <= j->sects)
+    {
+        struct journal_desc *jd = (struct journal_desc *)(log + pos * SECTOR_SIZE);
+        if (jd->magic != JOURNAL_MAGIC || jd->type != JOURNAL_DESC || jd->seq != seq ||
+            jd->nr_blocks > JOURNAL_MAX_BLOCKS || jd->nr_blocks + jd->nr_revoke > JOURNAL_DESC_SLOTS ||
+            pos + jd->nr_blocks + 2 > j->sects)
+            break;
+        struct journal_commit *jc = (struct journal_commit *)(log + (pos + jd->nr_blocks + 1) * SECTOR_SIZE);
+        if (jc->magic != JOURNAL_MAGIC || jc->type != JOURNAL_COMMIT || jc->seq != seq ||
+            jc->nr_blocks != jd->nr_blocks || jc->checksum != journal_checksum(jd, jd->nr_blocks, seq))
+            break;
+        revokes += jd->nr_revoke;
+        pos += jd->nr_blocks + 2;
+        seq++;
+        trans++;
+    }
+    uint32_t log_end = pos;
+
+    /* 2 收集撤销记录: 撤销了哪个lba, 在第几条记录中撤销 */
+    uint32_t *revoke_lba = NULL, *revoke_seq = NULL;
+    if (revokes)
+    {
+        revoke_lba = (uint32_t *)journal_kmalloc(revokes * 8);
+        if (revoke_lba == NULL)
+            PANIC("journal: alloc memory failed!");
+        revoke_seq = revoke_lba + revokes;
+    }
+    uint32_t revoke_idx = 0;
+    pos = 1;
+    while (pos < log_end)
+    {
+        struct journal_desc *jd = (struct journal_desc *)(log + pos * SECTOR_SIZE);
+        uint32_t idx = 0;
+        while (idx < jd->nr_revoke)
+        {
+            revoke_lba[revoke_idx] = jd->lba[jd->nr_blocks + idx];
+            revoke_seq[revoke_idx++] = jd->seq;
+            idx++;
+        }
+        pos += jd->nr_blocks + 2;
+    }
+
+    /* 3 按提交顺序把各扇区写回原位置, 后面的记录覆盖前面的 */
+    uint32_t replayed = 0;
+    pos = 1;
+    while (pos < log_end)
+    {
+        struct journal_desc *jd = (struct journal_desc *)(log + pos * SECTOR_SIZE);
+        uint32_t blk = 0;
+        while (blk < jd->nr_blocks)
+        {
+            uint32_t lba = jd->lba[blk];
+            bool revoked = false;
+            uint32_t idx = 0;
+            while (idx < revokes)
+            {
+                if (revoke_lba[idx] == lba && revoke_seq[idx] >= jd->seq)
+                {
+                    revoked = true;
+                    break;
+                }
+                idx++;
+            }
+            if (!revoked)
+            {
+                ide_write(part->my_disk, lba, log + (pos + 1 + blk) * SECTOR_SIZE, 1);
+                replayed++;
+            }
+            blk++;
+        }
+        pos += jd->nr_blocks + 2;
+    }
+
+    /* 4 日志中的内容都已经写回, 日志区从头开始使用 */
+    j->seq = seq;
+    j->head = 1;
+    if (trans)
+    {
+        journal_write_super(part, j->seq);
+        printk("%s: journal replayed %d transactions, %d sectors\n", part->name, trans, replayed);
+    }
+
+    if (revoke_lba)
+        journal_kfree(revoke_lba);
+    journal_kfree(log);
+}
+
+/**
+ * @brief journal_begin开始一个事务, 为它预留credits个扇区. 运行中的复合事务放不下时先提交它.
+ *        事务不能嵌套, 也不能在持有文件系统的其它锁时开始
+ *
+ * @param part 操作的分区
+ * @param credits 本事务最多修改的元数据扇区数, 不超过JOURNAL_MAX_BLOCKS
+ */
+void journal_begin(struct partition *part, uint32_t credits)
+{
+    struct journal *j = part->journal;
+    if (j == NULL)
+        return;
+    ASSERT(credits <= JOURNAL_MAX_BLOCKS);
+    while (1)
+    {
+        // 提交期间持有写锁, 新的事务在这里等待
+        read_lock(&j->updates);
+        enum intr_status old_status = intr_disable();
+        // 已开始的事务已写入的扇区同时计在running_cnt和reserved中, 估计偏大但不会超出
+        if (j->running_cnt + j->reserved + credits <= JOURNAL_MAX_BLOCKS)
+        {
+            j->reserved += credits;
+            intr_set_status(old_status);
+            return;
+        }
+        intr_set_status(old_status);
+        read_unlock(&j->updates);
+        journal_commit(part);
+    }
+}
+
+/**
+ * @brief journal_end结束一个事务. 事务中的修改此时还在内存中, 累积JOURNAL_GROUP_TRANS个事务后成组提交
+ *
+ * @param part 操作的分区
+ * @param credits journal_begin时预留的扇区数
+ */
+void journal_end(struct partition *part, uint32_t credits)
+{
+    struct journal *j = part->journal;
+    if (j == NULL)
+        return;
+    enum intr_status old_status = intr_disable();
+    ASSERT(j->reserved >= credits);
+    j->reserved -= credits;
+    j->stat_trans++;
+    bool commit = ++j->trans_cnt >= JOURNAL_GROUP_TRANS;
+    intr_set_status(old_status);
+    read_unlock(&j->updates);
+    if (commit)
+        journal_commit(part);
+}
+
+/**
+ * @brief journal_read读取元数据扇区. 若扇区的新内容还暂存在日志中, 则从日志中取, 否则从硬盘读
+ *
+ * @param part 操作的分区
+ * @param lba 起始扇区
+ * @param buf 读出数据存放的缓冲区
+ * @param sec_cnt 读取的扇区数
+ */
+void journal_read(struct partition *part, uint32_t lba, void *buf, uint32_t sec_cnt)
+{
+    struct journal *j = part->journal;
+    if (j == NULL)
+    {
+        ide_read(part->my_disk, lba, buf, sec_cnt);
+        return;
+    }
+
+    // 先整体从硬盘读出, 再用日志中较新的内容覆盖
+    ide_read(part->my_disk, lba, buf, sec_cnt);
+    uint32_t idx = 0;
+    while (idx < sec_cnt)
+    {
+        struct journal_buf *jb = journal_lookup(j, lba + idx);
+        if (jb != NULL)
+            memcpy((uint8_t *)buf + idx * SECTOR_SIZE, jb->data, SECTOR_SIZE);
+        idx++;
+    }
+}
+
+/**
+ * @brief journal_write写入元数据扇区. 新内容暂存在当前事务中, 提交后再写入日志, 检查点时才写回原位置
+ *
+ * @param part 操作的分区
+ * @param lba 起始扇区
+ * @param buf 要写入的数据
+ * @param sec_cnt 写入的扇区数
+ */
+void journal_write(struct partition *part, uint32_t lba, void *buf, uint32_t sec_cnt)
+{
+    struct journal *j = part->journal;
+    if (j == NULL)
+    {
+        ide_write(part->my_disk, lba, buf, sec_cnt);
+        return;
+    }
+
+    uint32_t idx = 0;
+    while (idx < sec_cnt)
+    {
+        struct journal_buf *jb = journal_find(&j->running, lba + idx);
+        if (jb == NULL)
+        {
+            // journal_begin预留过, 一次提交一定放得下
+            ASSERT(j->running_cnt < JOURNAL_MAX_BLOCKS);
+            jb = (struct journal_buf *)journal_kmalloc(sizeof(struct journal_buf));
+            if (jb == NULL)
+                PANIC("journal: alloc memory failed!");
+            jb->lba = lba + idx;
+            list_append(&j->running, &jb->buf_tag);
+            j->running_cnt++;
+        }
+        memcpy(jb->data, (uint8_t *)buf + idx * SECTOR_SIZE, SECTOR_SIZE);
+        idx++;
+    }
+}
+
+/**
+ * @brief journal_revoke在释放一个块时调用, 须在块位图中清0之前调用. 块被释放后可能作为普通文件的数据块直接写入,
+ *        因此日志中暂存的该块旧内容不能再写回. 若旧内容已经写入日志区, 重放时还会被写回,
+ *        所以该块要等到检查点使日志区作废后才能重新分配
+ *
+ * @param part 操作的分区
+ * @param lba 被释放的块
+ */
+void journal_revoke(struct partition *part, uint32_t lba)
+{
+    struct journal *j = part->journal;
+    if (j == NULL)
+        return;
+
+    struct journal_buf *jb = journal_find(&j->running, lba);
+    if (jb != NULL)
+    { // 还没有提交过的, 直接丢弃即可
+        list_remove(&jb->buf_tag);
+        j->running_cnt--;
+        journal_kfree(jb);
+    }
+
+    // 事务中不会遇到提交和检查点, 已写入日志区的旧内容都在checkpoint中
+    jb = journal_find(&j->checkpoint, lba);
+    if (jb != NULL)
+    {
+        list_remove(&jb->buf_tag);
+        j->checkpoint_cnt--;
+        journal_kfree(jb);
+        journal_hold_freed(j, lba);
+    }
+}
+
+/* 将jb按lba从小到大插入检查点队列, 使检查点尽量顺序写盘, 同一lba旧的内容被替换 */
+static void journal_checkpoint_insert(struct journal *j, struct journal_buf *jb)
+{
+    struct list_elem *elem = j->checkpoint.head.next;
+    while (elem != &j->checkpoint.tail)
+    {
+        struct journal_buf *old = elem2entry(struct journal_buf, buf_tag, elem);
+        if (old->lba == jb->lba)
+        {
+            list_insert_before(elem, &jb->buf_tag);
+            list_remove(&old->buf_tag);
+            journal_kfree(old);
+            return;
+        }
+        if (old->lba > jb->lba)
+            break;
+        elem = elem->next;
+    }
+    list_insert_before(elem, &jb->buf_tag);
+    j->checkpoint_cnt++;
+}
+
+static void journal_do_checkpoint(struct partition *part);
+
+/* 把运行中的复合事务写入日志, 见journal_commit. 调用者须持有updates的写锁 */
+static void journal_do_commit(struct partition *part)
+{
+    struct journal *j = part->journal;
+    if (j->running_cnt == 0)
+    {
+        j->trans_cnt = 0;
+        return;
+    }
+
+    uint32_t nr_blocks = j->running_cnt;
+    uint32_t log_sects = nr_blocks + 2;
+    // 日志区剩余空间不够, 先做检查点腾出日志区
+    if (j->head + log_sects > j->sects)
+        journal_do_checkpoint(part);
+    ASSERT(j->head + log_sects <= j->sects);
+
+    uint8_t *log = (uint8_t *)journal_kmalloc(log_sects * SECTOR_SIZE);
+    if (log == NULL)
+        PANIC("journal: alloc memory failed!");
+    memset(log, 0, SECTOR_SIZE);
+    struct journal_desc *jd = (struct journal_desc *)log;
+    jd->magic = JOURNAL_MAGIC;
+    jd->type = JOURNAL_DESC;
+    jd->seq = j->seq;
+    jd->nr_blocks = nr_blocks;
+    jd->nr_revoke = 0;
+    uint32_t freed_cnt = j->freed_cnt; // 此前释放的块都属于本次提交的事务
+
+    // 运行中的事务整体转入committing队列, 写日志期间读元数据的任务仍能从中找到最新内容
+    uint32_t blk = 0;
+    while (!list_empty(&j->running))
+    {
+        struct journal_buf *jb = elem2entry(struct journal_buf, buf_tag, list_pop(&j->running));
+        jd->lba[blk] = jb->lba;
+        memcpy(log + (blk + 1) * SECTOR_SIZE, jb->data, SECTOR_SIZE);
+        list_append(&j->committing, &jb->buf_tag);
+        blk++;
+    }
+    j->running_cnt = 0;
+    j->trans_cnt = 0;
+
+    struct journal_commit *jc = (struct journal_commit *)(log + (nr_blocks + 1) * SECTOR_SIZE);
+    memset(jc, 0, SECTOR_SIZE);
+    jc->magic = JOURNAL_MAGIC;
+    jc->type = JOURNAL_COMMIT;
+    jc->seq = j->seq;
+    jc->nr_blocks = nr_blocks;
+    jc->checksum = journal_checksum(jd, nr_blocks, j->seq);
+
+#ifdef JOURNAL_CRASH_TEST
+    if (journal_crash_point == JOURNAL_CRASH_BEFORE_COMMIT)
+    {
+        ide_write(part->my_disk, j->lba + j->head, log, log_sects - 1);
+        journal_crash("before commit block");
+    }
+#endif
+    ide_write(part->my_disk, j->lba + j->head, log, log_sects);
+#ifdef JOURNAL_CRASH_TEST
+    if (journal_crash_point == JOURNAL_CRASH_AFTER_COMMIT)
+        journal_crash("after commit");
+#endif
+
+    j->head += log_sects;
+    j->seq++;
+    j->freed_committed = freed_cnt;
+    j->stat_commits++;
+    j->stat_log_sects += log_sects;
+
+    // 已提交的扇区等待检查点写回原位置
+    while (!list_empty(&j->committing))
+    {
+        struct journal_buf *jb = elem2entry(struct journal_buf, buf_tag, list_pop(&j->committing));
+        journal_checkpoint_insert(j, jb);
+    }
+    journal_kfree(log);
+}
+
+/**
+ * @brief journal_commit把运行中的复合事务(包含一个或多个系统调用的修改)写入日志.
+ *        描述块, 所有修改过的扇区和提交块由一次ide_write顺序写入, 提交块落盘后这些修改才算持久化.
+ *        提交前等已开始的事务全部结束, 提交期间新的事务不能开始
+ *
+ * @param part 操作的分区
+ */
+void journal_commit(struct partition *part)
+{
+    struct journal *j = part->journal;
+    if (j == NULL)
+        return;
+    write_lock(&j->updates);
+    journal_do_commit(part);
+    write_unlock(&j->updates);
+}
+
+/**
+ * @brief journal_do_checkpoint把所有已提交的扇区写回原位置, 然后重置日志区.
+ *        在日志区写满或journal_sync时调用, 调用者须持有updates的写锁
+ *
+ * @param part 操作的分区
+ */
+static void journal_do_checkpoint(struct partition *part)
+{
+    struct journal *j = part->journal;
+    uint32_t written = 0;
+    struct list_elem *elem = j->checkpoint.head.next;
+    while (elem != &j->checkpoint.tail)
+    {
+        struct journal_buf *jb = elem2entry(struct journal_buf, buf_tag, elem);
+        ide_write(part->my_disk, jb->lba, jb->data, 1);
+        written++;
+#ifdef JOURNAL_CRASH_TEST
+        if (journal_crash_point == JOURNAL_CRASH_MID_CHECKPOINT && written == j->checkpoint_cnt / 2 + 1)
+            journal_crash("in the middle of checkpoint");
+#endif
+        elem = elem->next;
+    }
+    while (!list_empty(&j->checkpoint))
+        journal_kfree(elem2entry(struct journal_buf, buf_tag, list_pop(&j->checkpoint)));
+    j->checkpoint_cnt = 0;
+
+    // 日志中已提交的记录都写回了, 之后从日志区第1扇区重新开始
+    j->head = 1;
+    journal_write_super(part, j->seq);
+    journal_release_freed(j);
+    j->stat_checkpoints++;
+    j->stat_home_sects += written;
+}
+
+/**
+ * @brief journal_sync提交运行中的事务并做检查点, 返回后所有元数据修改都已写回原位置
+ *
+ * @param part 操作的分区
+ */
+void journal_sync(struct partition *part)
+{
+    struct journal *j = part->journal;
+    if (j == NULL)
+        return;
+    write_lock(&j->updates);
+    journal_do_commit(part);
+    journal_do_checkpoint(part);
+    write_unlock(&j->updates);
+}
+
+/**
+ * @brief journal_report打印日志的统计信息
+ *
+ * @param part 分区
+ */
+void journal_report(struct partition *part)
+{
+    struct journal *j = part->journal;
+    if (j == NULL)
+    {
+        printk("%s journal: disabled\n", part->name);
+        return;
+    }
+    printk("%s journal: %d transactions, %d commits, %d log sectors, %d checkpoints, %d home sectors, %d pending\n",
+           part->name, j->stat_trans, j->stat_commits, j->stat_log_sects, j->stat_checkpoints,
+           j->stat_home_sects, j->running_cnt + j->checkpoint_cnt);
+}
+
+#ifdef JOURNAL_CRASH_TEST
+/**
+ * @brief journal_check_dir检查目录inode_no下的所有目录项: 目录项指向的inode必须已在inode位图中分配,
+ *        inode使用的所有块必须已在块位图中分配. 子目录递归检查
+ *
+ * @return uint32_t 发现的错误数
+ */
+static uint32_t journal_check_dir(struct partition *part, uint32_t inode_no, uint32_t depth)
+{
+    uint32_t errors = 0;
+    struct dir *dir = dir_open(part, inode_no);
+    struct dir_entry *de;
+    while ((de = dir_read(dir)) != NULL)
+    {
+        if (!strcmp(de->filename, ".") || !strcmp(de->filename, ".."))
+            continue;
+        read_lock(&part->bitmap_lock);
+        bool allocated = bitmap_scan_test(&part->inode_bitmap, de->i_no);
+        read_unlock(&part->bitmap_lock);
+        if (!allocated)
+        {
+            printk("fsck: %s -> inode %d not allocated\n", de->filename, de->i_no);
+            errors++;
+            continue;
+        }
+        struct inode *inode = inode_open(part, de->i_no);
+        // 目录检查全部可能的块, 普通文件只检查i_size范围内的块
+        uint32_t block_cnt = DIR_MAX_BLOCKS;
+        if (de->f_type == FT_REGULAR)
+            block_cnt = DIV_ROUND_UP(inode->i_size, BLOCK_SIZE);
+        if (inode->i_flags & INODE_INLINE)
+            block_cnt = 0; // 数据内联在inode中, 没有数据块
+        uint32_t idx = 0;
+        read_lock(&inode->i_rwlock);
+        while (idx < block_cnt)
+        {
+            int32_t lba = bmap(part, inode, idx, false);
+            read_lock(&part->bitmap_lock);
+            if (lba > 0 && !bitmap_scan_test(&part->block_bitmap, lba - part->sb->data_start_lba))
+            {
+                printk("fsck: %s block %d (lba 0x%x) not allocated\n", de->filename, idx, lba);
+                errors++;
+            }
+            read_unlock(&part->bitmap_lock);
+            idx++;
+        }
+        read_unlock(&inode->i_rwlock);
+        inode_close(inode);
+        if (de->f_type == FT_DIRECTORY && depth < 16)
+        {
+            errors += journal_check_dir(part, de->i_no, depth + 1);
+        }
+    }
+    dir_close(dir);
+    return errors;
+}
+
+/**
+ * @brief journal_crash_test是日志的崩溃注入测试.
+ *        point不为JOURNAL_CRASH_NONE时, 在/jtest下做一组会修改元数据的操作, 然后在提交或检查点的指定位置模拟掉电;
+ *        重启后(point为JOURNAL_CRASH_NONE)挂载分区时会重放日志, 再检查文件系统元数据是否一致.
+ *        用make JOURNAL_CRASH_TEST=<崩溃点编号>构建即可启用, 正常构建的内核不含这些代码
+ *
+ * @param point 崩溃注入点
+ */
+void journal_crash_test(enum journal_crash_point point)
+{
+    if (point == JOURNAL_CRASH_NONE)
+    {
+        uint32_t errors = journal_check_dir(cur_part, cur_part->sb->root_inode_no, 0);
+        printk("journal crash test: fsck found %d errors\n", errors);
+        return;
+    }
+
+    char path[32];
+    char data[] = "journal crash test\n";
+    uint32_t idx = 0;
+    sys_mkdir("/jtest");
+    while (idx < 8)
+    {
+        sprintf(path, "/jtest/f%d", idx);
+        int32_t fd = sys_open(path, O_CREAT | O_RDWR);
+        if (fd != -1)
+        {
+            sys_write(fd, data, sizeof(data));
+            sys_close(fd);
+        }
+        if (idx & 1)
+            sys_unlink(path);
+        idx++;
+    }
+    journal_crash_point = point;
+    journal_sync(cur_part);
+    journal_crash_point = JOURNAL_CRASH_NONE;
+    printk("journal crash test: crash point %d not reached\n", point);
+}
+#endif
@@ -0,0 +1,143 @@
+#ifndef __FS_JOURNAL_H
+#define __FS_JOURNAL_H
+#include "stdint.h"
+#include "list.h"
+#include "ide.h"
+#include "sync.h"
+#include "global.h"
+
+/**
+ * 元数据日志(预写日志, write-ahead log)
+ *
+ * 日志区位于分区的保留区域(超级块之后, 块位图之前), 第0扇区是日志超级块, 其余扇区顺序存放提交记录.
+ * 一条提交记录由 描述块 + 若干元数据扇区的新内容 + 提交块 组成, 由一次ide_write顺序写入.
+ *
+ * 一个会修改元数据的系统调用(创建, 写入, 删除文件等)用journal_begin/journal_end包起来, 称为一个事务.
+ * 事务中对位图, inode表, 目录块, 间接块的修改通过journal_write暂存在内存中, 同一扇区的多次修改合并为一次.
+ * journal_begin为事务预留它最多会修改的扇区数, 运行中的复合事务放不下时先提交, 所以一个事务的修改总在同一次提交中.
+ * 提交时持有updates的写锁: 等已开始的事务全部结束, 并挡住新的事务, 提交的总是完整的操作.
+ * 累积JOURNAL_GROUP_TRANS个事务后成组提交, 提交后的扇区并不立即写回原位置(检查点),
+ * 而是等到日志区写满或者journal_sync时再统一写回, 写回后日志区从头开始重新使用.
+ *
+ * 挂载分区时journal_recover会重放日志区中所有完整的提交记录, 崩溃时未提交的事务被整体丢弃.
+ *
+ * 被释放的块若在日志区中还有旧内容, 重放时旧内容会被写回该块. 因此这样的块要等检查点使日志区作废后才能重新分配,
+ * 在此之前分配块时跳过它们(journal_mask_freed), 否则块被分配给普通文件直接写入数据后, 崩溃重放会用旧的元数据覆盖新数据.
+ */
+
+#define JOURNAL_MAGIC 0x4a524e4c // 日志记录的魔数, "JRNL"
+#define JOURNAL_SECTS 256        // 日志区占用的扇区数, 含日志超级块
+#define JOURNAL_DESC_SLOTS 123   // 描述块中可以记录的lba个数
+#define JOURNAL_MAX_BLOCKS 64    // 一次提交最多包含的元数据扇区数
+#define JOURNAL_GROUP_TRANS 4    // 累积多少个事务后成组提交一次
+
+/* 普通操作最多修改的元数据扇区数. 创建文件或目录: inode位图, 两个inode各2扇区, 新目录块, 父目录块和其间接块以及相应的块位图;
+ * 写入: sys_write每个事务最多写FS_WRITE_CHUNK字节, 即9个数据块, 沿途最多新分配6个间接块,
+ * 修改inode 2扇区, 间接块6个, 块位图最多15个扇区 */
+#define JOURNAL_OP_CREDITS 24
+/* 删除文件或目录最多修改的元数据扇区数: 回收的块可能分布在所有块位图扇区中,
+ * 另有inode位图, inode表2扇区, 父目录块, 父目录的间接块2个和父目录inode 2扇区 */
+#define JOURNAL_RELEASE_CREDITS(sb) (8 + (sb)->block_bitmap_sects)
+
+// 日志中记录块的类型
+enum journal_block_type
+{
+    JOURNAL_SUPER = 1, // 日志超级块
+    JOURNAL_DESC,      // 描述块
+    JOURNAL_COMMIT     // 提交块
+};
+
+// 日志超级块, 位于日志区的第0扇区
+struct journal_super
+{
+    uint32_t magic;
+    uint32_t type;      // JOURNAL_SUPER
+    uint32_t start_seq; // 日志区第1扇区处第一条提交记录的序号
+    uint8_t pad[500];
+} __attribute__((packed));
+
+// 描述块, 其后紧跟nr_blocks个扇区的新内容, 再之后是提交块
+struct journal_desc
+{
+    uint32_t magic;
+    uint32_t type; // JOURNAL_DESC
+    uint32_t seq;  // 提交记录的序号
+    uint32_t nr_blocks;
+    uint32_t nr_revoke; // 撤销记录数. 被释放的块改为等到检查点后才重新分配, 新写入的记录中总为0, 恢复时仍然处理
+    // 前nr_blocks个是其后各扇区内容应写回的lba, 再之后nr_revoke个是被撤销(已释放)的lba
+    uint32_t lba[JOURNAL_DESC_SLOTS];
+} __attribute__((packed));
+
+// 提交块, 只有提交块完整写入, 整条记录才有效
+struct journal_commit
+{
+    uint32_t magic;
+    uint32_t type; // JOURNAL_COMMIT
+    uint32_t seq;
+    uint32_t nr_blocks;
+    uint32_t checksum; // 描述块和所有数据扇区的校验和
+    uint8_t pad[492];
+} __attribute__((packed));
+
+// 内存中暂存的一个元数据扇区
+struct journal_buf
+{
+    uint32_t lba;
+    struct list_elem buf_tag; // 用于running, committing或checkpoint队列
+    uint8_t data[512];
+};
+
+// 每个分区的日志
+struct journal
+{
+    uint32_t lba;   // 日志区起始lba
+    uint32_t sects; // 日志区扇区数
+    uint32_t seq;   // 下一条提交记录的序号
+    uint32_t head;  // 下一条提交记录在日志区中的扇区偏移
+
+    struct rwlock updates; // 事务持有读锁, 提交和检查点持有写锁
+    uint32_t reserved;     // 已开始的事务预留的扇区数
+    uint32_t trans_cnt;    // 运行中的复合事务已经包含的事务数
+
+    struct list running;     // 尚未提交的元数据扇区
+    uint32_t running_cnt;    // running中的扇区数
+    struct list committing;  // 正在写入日志的元数据扇区
+    struct list checkpoint;  // 已提交但还未写回原位置的元数据扇区, 按lba排序
+    uint32_t checkpoint_cnt; // checkpoint中的扇区数
+
+    // 日志区中还有旧内容的已释放块, 在检查点之前不能重新分配. 日志区中的记录不超过JOURNAL_SECTS个扇区, 数组不会溢出
+    uint32_t freed[JOURNAL_SECTS];
+    uint32_t freed_cnt;       // freed中的块数
+    uint32_t freed_committed; // freed的前freed_committed个是已提交的事务释放的, 检查点之后可以分配
+
+    uint32_t stat_trans;       // 统计: 结束的事务数
+    uint32_t stat_commits;     // 统计: 提交次数
+    uint32_t stat_log_sects;   // 统计: 写入日志的扇区数
+    uint32_t stat_checkpoints; // 统计: 检查点次数
+    uint32_t stat_home_sects;  // 统计: 写回原位置的扇区数
+};
+
+#ifdef JOURNAL_CRASH_TEST
+// 崩溃注入点, 用于测试日志恢复, 只在make JOURNAL_CRASH_TEST=<崩溃点>构建时编入
+enum journal_crash_point
+{
+    JOURNAL_CRASH_NONE,
+    JOURNAL_CRASH_BEFORE_COMMIT,   // 写完描述块和数据扇区, 提交块未写入
+    JOURNAL_CRASH_AFTER_COMMIT,    // 提交记录已写入日志, 尚未做检查点
+    JOURNAL_CRASH_MID_CHECKPOINT   // 检查点写回了一半
+};
+extern enum journal_crash_point journal_crash_point;
+void journal_crash_test(enum journal_crash_point point);
+#endif
+
+void journal_recover(struct partition *part);
+void journal_begin(struct partition *part, uint32_t credits);
+void journal_end(struct partition *part, uint32_t credits);
+void journal_read(struct partition *part, uint32_t lba, void *buf, uint32_t sec_cnt);
+void journal_write(struct partition *part, uint32_t lba, void *buf, uint32_t sec_cnt);
+void journal_revoke(struct partition *part, uint32_t lba);
+void journal_mask_freed(struct partition *part, uint8_t value);
+void journal_commit(struct partition *part);
+void journal_sync(struct partition *part);
+void journal_report(struct partition *part);
+#endif
@@ -7,6 +7,13 @@
 
 // 我们为了方便, 设置1块等于1扇区
 
+/* 旧版本格式化时超级块的pad部分没有清0, 只有feature_magic等于此值时, features及其后的字段才有效 */
+#define FS_FEATURE_MAGIC 0x20240601
+
+// 文件系统特性
+#define FS_FEAT_JOURNAL 0x1 // 分区保留区中有元数据日志
+#define FS_FEAT_INLINE 0x2  // 小文件和小目录的数据可以内联存放在inode中
+
 // 超级块
 typedef struct super_block
 {
@@ -29,7 +36,12 @@ typedef struct super_block
     uint32_t root_inode_no;  // 根目录所在的I结点号
     uint32_t dir_entry_size; // 目录项大小,Directory
 
-    uint8_t pad[460]; // 加上460字节,凑够512字节1扇区大小
+    uint32_t feature_magic; // 为FS_FEATURE_MAGIC时, 以下字段才有效
+    uint32_t features;      // 文件系统特性, FS_FEAT_XXX
+    uint32_t journal_lba;   // 日志区起始扇区lba地址
+    uint32_t journal_sects; // 日志区占用的扇区数量
+
+    uint8_t pad[444]; // 加上444字节,凑够512字节1扇区大小
 } __attribute__((packed)) super_block_t;
 
 #endif
\ No newline at end of file
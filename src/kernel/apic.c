@@ -0,0 +1,204 @@
+#include "apic.h"
+#include "stdint.h"
+#include "global.h"
+#include "memory.h"
+#include "debug.h"
+#include "timer.h"
+
+/* 本地APIC寄存器, 以字节偏移表示 */
+#define LAPIC_ID 0x020    // APIC id, 位于高8位
+#define LAPIC_TPR 0x080   // 任务优先级, 为0时接收所有中断
+#define LAPIC_EOI 0x0B0   // 写0表示中断处理结束
+#define LAPIC_SVR 0x0F0   // 伪中断向量, 第8位为1时启用本地APIC
+#define LAPIC_ESR 0x280   // 错误状态
+#define LAPIC_ICRLO 0x300 // 中断命令寄存器低32位, 写入时发送IPI
+#define LAPIC_ICRHI 0x310 // 中断命令寄存器高32位, 目标APIC id在高8位
+#define LAPIC_TIMER 0x320 // LVT定时器
+#define LAPIC_LINT0 0x350 // LVT LINT0, 8259A经此引脚接入
+#define LAPIC_LINT1 0x360 // LVT LINT1, 接NMI
+#define LAPIC_ERROR 0x370 // LVT错误
+#define LAPIC_TICR 0x380  // 定时器初始计数
+#define LAPIC_TCCR 0x390  // 定时器当前计数
+#define LAPIC_TDCR 0x3E0  // 定时器分频
+
+#define LAPIC_ENABLE 0x00000100   // SVR中的软件启用位
+#define LVT_MASKED 0x00010000     // 屏蔽此中断
+#define LVT_NMI 0x00000400        // 按NMI投递
+#define TIMER_PERIODIC 0x00020000 // 定时器周期模式
+#define TIMER_DIV16 0x3           // 定时器按总线频率的1/16计数
+#define LAPIC_TIMER_HZ 100        // 与PIT的时钟中断频率相同, 每10毫秒一次
+
+/* IOAPIC通过索引寄存器和数据窗口间接访问 */
+#define IOAPIC_REGSEL 0x00
+#define IOAPIC_WIN 0x10
+#define IOAPIC_VER 0x01       // 第16~23位是重定向表的项数减1
+#define IOAPIC_REDTBL 0x10    // 第i项重定向表占0x10+2*i和0x10+2*i+1两个寄存器
+#define REDTBL_LOW_ACTIVE 0x00002000
+#define REDTBL_LEVEL 0x00008000
+#define REDTBL_MASKED 0x00010000
+
+/* MP表中中断来源的极性和触发方式, 00表示遵循总线的默认值, ISA总线默认高电平有效, 边沿触发 */
+#define MP_POLARITY_LOW 0x3
+#define MP_TRIGGER_LEVEL (0x3 << 2)
+
+#define ISA_IRQS 16
+
+bool apic_enabled = false;
+static volatile uint32_t *lapic;
+static volatile uint32_t *ioapic;
+static uint32_t lapic_timer_count; // 一个嘀嗒对应的本地APIC定时器计数
+
+/* ISA中断号连到IOAPIC的哪个引脚, 没有特别说明时与中断号相同 */
+static uint8_t isa_irq_pin[ISA_IRQS] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+static uint16_t isa_irq_flags[ISA_IRQS];
+
+static uint32_t lapic_read(uint32_t reg)
+{
+   return lapic[reg / 4];
+}
+
+static void lapic_write(uint32_t reg, uint32_t value)
+{
+   lapic[reg / 4] = value;
+   lapic[LAPIC_ID / 4]; // 读一次, 等待写操作完成
+}
+
+static uint32_t ioapic_read(uint32_t reg)
+{
+   ioapic[IOAPIC_REGSEL / 4] = reg;
+   return ioapic[IOAPIC_WIN / 4];
+}
+
+static void ioapic_write(uint32_t reg, uint32_t value)
+{
+   ioapic[IOAPIC_REGSEL / 4] = reg;
+   ioapic[IOAPIC_WIN / 4] = value;
+}
+
+/* 忙等us微秒, 用tsc计时, 关中断时也可以用. 调用前tsc必须已经校准 */
+void udelay(uint32_t us)
+{
+   ASSERT(tsc_khz != 0);
+   uint64_t end = ktime_get_ns() + (uint64_t)us * 1000;
+   while (ktime_get_ns() < end)
+   {
+      asm volatile("rep; nop");
+   }
+}
+
+/* 映射本地APIC和IOAPIC的寄存器 */
+void apic_map(uint32_t lapic_paddr, uint32_t ioapic_paddr)
+{
+   lapic = mmio_map(lapic_paddr);
+   ioapic = mmio_map(ioapic_paddr);
+}
+
+/* 记录MP表中的中断来源项: ISA中断irq接在IOAPIC的pin号引脚上 */
+void ioapic_isa_override(uint8_t irq, uint8_t pin, uint16_t flags)
+{
+   if (irq < ISA_IRQS)
+   {
+      isa_irq_pin[irq] = pin;
+      isa_irq_flags[irq] = flags;
+   }
+}
+
+/* 把ISA中断irq经IOAPIC以向量0x20+irq投递给dest_apic_id, 与8259A时的向量号一致 */
+static void ioapic_route(uint8_t irq, uint8_t dest_apic_id)
+{
+   uint32_t low = 0x20 + irq;
+   if ((isa_irq_flags[irq] & 0x3) == MP_POLARITY_LOW)
+   {
+      low |= REDTBL_LOW_ACTIVE;
+   }
+   if ((isa_irq_flags[irq] & (0x3 << 2)) == MP_TRIGGER_LEVEL)
+   {
+      low |= REDTBL_LEVEL;
+   }
+   uint8_t pin = isa_irq_pin[irq];
+   ioapic_write(IOAPIC_REDTBL + 2 * pin + 1, (uint32_t)dest_apic_id << 24);
+   ioapic_write(IOAPIC_REDTBL + 2 * pin, low);
+}
+
+/**
+ * @brief ioapic_init屏蔽IOAPIC的所有引脚, 再把8259A上打开的时钟, 键盘, 硬盘中断改由IOAPIC投递给dest_apic_id.
+ *        调用者随后要屏蔽8259A
+ */
+void ioapic_init(uint8_t dest_apic_id)
+{
+   uint32_t pins = ((ioapic_read(IOAPIC_VER) >> 16) & 0xff) + 1;
+   uint32_t pin = 0;
+   while (pin < pins)
+   {
+      ioapic_write(IOAPIC_REDTBL + 2 * pin, REDTBL_MASKED);
+      ioapic_write(IOAPIC_REDTBL + 2 * pin + 1, 0);
+      pin++;
+   }
+   ioapic_route(0, dest_apic_id);  // 时钟
+   ioapic_route(1, dest_apic_id);  // 键盘
+   ioapic_route(14, dest_apic_id); // 主通道硬盘
+}
+
+/**
+ * @brief lapic_init启用当前cpu的本地APIC. 8259A已被屏蔽, LINT0不再使用
+ *
+ * @param timer 为真时打开周期性的本地定时器, 需要先调用lapic_timer_calibrate
+ */
+void lapic_init(bool timer)
+{
+   lapic_write(LAPIC_SVR, LAPIC_ENABLE | SPURIOUS_VECTOR);
+   lapic_write(LAPIC_LINT0, LVT_MASKED);
+   lapic_write(LAPIC_LINT1, LVT_NMI);
+   lapic_write(LAPIC_ERROR, LVT_MASKED);
+   /* 连写两次清除错误状态 */
+   lapic_write(LAPIC_ESR, 0);
+   lapic_write(LAPIC_ESR, 0);
+   lapic_write(LAPIC_EOI, 0);
+   lapic_write(LAPIC_TPR, 0);
+
+   if (timer)
+   {
+      ASSERT(lapic_timer_count != 0);
+      lapic_write(LAPIC_TDCR, TIMER_DIV16);
+      lapic_write(LAPIC_TIMER, TIMER_PERIODIC | LAPIC_TIMER_VECTOR);
+      lapic_write(LAPIC_TICR, lapic_timer_count);
+   }
+   else
+   {
+      lapic_write(LAPIC_TIMER, LVT_MASKED);
+   }
+}
+
+/* 用tsc测出本地APIC定时器一个嘀嗒的计数. 各cpu的总线频率相同, 在bsp上测一次即可 */
+void lapic_timer_calibrate(void)
+{
+   lapic_write(LAPIC_TDCR, TIMER_DIV16);
+   lapic_write(LAPIC_TIMER, LVT_MASKED);
+   lapic_write(LAPIC_TICR, 0xffffffff);
+   udelay(1000000 / LAPIC_TIMER_HZ);
+   lapic_timer_count = 0xffffffff - lapic_read(LAPIC_TCCR);
+   lapic_write(LAPIC_TICR, 0);
+}
+
+/* 当前cpu的APIC id */
+uint8_t lapic_id(void)
+{
+   return lapic_read(LAPIC_ID) >> 24;
+}
+
+/* 通知本地APIC中断处理结束 */
+void lapic_eoi(void)
+{
+   lapic_write(LAPIC_EOI, 0);
+}
+
+/* 向apic_id发送处理器间中断, icr是中断命令寄存器的低32位 */
+void lapic_send_ipi(uint8_t apic_id, uint32_t icr)
+{
+   lapic_write(LAPIC_ICRHI, (uint32_t)apic_id << 24);
+   lapic_write(LAPIC_ICRLO, icr);
+   while (lapic_read(LAPIC_ICRLO) & ICR_DELIVS)
+   {
+      asm volatile("rep; nop");
+   }
+}
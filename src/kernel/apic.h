@@ -0,0 +1,36 @@
+#ifndef __KERNEL_APIC_H
+#define __KERNEL_APIC_H
+#include "stdint.h"
+#include "global.h"
+
+/**
+ * 高级可编程中断控制器(APIC)
+ *
+ * 每个cpu有一个本地APIC, 负责接收投递给本cpu的中断, 提供本地定时器, 并向其它cpu发送处理器间中断(IPI).
+ * IOAPIC接收外部设备的中断, 按重定向表投递给某个cpu的本地APIC. 启用后8259A被全部屏蔽.
+ */
+
+#define LAPIC_TIMER_VECTOR 0x30 // 本地APIC定时器, ap用它来驱动调度
+#define RESCHED_VECTOR 0x31     // 唤醒空闲cpu的处理器间中断
+#define SPURIOUS_VECTOR 0x3f    // 本地APIC的伪中断, 不需要EOI
+
+/* 中断命令寄存器(ICR)低32位 */
+#define ICR_FIXED 0x00000000   // 按向量号投递
+#define ICR_INIT 0x00000500    // INIT
+#define ICR_STARTUP 0x00000600 // Startup IPI, 向量号为启动代码的物理页号
+#define ICR_DELIVS 0x00001000  // 投递中
+#define ICR_ASSERT 0x00004000  // 电平有效
+#define ICR_LEVEL 0x00008000   // 电平触发
+
+extern bool apic_enabled; // 为真时中断由IOAPIC和本地APIC投递, 否则仍由8259A投递
+
+void apic_map(uint32_t lapic_paddr, uint32_t ioapic_paddr);
+void ioapic_isa_override(uint8_t irq, uint8_t pin, uint16_t flags);
+void ioapic_init(uint8_t dest_apic_id);
+void lapic_init(bool timer);
+void lapic_timer_calibrate(void);
+uint8_t lapic_id(void);
+void lapic_eoi(void);
+void lapic_send_ipi(uint8_t apic_id, uint32_t icr);
+void udelay(uint32_t us);
+#endif
@@ -0,0 +1,309 @@
+#include "bench.h"
+#include "thread.h"
+#include "sync.h"
+#include "memory.h"
+#include "interrupt.h"
+#include "string.h"
+#include "timer.h"
+#include "fpu.h"
+#include "stdio-kernel.h"
+
+/* 调度延迟统计: 从thread_unblock唤醒到任务真正上cpu经过的cpu周期数 */
+static uint32_t sched_latency_hist[SCHED_HIST_BUCKETS];
+static uint64_t sched_latency_sum;
+static uint32_t sched_latency_max;
+
+/* 记录一次唤醒到运行的延迟 */
+void bench_sched_latency(struct task_struct *next)
+{
+   uint32_t delta = (uint32_t)(rdtsc() - next->wake_tsc);
+   next->wake_tsc = 0;
+   uint32_t bucket = 0;
+   if (delta != 0)
+   {
+      asm("bsr %1, %0"
+          : "=r"(bucket)
+          : "rm"(delta));
+   }
+   sched_latency_hist[bucket]++;
+   sched_latency_sum += delta;
+   if (delta > sched_latency_max)
+   {
+      sched_latency_max = delta;
+   }
+}
+
+/**
+ * @brief sys_sched_stat输出调度延迟直方图, 即任务从被唤醒到上cpu经过的cpu周期数的分布
+ *
+ * @param reset 为真时不输出, 只清空统计
+ * @return int32_t 返回0
+ */
+int32_t sys_sched_stat(int32_t reset)
+{
+   enum intr_status old_status = intr_disable();
+   if (reset)
+   {
+      memset(sched_latency_hist, 0, sizeof(sched_latency_hist));
+      sched_latency_sum = 0;
+      sched_latency_max = 0;
+      intr_set_status(old_status);
+      return 0;
+   }
+   uint32_t hist[SCHED_HIST_BUCKETS];
+   memcpy(hist, sched_latency_hist, sizeof(hist));
+   uint64_t sum = sched_latency_sum;
+   uint32_t max = sched_latency_max;
+   intr_set_status(old_status);
+
+   uint32_t total = 0, bucket = 0;
+   while (bucket < SCHED_HIST_BUCKETS)
+   {
+      total += hist[bucket++];
+   }
+   printk("wakeup-to-run latency (cpu cycles), %d wakeups\n", total);
+   for (bucket = 0; bucket < SCHED_HIST_BUCKETS; bucket++)
+   {
+      if (hist[bucket] != 0)
+      {
+         printk("  [2^%d, 2^%d): %d\n", bucket, bucket + 1, hist[bucket]);
+      }
+   }
+   if (total != 0)
+   {
+      /* 平均值不超过max, 商不会溢出 */
+      printk("  avg: %d  max: %d\n", div64_32(sum, total, NULL), max);
+   }
+   return 0;
+}
+
+/* 写保护缺页的统计, 单位是cpu周期 */
+static uint32_t cow_faults; // 写保护缺页的次数
+static uint32_t cow_copies; // 其中复制了页面的次数, 其余是独享页面只改权限
+static uint64_t cow_cycles; // 复制页面的缺页处理的总耗时
+static uint32_t cow_max;    // 复制页面的缺页处理的最长耗时
+
+/* 记录一次写保护缺页的处理耗时, 开始时间为start */
+void bench_cow_fault(uint64_t start, bool copied)
+{
+   cow_faults++;
+   if (!copied)
+      return;
+   uint32_t delta = (uint32_t)(rdtsc() - start);
+   cow_copies++;
+   cow_cycles += delta;
+   if (delta > cow_max)
+      cow_max = delta;
+}
+
+/**
+ * @brief sys_cow_stat输出写时复制缺页的次数和处理耗时
+ *
+ * @param reset 为真时不输出, 只清空统计
+ * @return int32_t 返回0
+ */
+int32_t sys_cow_stat(int32_t reset)
+{
+   if (reset)
+   {
+      cow_faults = cow_copies = cow_max = 0;
+      cow_cycles = 0;
+      return 0;
+   }
+   printk("write-protect faults: %d, copied: %d\n", cow_faults, cow_copies);
+   if (cow_copies != 0)
+   {
+      /* 平均值不超过max, 商不会溢出 */
+      printk("  copy latency (cpu cycles) avg: %d  max: %d\n", div64_32(cow_cycles, cow_copies, NULL), cow_max);
+   }
+   return 0;
+}
+
+/* 压力测试用的共享数据 */
+static struct lock stress_mutex;
+static struct semaphore stress_sema;
+static struct spinlock stress_spin;
+static uint32_t stress_expected;   // 所有任务执行的总轮数
+static uint32_t stress_mutex_cnt;  // 在互斥锁内累加
+static uint32_t stress_spin_cnt;   // 在自旋锁内累加
+static uint32_t stress_inside;     // 当前在计数信号量临界区内的任务数
+static uint32_t stress_max_inside; // 同时在计数信号量临界区内的最大任务数
+
+/**
+ * @brief sys_lock_stress同步原语压力测试. 多个进程同时执行LOCK_STRESS_RUN, 每一轮依次:
+ *        在互斥锁内读计数, 让出cpu后再写回加1, 锁不互斥就会丢失更新;
+ *        进入初值为LOCK_STRESS_SLOTS的计数信号量, 让出cpu, 统计同时在内的任务数;
+ *        在自旋锁内加另一个计数. 全部结束后用LOCK_STRESS_REPORT检查两个计数都等于总轮数
+ *
+ * @param op 见enum lock_stress_op
+ * @param arg LOCK_STRESS_RUN时为轮数
+ * @return int32_t LOCK_STRESS_REPORT时结果正确返回0, 否则返回-1; 其它操作返回0
+ */
+int32_t sys_lock_stress(uint32_t op, uint32_t arg)
+{
+   uint32_t round = 0;
+   enum intr_status old_status;
+   switch (op)
+   {
+   case LOCK_STRESS_RESET:
+      lock_init(&stress_mutex);
+      sema_init(&stress_sema, LOCK_STRESS_SLOTS);
+      spin_init(&stress_spin);
+      stress_expected = stress_mutex_cnt = stress_spin_cnt = 0;
+      stress_inside = stress_max_inside = 0;
+      return 0;
+   case LOCK_STRESS_RUN:
+      lock_acquire(&stress_mutex);
+      stress_expected += arg;
+      lock_release(&stress_mutex);
+      for (round = 0; round < arg; round++)
+      {
+         lock_acquire(&stress_mutex);
+         uint32_t value = stress_mutex_cnt;
+         thread_yield();
+         stress_mutex_cnt = value + 1;
+         lock_release(&stress_mutex);
+
+         sema_down(&stress_sema);
+         old_status = spin_lock_irqsave(&stress_spin);
+         if (++stress_inside > stress_max_inside)
+         {
+            stress_max_inside = stress_inside;
+         }
+         spin_unlock_irqrestore(&stress_spin, old_status);
+         thread_yield();
+         old_status = spin_lock_irqsave(&stress_spin);
+         stress_inside--;
+         stress_spin_cnt++;
+         spin_unlock_irqrestore(&stress_spin, old_status);
+         sema_up(&stress_sema);
+      }
+      return 0;
+   case LOCK_STRESS_REPORT:
+      printk("lock stress: expected %d, mutex %d, spinlock %d, max in semaphore %d/%d\n",
+             stress_expected, stress_mutex_cnt, stress_spin_cnt, stress_max_inside, LOCK_STRESS_SLOTS);
+      if (stress_mutex_cnt != stress_expected || stress_spin_cnt != stress_expected ||
+          stress_max_inside > LOCK_STRESS_SLOTS || stress_inside != 0)
+      {
+         return -1;
+      }
+      return 0;
+   }
+   return -1;
+}
+
+#define MEMBENCH_PAGES 16 // 测试缓冲区的页数, 64KB可以放进大多数cpu的L2
+#define MEMBENCH_ROUNDS 8 // 每种实现重复的次数
+
+/* 原来的逐字节实现, 作为对照 */
+static void membench_byte_set(uint8_t *dst, uint8_t value, uint32_t size)
+{
+   while (size-- > 0)
+      *dst++ = value;
+}
+
+static void membench_byte_copy(uint8_t *dst, const uint8_t *src, uint32_t size)
+{
+   while (size-- > 0)
+      *dst++ = *src++;
+}
+
+static int membench_byte_cmp(const char *a, const char *b, uint32_t size)
+{
+   while (size-- > 0)
+   {
+      if (*a != *b)
+         return *a > *b ? 1 : -1;
+      a++;
+      b++;
+   }
+   return 0;
+}
+
+/* 输出一种实现的结果: 每个cpu周期处理的字节数, 保留两位小数 */
+static void membench_report(const char *name, uint32_t cycles)
+{
+   uint32_t bytes = MEMBENCH_PAGES * PG_SIZE * MEMBENCH_ROUNDS;
+   uint32_t per100 = cycles == 0 ? 0 : div64_32((uint64_t)bytes * 100, cycles, NULL);
+   printk("  %s: %d cycles, %d.%d%d bytes/cycle\n", name, cycles, per100 / 100, per100 / 10 % 10, per100 % 10);
+}
+
+/**
+ * @brief sys_mem_bench测试memset, memcpy, memcmp各种实现的速度: 原来的逐字节循环, rep stosl/movsl和按字比较,
+ *        以及支持SSE2时清零和复制整页用的非临时存储. 每种实现在64KB的缓冲区上重复MEMBENCH_ROUNDS次, 用rdtsc计时
+ *
+ * @return int32_t 成功返回0, 内存不足返回-1
+ */
+int32_t sys_mem_bench(void)
+{
+   uint8_t *src = get_kernel_pages(MEMBENCH_PAGES);
+   if (src == NULL)
+      return -1;
+   uint8_t *dst = get_kernel_pages(MEMBENCH_PAGES);
+   if (dst == NULL)
+   {
+      mfree_page(PF_KERNEL, src, MEMBENCH_PAGES);
+      return -1;
+   }
+   uint32_t size = MEMBENCH_PAGES * PG_SIZE, round, pg;
+   uint64_t start;
+   int32_t sink = 0;
+   printk("membench: %d bytes x %d rounds, sse2: %d\n", size, MEMBENCH_ROUNDS, cpu_has_sse2);
+
+   start = rdtsc();
+   for (round = 0; round < MEMBENCH_ROUNDS; round++)
+      membench_byte_set(src, round, size);
+   membench_report("memset byte loop", (uint32_t)(rdtsc() - start));
+
+   start = rdtsc();
+   for (round = 0; round < MEMBENCH_ROUNDS; round++)
+      memset(src, round, size);
+   membench_report("memset rep stosl", (uint32_t)(rdtsc() - start));
+
+   if (cpu_has_sse2)
+   {
+      start = rdtsc();
+      for (round = 0; round < MEMBENCH_ROUNDS; round++)
+         clear_pages(dst, MEMBENCH_PAGES);
+      membench_report("clear_pages sse2", (uint32_t)(rdtsc() - start));
+   }
+
+   start = rdtsc();
+   for (round = 0; round < MEMBENCH_ROUNDS; round++)
+      membench_byte_copy(dst, src, size);
+   membench_report("memcpy byte loop", (uint32_t)(rdtsc() - start));
+
+   start = rdtsc();
+   for (round = 0; round < MEMBENCH_ROUNDS; round++)
+      memcpy(dst, src, size);
+   membench_report("memcpy rep movsl", (uint32_t)(rdtsc() - start));
+
+   if (cpu_has_sse2)
+   {
+      start = rdtsc();
+      for (round = 0; round < MEMBENCH_ROUNDS; round++)
+         for (pg = 0; pg < MEMBENCH_PAGES; pg++)
+            copy_page(dst + pg * PG_SIZE, src + pg * PG_SIZE);
+      membench_report("copy_page sse2", (uint32_t)(rdtsc() - start));
+   }
+
+   /* 此时两个缓冲区内容相同, memcmp要比较全部字节 */
+   start = rdtsc();
+   for (round = 0; round < MEMBENCH_ROUNDS; round++)
+      sink += membench_byte_cmp((const char *)dst, (const char *)src, size);
+   membench_report("memcmp byte loop", (uint32_t)(rdtsc() - start));
+
+   start = rdtsc();
+   for (round = 0; round < MEMBENCH_ROUNDS; round++)
+      sink += memcmp(dst, src, size);
+   membench_report("memcmp by dword", (uint32_t)(rdtsc() - start));
+
+   mfree_page(PF_KERNEL, src, MEMBENCH_PAGES);
+   mfree_page(PF_KERNEL, dst, MEMBENCH_PAGES);
+   if (sink != 0)
+   {
+      printk("membench: copies differ\n");
+      return -1;
+   }
+   return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef __KERNEL_BENCH_H
+#define __KERNEL_BENCH_H
+#include "stdint.h"
+#include "global.h"
+
+/**
+ * 性能测试和统计用的系统调用. 只在用make BENCH=1构建(定义CONFIG_BENCH)时编进内核,
+ * 否则这些系统调用号返回-1, 调度和缺页处理中的统计点也不编译
+ */
+
+/* 同步原语压力测试的操作, 见sys_lock_stress */
+enum lock_stress_op
+{
+   LOCK_STRESS_RESET,  // 清空计数
+   LOCK_STRESS_RUN,    // 当前任务执行arg轮加锁
+   LOCK_STRESS_REPORT  // 检查并输出结果
+};
+#define LOCK_STRESS_SLOTS 2 // 压力测试中计数信号量的初值, 同时在临界区内的任务不能超过此数
+
+#define SCHED_HIST_BUCKETS 32 // 调度延迟直方图的桶数, 第i个桶统计延迟在[2^i, 2^(i+1))个cpu周期内的唤醒
+
+#ifdef CONFIG_BENCH
+struct task_struct;
+void bench_sched_latency(struct task_struct *next);
+void bench_cow_fault(uint64_t start, bool copied);
+int32_t sys_sched_stat(int32_t reset);
+int32_t sys_lock_stress(uint32_t op, uint32_t arg);
+int32_t sys_mem_bench(void);
+int32_t sys_cow_stat(int32_t reset);
+#endif
+
+#endif
@@ -0,0 +1,348 @@
+#include "fpu.h"
+#include "global.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "memory.h"
+#include "string.h"
+#include "print.h"
+#include "smp.h"
+
+bool cpu_has_fxsr; // 支持fxsave/fxrstor
+bool cpu_has_sse;  // 支持SSE, 已在CR4中打开
+bool cpu_has_sse2; // 支持SSE2
+
+#define MXCSR_DEFAULT 0x1f80 // 屏蔽所有SIMD浮点异常, 就近舍入
+
+static inline uint32_t read_cr0(void)
+{
+   uint32_t cr0;
+   asm volatile("movl %%cr0, %0"
+                : "=r"(cr0));
+   return cr0;
+}
+
+static inline void write_cr0(uint32_t cr0)
+{
+   asm volatile("movl %0, %%cr0"
+                :
+                : "r"(cr0)
+                : "memory");
+}
+
+/* 置上TS, 下一条浮点指令将触发#NM */
+static inline void stts(void)
+{
+   uint32_t cr0 = read_cr0();
+   if (!(cr0 & CR0_TS))
+   {
+      write_cr0(cr0 | CR0_TS);
+   }
+}
+
+/* 清除TS, 浮点指令可以直接执行 */
+static inline void clts(void)
+{
+   asm volatile("clts" ::: "memory");
+}
+
+/* 任务的保存区, 按16字节对齐 */
+static inline void *fpu_area(struct task_struct *pthread)
+{
+   return (void *)(((uint32_t)pthread->fpu_state + 15) & ~15);
+}
+
+/* 把寄存器中的浮点状态保存到pthread的保存区 */
+static void fpu_save(struct task_struct *pthread)
+{
+   if (cpu_has_fxsr)
+   {
+      asm volatile("fxsave %0"
+                   : "=m"(*(uint8_t(*)[FPU_STATE_SIZE])fpu_area(pthread)));
+   }
+   else
+   {
+      /* fnsave保存后会重新初始化x87, 接着用frstor装回, 寄存器中的状态保持有效 */
+      asm volatile("fnsave %0; frstor %0"
+                   : "+m"(*(uint8_t(*)[FPU_STATE_SIZE])fpu_area(pthread)));
+   }
+}
+
+/* 从pthread的保存区恢复浮点状态 */
+static void fpu_restore(struct task_struct *pthread)
+{
+   if (cpu_has_fxsr)
+   {
+      asm volatile("fxrstor %0"
+                   :
+                   : "m"(*(uint8_t(*)[FPU_STATE_SIZE])fpu_area(pthread)));
+   }
+   else
+   {
+      asm volatile("frstor %0"
+                   :
+                   : "m"(*(uint8_t(*)[FPU_STATE_SIZE])fpu_area(pthread)));
+   }
+}
+
+/* 从内核堆中分配保存区, 用户进程调用时也从内核堆中分配. 多分配15字节用于对齐 */
+static void *fpu_kmalloc(void)
+{
+   struct task_struct *cur = running_thread();
+   uint32_t *cur_pagedir_bak = cur->pgdir;
+   cur->pgdir = NULL;
+   void *vaddr = sys_malloc(FPU_STATE_SIZE + 15);
+   cur->pgdir = cur_pagedir_bak;
+   return vaddr;
+}
+
+// 释放fpu_kmalloc申请的内存
+static void fpu_kfree(void *vaddr)
+{
+   struct task_struct *cur = running_thread();
+   uint32_t *cur_pagedir_bak = cur->pgdir;
+   cur->pgdir = NULL;
+   sys_free(vaddr);
+   cur->pgdir = cur_pagedir_bak;
+}
+
+/**
+ * @brief fpu_nm_handler是#NM的处理函数. 当前任务在TS为1时执行了浮点指令, 把它的状态装进寄存器.
+ *        原来占用寄存器的任务被换下时已经保存过, 这里不用再保存
+ */
+static void fpu_nm_handler(uint8_t vec_nr)
+{
+   struct task_struct *cur = running_thread();
+   struct cpu_info *cpu = this_cpu();
+   if (cpu->fpu_owner == cur && cur->fpu_cpu == cur->cpu)
+   {
+      clts();
+      return; // 寄存器中就是自己的状态
+   }
+
+   /* 分配时清零页面可能用到kernel_fpu_begin, 它结束时会重新置上TS, 所以分配完再清TS */
+   if (cur->fpu_state == NULL)
+   {
+      cur->fpu_state = fpu_kmalloc();
+      if (cur->fpu_state == NULL)
+      {
+         PANIC("fpu_nm_handler: no memory for fpu state");
+      }
+      /* 第一次使用浮点, 从初始状态开始 */
+      clts();
+      asm volatile("fninit");
+      if (cpu_has_sse)
+      {
+         uint32_t mxcsr = MXCSR_DEFAULT;
+         asm volatile("ldmxcsr %0"
+                      :
+                      : "m"(mxcsr));
+      }
+   }
+   else
+   {
+      clts();
+      fpu_restore(cur);
+   }
+   cpu->fpu_owner = cur;
+   cur->fpu_cpu = cur->cpu;
+}
+
+/**
+ * @brief fpu_switch在schedule中切换任务前调用. prev本次运行用过浮点就保存其状态,
+ *        next的状态仍在本cpu的寄存器中时清TS, 否则置TS等它用到时再恢复
+ */
+void fpu_switch(struct task_struct *prev, struct task_struct *next)
+{
+   struct cpu_info *cpu = this_cpu();
+   if (cpu->fpu_owner == prev && !(read_cr0() & CR0_TS))
+   {
+      fpu_save(prev);
+   }
+   if (cpu->fpu_owner == next && next->fpu_cpu == prev->cpu)
+   {
+      clts();
+   }
+   else
+   {
+      stts();
+   }
+}
+
+/**
+ * @brief kernel_fpu_begin让内核代码可以使用SSE寄存器. 关中断防止被切换走, 寄存器中若还有某个任务的状态,
+ *        先写回它的保存区, 之后该任务再用浮点时由#NM恢复. 须与kernel_fpu_end成对使用, 其间不能睡眠
+ *
+ * @return enum intr_status 调用前的中断状态, 交给kernel_fpu_end恢复
+ */
+enum intr_status kernel_fpu_begin(void)
+{
+   enum intr_status old_status = intr_disable();
+   struct cpu_info *cpu = this_cpu();
+   if (cpu->fpu_owner != NULL && !(read_cr0() & CR0_TS))
+   {
+      fpu_save(cpu->fpu_owner);
+   }
+   cpu->fpu_owner = NULL;
+   clts();
+   return old_status;
+}
+
+/* 结束内核对SSE寄存器的使用, 置上TS后恢复中断状态 */
+void kernel_fpu_end(enum intr_status old_status)
+{
+   stts();
+   intr_set_status(old_status);
+}
+
+/**
+ * @brief sse2_clear_page用128位的非临时存储(movntdq)清零一页, 写入绕过cache, 不会把有用的数据挤出去.
+ *        须在kernel_fpu_begin和kernel_fpu_end之间调用
+ *
+ * @param page 页的起始地址, 4K对齐
+ */
+void sse2_clear_page(void *page)
+{
+   uint32_t cnt = PG_SIZE / 64;
+   asm volatile("pxor %%xmm0, %%xmm0\n"
+                "1:\n"
+                "movntdq %%xmm0, 0(%0)\n"
+                "movntdq %%xmm0, 16(%0)\n"
+                "movntdq %%xmm0, 32(%0)\n"
+                "movntdq %%xmm0, 48(%0)\n"
+                "addl $64, %0\n"
+                "decl %1\n"
+                "jnz 1b\n"
+                "sfence"
+                : "+r"(page), "+r"(cnt)
+                :
+                : "memory", "cc");
+}
+
+/**
+ * @brief sse2_copy_page按128位读入一页, 用非临时存储写到目的页. 须在kernel_fpu_begin和kernel_fpu_end之间调用
+ *
+ * @param dst 目的页, 4K对齐
+ * @param src 源页, 4K对齐
+ */
+void sse2_copy_page(void *dst, const void *src)
+{
+   uint32_t cnt = PG_SIZE / 64;
+   asm volatile("1:\n"
+                "prefetchnta 256(%1)\n"
+                "movdqa 0(%1), %%xmm0\n"
+                "movdqa 16(%1), %%xmm1\n"
+                "movdqa 32(%1), %%xmm2\n"
+                "movdqa 48(%1), %%xmm3\n"
+                "movntdq %%xmm0, 0(%0)\n"
+                "movntdq %%xmm1, 16(%0)\n"
+                "movntdq %%xmm2, 32(%0)\n"
+                "movntdq %%xmm3, 48(%0)\n"
+                "addl $64, %0\n"
+                "addl $64, %1\n"
+                "decl %2\n"
+                "jnz 1b\n"
+                "sfence"
+                : "+r"(dst), "+r"(src), "+r"(cnt)
+                :
+                : "memory", "cc");
+}
+
+/**
+ * @brief fpu_fork让fork出的子进程继承父进程的浮点状态
+ *
+ * @param child 子进程, pcb从父进程复制而来
+ * @param parent 父进程, 即当前任务
+ * @return int32_t 成功返回0, 内存不足返回-1
+ */
+int32_t fpu_fork(struct task_struct *child, struct task_struct *parent)
+{
+   if (parent->fpu_state == NULL)
+   {
+      return 0;
+   }
+   child->fpu_state = fpu_kmalloc();
+   if (child->fpu_state == NULL)
+   {
+      return -1;
+   }
+   /* 父进程本次运行用过浮点时, 最新的状态还在寄存器中 */
+   if (this_cpu()->fpu_owner == parent && !(read_cr0() & CR0_TS))
+   {
+      fpu_save(parent);
+   }
+   memcpy(fpu_area(child), fpu_area(parent), FPU_STATE_SIZE);
+   return 0;
+}
+
+/**
+ * @brief fpu_release释放任务的浮点保存区, 任务退出或exec时调用. 之后任务再用浮点时从初始状态开始
+ */
+void fpu_release(struct task_struct *pthread)
+{
+   uint32_t cpu = 0;
+   while (cpu < NR_CPUS)
+   {
+      if (cpus[cpu].fpu_owner == pthread)
+      {
+         cpus[cpu].fpu_owner = NULL;
+      }
+      cpu++;
+   }
+   if (pthread == running_thread())
+   {
+      stts();
+   }
+   if (pthread->fpu_state != NULL)
+   {
+      fpu_kfree(pthread->fpu_state);
+      pthread->fpu_state = NULL;
+   }
+}
+
+/* 在当前cpu上打开浮点和SSE: CR0.EM清0不再模拟, MP和NE置1, 支持时在CR4中声明操作系统会保存SSE状态 */
+void fpu_cpu_init(void)
+{
+   uint32_t cr0 = read_cr0();
+   cr0 &= ~CR0_EM;
+   cr0 |= CR0_MP | CR0_NE;
+   write_cr0(cr0);
+   asm volatile("fninit");
+   if (cpu_has_fxsr)
+   {
+      uint32_t cr4;
+      asm volatile("movl %%cr4, %0"
+                   : "=r"(cr4));
+      cr4 |= CR4_OSFXSR;
+      if (cpu_has_sse)
+      {
+         cr4 |= CR4_OSXMMEXCPT;
+      }
+      asm volatile("movl %0, %%cr4"
+                   :
+                   : "r"(cr4));
+   }
+   /* 还没有任务的状态在寄存器中, 第一次使用时由#NM装入 */
+   this_cpu()->fpu_owner = NULL;
+   stts();
+}
+
+/* 检测cpu支持的浮点特性, 注册#NM处理函数, 打开bsp的浮点 */
+void fpu_init(void)
+{
+   put_str("fpu_init start\n");
+   uint32_t eax = 1, ebx, ecx, edx;
+   asm volatile("cpuid"
+                : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+   cpu_has_fxsr = (edx & CPUID_FXSR) != 0;
+   cpu_has_sse = cpu_has_fxsr && (edx & CPUID_SSE) != 0;
+   cpu_has_sse2 = cpu_has_sse && (edx & CPUID_SSE2) != 0;
+   register_handler(7, fpu_nm_handler);
+   fpu_cpu_init();
+   put_str("   fxsr: ");
+   put_int(cpu_has_fxsr);
+   put_str(" sse: ");
+   put_int(cpu_has_sse);
+   put_str(" sse2: ");
+   put_int(cpu_has_sse2);
+   put_str("\nfpu_init done\n");
+}
@@ -0,0 +1,43 @@
+#ifndef __KERNEL_FPU_H
+#define __KERNEL_FPU_H
+#include "stdint.h"
+#include "global.h"
+#include "thread.h"
+#include "interrupt.h"
+
+/**
+ * 浮点和SIMD(x87/SSE)寄存器的惰性保存
+ *
+ * 每个任务第一次使用浮点指令时才在内核堆中分配保存区. 任务切换时只置上CR0.TS, 不保存也不恢复,
+ * 换上来的任务执行第一条浮点指令时触发#NM, 这时才把它的状态装进寄存器, 从不用浮点的任务切换时没有额外开销.
+ * 多处理器上任务可能换到别的cpu运行, 所以用过浮点的任务被换下时就把寄存器写回保存区,
+ * 之后若仍在同一个cpu上运行且期间没有别的任务用过浮点, 直接清TS继续用寄存器中的状态.
+ */
+
+#define FPU_STATE_SIZE 512 // fxsave保存区的大小, 须16字节对齐; 不支持fxsave时fnsave只用前108字节
+
+#define CR0_MP (1 << 1)          // 与TS配合, wait/fwait也触发#NM
+#define CR0_EM (1 << 2)          // 为1时浮点指令触发#UD, 用于模拟浮点
+#define CR0_TS (1 << 3)          // 任务已切换, 为1时浮点指令触发#NM
+#define CR0_NE (1 << 5)          // 浮点错误通过#MF报告
+#define CR4_OSFXSR (1 << 9)      // 操作系统支持fxsave/fxrstor, 允许使用SSE指令
+#define CR4_OSXMMEXCPT (1 << 10) // 操作系统处理SIMD浮点异常#XF
+
+#define CPUID_FXSR (1 << 24) // cpuid 1号功能edx: 支持fxsave/fxrstor
+#define CPUID_SSE (1 << 25)  // cpuid 1号功能edx: 支持SSE
+#define CPUID_SSE2 (1 << 26) // cpuid 1号功能edx: 支持SSE2
+
+extern bool cpu_has_fxsr;
+extern bool cpu_has_sse;
+extern bool cpu_has_sse2;
+
+void fpu_init(void);
+void fpu_cpu_init(void);
+void fpu_switch(struct task_struct *prev, struct task_struct *next);
+int32_t fpu_fork(struct task_struct *child, struct task_struct *parent);
+void fpu_release(struct task_struct *pthread);
+enum intr_status kernel_fpu_begin(void);
+void kernel_fpu_end(enum intr_status old_status);
+void sse2_clear_page(void *page);
+void sse2_copy_page(void *dst, const void *src);
+#endif
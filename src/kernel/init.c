@@ -10,6 +10,9 @@
 #include "syscall-init.h"
 #include "ide.h"
 #include "fs.h"
+#include "smp.h"
+#include "futex.h"
+#include "fpu.h"
 
 /*负责初始化所有模块 */
 void init_all()
@@ -17,12 +20,16 @@ void init_all()
    put_str("init_all\n");
    idt_init();      // 初始化中断
    mem_init();      // 初始化内存管理系统
+   mp_init();       // 解析MP表, 映射APIC寄存器, 须在创建init进程之前
    thread_init();   // 初始化线程相关结构
    console_init();  // 控制台初始化最好放在开中断之前
    timer_init();    // 初始化PIT
    keyboard_init(); // 键盘初始化
    tss_init();      // tss初始化
+   fpu_init();      // 打开浮点和SSE, 注册#NM, 须在启动其它cpu之前
+   smp_init();      // 改用IOAPIC投递中断, 启动其它cpu
    syscall_init();  // 初始化系统调用
+   futex_init();    // 初始化futex等待队列
    intr_enable();   // 后面的ide_init需要打开中断
    ide_init();      // 初始化硬盘
    filesys_init();  // 初始化文件系统
@@ -3,6 +3,7 @@
 #include "global.h"
 #include "io.h"
 #include "print.h"
+#include "apic.h"
 
 #define PIC_M_CTRL 0x20 // 这里用的可编程中断控制器是8259A,主片的控制端口是0x20
 #define PIC_M_DATA 0x21 // 主片的数据端口是0x21
@@ -110,9 +111,9 @@ static void idt_desc_init(void)
  */
 static void general_intr_handler(uint8_t vec_nr)
 {
-   if (vec_nr == 0x27 || vec_nr == 0x2f)
+   if (vec_nr == 0x27 || vec_nr == 0x2f || vec_nr == SPURIOUS_VECTOR)
    {          // 0x2f是从片8259A上的最后一个irq引脚，保留
-      return; // IRQ7和IRQ15会产生伪中断(spurious interrupt),无须处理。
+      return; // IRQ7和IRQ15会产生伪中断(spurious interrupt),无须处理。本地APIC的伪中断同样忽略
    }
    /* 将光标置为0,从屏幕左上角清出一片打印异常信息的区域,方便阅读 */
    set_cursor(0);
@@ -231,6 +232,39 @@ void register_handler(uint8_t vector_no, intr_handler function)
    idt_table[vector_no] = function;
 }
 
+/* 屏蔽8259A的所有中断, 改用IOAPIC后调用 */
+void pic_mask_all(void)
+{
+   outb(PIC_M_DATA, 0xff);
+   outb(PIC_S_DATA, 0xff);
+}
+
+/**
+ * @brief intr_eoi在kernel.S的中断入口中调用, 通知中断控制器中断处理结束.
+ *        8259A模式下主从片都发送EOI; APIC模式下只对外部中断和处理器间中断向本地APIC发送, 伪中断不需要
+ */
+void intr_eoi(uint8_t vec_nr)
+{
+   if (!apic_enabled)
+   {
+      outb(PIC_S_CTRL, 0x20); // 向从片发送
+      outb(PIC_M_CTRL, 0x20); // 向主片发送
+   }
+   else if (vec_nr >= 0x20 && vec_nr != SPURIOUS_VECTOR)
+   {
+      lapic_eoi();
+   }
+}
+
+/* 加载idt, 所有cpu共用一个idt */
+void idt_load(void)
+{
+   uint64_t idt_operand = ((sizeof(idt) - 0) | ((uint64_t)(uint32_t)idt << 16));
+   asm volatile("lidt %0"
+                :
+                : "m"(idt_operand));
+}
+
 /*完成有关中断的所有初始化工作*/
 void idt_init()
 {
@@ -240,9 +274,6 @@ void idt_init()
    pic_init();       // 初始化8259A
 
    /* 加载idt */
-   uint64_t idt_operand = ((sizeof(idt) - 0) | ((uint64_t)(uint32_t)idt << 16));
-   asm volatile("lidt %0"
-                :
-                : "m"(idt_operand));
+   idt_load();
    put_str("idt_init done\n");
 }
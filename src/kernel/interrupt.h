@@ -3,6 +3,9 @@
 #include "stdint.h"
 typedef void *intr_handler;
 void idt_init(void);
+void idt_load(void);
+void pic_mask_all(void);
+void intr_eoi(uint8_t vec_nr);
 
 /* 定义中断的两种状态:
  * INTR_OFF值为0,表示关中断,
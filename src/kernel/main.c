@@ -16,12 +16,17 @@
 #include "ide.h"
 #include "assert.h"
 #include "timer.h"
+#include "journal.h"
 
 void init(void);
 extern tm_t time;
 int main(void)
 {
    init_all();
+#ifdef JOURNAL_CRASH_TEST
+   // 日志崩溃测试: make JOURNAL_CRASH_TEST=<崩溃点> 构建的内核在指定位置模拟掉电, 重启后用 make JOURNAL_CRASH_TEST=0 构建的内核检查文件系统
+   journal_crash_test(JOURNAL_CRASH_TEST);
+#endif
    /************    写入应用程序    *************/
    // uint32_t file_size = 21284;
    // uint32_t sec_cnt = DIV_ROUND_UP(file_size, 512);
@@ -9,6 +9,10 @@
 
 // 调试使用的头文件，不用的时候可以删除掉
 #include "stdio-kernel.h"
+#include "smp.h"
+#include "fpu.h"
+#include "timer.h"
+#include "bench.h"
 
 // memory是系统的内存管理模块，因此需要先规划系统的物理内存
 
@@ -62,9 +66,16 @@
 // 但是注意，物理内存0x00100000~0x00100FFF存放了页目录,0x00101000~0x00101FFF存放了第一个页表
 // 因此虚拟地址0xC0100000~0xC0101FFF要重新映射
 
+// mem_init之后内核空间改为直接映射: 物理地址paddr映射在0xC0000000 + paddr, 覆盖0到内核内存池的末尾(按4MB向上取整).
+// cpu支持PSE时每个页目录项直接映射一个4MB的大页, 不用页表, 整个内核只占几个tlb项.
+// loader预留的254个页表不再使用, 0x00102000以后都并入内核内存池, 内核堆就是内核内存池在直接映射区中的部分.
+// 直接映射区后面的一个4MB是kmap窗口等需要单独映射的内核虚拟地址, 由kernel_vaddr管理
+
 // 一个物理页大小的位图可以表示的内存4096 byte * 8 bit * 4 KB = 128M，完全足够内核使用了，所以使用一个页来管理内核的内存就可以了
 #define MEM_BITMAP_BASE 0xC009A000 // 内核的位图放在0xC009A000处
-#define K_HEAP_START 0xC0100000    // 内核的堆建立在0xC0100000处, 只是选择在这里, 这里以及后面一大片区域，全是内核的内存
+#define K_HEAP_START 0xC0102000    // 内核的堆即内核内存池在直接映射区中的位置, 从页目录和第一个页表之后开始
+#define KVADDR_PAGES 1024          // 直接映射区之后单独映射的内核虚拟页数, 正好用一个页表
+#define MMIO_VADDR_LOW 0xfec00000  // 内核空间中最低的设备寄存器地址(IOAPIC, 本地APIC在0xfee00000), 由mmio_map映射
 
 #define PDE_IDX(addr) ((addr & 0xffc00000) >> 22)
 #define PTE_IDX(addr) ((addr & 0x003ff000) >> 12)
@@ -78,6 +89,8 @@ typedef struct pool
    uint32_t phy_addr_start; // 本内存池所管理的物理内存的起始地址
    uint32_t pool_size;      // 本内存池的字节容量
    lock_t mutex;            // 内存池是共享变量，申请内存时候要保证互斥
+   uint32_t zero_pages[ZERO_POOL_PAGES]; // idle预先清零的物理页, 在位图中已标记为占用
+   uint32_t zero_cnt;                    // zero_pages中的页数
 } pool_t;
 
 pool_t kernel_pool, user_pool; /// 内核内存池和用户内存池
@@ -86,10 +99,16 @@ virtual_addr_t kernel_vaddr;   /// 用于管理内核虚拟地址
 /// 内核不同大小内存单元的售货窗口
 mem_block_desc_t k_block_descs[DESC_CNT];
 
-#define mem_idx(addr) ((addr - 0x200000) / PG_SIZE)
+#define mem_idx(addr) ((addr - 0x102000) / PG_SIZE)
 #define Physical_Page 7800
 uint8_t mem[7800] = {0}; // 哈希表，描述物理页被引用的情况
 
+static uint32_t direct_map_end; // 直接映射区覆盖的物理内存上限, 4MB对齐
+
+static void *palloc(pool_t *m_pool, uint32_t gfp);
+static void kmap_init(void);
+static void kernel_direct_map_init(void);
+
 /**
  * @brief mem_pool_init用于初始化内存池
  *
@@ -111,9 +130,10 @@ static void mem_pool_init(uint32_t all_mem)
    //      0x101000~0x101FFF第二个物理页存放了第一个页表（该页表指向0~4MB空间，即内核）
    //      操作系统运行占用1G内存，描述这部分内存用了是页目录中C00~FFE这254个页表，而一个
    //      页表要用一个物理页保存，所以描述操作系统运行所需要的内存需要254物理页以保存这254个页表（虽然这254个页目前只初始化了第一个页）
-   // 所以目前已经已经用了：1MB系统内核 + 256个物理页 * 4KB
-   uint32_t page_table_size = PG_SIZE * 256;
-   uint32_t used_mem = page_table_size + 0x100000; // 2MB
+   // 这254个页表在kernel_direct_map_init改为直接映射后就不再使用, 一并放入内核内存池,
+   // 所以目前已经已经用了：1MB系统内核 + 页目录 + 第一个页表
+   uint32_t page_table_size = PG_SIZE * 2;
+   uint32_t used_mem = page_table_size + 0x100000; // 1MB + 8KB
    uint32_t free_mem = all_mem - used_mem;
    uint16_t all_free_page = free_mem / PG_SIZE;
 
@@ -123,7 +143,7 @@ static void mem_pool_init(uint32_t all_mem)
 
    // 初始化内核物理内存池，内存池用bitmap来描述
    uint32_t kbm_length = kernel_free_pages / 8;         // 描述内核物理内存的bitmap (kernel bitmap)的长度
-   uint32_t kp_start = used_mem;                        // 内核内存池从1MB + 1MB后开始
+   uint32_t kp_start = used_mem;                        // 内核内存池从1MB + 8KB后开始
    kernel_pool.phy_addr_start = kp_start;               // 设置内核物理内存开始地址为已经使用的内存之后
    kernel_pool.pool_size = kernel_free_pages * PG_SIZE; // 单位:字节
    // 初始化内核内存池
@@ -155,12 +175,18 @@ static void mem_pool_init(uint32_t all_mem)
 
    lock_init(&user_pool.mutex);
    lock_init(&kernel_pool.mutex);
+   user_pool.zero_cnt = kernel_pool.zero_cnt = 0;
+   // 直接映射区覆盖整个内核内存池, 按4MB大页向上取整
+   direct_map_end = (up_start + 0x3fffff) & 0xffc00000;
+   // 直接映射区和其后的kmap窗口都不能盖住mmio_map要映射的设备寄存器
+   ASSERT(direct_map_end + KVADDR_PAGES * PG_SIZE <= MMIO_VADDR_LOW - PAGE_OFFSET);
+
    // 内核虚拟内存初始化
-   // 内核虚拟地址位图按照物理内存大小初始化
-   kernel_vaddr.vaddr_bitmap.btmp_bytes_len = kbm_length;
+   // 内核堆在直接映射区中, 不用分配虚拟地址. 这里只管理直接映射区之后的KVADDR_PAGES个虚拟页
+   kernel_vaddr.vaddr_bitmap.btmp_bytes_len = KVADDR_PAGES / 8;
    // 内核虚拟地址位图也要一块内存储存，目前定位置在内核物理内存位图和用户物理内存位图后面
    kernel_vaddr.vaddr_bitmap.bits = (void *)(MEM_BITMAP_BASE + kbm_length + ubm_length);
-   kernel_vaddr.vaddr_start = K_HEAP_START; // 内核虚拟内存的起始地址为
+   kernel_vaddr.vaddr_start = PAGE_OFFSET + direct_map_end;
    bitmap_init(&kernel_vaddr.vaddr_bitmap);
 
    put_str("    mem_pool_init done\n");
@@ -181,7 +207,9 @@ void mem_init()
    put_str("mem_init start\n");
    uint32_t mem_byte_total = (*(uint32_t *)(0xb00)); // loader.S中获取了系统当前的内存，保存在0xb00中，现在获取该值
    mem_pool_init(mem_byte_total);
+   kernel_direct_map_init();
    block_desc_init(k_block_descs);
+   kmap_init();
    put_str("mem_init done\n");
 }
 
@@ -228,12 +256,12 @@ static void *vaddr_get(pool_flags_t pf, uint32_t pg_cnt)
    {
       // 从用户虚拟内存池中分配页
       task_struct_t *cur = running_thread();
-      if ((bit_idx_start = bitmap_scan(&cur->userprog_vaddr.vaddr_bitmap, pg_cnt)) == -1)
+      if ((bit_idx_start = bitmap_scan(&cur->mm->userprog_vaddr.vaddr_bitmap, pg_cnt)) == -1)
          return NULL;
       // 设置位图中的位
       while (cnt < pg_cnt)
-         bitmap_set(&cur->userprog_vaddr.vaddr_bitmap, bit_idx_start + cnt++, 1);
-      vaddr_start = cur->userprog_vaddr.vaddr_start + bit_idx_start * PG_SIZE;
+         bitmap_set(&cur->mm->userprog_vaddr.vaddr_bitmap, bit_idx_start + cnt++, 1);
+      vaddr_start = cur->mm->userprog_vaddr.vaddr_start + bit_idx_start * PG_SIZE;
 
       // 0xC000_0000 ~ 0xC000_0FFF将用于存储用户的三级栈，因此分配得到的空间覆盖这里
       ASSERT((uint32_t)vaddr_start < (0xC0000000 - PG_SIZE));
@@ -241,25 +269,296 @@ static void *vaddr_get(pool_flags_t pf, uint32_t pg_cnt)
    return (void *)vaddr_start;
 }
 
+/* ================================================================================================================== */
+/* ============================================== 临时映射与预先清零的物理页 ============================================= */
+/* ================================================================================================================== */
+
+static uint32_t kmap_base; // 各cpu临时映射窗口的起始虚拟地址, 第cpu个cpu的第type个窗口在kmap_base + (cpu * KM_TYPE_NR + type) * PG_SIZE
+
+/**
+ * @brief kmap_init从内核虚拟地址池中为每个cpu的每种用途留出一页作为临时映射窗口, 并建好窗口所在的页表,
+ *        之后kmap_atomic直接改pte即可. 用户进程的页目录只在创建时复制内核的页目录项, 所以要在mem_init中建好
+ */
+static void kmap_init(void)
+{
+   kmap_base = (uint32_t)vaddr_get(PF_KERNEL, NR_CPUS * KM_TYPE_NR);
+   if (kmap_base == 0)
+      PANIC("kmap_init: no kernel virtual address");
+   uint32_t pt_phyaddr = (uint32_t)palloc(&kernel_pool, 0);
+   if (pt_phyaddr == 0)
+      PANIC("kmap_init: no free page for page table");
+   clear_pages(PHYS_TO_VIRT(pt_phyaddr), 1);
+   *pde_ptr(kmap_base) = pt_phyaddr | PG_US_U | PG_RW_W | PG_P_1;
+}
+
+/* 使本cpu的tlb中vaddr所在页的映射失效 */
+static inline void invlpg(uint32_t vaddr)
+{
+   asm volatile("invlpg (%0)"
+                :
+                : "r"(vaddr)
+                : "memory");
+}
+
+/**
+ * @brief kmap_atomic把物理页paddr映射到本cpu的type号临时窗口上. 窗口只由本cpu使用, 只刷新本cpu的tlb即可.
+ *        须关中断调用, 用完后调用kunmap_atomic, 期间不能被切换到别的cpu
+ *
+ * @param paddr 物理页地址, 4K对齐
+ * @param type 窗口的用途
+ * @return void* 窗口的虚拟地址
+ */
+void *kmap_atomic(uint32_t paddr, enum km_type type)
+{
+   ASSERT(intr_get_status() == INTR_OFF);
+   uint32_t vaddr = kmap_base + (running_thread()->cpu * KM_TYPE_NR + type) * PG_SIZE;
+   *pte_ptr(vaddr) = paddr | PG_US_S | PG_RW_W | PG_P_1;
+   invlpg(vaddr);
+   return (void *)vaddr;
+}
+
+/* 解除kmap_atomic建立的临时映射 */
+void kunmap_atomic(void *vaddr)
+{
+   *pte_ptr((uint32_t)vaddr) = 0;
+   invlpg((uint32_t)vaddr);
+}
+
+#define CPUID_PSE (1 << 3)  // cpuid 1号功能edx: 支持4MB大页
+#define CPUID_PGE (1 << 13) // cpuid 1号功能edx: 支持全局页
+#define CR4_PSE (1 << 4)    // 打开4MB大页
+#define CR4_PGE (1 << 7)    // 打开全局页
+
+static uint32_t paging_cr4_bits; // 内核页表用到的CR4位, 由kernel_direct_map_init按cpuid设置
+
+/* 内核页表要求的CR4位. ap的启动代码在打开分页前就要设置, 否则内核所在的大页无法访问 */
+uint32_t paging_cr4(void)
+{
+   return paging_cr4_bits;
+}
+
+/* 在bsp上打开内核页表要求的CR4位 */
+static void paging_cpu_init(void)
+{
+   uint32_t cr4;
+   asm volatile("movl %%cr4, %0"
+                : "=r"(cr4));
+   asm volatile("movl %0, %%cr4"
+                :
+                : "r"(cr4 | paging_cr4_bits)
+                : "memory");
+}
+
+/* 重新加载cr3, 刷新本cpu的tlb中非全局页的映射, 即用户空间的映射 */
+static inline void tlb_flush_user(void)
+{
+   uint32_t cr3;
+   asm volatile("movl %%cr3, %0; movl %0, %%cr3"
+                : "=r"(cr3)
+                :
+                : "memory");
+}
+
+/* 刷新本cpu的整个tlb. 全局页不受cr3重新加载的影响, 要把CR4.PGE清0再置1 */
+void tlb_flush_all(void)
+{
+   if (!(paging_cr4_bits & CR4_PGE))
+   {
+      tlb_flush_user();
+      return;
+   }
+   uint32_t cr4;
+   asm volatile("movl %%cr4, %0"
+                : "=r"(cr4));
+   asm volatile("movl %0, %%cr4"
+                :
+                : "r"(cr4 & ~CR4_PGE)
+                : "memory");
+   asm volatile("movl %0, %%cr4"
+                :
+                : "r"(cr4)
+                : "memory");
+}
+
+/* 开始收集一次操作中映射被修改的虚拟页 */
+void tlb_gather_init(struct tlb_gather *tlb)
+{
+   tlb->cnt = 0;
+   tlb->kernel = false;
+}
+
+/* 记下映射被修改的虚拟页vaddr, 在tlb_gather_flush之前, 本cpu的tlb中可能还是旧的映射 */
+void tlb_gather_add(struct tlb_gather *tlb, uint32_t vaddr)
+{
+   if (tlb->cnt < TLB_GATHER_MAX)
+      tlb->vaddrs[tlb->cnt] = vaddr & 0xfffff000;
+   tlb->cnt++;
+   if (vaddr >= 0xc0000000)
+      tlb->kernel = true;
+}
+
+/**
+ * @brief tlb_gather_flush使收集到的虚拟页在tlb中的映射失效. 页数不超过TLB_GATHER_MAX时逐页invlpg,
+ *        否则整体刷新一次: 只有用户空间的页时重新加载cr3, 内核空间的全局页还留在tlb中.
+ *        用户地址空间同时只在一个cpu上运行, 只刷新本cpu即可; 内核空间是所有cpu共享的,
+ *        其它cpu在下次获取大内核锁时看到kernel_tlb_gen变化后刷新
+ */
+void tlb_gather_flush(struct tlb_gather *tlb)
+{
+   if (tlb->cnt == 0)
+      return;
+   if (tlb->cnt <= TLB_GATHER_MAX)
+   {
+      uint32_t idx;
+      for (idx = 0; idx < tlb->cnt; idx++)
+         invlpg(tlb->vaddrs[idx]);
+   }
+   else if (tlb->kernel)
+      tlb_flush_all();
+   else
+      tlb_flush_user();
+
+   if (tlb->kernel)
+      kernel_tlb_gen++;
+   tlb_gather_init(tlb);
+}
+
+/* 清零物理页paddr, 在直接映射区中的直接清零, 否则通过临时窗口 */
+static void zero_phy_page(uint32_t paddr)
+{
+   if (paddr < direct_map_end)
+   {
+      clear_pages(PHYS_TO_VIRT(paddr), 1);
+      return;
+   }
+   enum intr_status old_status = intr_disable();
+   void *vaddr = kmap_atomic(paddr, KM_ZERO);
+   clear_pages(vaddr, 1);
+   kunmap_atomic(vaddr);
+   intr_set_status(old_status);
+}
+
 /**
  * @brief palloc用于在m_pool指向的内存池中分配1个物理页
  *
  * @param m_pool 要分配物理页的内存池的地址
+ * @param gfp 分配标志, GFP_ZERO表示要清零的页, 有预先清零的页时直接取用, 否则当场清零
  * @return void* 若成功，则返回物理页第一个字节的物理地址，若失败则返回NULL
  */
-static void *palloc(pool_t *m_pool)
+static void *palloc(pool_t *m_pool, uint32_t gfp)
 {
-   int bit_idx = bitmap_scan(&m_pool->pool_bitmap, 1);
-   if (bit_idx == -1)
+   uint32_t page_phyaddr;
+   int bit_idx = -1;
+   if (!(gfp & GFP_ZERO) || m_pool->zero_cnt == 0)
+      bit_idx = bitmap_scan(&m_pool->pool_bitmap, 1);
+
+   if (bit_idx != -1)
+   {
+      bitmap_set(&m_pool->pool_bitmap, bit_idx, 1);
+      page_phyaddr = ((bit_idx * PG_SIZE) + m_pool->phy_addr_start);
+      if (gfp & GFP_ZERO)
+         zero_phy_page(page_phyaddr);
+   }
+   else if (m_pool->zero_cnt > 0)
+   {
+      // 要清零的页, 或位图中已没有空闲页时, 从预先清零的页中取
+      page_phyaddr = m_pool->zero_pages[--m_pool->zero_cnt];
+   }
+   else
       return NULL;
 
-   bitmap_set(&m_pool->pool_bitmap, bit_idx, 1);
-   uint32_t page_phyaddr = ((bit_idx * PG_SIZE) + m_pool->phy_addr_start);
    mem[mem_idx(page_phyaddr)] = 1;
-
    return (void *)page_phyaddr;
 }
 
+/**
+ * @brief kernel_direct_map_init把内核空间改为直接映射: 物理地址0到direct_map_end映射在PAGE_OFFSET开始的虚拟地址上,
+ *        cpu支持PSE时用4MB大页, 否则为每4MB分配一个页表. 支持PGE时都设为全局页. 其余内核页目录项清空,
+ *        loader预留在0x102000开始的页表不再使用, 已在mem_pool_init中并入内核内存池.
+ *        loader让第0个和第768个页目录项共用第一个页表, 改完后只有第0个页目录项的低端1MB一一映射仍用它,
+ *        第768个页目录项换成新的页表或大页
+ */
+static void kernel_direct_map_init(void)
+{
+   uint32_t eax = 1, ebx, ecx, edx;
+   asm volatile("cpuid"
+                : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+   if (edx & CPUID_PSE)
+      paging_cr4_bits |= CR4_PSE;
+   if (edx & CPUID_PGE)
+      paging_cr4_bits |= CR4_PGE;
+   // 先打开PSE再填写大页的页目录项, 否则cpu会把大页当作页表
+   paging_cpu_init();
+
+   uint32_t global = paging_cr4_bits & CR4_PGE ? PG_G : 0;
+   uint32_t vaddr, paddr, pte_idx;
+   // 没有大页时, 新页表不一定在已映射的低端1MB中. 先把它挂在kmap窗口的页目录项上,
+   // 通过页目录的自映射填写, 再装到目标页目录项. kmap_init之后才使用这个页目录项
+   uint32_t scratch = PAGE_OFFSET + direct_map_end;
+
+   // 清空第一个之后的内核页目录项, 它们指向的预留页表马上会被分配出去. 最后一个页目录项指向页目录自身, 保留
+   for (vaddr = PAGE_OFFSET + 0x400000; vaddr < 0xffc00000; vaddr += 0x400000)
+      *pde_ptr(vaddr) = 0;
+   tlb_flush_user();
+
+   for (paddr = 0; paddr < direct_map_end; paddr += 0x400000)
+   {
+      uint32_t pde;
+      if (paging_cr4_bits & CR4_PSE)
+         pde = paddr | PG_PS | global | PG_US_U | PG_RW_W | PG_P_1;
+      else
+      {
+         uint32_t pt_phyaddr = (uint32_t)palloc(&kernel_pool, 0);
+         if (pt_phyaddr == 0)
+            PANIC("kernel_direct_map_init: no free page for page table");
+         *pde_ptr(scratch) = pt_phyaddr | PG_US_U | PG_RW_W | PG_P_1;
+         uint32_t *pt = pte_ptr(scratch);
+         invlpg((uint32_t)pt);
+         for (pte_idx = 0; pte_idx < 1024; pte_idx++)
+            pt[pte_idx] = (paddr + pte_idx * PG_SIZE) | global | PG_US_U | PG_RW_W | PG_P_1;
+         pde = pt_phyaddr | PG_US_U | PG_RW_W | PG_P_1;
+      }
+      // 第一个页目录项改写前后映射的物理页相同, 正在执行的内核代码不受影响
+      *pde_ptr(PAGE_OFFSET + paddr) = pde;
+   }
+   *pde_ptr(scratch) = 0;
+   tlb_flush_all();
+}
+
+/**
+ * @brief zero_pool_refill由idle线程在没有就绪任务时调用, 从位图中取出空闲页清零后放入各内存池的zero_pages,
+ *        直到放满或有任务要运行. 之后带GFP_ZERO的分配不用再当场清零.
+ *        idle不能睡眠, 用lock_try_acquire获取内存池的锁, 有任务持有时本次不补充
+ */
+void zero_pool_refill(void)
+{
+   pool_t *pools[] = {&kernel_pool, &user_pool};
+   uint32_t idx;
+   for (idx = 0; idx < sizeof(pools) / sizeof(pools[0]); idx++)
+   {
+      pool_t *m_pool = pools[idx];
+      while (m_pool->zero_cnt < ZERO_POOL_PAGES && !need_resched)
+      {
+         if (!lock_try_acquire(&m_pool->mutex))
+            break;
+         // 每次只清零一页, 期间关中断, 避免持有内存池的锁时被换下cpu
+         enum intr_status old_status = intr_disable();
+         int bit_idx = bitmap_scan(&m_pool->pool_bitmap, 1);
+         if (bit_idx != -1)
+         {
+            bitmap_set(&m_pool->pool_bitmap, bit_idx, 1);
+            uint32_t page_phyaddr = bit_idx * PG_SIZE + m_pool->phy_addr_start;
+            zero_phy_page(page_phyaddr);
+            m_pool->zero_pages[m_pool->zero_cnt++] = page_phyaddr;
+         }
+         intr_set_status(old_status);
+         lock_release(&m_pool->mutex);
+         if (bit_idx == -1)
+            break;
+      }
+   }
+}
+
 /**
  * @brief page_table_add用于在页表中添加虚拟地址所属的虚拟页与物理地址所属的物理页的映射。
  *        页表项是不存在的
@@ -272,7 +571,8 @@ static void *palloc(pool_t *m_pool)
 static void page_table_add(void *_vaddr, void *_page_phyaddr, uint8_t pte_flag)
 {
    uint32_t vaddr = (uint32_t)_vaddr;
-   uint32_t page_phyaddr = (uint32_t)_page_phyaddr;
+   // 内核空间的映射所有进程共用, 作为全局页在切换进程时保留在tlb中
+   uint32_t page_phyaddr = (uint32_t)_page_phyaddr | (vaddr >= 0xc0000000 && (paging_cr4_bits & CR4_PGE) ? PG_G : 0);
 
    // 获取页表地址和页地址，这两个包含在pde和pte中
    uint32_t *pt_addr = pde_ptr(vaddr);
@@ -293,22 +593,24 @@ static void page_table_add(void *_vaddr, void *_page_phyaddr, uint8_t pte_flag)
    else
    {
       // pt_addr不存在，需要首先进行创建页目录项
-      uint32_t pt_phyaddr = (uint32_t)palloc(&kernel_pool);
+      uint32_t pt_phyaddr = (uint32_t)palloc(&kernel_pool, 0);
       *pt_addr = (pt_phyaddr | PG_US_U | PG_RW_W | PG_P_1);
-      // 页表中的数据要清0，避免原有的数据被误认为是页表项
-      memset((void *)((int)p_addr & 0xFFFFF000), 0, PG_SIZE);
+      // 页表中的数据要清0，避免原有的数据被误认为是页表项. mmio_map在建立线程前就可能来到这里, 不能用kmap_atomic
+      clear_pages((void *)((int)p_addr & 0xFFFFF000), 1);
       ASSERT(!(*p_addr & 0x00000001));
       *p_addr = (page_phyaddr | (pte_flag & 0x07));
    }
 }
 
 /**
- * @brief 修改页表项权限，需要确保页表项已经存在
+ * @brief 修改页表项权限，需要确保页表项已经存在. 修改后本cpu的tlb中可能还是旧的映射, 把这一页记入tlb,
+ *        由调用者在修改完后统一刷新
  *
  * @param vaddr
  * @param pte_flag
+ * @param tlb 收集映射被修改的虚拟页
  */
-static void Modify_PTE(uint32_t _vaddr, uint32_t _page_phyaddr, uint8_t pte_flag)
+static void Modify_PTE(uint32_t _vaddr, uint32_t _page_phyaddr, uint8_t pte_flag, struct tlb_gather *tlb)
 {
    uint32_t page_phyaddr = _page_phyaddr;
    uint32_t vaddr = (_vaddr & 0xfffff000); // 对齐于4kb边界
@@ -325,6 +627,7 @@ static void Modify_PTE(uint32_t _vaddr, uint32_t _page_phyaddr, uint8_t pte_flag
          *p_addr = (page_phyaddr | (pte_flag & 0x07)); // 修改权限
       else
          PANIC("pte repeat");
+      tlb_gather_add(tlb, vaddr);
    }
    else
       ASSERT((*pt_addr & 0x00000001));
@@ -338,6 +641,14 @@ static void Modify_PTE(uint32_t _vaddr, uint32_t _page_phyaddr, uint8_t pte_flag
  * @return void* 被绑定后的地址，等于(void*) vaddr
  */
 void *get_a_page(pool_flags_t pf, uint32_t vaddr)
+{
+   return get_a_page_gfp(pf, vaddr, 0);
+}
+
+/**
+ * @brief get_a_page_gfp与get_a_page相同, 分配物理页时带上分配标志gfp, 如GFP_ZERO得到清零的页
+ */
+void *get_a_page_gfp(pool_flags_t pf, uint32_t vaddr, uint32_t gfp)
 {
    pool_t *mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
    lock_acquire(&mem_pool->mutex);
@@ -349,9 +660,9 @@ void *get_a_page(pool_flags_t pf, uint32_t vaddr)
    if (cur->pgdir != NULL && pf == PF_USER)
    {
       // 若是用户进程申请用户内存，并且用户进程已经有虚拟内存页，则修改用户进程虚拟内存位图
-      bit_idx = (vaddr - cur->userprog_vaddr.vaddr_start) / PG_SIZE;
+      bit_idx = (vaddr - cur->mm->userprog_vaddr.vaddr_start) / PG_SIZE;
       ASSERT(bit_idx > 0);
-      bitmap_set(&cur->userprog_vaddr.vaddr_bitmap, bit_idx, 1);
+      bitmap_set(&cur->mm->userprog_vaddr.vaddr_bitmap, bit_idx, 1);
    }
    else if (cur->pgdir == NULL && pf == PF_KERNEL)
    {
@@ -363,9 +674,17 @@ void *get_a_page(pool_flags_t pf, uint32_t vaddr)
       PANIC("get_a_page: kernel allocates usersapce or user allocate kernelspace is not allowed!");
 
    // 分配一个物理页
-   void *page_phyaddr = palloc(mem_pool);
+   void *page_phyaddr = palloc(mem_pool, gfp);
    if (page_phyaddr == NULL)
+   {
+      // 归还已占用的虚拟页
+      if (pf == PF_USER)
+         bitmap_set(&cur->mm->userprog_vaddr.vaddr_bitmap, bit_idx, 0);
+      else
+         bitmap_set(&kernel_vaddr.vaddr_bitmap, bit_idx, 0);
+      lock_release(&mem_pool->mutex);
       return NULL;
+   }
 
    // 页表中添加虚拟页和物理页的映射
    page_table_add((void *)vaddr, page_phyaddr, PG_US_U | PG_RW_W | PG_P_1);
@@ -390,7 +709,7 @@ void *get_a_page_without_opvaddrbitmap(pool_flags_t pf, uint32_t vaddr)
 {
    pool_t *mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
    lock_acquire(&mem_pool->mutex);
-   void *page_phyaddr = palloc(mem_pool);
+   void *page_phyaddr = palloc(mem_pool, 0);
    if (page_phyaddr == NULL)
    {
       lock_release(&mem_pool->mutex);
@@ -442,26 +761,46 @@ void free_a_phy_page(uint32_t pg_phy_page)
  */
 uint32_t addr_v2p(uint32_t vaddr)
 {
+   // 4MB的大页没有页表, 物理地址是页目录项的高10位拼接虚拟地址的低22位
+   uint32_t pde = *pde_ptr(vaddr);
+   if (pde & PG_PS)
+      return (pde & 0xffc00000) + (vaddr & 0x003fffff);
    uint32_t *page_addr = pte_ptr(vaddr);
    // 去掉页表项低12位的页表项属性，而后拼接虚拟地址的低12位页内偏移得到物理地址
    return ((*page_addr & 0xFFFFF000) + (vaddr & 0x00000FFF));
 }
 
+/**
+ * @brief mmio_map把物理地址paddr所在的页映射到内核空间中相同的虚拟地址上, 并禁用缓存,
+ *        用于访问本地APIC, IOAPIC等内存映射的设备寄存器. 必须在创建第一个用户进程前调用,
+ *        因为用户进程的页目录只在创建时复制一次内核的页目录项
+ *
+ * @param paddr 设备寄存器的物理地址, 必须位于内核空间3GB以上, 且不与直接映射区和kmap窗口重叠
+ * @return void* 可以访问paddr的虚拟地址
+ */
+void *mmio_map(uint32_t paddr)
+{
+   uint32_t vaddr = paddr & 0xfffff000;
+   ASSERT(vaddr >= kernel_vaddr.vaddr_start + KVADDR_PAGES * PG_SIZE);
+   if (!(*pde_ptr(vaddr) & PG_P_1) || !(*pte_ptr(vaddr) & PG_P_1))
+   {
+      page_table_add((void *)vaddr, (void *)vaddr, PG_US_S | PG_RW_W | PG_P_1);
+      *pte_ptr(vaddr) |= PG_PCD | PG_PWT;
+   }
+   return (void *)paddr;
+}
+
 /**
  * @brief page_table_pte_remove用于将vaddr指向的虚拟内存地址所在的虚拟页从对应的页表中取消和物理页的映射
  *
  * @param vaddr 要取消映射的虚拟地址
+ * @param tlb 收集映射被解除的虚拟页, 由调用者统一刷新tlb
  */
-static void page_table_pte_remove(uint32_t vaddr)
+static void page_table_pte_remove(uint32_t vaddr, struct tlb_gather *tlb)
 {
    uint32_t *pte = pte_ptr(vaddr);
    *pte &= ~PG_P_1;
-   // invlpg update tlb
-   asm volatile(
-       "invlpg %0"
-       :
-       : "m"(vaddr)
-       : "memory");
+   tlb_gather_add(tlb, vaddr);
 }
 
 /**
@@ -488,9 +827,9 @@ static void vaddr_remove(pool_flags_t pf, void *_vaddr, uint32_t pg_cnt)
    {
       // release from user virtual memory
       task_struct_t *cur = running_thread();
-      bit_idx_start = (vaddr - cur->userprog_vaddr.vaddr_start) / PG_SIZE;
+      bit_idx_start = (vaddr - cur->mm->userprog_vaddr.vaddr_start) / PG_SIZE;
       while (cnt < pg_cnt)
-         bitmap_set(&cur->userprog_vaddr.vaddr_bitmap, bit_idx_start + cnt++, 0);
+         bitmap_set(&cur->mm->userprog_vaddr.vaddr_bitmap, bit_idx_start + cnt++, 0);
    }
 }
 
@@ -507,6 +846,8 @@ void mfree_page(pool_flags_t pf, void *_vaddr, uint32_t pg_cnt)
    uint32_t pg_phy_addr;
    uint32_t vaddr = (int32_t)_vaddr;
    uint32_t page_cnt = 0;
+   struct tlb_gather tlb;
+   tlb_gather_init(&tlb);
 
    // 对vaddr进行合法性检查
    // 要释放的页必须要大于等于1页, vaddr也必须指向虚拟页开始
@@ -534,27 +875,23 @@ void mfree_page(pool_flags_t pf, void *_vaddr, uint32_t pg_cnt)
          // 稍后统一释放虚拟页
 
          // 清除虚拟页和物理页的映射
-         page_table_pte_remove(vaddr);
+         page_table_pte_remove(vaddr, &tlb);
       }
+      tlb_gather_flush(&tlb);
       // 统一释放虚拟页
       vaddr_remove(pf, _vaddr, pg_cnt);
    }
    else
    {
+      // 内核的页在直接映射区中, 映射一直保留, 只释放物理页, 也不用刷新tlb
+      ASSERT((uint32_t)_vaddr >= K_HEAP_START && (uint32_t)_vaddr + pg_cnt * PG_SIZE <= PAGE_OFFSET + direct_map_end);
       while (page_cnt++ < pg_cnt)
       {
          vaddr += PG_SIZE;
-         pg_phy_addr = addr_v2p(vaddr);
+         pg_phy_addr = VIRT_TO_PHYS(vaddr);
          ASSERT((pg_phy_addr % PG_SIZE == 0) && kernel_pool.phy_addr_start <= pg_phy_addr && pg_phy_addr < user_pool.phy_addr_start)
-
-         // 先释放物理页
          free_a_phy_page(pg_phy_addr);
-         // 稍后统一释放虚拟页
-
-         // 清除虚拟页和物理页的映射
-         page_table_pte_remove(vaddr);
       }
-      vaddr_remove(pf, _vaddr, pg_cnt);
    }
 }
 
@@ -599,8 +936,50 @@ uint32_t *pde_ptr(uint32_t vaddr)
  * @return void* 若分配成功，则返回虚拟地址，失败则返回NULL
  */
 void *malloc_page(pool_flags_t pf, uint32_t pg_cnt)
+{
+   return malloc_page_gfp(pf, pg_cnt, 0);
+}
+
+/**
+ * @brief kernel_pages_alloc从内核内存池中分配pg_cnt个物理上连续的页, 返回它们在直接映射区中的虚拟地址.
+ *        直接映射在mem_init中已经建好, 不用分配虚拟地址, 也不用修改页表
+ *
+ * @param pg_cnt 页数
+ * @param gfp 分配标志, 单页时可以用预先清零的页
+ * @return void* 虚拟地址, 没有足够的连续物理页时返回NULL
+ */
+static void *kernel_pages_alloc(uint32_t pg_cnt, uint32_t gfp)
+{
+   if (pg_cnt == 1)
+   {
+      void *page_phyaddr = palloc(&kernel_pool, gfp);
+      return page_phyaddr == NULL ? NULL : PHYS_TO_VIRT(page_phyaddr);
+   }
+
+   int bit_idx_start = bitmap_scan(&kernel_pool.pool_bitmap, pg_cnt);
+   if (bit_idx_start == -1)
+      return NULL;
+   uint32_t page_phyaddr = kernel_pool.phy_addr_start + bit_idx_start * PG_SIZE;
+   uint32_t cnt = 0;
+   while (cnt < pg_cnt)
+   {
+      bitmap_set(&kernel_pool.pool_bitmap, bit_idx_start + cnt, 1);
+      mem[mem_idx(page_phyaddr + cnt * PG_SIZE)] = 1;
+      cnt++;
+   }
+   if (gfp & GFP_ZERO)
+      clear_pages(PHYS_TO_VIRT(page_phyaddr), pg_cnt);
+   return PHYS_TO_VIRT(page_phyaddr);
+}
+
+/**
+ * @brief malloc_page_gfp与malloc_page相同, 分配物理页时带上分配标志gfp, 如GFP_ZERO得到清零的页
+ */
+void *malloc_page_gfp(pool_flags_t pf, uint32_t pg_cnt, uint32_t gfp)
 {
    ASSERT(pg_cnt > 0 && pg_cnt < 3840);
+   if (pf == PF_KERNEL)
+      return kernel_pages_alloc(pg_cnt, gfp);
    // malloc_page的流程：
    //      1. 首先需要在虚拟内存池中申请得到一个虚拟页
    //      2. 然后需要在物理内存池中申请得到一个物理页
@@ -617,7 +996,7 @@ void *malloc_page(pool_flags_t pf, uint32_t pg_cnt)
    // 分配物理页, 并对每个物理页进行映射
    while (cnt-- > 0)
    {
-      void *page_phyaddr = palloc(mem_pool);
+      void *page_phyaddr = palloc(mem_pool, gfp);
       // 如果申请物理页失败，已经获得虚拟页要归还，后面再实现，也可以实现换页
       if (page_phyaddr == NULL)
          return NULL;
@@ -629,6 +1008,47 @@ void *malloc_page(pool_flags_t pf, uint32_t pg_cnt)
    return vaddr_start;
 }
 
+/**
+ * @brief clear_pages清零从vaddr开始的pg_cnt个页. cpu支持SSE2时(fpu_init中由cpuid检测)用非临时存储,
+ *        新页大多不会马上被整页读写, 绕过cache写入可以避免把有用的数据挤出去; 否则用rep stosl
+ *
+ * @param vaddr 起始虚拟地址, 4K对齐
+ * @param pg_cnt 页数
+ */
+void clear_pages(void *vaddr, uint32_t pg_cnt)
+{
+   if (!cpu_has_sse2)
+   {
+      memset(vaddr, 0, pg_cnt * PG_SIZE);
+      return;
+   }
+   enum intr_status old_status = kernel_fpu_begin();
+   while (pg_cnt-- > 0)
+   {
+      sse2_clear_page(vaddr);
+      vaddr = (uint8_t *)vaddr + PG_SIZE;
+   }
+   kernel_fpu_end(old_status);
+}
+
+/**
+ * @brief copy_page把src页的内容复制到dst页, 支持SSE2时用128位读写和非临时存储, 否则用rep movsl
+ *
+ * @param dst 目的页的虚拟地址, 4K对齐
+ * @param src 源页的虚拟地址, 4K对齐
+ */
+void copy_page(void *dst, const void *src)
+{
+   if (!cpu_has_sse2)
+   {
+      memcpy(dst, src, PG_SIZE);
+      return;
+   }
+   enum intr_status old_status = kernel_fpu_begin();
+   sse2_copy_page(dst, src);
+   kernel_fpu_end(old_status);
+}
+
 /**
  * @brief get_kernel_page用于从内核内存池中申请pg_cnt个页
  *
@@ -638,9 +1058,7 @@ void *malloc_page(pool_flags_t pf, uint32_t pg_cnt)
 void *get_kernel_pages(uint32_t pg_cnt)
 {
    lock_acquire(&kernel_pool.mutex);
-   void *vaddr = malloc_page(PF_KERNEL, pg_cnt);
-   if (vaddr != NULL)
-      memset(vaddr, 0, pg_cnt * PG_SIZE);
+   void *vaddr = malloc_page_gfp(PF_KERNEL, pg_cnt, GFP_ZERO);
    lock_release(&kernel_pool.mutex);
    return vaddr;
 }
@@ -659,9 +1077,7 @@ void *get_user_pages(uint32_t pg_cnt)
 {
    // 未来可能会有多个用户进程，因此需要上锁
    lock_acquire(&user_pool.mutex);
-   void *vaddr = malloc_page(PF_USER, pg_cnt);
-   // if (vaddr != NULL)
-   memset(vaddr, 0, pg_cnt * PG_SIZE);
+   void *vaddr = malloc_page_gfp(PF_USER, pg_cnt, GFP_ZERO);
    lock_release(&user_pool.mutex);
    return vaddr;
 }
@@ -765,7 +1181,7 @@ void *sys_malloc(uint32_t size)
       pf = PF_USER;
       mem_pool = &user_pool;
       pool_size = user_pool.pool_size;
-      descs = cur->u_block_desc;
+      descs = cur->mm->u_block_desc;
    }
 
    // 申请的内存数量不合法
@@ -782,13 +1198,12 @@ void *sys_malloc(uint32_t size)
       // 超过最大1024字节的mem_block_desc, 直接分配整个页
       uint32_t page_cnt = DIV_ROUND_UP(size + sizeof(arena_t), PG_SIZE) + 1;
 
-      if ((a = malloc_page(pf, page_cnt)) == NULL)
+      if ((a = malloc_page_gfp(pf, page_cnt, GFP_ZERO)) == NULL)
       {
          // 分配失败, 释放锁, 直接放回
          lock_release(&mem_pool->mutex);
          return NULL;
       }
-      memset(a, 0, page_cnt * PG_SIZE);
 
       a->desc = NULL;
       a->free_cnt = page_cnt;
@@ -809,13 +1224,12 @@ void *sys_malloc(uint32_t size)
       // 若mem_block_desc的free_list中已经没有可用的mem_block, 则创建新的arena提供mem_block
       if (list_empty(&descs[desc_idx].free_list))
       {
-         if ((a = malloc_page(pf, 1)) == NULL)
+         // 初始化arena, 页要清零
+         if ((a = malloc_page_gfp(pf, 1, GFP_ZERO)) == NULL)
          {
             lock_release(&mem_pool->mutex);
             return NULL;
          }
-         // 初始化arena
-         memset(a, 0, PG_SIZE);
 
          // 下面将arena拆分成内存块, 即将内存块链接到链表中, 必须要关中断
          intr_status_t old_status = intr_disable();
@@ -912,25 +1326,45 @@ void sys_free(void *ptr)
  */
 void do_wp_page(uint32_t error_code, uint32_t address)
 {
-
-   uint32_t pvaddr = addr_v2p(address & 0xfffff000);
+#ifdef CONFIG_BENCH
+   uint64_t start = rdtsc();
+#endif
+   uint32_t vaddr = address & 0xfffff000;
+   uint32_t pvaddr = addr_v2p(vaddr);
+   struct tlb_gather tlb;
+   tlb_gather_init(&tlb);
 
    if (mem[mem_idx(pvaddr)] == 1)
    { // 物理页独享 - 修改页面权限返回，
-      Modify_PTE(address, pvaddr, PG_US_U | PG_RW_W | PG_P_1);
+      Modify_PTE(vaddr, pvaddr, PG_US_U | PG_RW_W | PG_P_1, &tlb);
+      tlb_gather_flush(&tlb);
+#ifdef CONFIG_BENCH
+      bench_cow_fault(start, false);
+#endif
       return;
    }
 
-   // 分配新页面给进程，在进程用的时候给进程分配页面,给子进程分配新的页面
-   void *buf_page = get_kernel_pages(1);
-   void *new_page = palloc(&kernel_pool);
-   memcpy(buf_page, (void *)(address & 0xfffff000), PG_SIZE);
-   Modify_PTE(address, (uint32_t)new_page, PG_US_U | PG_RW_W | PG_P_1);
-   memcpy((void *)(address & 0xfffff000), buf_page, PG_SIZE);
+   // 从用户内存池分配新页面. 原页仍以只读映射在vaddr上, 新页临时映射到本cpu的窗口, 直接从原页复制过去
+   lock_acquire(&user_pool.mutex);
+   uint32_t new_page = (uint32_t)palloc(&user_pool, 0);
+   lock_release(&user_pool.mutex);
+   if (new_page == 0)
+      PANIC("do_wp_page: no free page in user_pool");
 
-   mem[mem_idx(pvaddr)]--; // 原物理页共享数减一
+   enum intr_status old_status = intr_disable();
+   void *dst = kmap_atomic(new_page, KM_COW);
+   copy_page(dst, (void *)vaddr);
+   kunmap_atomic(dst);
+   intr_set_status(old_status);
+
+   // 让进程的虚拟页指向新页, 只需使本cpu上这一页的tlb失效: 同一地址空间的任务只在一个cpu上运行
+   Modify_PTE(vaddr, new_page, PG_US_U | PG_RW_W | PG_P_1, &tlb);
+   tlb_gather_flush(&tlb);
 
-   mfree_page(PF_KERNEL, buf_page, 1);
+   mem[mem_idx(pvaddr)]--; // 原物理页共享数减一
+#ifdef CONFIG_BENCH
+   bench_cow_fault(start, true);
+#endif
 }
 
 /**
@@ -943,29 +1377,140 @@ void do_no_page(uint32_t error_code, uint32_t address)
 {
 }
 
+/**
+ * @brief child_pte_set在页目录pgdir中把vaddr映射为页表项pte, 页表不存在时先分配.
+ *        pgdir不是当前使用的页目录, 其页表不在递归映射中, 页表来自内核内存池, 通过直接映射填写, 不用切换cr3
+ */
+static void child_pte_set(uint32_t *pgdir, uint32_t vaddr, uint32_t pte)
+{
+   uint32_t *pde = pgdir + PDE_IDX(vaddr);
+   if (!(*pde & PG_P_1))
+   {
+      uint32_t pt_phyaddr = (uint32_t)palloc(&kernel_pool, GFP_ZERO);
+      if (pt_phyaddr == 0)
+         PANIC("child_pte_set: no free page for page table");
+      *pde = pt_phyaddr | PG_US_U | PG_RW_W | PG_P_1;
+   }
+   uint32_t *pt = PHYS_TO_VIRT(*pde & 0xfffff000);
+   ASSERT(!(pt[PTE_IDX(vaddr)] & PG_P_1));
+   pt[PTE_IDX(vaddr)] = pte;
+}
+
 /**
  * @brief 供fork()使用，填充子进程页表项，修改父进程页表项权限
  *
  * @param address 需要填充的虚拟地址
+ * @param tlb 收集父进程中被去掉写权限的页, 全部填充完后由调用者统一刷新tlb
  */
-void full_childProcess_pageTable(void *child_thread, void *parent_thread, uint32_t vaddress)
+void full_childProcess_pageTable(void *child_thread, void *parent_thread, uint32_t vaddress, struct tlb_gather *tlb)
 {
    uint32_t pvaddr = addr_v2p(vaddress);
-   Modify_PTE(vaddress, pvaddr, PG_US_U | PG_P_1);
+   bool shared = (*pte_ptr(vaddress) & PG_SHARED) != 0;
+   if (!shared) // 共享页保持可写, 其余页去掉写权限, 写时再复制
+      Modify_PTE(vaddress, pvaddr, PG_US_U | PG_P_1, tlb);
 
-   // 使用子进程的页目录, 此后操作的就是子进程的虚拟内存
-   page_dir_activate((struct task_struct *)child_thread);
-   page_table_add((void *)vaddress, (void *)pvaddr, PG_US_U | PG_P_1);
-   page_dir_activate((struct task_struct *)parent_thread); // 切换成父亲进程页表
+   // 直接填写子进程的页表, 不必为每一页来回切换cr3
+   uint32_t pte = pvaddr | PG_US_U | PG_P_1;
+   if (shared)
+      pte |= PG_RW_W | PG_SHARED;
+   child_pte_set(((struct task_struct *)child_thread)->pgdir, vaddress, pte);
 
    mem[mem_idx(pvaddr)]++;
 }
 
+/**
+ * @brief sys_mmap_shared在当前进程的用户空间分配size字节(按页向上取整)的共享内存, 内容清0.
+ *        fork时这些页不做写时复制, 父子进程映射同一物理页, 一方的写入另一方立即可见, 进程退出时按引用计数回收.
+ *        用于进程间在同一个futex字上同步
+ *
+ * @param size 字节数
+ * @return void* 起始虚拟地址, 失败返回NULL
+ */
+void *sys_mmap_shared(uint32_t size)
+{
+   struct task_struct *cur = running_thread();
+   uint32_t pg_cnt = DIV_ROUND_UP(size, PG_SIZE);
+   if (cur->pgdir == NULL || pg_cnt == 0)
+      return NULL;
+
+   uint32_t vaddr = (uint32_t)get_user_pages(pg_cnt);
+   if (vaddr == 0)
+      return NULL;
+   uint32_t pg_idx = 0;
+   while (pg_idx < pg_cnt)
+   {
+      *pte_ptr(vaddr + pg_idx * PG_SIZE) |= PG_SHARED;
+      pg_idx++;
+   }
+   return (void *)vaddr;
+}
+
+/**
+ * @brief sys_sbrk把当前进程的堆的末尾移动increment字节, 增长时映射新的页并清零, 缩小时释放不再用到的页.
+ *        用户态的malloc只在空闲块不够时调用它
+ *
+ * @param increment 增加的字节数, 可以为负, 为0时只返回当前的末尾
+ * @return void* 原来的末尾, 超出[USER_HEAP_START, USER_HEAP_END)或内存不足时返回(void *)-1
+ */
+void *sys_sbrk(int32_t increment)
+{
+   struct task_struct *cur = running_thread();
+   if (cur->pgdir == NULL)
+      return (void *)-1;
+   struct mm_struct *mm = cur->mm;
+   uint32_t old_brk = mm->brk;
+   uint32_t new_brk = old_brk + increment;
+   if ((increment > 0 && new_brk < old_brk) || (increment < 0 && new_brk > old_brk) ||
+       new_brk < USER_HEAP_START || new_brk > USER_HEAP_END)
+      return (void *)-1;
+
+   uint32_t old_end = DIV_ROUND_UP(old_brk, PG_SIZE) * PG_SIZE;
+   uint32_t new_end = DIV_ROUND_UP(new_brk, PG_SIZE) * PG_SIZE;
+   uint32_t vaddr;
+   if (new_end > old_end)
+   {
+      // 这段虚拟地址可能已被malloc_page等从位图中分走
+      for (vaddr = old_end; vaddr < new_end; vaddr += PG_SIZE)
+      {
+         if (bitmap_scan_test(&mm->userprog_vaddr.vaddr_bitmap, (vaddr - mm->userprog_vaddr.vaddr_start) / PG_SIZE))
+            return (void *)-1;
+      }
+      for (vaddr = old_end; vaddr < new_end; vaddr += PG_SIZE)
+      {
+         // 优先用idle预先清零的页, 没有时palloc当场清零
+         if (get_a_page_gfp(PF_USER, vaddr, GFP_ZERO) == NULL)
+         {
+            if (vaddr > old_end)
+               mfree_page(PF_USER, (void *)old_end, (vaddr - old_end) / PG_SIZE);
+            return (void *)-1;
+         }
+      }
+   }
+   else if (new_end < old_end)
+      mfree_page(PF_USER, (void *)new_end, (old_end - new_end) / PG_SIZE);
+   mm->brk = new_brk;
+   return (void *)old_brk;
+}
+
+/**
+ * @brief user_heap_reset释放当前进程的整个堆, 重新映射清零的第一页, 用户态的分配器看到清零的状态后重新初始化.
+ *        在进程开始运行和exec时调用, exec先把参数复制到内核中再调用
+ *
+ * @return int32_t 成功返回0, 内存不足返回-1
+ */
+int32_t user_heap_reset(void)
+{
+   struct mm_struct *mm = running_thread()->mm;
+   if (mm->brk > USER_HEAP_START)
+      sys_sbrk(USER_HEAP_START - mm->brk);
+   return sys_sbrk(PG_SIZE) == (void *)-1 ? -1 : 0;
+}
+
 void Debugmem()
 {
    for (int i = 0; i < Physical_Page; i++)
       if (mem[i])
       {
-         printk("%x:%d ", (i * PG_SIZE) + 0x200000, mem[i]);
+         printk("%x:%d ", (i * PG_SIZE) + 0x102000, mem[i]);
       }
-}
\ No newline at end of file
+}
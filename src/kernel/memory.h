@@ -11,12 +11,44 @@ enum pool_flags
    PF_USER = 2    // 用户内存池
 };
 typedef enum pool_flags pool_flags_t;
+
+/* palloc的分配标志 */
+#define GFP_ZERO 0x1 // 物理页须清零, 优先从idle预先清零的页中取
+
+#define ZERO_POOL_PAGES 64 // 每个内存池最多保留的预先清零的物理页数
+
+/* 每个cpu的临时映射窗口, 用于访问没有映射到内核空间的物理页. 每种用途一个, 关中断使用, 互不覆盖 */
+enum km_type
+{
+   KM_ZERO,    // 清零物理页
+   KM_COW,     // 写时复制的目的页
+   KM_TYPE_NR
+};
 #define PG_P_1 1  // 页表项或页目录项存在属性位
 #define PG_P_0 0  // 页表项或页目录项存在属性位
 #define PG_RW_R 0 // R/W 属性位值, 读/执行
 #define PG_RW_W 2 // R/W 属性位值, 读/写/执行
 #define PG_US_S 0 // U/S 属性位值, 系统级
 #define PG_US_U 4 // U/S 属性位值, 用户级
+#define PG_PWT 8  // PWT 属性位值, 直写
+#define PG_PCD 16 // PCD 属性位值, 禁用缓存, 用于内存映射的设备寄存器
+#define PG_PS 0x80 // 页目录项的PS位, 直接映射一个4MB的大页, 需要CR4.PSE
+#define PG_G 0x100 // 全局页, CR4.PGE打开后重新加载cr3时不从tlb中刷掉, 用于内核空间的映射
+#define PG_SHARED 0x200 // 页表项中留给软件的第9位: 该页fork后父子共享且都可写, 不做写时复制
+
+/* 内核空间的直接映射: 物理地址paddr映射在PAGE_OFFSET + paddr, 覆盖低端内存和整个内核内存池 */
+#define PAGE_OFFSET 0xc0000000
+#define PHYS_TO_VIRT(paddr) ((void *)((uint32_t)(paddr) + PAGE_OFFSET))
+#define VIRT_TO_PHYS(vaddr) ((uint32_t)(vaddr) - PAGE_OFFSET)
+
+/* 一次操作中映射被修改的虚拟页, 操作结束时统一刷新tlb. 页数不多时逐页invlpg, 超过TLB_GATHER_MAX页时整体刷新 */
+#define TLB_GATHER_MAX 32
+struct tlb_gather
+{
+   uint32_t cnt;                    // 收集到的页数, 超过TLB_GATHER_MAX后只计数不再记录
+   bool kernel;                     // 含有内核空间的页, 要通知其它cpu
+   uint32_t vaddrs[TLB_GATHER_MAX]; // 映射被修改的虚拟页
+};
 
 // 内存块描述符个数
 #define DESC_CNT 7
@@ -45,23 +77,52 @@ struct mem_block_desc
 };
 typedef struct mem_block_desc mem_block_desc_t;
 
+/* 用户地址空间. 进程clone出的线程与进程共享同一个, 最后一个使用者退出时才回收.
+ * 修改用户页表后只刷新本cpu的tlb, 所以同一地址空间的线程同时只在一个cpu上运行, 由schedule保证 */
+struct mm_struct
+{
+   uint32_t users;                               // 共享此地址空间的任务数
+   uint32_t running;                             // 正在cpu上运行的任务数
+   uint8_t cpu;                                  // running不为0时, 这些任务所在的cpu
+   struct virtual_addr userprog_vaddr;           // 用户进程的虚拟地址
+   uint32_t brk;                                 // 用户堆的末尾, 堆从USER_HEAP_START到这里, 已按页映射
+   bool group_exit;                              // 主线程正在退出, 同组的其它线程不再睡眠, 返回用户态前退出
+   struct mem_block_desc u_block_desc[DESC_CNT]; // 用户内存块描述符数组, 管理进程的堆
+};
+
 extern struct pool kernel_pool, user_pool;
 void mem_init(void);
 void *get_kernel_pages(uint32_t pg_cnt);
 void *malloc_page(enum pool_flags pf, uint32_t pg_cnt);
+void *malloc_page_gfp(enum pool_flags pf, uint32_t pg_cnt, uint32_t gfp);
 uint32_t *pte_ptr(uint32_t vaddr);
 uint32_t *pde_ptr(uint32_t vaddr);
 uint32_t addr_v2p(uint32_t vaddr);
 void *get_a_page(enum pool_flags pf, uint32_t vaddr);
+void *get_a_page_gfp(enum pool_flags pf, uint32_t vaddr, uint32_t gfp);
 void *get_user_pages(uint32_t pg_cnt);
+void clear_pages(void *vaddr, uint32_t pg_cnt);
+void copy_page(void *dst, const void *src);
+void *kmap_atomic(uint32_t paddr, enum km_type type);
+void kunmap_atomic(void *vaddr);
+void zero_pool_refill(void);
+uint32_t paging_cr4(void);
+void tlb_flush_all(void);
+void tlb_gather_init(struct tlb_gather *tlb);
+void tlb_gather_add(struct tlb_gather *tlb, uint32_t vaddr);
+void tlb_gather_flush(struct tlb_gather *tlb);
 void block_desc_init(struct mem_block_desc *desc_array);
 void *sys_malloc(uint32_t size);
 void sys_free(void *ptr);
 void mfree_page(enum pool_flags pf, void *_vaddr, uint32_t pg_cnt);
 void *get_a_page_without_opvaddrbitmap(enum pool_flags pf, uint32_t vaddr);
 void free_a_phy_page(uint32_t pg_phy_addr);
+void *mmio_map(uint32_t paddr);
+void *sys_mmap_shared(uint32_t size);
+void *sys_sbrk(int32_t increment);
+int32_t user_heap_reset(void);
 
-void full_childProcess_pageTable(void *child_thread, void *parent_thread, uint32_t vaddress);
+void full_childProcess_pageTable(void *child_thread, void *parent_thread, uint32_t vaddress, struct tlb_gather *tlb);
 void do_wp_page(uint32_t error_code, uint32_t address);
 void do_no_page(uint32_t error_code, uint32_t address);
 void Debugmem(); // 调试时候用
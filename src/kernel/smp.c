@@ -0,0 +1,464 @@
+#include "smp.h"
+#include "stdint.h"
+#include "global.h"
+#include "string.h"
+#include "print.h"
+#include "io.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "memory.h"
+#include "thread.h"
+#include "timer.h"
+#include "tss.h"
+#include "apic.h"
+#include "fpu.h"
+#include "stdio.h"
+
+/* MP表项的类型 */
+#define MP_PROC 0   // 处理器
+#define MP_BUS 1    // 总线
+#define MP_IOAPIC 2 // IOAPIC
+#define MP_IOINTR 3 // IOAPIC引脚的中断来源
+#define MP_LINTR 4  // 本地APIC引脚的中断来源
+
+#define MP_PROC_ENABLED 0x1 // 处理器可用
+#define MP_PROC_BSP 0x2     // 该处理器是bsp
+#define MP_IMCR 0x80        // 系统处于PIC模式, 需要通过IMCR把中断切到APIC
+
+#define IMCR_ADDR 0x22
+#define IMCR_DATA 0x23
+
+#define KERNEL_PAGE_DIR 0x100000 // 内核页目录的物理地址
+#define LOADER_GDT 0x900         // loader中gdt的物理地址
+
+/* MP浮动指针结构, 位于EBDA的第1KB, 常规内存的最后1KB或BIOS的ROM中, 16字节对齐 */
+struct mp_fptr
+{
+   char signature[4]; // "_MP_"
+   uint32_t physaddr; // MP配置表的物理地址
+   uint8_t length;    // 以16字节为单位, 为1
+   uint8_t specrev;
+   uint8_t checksum; // 所有字节之和为0
+   uint8_t type;     // 为0时有MP配置表
+   uint8_t imcrp;
+   uint8_t reserved[3];
+} __attribute__((packed));
+
+/* MP配置表头, 后面紧跟entry个表项 */
+struct mp_conf
+{
+   char signature[4]; // "PCMP"
+   uint16_t length;   // 含表头在内的长度
+   uint8_t version;
+   uint8_t checksum;
+   char product[20];
+   uint32_t oemtable;
+   uint16_t oemlength;
+   uint16_t entry;
+   uint32_t lapicaddr; // 本地APIC的物理地址
+   uint16_t xlength;
+   uint8_t xchecksum;
+   uint8_t reserved;
+} __attribute__((packed));
+
+/* 处理器表项, 20字节 */
+struct mp_proc
+{
+   uint8_t type;
+   uint8_t apicid;
+   uint8_t version;
+   uint8_t flags;
+   uint32_t signature;
+   uint32_t feature;
+   uint8_t reserved[8];
+} __attribute__((packed));
+
+/* 总线表项, 8字节 */
+struct mp_bus
+{
+   uint8_t type;
+   uint8_t busid;
+   char bustype[6];
+} __attribute__((packed));
+
+/* IOAPIC表项, 8字节 */
+struct mp_ioapic
+{
+   uint8_t type;
+   uint8_t apicno;
+   uint8_t version;
+   uint8_t flags;
+   uint32_t addr;
+} __attribute__((packed));
+
+/* 中断来源表项, 8字节, IOAPIC和本地APIC的共用 */
+struct mp_intr
+{
+   uint8_t type;
+   uint8_t irqtype;  // 0为普通中断
+   uint16_t irqflag; // 极性和触发方式
+   uint8_t srcbus;
+   uint8_t srcbusirq;
+   uint8_t dstapic;
+   uint8_t dstirq; // 接到的引脚
+} __attribute__((packed));
+
+/* ap启动参数, 布局与ap_boot.S末尾一致 */
+struct ap_boot_args
+{
+   uint16_t gdt_limit;
+   uint32_t gdt_base;
+   uint16_t pad;
+   uint32_t cr3;
+   uint32_t cr4;
+   uint32_t stack;
+   uint32_t entry;
+} __attribute__((packed));
+
+extern char ap_trampoline_start[], ap_trampoline_end[], ap_boot_args[];
+
+struct cpu_info cpus[NR_CPUS];
+uint32_t cpu_count = 1;
+uint32_t volatile kernel_tlb_gen;
+
+/* 大内核锁. bsp从开机起就持有(0号已领出, 正轮到0号), 由main线程传给之后运行的任务 */
+static struct spinlock kernel_lock = {0, 1};
+
+static uint32_t mp_cpus = 1;  // MP表中可用的cpu数
+static bool mp_apic = false;  // MP表有效, 且找到了IOAPIC
+static bool mp_imcr = false;  // 需要设置IMCR
+
+static uint8_t mp_checksum(void *addr, uint32_t len)
+{
+   uint8_t sum = 0, *p = addr;
+   while (len-- > 0)
+   {
+      sum += *p++;
+   }
+   return sum;
+}
+
+/* 在物理地址[paddr, paddr+len)中找MP浮动指针 */
+static struct mp_fptr *mp_search_range(uint32_t paddr, uint32_t len)
+{
+   uint8_t *p = PHYS_TO_VIRT(paddr), *end = p + len;
+   for (; p < end; p += sizeof(struct mp_fptr))
+   {
+      if (memcmp(p, "_MP_", 4) == 0 && mp_checksum(p, sizeof(struct mp_fptr)) == 0)
+      {
+         return (struct mp_fptr *)p;
+      }
+   }
+   return NULL;
+}
+
+/* 依次在EBDA的第1KB, 常规内存的最后1KB, BIOS的ROM中找MP浮动指针 */
+static struct mp_fptr *mp_search(void)
+{
+   struct mp_fptr *fp;
+   uint32_t ebda = (uint32_t)*(uint16_t *)PHYS_TO_VIRT(0x40e) << 4;
+   if (ebda != 0 && (fp = mp_search_range(ebda, 1024)) != NULL)
+   {
+      return fp;
+   }
+   uint32_t base_kb = *(uint16_t *)PHYS_TO_VIRT(0x413);
+   if ((fp = mp_search_range(base_kb * 1024 - 1024, 1024)) != NULL)
+   {
+      return fp;
+   }
+   return mp_search_range(0xf0000, 0x10000);
+}
+
+/**
+ * @brief mp_init解析MP表, 得到所有cpu的APIC id, 本地APIC和IOAPIC的地址, 以及ISA中断接在IOAPIC的哪个引脚上.
+ *        必须在创建第一个用户进程之前调用, 见mmio_map. 找不到MP表或只有一个cpu时仍按单处理器运行
+ */
+void mp_init(void)
+{
+   put_str("mp_init start\n");
+   cpus[0].online = true;
+
+   struct mp_fptr *fp = mp_search();
+   /* 配置表在低端1MB以外或只有默认配置时按单处理器处理 */
+   if (fp == NULL || fp->physaddr == 0 || fp->physaddr >= 0x100000)
+   {
+      put_str("   no MP table, uniprocessor\n");
+      return;
+   }
+   struct mp_conf *conf = PHYS_TO_VIRT(fp->physaddr);
+   if (memcmp(conf->signature, "PCMP", 4) != 0 || mp_checksum(conf, conf->length) != 0)
+   {
+      put_str("   bad MP config table, uniprocessor\n");
+      return;
+   }
+
+   uint32_t ioapic_addr = 0;
+   uint8_t isa_bus = 0xff;
+   uint32_t ap = 1;
+   uint8_t *p = (uint8_t *)(conf + 1), *end = (uint8_t *)conf + conf->length;
+   /* 表项按类型排好序: 处理器, 总线, IOAPIC, 中断来源, 所以读到中断来源时已经知道ISA总线的编号 */
+   while (p < end)
+   {
+      switch (*p)
+      {
+      case MP_PROC:
+      {
+         struct mp_proc *proc = (struct mp_proc *)p;
+         if (proc->flags & MP_PROC_BSP)
+         {
+            cpus[0].apic_id = proc->apicid;
+         }
+         else if ((proc->flags & MP_PROC_ENABLED) && ap < NR_CPUS)
+         {
+            cpus[ap++].apic_id = proc->apicid;
+         }
+         p += sizeof(struct mp_proc);
+         break;
+      }
+      case MP_BUS:
+      {
+         struct mp_bus *bus = (struct mp_bus *)p;
+         if (memcmp(bus->bustype, "ISA", 3) == 0)
+         {
+            isa_bus = bus->busid;
+         }
+         p += sizeof(struct mp_bus);
+         break;
+      }
+      case MP_IOAPIC:
+      {
+         struct mp_ioapic *io = (struct mp_ioapic *)p;
+         if (ioapic_addr == 0 && (io->flags & 0x1))
+         {
+            ioapic_addr = io->addr;
+         }
+         p += sizeof(struct mp_ioapic);
+         break;
+      }
+      case MP_IOINTR:
+      {
+         struct mp_intr *intr = (struct mp_intr *)p;
+         if (intr->irqtype == 0 && intr->srcbus == isa_bus)
+         {
+            ioapic_isa_override(intr->srcbusirq, intr->dstirq, intr->irqflag);
+         }
+         p += sizeof(struct mp_intr);
+         break;
+      }
+      case MP_LINTR:
+         p += sizeof(struct mp_intr);
+         break;
+      default:
+         put_str("   unknown MP entry, uniprocessor\n");
+         return;
+      }
+   }
+
+   /* APIC寄存器映射到内核空间的同一地址, 要求在3GB以上 */
+   if (ap == 1 || ioapic_addr < 0xc0000000 || conf->lapicaddr < 0xc0000000)
+   {
+      put_str("   single cpu or no IOAPIC, uniprocessor\n");
+      return;
+   }
+   apic_map(conf->lapicaddr, ioapic_addr);
+   mp_cpus = ap;
+   mp_apic = true;
+   mp_imcr = (fp->imcrp & MP_IMCR) != 0;
+   put_str("   cpus: ");
+   put_int(mp_cpus);
+   put_str("\nmp_init done\n");
+}
+
+/* 获取大内核锁, 嵌套时只增加深度. 必须在关中断时调用, 否则中断可能在加深度和上锁之间看到已持有的假象 */
+void lock_kernel(void)
+{
+   ASSERT(intr_get_status() == INTR_OFF);
+   struct task_struct *cur = running_thread();
+   if (cur->lock_depth++ == 0)
+   {
+      spin_lock(&kernel_lock);
+      /* 不持有锁期间别的cpu可能解除了内核空间的映射, 刷新tlb, 包括全局页 */
+      struct cpu_info *cpu = this_cpu();
+      if (cpu->tlb_gen != kernel_tlb_gen)
+      {
+         cpu->tlb_gen = kernel_tlb_gen;
+         tlb_flush_all();
+      }
+   }
+}
+
+/* 释放大内核锁, 深度减到0时才真正释放 */
+void unlock_kernel(void)
+{
+   ASSERT(intr_get_status() == INTR_OFF);
+   struct task_struct *cur = running_thread();
+   ASSERT(cur->lock_depth > 0);
+   if (--cur->lock_depth == 0)
+   {
+      spin_unlock(&kernel_lock);
+   }
+}
+
+/* ap的时钟中断, 只负责本cpu上任务的时间片. 全局的ticks和时间轮仍由bsp的PIT驱动 */
+static void intr_lapic_timer_handler(uint8_t vec_nr)
+{
+   struct task_struct *cur_thread = running_thread();
+   ASSERT(cur_thread->stack_magic == 0x19870916); // 检查栈是否溢出
+
+   cur_thread->elapsed_ticks++;
+   if (cur_thread->ticks == 0 || need_resched)
+   {
+      schedule();
+   }
+   else
+   {
+      cur_thread->ticks--;
+   }
+}
+
+/* 唤醒空闲cpu的处理器间中断, 只为了让idle从hlt中返回去调度, 不需要做事 */
+static void intr_resched_handler(uint8_t vec_nr)
+{
+}
+
+/* 有任务变为就绪时调用, 若有别的cpu正在运行idle, 向它发送处理器间中断 */
+void smp_wake_idle(void)
+{
+   if (cpu_count < 2)
+   {
+      return;
+   }
+   struct cpu_info *self = this_cpu();
+   uint32_t cpu = 0;
+   for (cpu = 0; cpu < NR_CPUS; cpu++)
+   {
+      struct cpu_info *c = &cpus[cpu];
+      if (c != self && c->online && c->curr == c->idle)
+      {
+         lapic_send_ipi(c->apic_id, ICR_FIXED | ICR_ASSERT | RESCHED_VECTOR);
+         return;
+      }
+   }
+}
+
+/* ap进入内核后执行的第一个函数, 运行在bsp为它准备的idle线程的栈上 */
+void ap_main(void)
+{
+   struct task_struct *idle = running_thread();
+   tss_load(idle->cpu);
+   idt_load();
+   lapic_init(true);
+   fpu_cpu_init();
+   this_cpu()->online = true;
+
+   /* bsp在启动完所有ap, 第一次返回用户态或进入idle之前一直持有大内核锁 */
+   lock_kernel();
+   intr_enable();
+   cpu_idle();
+}
+
+/**
+ * @brief ap_start按INIT-SIPI-SIPI的顺序启动第cpu号ap, 等待它执行到ap_main
+ *
+ * @return bool 启动成功返回true
+ */
+static bool ap_start(uint8_t cpu, struct ap_boot_args *args)
+{
+   /* ap的idle线程, 已经处于运行状态, 启动后直接在它的栈上运行 */
+   struct task_struct *idle = get_kernel_pages(1);
+   if (idle == NULL)
+   {
+      return false;
+   }
+   char name[TASK_NAME_LEN];
+   sprintf(name, "idle%d", cpu);
+   init_thread(idle, name, 10);
+   idle->status = TASK_RUNNING;
+   idle->cpu = cpu;
+   idle->static_level = idle->level = PRIO_IDLE;
+   idle->lock_depth = 0; // 在ap_main中获取大内核锁
+   cpus[cpu].idle = cpus[cpu].curr = idle;
+   cpus[cpu].tlb_gen = kernel_tlb_gen;
+   args->stack = (uint32_t)idle + PG_SIZE;
+
+   uint8_t apic_id = cpus[cpu].apic_id;
+   lapic_send_ipi(apic_id, ICR_INIT | ICR_LEVEL | ICR_ASSERT);
+   udelay(200);
+   lapic_send_ipi(apic_id, ICR_INIT | ICR_LEVEL);
+   udelay(10000);
+   /* 按规范发送两次Startup IPI, 已经在运行的cpu会忽略第二次 */
+   uint32_t sipi = 0;
+   while (sipi++ < 2)
+   {
+      lapic_send_ipi(apic_id, ICR_STARTUP | (AP_TRAMPOLINE >> 12));
+      udelay(200);
+   }
+   uint32_t wait_ms = 0;
+   while (!cpus[cpu].online && wait_ms++ < 100)
+   {
+      udelay(1000);
+   }
+   if (!cpus[cpu].online)
+   {
+      cpus[cpu].idle = cpus[cpu].curr = NULL;
+      release_pid(idle->pid);
+      mfree_page(PF_KERNEL, idle, 1);
+      return false;
+   }
+   task_register(idle);
+   cpu_count++;
+   return true;
+}
+
+/**
+ * @brief smp_init把外部中断改由IOAPIC投递给bsp, 然后启动所有ap.
+ *        在tss_init之后, 开中断之前调用, 此时bsp持有大内核锁, ap启动后等到bsp第一次释放锁才开始调度
+ */
+void smp_init(void)
+{
+   put_str("smp_init start\n");
+   /* 启动ap要用tsc计时 */
+   if (!mp_apic || tsc_khz == 0)
+   {
+      put_str("smp_init done\n");
+      return;
+   }
+
+   /* PIC模式的主板上8259A直接连在cpu的INTR上, 通过IMCR改接到APIC */
+   if (mp_imcr)
+   {
+      outb(IMCR_ADDR, 0x70);
+      outb(IMCR_DATA, inb(IMCR_DATA) | 0x1);
+   }
+   pic_mask_all();
+   cpus[0].apic_id = lapic_id();
+   ioapic_init(cpus[0].apic_id);
+   lapic_timer_calibrate();
+   lapic_init(false); // bsp仍用PIT做时钟
+   apic_enabled = true;
+   register_handler(LAPIC_TIMER_VECTOR, intr_lapic_timer_handler);
+   register_handler(RESCHED_VECTOR, intr_resched_handler);
+
+   /* 复制启动代码并填写参数, 各ap共用, 只有栈不同 */
+   memcpy(PHYS_TO_VIRT(AP_TRAMPOLINE), ap_trampoline_start, ap_trampoline_end - ap_trampoline_start);
+   struct ap_boot_args *args = PHYS_TO_VIRT(AP_TRAMPOLINE + (ap_boot_args - ap_trampoline_start));
+   args->gdt_limit = 8 * 4 - 1; // 进入保护模式只需要loader的前4个描述符
+   args->gdt_base = LOADER_GDT;
+   args->cr3 = KERNEL_PAGE_DIR;
+   args->cr4 = paging_cr4();
+   args->entry = (uint32_t)ap_main;
+
+   uint32_t cpu = 1;
+   for (cpu = 1; cpu < mp_cpus; cpu++)
+   {
+      if (!ap_start(cpu, args))
+      {
+         put_str("   cpu ");
+         put_int(cpu);
+         put_str(" failed to start\n");
+      }
+   }
+   put_str("   cpus online: ");
+   put_int(cpu_count);
+   put_str("\nsmp_init done\n");
+}
@@ -0,0 +1,47 @@
+#ifndef __KERNEL_SMP_H
+#define __KERNEL_SMP_H
+#include "stdint.h"
+#include "global.h"
+#include "thread.h"
+#include "sync.h"
+
+/**
+ * 对称多处理(SMP)
+ *
+ * 开机时只有bsp(bootstrap processor)在运行, 其它cpu(application processor, ap)处于等待状态.
+ * mp_init从BIOS提供的MP表中找出所有cpu和IOAPIC, smp_init把外部中断改由IOAPIC投递给bsp,
+ * 再依次向各ap发送INIT-SIPI-SIPI, ap从AP_TRAMPOLINE处的启动代码进入保护模式和分页后执行ap_main.
+ *
+ * 内核用一把大内核锁(kernel_lock)保护: 每次从用户态或idle进入内核(中断, 系统调用, 缺页)时获取,
+ * 返回用户态或idle准备hlt时释放, 任务切换时锁随cpu传给下一个任务. 用户态代码可以在所有cpu上并行执行,
+ * 内核代码同一时刻只在一个cpu上执行, 所以原来靠关中断实现的互斥在多处理器上仍然成立.
+ */
+
+#define NR_CPUS 8             // 最多支持的cpu个数
+#define AP_TRAMPOLINE 0x70000 // ap启动代码的物理地址, 须4K对齐且在1MB以下, 这里原是加载kernel.bin的缓冲区
+
+/* 每个cpu的数据, 以cpu编号为下标, bsp的编号为0 */
+struct cpu_info
+{
+   uint8_t apic_id;           // 本地APIC的id
+   volatile bool online;      // 已经启动完成
+   struct task_struct *idle;  // 本cpu的idle线程, 不进就绪队列, 没有其它就绪任务时才运行
+   struct task_struct *curr;  // 本cpu上正在运行的任务
+   uint32_t tlb_gen;          // 本cpu上次刷新tlb时的kernel_tlb_gen
+   struct task_struct *fpu_owner; // 浮点寄存器中保存的是哪个任务的状态, 没有为NULL
+};
+
+extern struct cpu_info cpus[NR_CPUS];
+extern uint32_t cpu_count;              // 已启动的cpu数
+extern uint32_t volatile kernel_tlb_gen; // 内核空间的映射每解除一次加1
+
+/* 当前cpu, 由正在运行的任务记录的cpu编号得到 */
+#define this_cpu() (&cpus[running_thread()->cpu])
+
+void mp_init(void);
+void smp_init(void);
+void smp_wake_idle(void);
+void lock_kernel(void);
+void unlock_kernel(void);
+void ap_main(void);
+#endif
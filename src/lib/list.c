@@ -1,5 +1,6 @@
 #include "list.h"
 #include "interrupt.h"
+#include "debug.h"
 
 /**
  * @brief list_init用于初始化链表
@@ -10,8 +11,21 @@ void list_init(list_t *list)
 {
    list->head.prev = NULL;
    list->head.next = &list->tail;
+   list->head.owner = list;
    list->tail.prev = &list->head;
    list->tail.next = NULL;
+   list->tail.owner = list;
+}
+
+/**
+ * @brief elem_init把结点置为不在任何链表中, 用于复制来的或未清零内存中的结点
+ *
+ * @param elem 要初始化的结点
+ */
+void elem_init(list_elem_t *elem)
+{
+   elem->prev = elem->next = NULL;
+   elem->owner = NULL;
 }
 
 /**
@@ -32,6 +46,7 @@ void list_insert_before(list_elem_t *before, list_elem_t *elem)
    elem->prev = before->prev;
    elem->next = before;
    before->prev = elem;
+   elem->owner = before->owner;
 
    // 解锁
    intr_set_status(old_status);
@@ -70,6 +85,7 @@ void list_remove(list_elem_t *pelem)
    intr_status_t old_status = intr_disable();
    pelem->prev->next = pelem->next;
    pelem->next->prev = pelem->prev;
+   pelem->owner = NULL;
    // 解锁
    intr_set_status(old_status);
 }
@@ -88,7 +104,7 @@ list_elem_t *list_pop(list_t *plist)
 }
 
 /**
- * @brief elem_find用于在plist中查找是否存在obj_elem指向的元素
+ * @brief elem_find用于判断obj_elem是否在plist中. 结点记录了所在的链表, 不需要遍历
  *
  * @param plist 要查找的链表
  * @param obj_elem 要查找的元素
@@ -97,14 +113,22 @@ list_elem_t *list_pop(list_t *plist)
  */
 bool elem_find(list_t *plist, list_elem_t *obj_elem)
 {
+#ifdef LIST_DEBUG
+   /* 调试时遍历链表, 核对owner与结点实际所在的位置是否一致 */
+   bool found = false;
    list_elem_t *elem = plist->head.next;
    while (elem != &plist->tail && elem != 0)
    {
       if (elem == obj_elem)
-         return true;
+      {
+         found = true;
+         break;
+      }
       elem = elem->next;
    }
-   return false;
+   ASSERT(found == (obj_elem->owner == plist));
+#endif
+   return obj_elem->owner == plist;
 }
 
 /**
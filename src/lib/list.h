@@ -11,11 +11,14 @@
    (struct_type *)((int)elem_ptr - offset(struct_type, struct_member_name))
 
 /**********   定义链表结点成员结构   ***********
- *结点中不需要数据成元,只要求前驱和后继结点指针，链表节点*/
+ *结点中不需要数据成元,只要求前驱和后继结点指针，链表节点.
+ *owner记录结点所在的链表, elem_find据此O(1)判断结点是否在某个链表中.
+ *定义LIST_DEBUG编译时, elem_find还会遍历链表核对owner是否正确 */
 struct list_elem
 {
    struct list_elem *prev; // 前躯结点
    struct list_elem *next; // 后继结点
+   struct list *owner;     // 所在的链表, 不在任何链表中时为NULL; 链表的head和tail指向链表自己
 };
 
 /* 链表头结构,用来实现队列 */
@@ -33,6 +36,7 @@ typedef struct list list_t;
 typedef bool(function)(struct list_elem *, int arg);
 
 void list_init(struct list *);
+void elem_init(struct list_elem *elem);
 void list_insert_before(struct list_elem *before, struct list_elem *elem);
 void list_push(struct list *plist, struct list_elem *elem);
 void list_iterate(struct list *plist);
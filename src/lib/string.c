@@ -2,31 +2,63 @@
 #include "global.h"
 #include "assert.h"
 
-/* 将dst_起始的size个字节置为value */
+/* 将dst_起始的size个字节置为value. 先逐字节写到4字节对齐处, 中间用rep stosl每次写4字节, 最后补上不足4字节的尾部 */
 void memset(void *dst_, uint8_t value, uint32_t size)
 {
-   assert(dst_ != NULL);
    uint8_t *dst = (uint8_t *)dst_;
+   while (size > 0 && ((uint32_t)dst & 3))
+   {
+      *dst++ = value;
+      size--;
+   }
+   uint32_t dwords = size >> 2;
+   uint32_t fill = value * 0x01010101;
+   asm volatile("cld; rep stosl"
+                : "+D"(dst), "+c"(dwords)
+                : "a"(fill)
+                : "memory");
+   size &= 3;
    while (size-- > 0)
       *dst++ = value;
 }
 
-/* 将src_起始的size个字节复制到dst_ */
+/* 将src_起始的size个字节复制到dst_. 较长时先按字节复制到目的地址4字节对齐, 再用rep movsl每次复制4字节 */
 void memcpy(void *dst_, const void *src_, uint32_t size)
 {
-   assert(dst_ != NULL && src_ != NULL);
    uint8_t *dst = dst_;
    const uint8_t *src = src_;
-   while (size-- > 0)
-      *dst++ = *src++;
+   if (size >= 16)
+   {
+      uint32_t head = (0 - (uint32_t)dst) & 3;
+      uint32_t dwords = (size - head) >> 2;
+      size = (size - head) & 3;
+      asm volatile("cld; rep movsb"
+                   : "+D"(dst), "+S"(src), "+c"(head)
+                   :
+                   : "memory");
+      asm volatile("rep movsl"
+                   : "+D"(dst), "+S"(src), "+c"(dwords)
+                   :
+                   : "memory");
+   }
+   asm volatile("cld; rep movsb"
+                : "+D"(dst), "+S"(src), "+c"(size)
+                :
+                : "memory");
 }
 
-/* 连续比较以地址a_和地址b_开头的size个字节,若相等则返回0,若a_大于b_返回+1,否则返回-1 */
+/* 连续比较以地址a_和地址b_开头的size个字节,若相等则返回0,若a_大于b_返回+1,否则返回-1.
+ * 相同的部分按4字节跳过, 从第一个不同的字开始逐字节比较 */
 int memcmp(const void *a_, const void *b_, uint32_t size)
 {
    const char *a = a_;
    const char *b = b_;
-   assert(a != NULL || b != NULL);
+   while (size >= 4 && *(const uint32_t *)a == *(const uint32_t *)b)
+   {
+      a += 4;
+      b += 4;
+      size -= 4;
+   }
    while (size-- > 0)
    {
       if (*a != *b)
@@ -58,12 +58,13 @@ uint32_t write(int32_t fd, const void *buf, uint32_t count)
    return _syscall3(SYS_WRITE, fd, buf, count);
 }
 
-void *malloc(uint32_t size)
+// 在内核中为进程分配内存, 每次都要陷入内核. 一般用lib/umalloc.c中的malloc
+void *malloc_syscall(uint32_t size)
 {
    return (void *)_syscall1(SYS_MALLOC, size);
 }
 
-void free(void *ptr)
+void free_syscall(void *ptr)
 {
    _syscall1(SYS_FREE, ptr);
 }
@@ -212,3 +213,100 @@ void debug(void)
 {
    _syscall0(SYS_DEBUG);
 }
+
+// 将内存中尚未写回的文件系统元数据写回硬盘
+void sync(void)
+{
+   _syscall0(SYS_SYNC);
+}
+
+// 复制文件描述符, 返回最小的空闲描述符
+int32_t dup(int32_t old_fd)
+{
+   return _syscall1(SYS_DUP, old_fd);
+}
+
+// 让new_fd指向old_fd所指的文件
+int32_t dup2(int32_t old_fd, int32_t new_fd)
+{
+   return _syscall2(SYS_DUP2, old_fd, new_fd);
+}
+
+// 输出调度延迟直方图, reset为真时只清空统计. 内核不带性能测试时返回-1
+int32_t sched_stat(int32_t reset)
+{
+   return _syscall1(SYS_SCHED_STAT, reset);
+}
+
+// 读取时钟, clock_id为CLOCK_MONOTONIC或CLOCK_REALTIME
+int32_t clock_gettime(int32_t clock_id, struct timespec *tp)
+{
+   return _syscall2(SYS_CLOCK_GETTIME, clock_id, tp);
+}
+
+// 同步原语压力测试, op见enum lock_stress_op
+int32_t lock_stress(uint32_t op, uint32_t arg)
+{
+   return _syscall2(SYS_LOCK_STRESS, op, arg);
+}
+
+// 若*uaddr仍等于val则睡眠, 直到被futex_wake唤醒
+int32_t futex_wait(uint32_t *uaddr, uint32_t val)
+{
+   return _syscall2(SYS_FUTEX_WAIT, uaddr, val);
+}
+
+// 唤醒最多nr_wake个在uaddr上等待的任务
+int32_t futex_wake(uint32_t *uaddr, uint32_t nr_wake)
+{
+   return _syscall2(SYS_FUTEX_WAKE, uaddr, nr_wake);
+}
+
+// 分配fork后父子进程共享的内存
+void *mmap_shared(uint32_t size)
+{
+   return (void *)_syscall1(SYS_MMAP_SHARED, size);
+}
+
+// clone出的线程从这里开始在用户态执行, func返回后线程退出
+static void clone_start(void (*func)(void *), void *arg)
+{
+   func(arg);
+   exit(0);
+}
+
+// 创建与当前进程共享地址空间和文件描述符表的线程执行func(arg), 返回线程id
+int16_t clone(void (*func)(void *), void *arg)
+{
+   return _syscall3(SYS_CLONE, clone_start, func, arg);
+}
+
+// 主动让出cpu
+void sched_yield(void)
+{
+   _syscall0(SYS_SCHED_YIELD);
+}
+
+// 测试memset, memcpy, memcmp各种实现的速度, 结果由内核输出
+int32_t mem_bench(void)
+{
+   return _syscall0(SYS_MEM_BENCH);
+}
+
+// 输出写时复制缺页的次数和耗时, reset为真时只清空统计. 内核不带性能测试时返回-1
+int32_t cow_stat(int32_t reset)
+{
+   return _syscall1(SYS_COW_STAT, reset);
+}
+
+// 把堆的末尾移动increment字节, 返回原来的末尾, 失败返回(void *)-1
+void *sbrk(int32_t increment)
+{
+   return (void *)_syscall1(SYS_SBRK, increment);
+}
+
+// 等待clone出的线程tid退出并回收它, wait不回收同组的线程
+int16_t thread_join(int16_t tid, int32_t *status)
+{
+   return _syscall2(SYS_THREAD_JOIN, tid, status);
+}
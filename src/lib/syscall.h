@@ -2,6 +2,9 @@
 #define __LIB_USER_SYSCALL_H
 #include "stdint.h"
 #include "fs.h"
+#include "timer.h"
+#include "sync.h"
+#include "bench.h"
 
 enum SYSCALL_NR
 {
@@ -35,12 +38,27 @@ enum SYSCALL_NR
    SYS_FD_REDIRECT,
    SYS_HELP,
    SYS_DATE,
-   SYS_DEBUG
+   SYS_DEBUG,
+   SYS_SYNC,
+   SYS_DUP,
+   SYS_DUP2,
+   SYS_SCHED_STAT,
+   SYS_CLOCK_GETTIME,
+   SYS_LOCK_STRESS,
+   SYS_FUTEX_WAIT,
+   SYS_FUTEX_WAKE,
+   SYS_MMAP_SHARED,
+   SYS_CLONE,
+   SYS_SCHED_YIELD,
+   SYS_MEM_BENCH,
+   SYS_COW_STAT,
+   SYS_SBRK,
+   SYS_THREAD_JOIN
 };
 uint32_t getpid(void);
 uint32_t write(int32_t fd, const void *buf, uint32_t count);
-void *malloc(uint32_t size);
-void free(void *ptr);
+void *malloc_syscall(uint32_t size);
+void free_syscall(void *ptr);
 int16_t fork(void);
 uint32_t read(int32_t fd, void *buf, uint32_t count);
 void clear(void);
@@ -67,4 +85,19 @@ int32_t pipe(int32_t pipe_fd[2]);
 void fd_redirect(uint32_t old_local_fd, uint32_t new_local_fd);
 void date(void);
 void debug(void);
+void sync(void);
+int32_t dup(int32_t old_fd);
+int32_t dup2(int32_t old_fd, int32_t new_fd);
+int32_t sched_stat(int32_t reset);
+int32_t lock_stress(uint32_t op, uint32_t arg);
+int32_t clock_gettime(int32_t clock_id, struct timespec *tp);
+int32_t futex_wait(uint32_t *uaddr, uint32_t val);
+int32_t futex_wake(uint32_t *uaddr, uint32_t nr_wake);
+void *mmap_shared(uint32_t size);
+int16_t clone(void (*func)(void *), void *arg);
+void sched_yield(void);
+int32_t mem_bench(void);
+int32_t cow_stat(int32_t reset);
+void *sbrk(int32_t increment);
+int16_t thread_join(int16_t tid, int32_t *status);
 #endif
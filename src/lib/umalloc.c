@@ -0,0 +1,144 @@
+#include "umalloc.h"
+#include "umutex.h"
+#include "syscall.h"
+#include "global.h"
+
+#define USER_HEAP_START 0x40000000 // 与userprog/process.h一致, 内核在这里映射了堆的第一页
+#define UMALLOC_MAGIC 0x48454150   // "HEAP", 第一次分配时写入, 页是清零的, 不等说明还没初始化
+#define UMALLOC_LARGE 0xff         // 块头中表示大块的类号
+
+/* 每个块前面的块头, 8字节, 使返回给用户的地址8字节对齐 */
+struct ublock
+{
+   uint32_t class_idx; // 尺寸类, 大块为UMALLOC_LARGE
+   uint32_t size;      // 块的总字节数, 含块头
+};
+
+/* 空闲块复用块头之后的空间链接起来 */
+struct ufree
+{
+   struct ublock head;
+   struct ufree *next;
+};
+
+/* 分配器的状态, 放在堆的第一页 */
+struct uheap
+{
+   uint32_t magic;
+   struct umutex lock;
+   struct ufree *free_list[UMALLOC_CLASSES]; // 各尺寸类的空闲块
+   struct ufree *large_list;                 // 释放的大块
+   uint8_t *top;                             // 堆中尚未切分的部分从这里开始
+   uint8_t *end;                             // 堆的末尾, 即当前的break
+};
+
+#define heap ((struct uheap *)USER_HEAP_START)
+
+/* size字节(含块头)所属的尺寸类 */
+static uint32_t size_class(uint32_t size)
+{
+   uint32_t class_idx = 0;
+   while ((1u << (UMALLOC_MIN_SHIFT + class_idx)) < size)
+      class_idx++;
+   return class_idx;
+}
+
+/* 从堆顶切出size字节, 不够时用sbrk扩展. 调用时持有heap->lock */
+static struct ublock *heap_carve(uint32_t size)
+{
+   if ((uint32_t)(heap->end - heap->top) < size)
+   {
+      uint32_t grow = size > UMALLOC_GROW ? DIV_ROUND_UP(size, PG_SIZE) * PG_SIZE : UMALLOC_GROW;
+      uint8_t *old_end = sbrk(grow);
+      if (old_end == (uint8_t *)-1)
+         return NULL;
+      // 正常情况下新空间紧接在原来的末尾之后, 否则堆被别处扩展过, 原来剩下的部分放弃
+      if (old_end != heap->end)
+         heap->top = old_end;
+      heap->end = old_end + grow;
+   }
+   struct ublock *b = (struct ublock *)heap->top;
+   heap->top += size;
+   b->size = size;
+   return b;
+}
+
+/* 第一次使用时初始化堆的状态, 可分配的空间从状态之后开始. 调用时持有heap->lock */
+static void heap_init(void)
+{
+   uint32_t class_idx;
+   for (class_idx = 0; class_idx < UMALLOC_CLASSES; class_idx++)
+      heap->free_list[class_idx] = NULL;
+   heap->large_list = NULL;
+   heap->top = (uint8_t *)USER_HEAP_START + DIV_ROUND_UP(sizeof(struct uheap), 16) * 16;
+   heap->end = (uint8_t *)USER_HEAP_START + PG_SIZE;
+   heap->magic = UMALLOC_MAGIC;
+}
+
+/**
+ * @brief malloc在当前进程的堆中分配size字节, 空闲链表中有合适的块时不进入内核. 返回的内存不清零
+ *
+ * @param size 字节数
+ * @return void* 8字节对齐的地址, 失败返回NULL
+ */
+void *malloc(uint32_t size)
+{
+   if (size == 0 || size > 0x40000000)
+      return NULL;
+   uint32_t need = size + sizeof(struct ublock);
+   struct ublock *b = NULL;
+
+   umutex_lock(&heap->lock);
+   if (heap->magic != UMALLOC_MAGIC)
+      heap_init();
+
+   if (need <= UMALLOC_MAX_SMALL)
+   {
+      uint32_t class_idx = size_class(need);
+      struct ufree *f = heap->free_list[class_idx];
+      if (f != NULL)
+      {
+         heap->free_list[class_idx] = f->next;
+         b = &f->head;
+      }
+      else if ((b = heap_carve(1 << (UMALLOC_MIN_SHIFT + class_idx))) != NULL)
+         b->class_idx = class_idx;
+   }
+   else
+   {
+      need = DIV_ROUND_UP(need, 16) * 16;
+      struct ufree **pf = &heap->large_list;
+      while (*pf != NULL && (*pf)->head.size < need)
+         pf = &(*pf)->next;
+      if (*pf != NULL)
+      {
+         b = &(*pf)->head;
+         *pf = (*pf)->next;
+      }
+      else if ((b = heap_carve(need)) != NULL)
+         b->class_idx = UMALLOC_LARGE;
+   }
+   umutex_unlock(&heap->lock);
+   return b == NULL ? NULL : (void *)(b + 1);
+}
+
+/* 释放malloc分配的内存, 块放回对应的空闲链表, 不还给内核 */
+void free(void *ptr)
+{
+   if (ptr == NULL)
+      return;
+   struct ufree *f = (struct ufree *)((struct ublock *)ptr - 1);
+
+   umutex_lock(&heap->lock);
+   if (f->head.class_idx == UMALLOC_LARGE)
+   {
+      f->next = heap->large_list;
+      heap->large_list = f;
+   }
+   else
+   {
+      f->next = heap->free_list[f->head.class_idx];
+      heap->free_list[f->head.class_idx] = f;
+   }
+   umutex_unlock(&heap->lock);
+}
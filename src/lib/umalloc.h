@@ -0,0 +1,20 @@
+#ifndef __LIB_UMALLOC_H
+#define __LIB_UMALLOC_H
+#include "stdint.h"
+
+/**
+ * 用户态的内存分配器.
+ * 进程的堆从USER_HEAP_START开始, 内核在进程创建和exec时释放原来的堆, 重新映射第一页并清零, 分配器的状态就放在这一页里,
+ * 这样每个进程(包括fork出的子进程)都有自己的一份, clone出的线程共享同一份, 由其中的umutex互斥.
+ * 小于等于UMALLOC_MAX_SMALL字节的请求按2的幂分成若干尺寸类, 释放的块挂在各自类的空闲链表上直接复用;
+ * 更大的请求按16字节取整, 释放后放进大块链表, 首次适配复用. 只有空间不够时才用sbrk向内核扩展堆
+ */
+
+#define UMALLOC_MIN_SHIFT 4                            // 最小的尺寸类16字节(含块头)
+#define UMALLOC_CLASSES 8                              // 尺寸类16, 32, ..., 2048字节
+#define UMALLOC_MAX_SMALL (1 << (UMALLOC_MIN_SHIFT + UMALLOC_CLASSES - 1))
+#define UMALLOC_GROW (16 * 4096)                       // 每次至少向内核扩展的堆大小
+
+void *malloc(uint32_t size);
+void free(void *ptr);
+#endif
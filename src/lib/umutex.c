@@ -0,0 +1,101 @@
+#include "umutex.h"
+#include "syscall.h"
+
+/* 原子地比较*ptr与old, 相等则写入new. 返回*ptr原来的值 */
+static inline uint32_t atomic_cmpxchg(volatile uint32_t *ptr, uint32_t old, uint32_t new)
+{
+   uint32_t prev;
+   asm volatile("lock; cmpxchgl %2, %1"
+                : "=a"(prev), "+m"(*ptr)
+                : "r"(new), "0"(old)
+                : "memory");
+   return prev;
+}
+
+/* 原子地把*ptr换成val, 返回原来的值 */
+static inline uint32_t atomic_xchg(volatile uint32_t *ptr, uint32_t val)
+{
+   asm volatile("xchgl %0, %1"
+                : "+r"(val), "+m"(*ptr)
+                :
+                : "memory");
+   return val;
+}
+
+/* 原子地给*ptr加val, 返回原来的值 */
+static inline uint32_t atomic_fetch_add(volatile uint32_t *ptr, uint32_t val)
+{
+   asm volatile("lock; xaddl %0, %1"
+                : "+r"(val), "+m"(*ptr)
+                :
+                : "memory");
+   return val;
+}
+
+/* 初始化互斥锁 */
+void umutex_init(struct umutex *m)
+{
+   m->state = 0;
+}
+
+/**
+ * @brief umutex_lock加锁. 先尝试0->1, 成功就是无竞争的快速路径;
+ *        否则把状态置为2(有人等待)再睡眠, 被唤醒后同样以2的状态抢锁, 保证解锁者知道要进内核唤醒
+ */
+void umutex_lock(struct umutex *m)
+{
+   uint32_t c = atomic_cmpxchg(&m->state, 0, 1);
+   if (c == 0)
+      return;
+
+   if (c != 2)
+      c = atomic_xchg(&m->state, 2);
+   while (c != 0)
+   {
+      futex_wait((uint32_t *)&m->state, 2);
+      c = atomic_xchg(&m->state, 2);
+   }
+}
+
+/* 解锁. 原来是1说明没人等待, 直接返回; 是2则唤醒一个等待者 */
+void umutex_unlock(struct umutex *m)
+{
+   if (atomic_xchg(&m->state, 0) == 2)
+      futex_wake((uint32_t *)&m->state, 1);
+}
+
+/* 初始化条件变量 */
+void ucond_init(struct ucond *c)
+{
+   c->seq = 0;
+}
+
+/**
+ * @brief ucond_wait释放m并等待条件变量c被通知, 返回前重新持有m.
+ *        解锁前先记下seq, 解锁之后的通知会改变seq, futex_wait发现值已变就立即返回, 不会丢失通知.
+ *        和pthread一样可能虚假唤醒, 调用者应在循环中检查条件
+ */
+void ucond_wait(struct ucond *c, struct umutex *m)
+{
+   uint32_t seq = c->seq;
+   umutex_unlock(m);
+   futex_wait((uint32_t *)&c->seq, seq);
+
+   /* 被唤醒的可能不止一个, 按有人等待的状态抢锁, 以免解锁时漏掉唤醒 */
+   while (atomic_xchg(&m->state, 2) != 0)
+      futex_wait((uint32_t *)&m->state, 2);
+}
+
+/* 唤醒一个等待者 */
+void ucond_signal(struct ucond *c)
+{
+   atomic_fetch_add(&c->seq, 1);
+   futex_wake((uint32_t *)&c->seq, 1);
+}
+
+/* 唤醒全部等待者 */
+void ucond_broadcast(struct ucond *c)
+{
+   atomic_fetch_add(&c->seq, 1);
+   futex_wake((uint32_t *)&c->seq, 0xffffffff);
+}
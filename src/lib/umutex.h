@@ -0,0 +1,30 @@
+#ifndef __LIB_UMUTEX_H
+#define __LIB_UMUTEX_H
+#include "stdint.h"
+
+/**
+ * 基于futex的用户态互斥锁和条件变量.
+ * 没有竞争时加锁解锁只是一条原子指令, 不进入内核; 有竞争时才用futex_wait睡眠, futex_wake唤醒.
+ * 多个进程使用时, 结构体须放在mmap_shared分配的共享内存中
+ */
+
+/* 互斥锁, state: 0未加锁, 1已加锁且无人等待, 2已加锁且可能有人在等待 */
+struct umutex
+{
+   volatile uint32_t state;
+};
+
+/* 条件变量, seq每次signal/broadcast加1, 等待者据此判断是否已被通知 */
+struct ucond
+{
+   volatile uint32_t seq;
+};
+
+void umutex_init(struct umutex *m);
+void umutex_lock(struct umutex *m);
+void umutex_unlock(struct umutex *m);
+void ucond_init(struct ucond *c);
+void ucond_wait(struct ucond *c, struct umutex *m);
+void ucond_signal(struct ucond *c);
+void ucond_broadcast(struct ucond *c);
+#endif
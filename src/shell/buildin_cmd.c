@@ -7,6 +7,8 @@
 #include "dir.h"
 #include "shell.h"
 #include "assert.h"
+#include "umutex.h"
+#include "umalloc.h"
 
 extern char final_path[MAX_PATH_LEN];
 
@@ -486,3 +488,843 @@ void buildin_echo(uint32_t argc, char **argv)
     }
     return;
 }
+
+#define SCHEDBENCH_CPU 2          // 计算型子进程数
+#define SCHEDBENCH_IO 2           // I/O型子进程数
+#define SCHEDBENCH_LOOPS 20000000 // 计算型子进程的循环次数
+#define SCHEDBENCH_READS 50       // I/O型子进程读文件的次数
+#define SCHEDBENCH_FILE "/schedbench"
+
+/**
+ * @brief buildin_schedbench调度延迟测试: 同时运行计算型和I/O型子进程,
+ *        I/O型子进程反复从硬盘读文件, 每次都要阻塞等待硬盘中断, 结束后输出内核统计的唤醒到运行延迟直方图
+ */
+void buildin_schedbench(uint32_t argc, char **argv)
+{
+    if (argc != 1)
+    {
+        printf("schedbench: no argument support!\n");
+        return;
+    }
+
+    // 准备一个8扇区的文件, 保证读操作会访问硬盘
+    char buf[512];
+    memset(buf, 'x', sizeof(buf));
+    int32_t fd = open(SCHEDBENCH_FILE, O_CREAT | O_RDWR);
+    if (fd == -1)
+    {
+        printf("schedbench: create %s failed\n", SCHEDBENCH_FILE);
+        return;
+    }
+    uint32_t sec = 0;
+    while (sec++ < 8)
+    {
+        write(fd, buf, sizeof(buf));
+    }
+    close(fd);
+
+    if (sched_stat(1) == -1)
+    {
+        printf("schedbench: kernel built without BENCH=1\n");
+        unlink(SCHEDBENCH_FILE);
+        return;
+    }
+    uint32_t child = 0;
+    while (child < SCHEDBENCH_CPU + SCHEDBENCH_IO)
+    {
+        int32_t pid = fork();
+        if (pid == 0)
+        {
+            if (child < SCHEDBENCH_CPU)
+            {
+                volatile uint32_t loop = 0;
+                while (loop < SCHEDBENCH_LOOPS)
+                {
+                    loop++;
+                }
+            }
+            else
+            {
+                uint32_t reads = 0;
+                while (reads++ < SCHEDBENCH_READS)
+                {
+                    fd = open(SCHEDBENCH_FILE, O_RDONLY);
+                    if (fd == -1)
+                        exit(-1);
+                    sec = 0;
+                    while (sec++ < 8)
+                    {
+                        read(fd, buf, sizeof(buf));
+                    }
+                    close(fd);
+                }
+            }
+            exit(0);
+        }
+        else if (pid == -1)
+        {
+            printf("schedbench: fork failed\n");
+            break;
+        }
+        child++;
+    }
+
+    int32_t status;
+    while (child-- > 0)
+    {
+        wait(&status);
+    }
+    sched_stat(0);
+    unlink(SCHEDBENCH_FILE);
+}
+
+#define SMPBENCH_MAX_PROCS 8      // 最多同时运行的子进程数
+#define SMPBENCH_LOOPS 80000000   // 总的循环次数, 平分给各子进程
+
+/* 开机以来的毫秒数 */
+static uint32_t smpbench_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief buildin_smpbench多处理器扩展性测试: 把固定的计算量平分给1, 2, 4, 8个同时fork出的子进程,
+ *        输出全部完成所用的时间. 计算在用户态进行, 子进程数不超过cpu数时耗时应随子进程数近似成反比
+ */
+void buildin_smpbench(uint32_t argc, char **argv)
+{
+    if (argc != 1)
+    {
+        printf("smpbench: no argument support!\n");
+        return;
+    }
+
+    uint32_t nproc = 1;
+    uint32_t base_ms = 0;
+    for (nproc = 1; nproc <= SMPBENCH_MAX_PROCS; nproc *= 2)
+    {
+        uint32_t start = smpbench_now_ms();
+        uint32_t child = 0;
+        while (child < nproc)
+        {
+            int32_t pid = fork();
+            if (pid == 0)
+            {
+                volatile uint32_t loop = 0;
+                while (loop < SMPBENCH_LOOPS / nproc)
+                {
+                    loop++;
+                }
+                exit(0);
+            }
+            else if (pid == -1)
+            {
+                printf("smpbench: fork failed\n");
+                break;
+            }
+            child++;
+        }
+
+        int32_t status;
+        while (child-- > 0)
+        {
+            wait(&status);
+        }
+        uint32_t elapsed = smpbench_now_ms() - start;
+        if (nproc == 1)
+        {
+            base_ms = elapsed;
+        }
+        /* 加速比保留一位小数 */
+        uint32_t speedup = elapsed != 0 ? base_ms * 10 / elapsed : 0;
+        printf("%d procs: %d ms, speedup %d.%d\n", nproc, elapsed, speedup / 10, speedup % 10);
+    }
+}
+
+#define LOCKSTRESS_PROCS 8    // 同时加锁的子进程数
+#define LOCKSTRESS_ROUNDS 200 // 每个子进程的轮数
+
+/**
+ * @brief buildin_lockstress锁竞争压力测试: 多个子进程同时在内核中反复获取同一个互斥锁, 计数信号量和自旋锁,
+ *        临界区内主动让出cpu制造竞争, 结束后由内核检查计数有没有丢失更新, 计数信号量有没有超额放行
+ */
+void buildin_lockstress(uint32_t argc, char **argv)
+{
+    if (argc != 1)
+    {
+        printf("lockstress: no argument support!\n");
+        return;
+    }
+
+    if (lock_stress(LOCK_STRESS_RESET, 0) == -1)
+    {
+        printf("lockstress: kernel built without BENCH=1\n");
+        return;
+    }
+    uint32_t child = 0;
+    while (child < LOCKSTRESS_PROCS)
+    {
+        int32_t pid = fork();
+        if (pid == 0)
+        {
+            lock_stress(LOCK_STRESS_RUN, LOCKSTRESS_ROUNDS);
+            exit(0);
+        }
+        else if (pid == -1)
+        {
+            printf("lockstress: fork failed\n");
+            break;
+        }
+        child++;
+    }
+
+    int32_t status;
+    while (child-- > 0)
+    {
+        wait(&status);
+    }
+    printf("lockstress: %s\n", lock_stress(LOCK_STRESS_REPORT, 0) == 0 ? "PASS" : "FAIL");
+}
+
+#define FUTEXBENCH_PROCS 4     // 同时争抢锁的子进程数
+#define FUTEXBENCH_ROUNDS 2000 // 每个子进程加锁的次数
+
+/* 争抢的锁和它保护的计数, 放在共享内存中 */
+struct futexbench_shared
+{
+    struct umutex lock;
+    volatile uint32_t counter;
+};
+
+/* 用管道实现的锁: 管道中始终只有一个字节的令牌, 读走令牌即加锁, 写回令牌即解锁 */
+static void pipe_lock(int32_t fd[2])
+{
+    char token;
+    read(fd[0], &token, 1);
+}
+
+static void pipe_unlock(int32_t fd[2])
+{
+    write(fd[1], "t", 1);
+}
+
+/**
+ * @brief futexbench_run让FUTEXBENCH_PROCS个子进程各自FUTEXBENCH_ROUNDS次加锁, 给共享计数加1再解锁.
+ *        use_futex为true时用umutex, 否则用管道锁
+ *
+ * @return uint32_t 耗时(毫秒). 计数不等于总次数时输出错误
+ */
+static uint32_t futexbench_run(struct futexbench_shared *shared, bool use_futex)
+{
+    int32_t fd[2];
+    if (!use_futex)
+    {
+        pipe(fd);
+        pipe_unlock(fd); // 放入令牌
+    }
+    umutex_init(&shared->lock);
+    shared->counter = 0;
+
+    uint32_t start = smpbench_now_ms();
+    uint32_t child = 0;
+    while (child < FUTEXBENCH_PROCS)
+    {
+        int32_t pid = fork();
+        if (pid == 0)
+        {
+            uint32_t round = 0;
+            while (round++ < FUTEXBENCH_ROUNDS)
+            {
+                if (use_futex)
+                    umutex_lock(&shared->lock);
+                else
+                    pipe_lock(fd);
+                shared->counter++;
+                if (use_futex)
+                    umutex_unlock(&shared->lock);
+                else
+                    pipe_unlock(fd);
+            }
+            exit(0);
+        }
+        else if (pid == -1)
+        {
+            printf("futexbench: fork failed\n");
+            break;
+        }
+        child++;
+    }
+
+    int32_t status;
+    while (child-- > 0)
+    {
+        wait(&status);
+    }
+    uint32_t elapsed = smpbench_now_ms() - start;
+    if (!use_futex)
+    {
+        close(fd[0]);
+        close(fd[1]);
+    }
+    if (shared->counter != FUTEXBENCH_PROCS * FUTEXBENCH_ROUNDS)
+    {
+        printf("futexbench: counter %d, expected %d, lock is broken!\n",
+               shared->counter, FUTEXBENCH_PROCS * FUTEXBENCH_ROUNDS);
+    }
+    return elapsed;
+}
+
+/**
+ * @brief buildin_futexbench比较futex互斥锁和管道锁在多进程竞争下的耗时.
+ *        共享内存在一个单独fork出的子进程中分配, 测试完随该进程退出回收
+ */
+void buildin_futexbench(uint32_t argc, char **argv)
+{
+    if (argc != 1)
+    {
+        printf("futexbench: no argument support!\n");
+        return;
+    }
+
+    int32_t pid = fork();
+    if (pid == 0)
+    {
+        struct futexbench_shared *shared = mmap_shared(sizeof(struct futexbench_shared));
+        if (shared == NULL)
+        {
+            printf("futexbench: mmap_shared failed\n");
+            exit(-1);
+        }
+        uint32_t futex_ms = futexbench_run(shared, true);
+        uint32_t pipe_ms = futexbench_run(shared, false);
+        printf("%d procs x %d rounds: futex mutex %d ms, pipe lock %d ms\n",
+               FUTEXBENCH_PROCS, FUTEXBENCH_ROUNDS, futex_ms, pipe_ms);
+        exit(0);
+    }
+    else if (pid == -1)
+    {
+        printf("futexbench: fork failed\n");
+        return;
+    }
+    int32_t status;
+    wait(&status);
+}
+
+#define THREADBENCH_THREADS 4         // 同时给计数加1的线程数
+#define THREADBENCH_ROUNDS 2000       // 每个线程加1的次数
+#define THREADBENCH_READ_PASSES 8     // 读文件线程把文件从头读到尾的遍数
+#define THREADBENCH_SPINS 20000000    // 主线程计算的循环次数
+
+/* 线程之间共享的数据, 在堆中分配, 同时检验clone出的线程与主线程共享堆 */
+struct threadbench_shared
+{
+    struct umutex lock;
+    volatile uint32_t counter;
+    const char *path;    // 读文件线程要读的文件
+    uint32_t read_bytes; // 读文件线程读到的总字节数
+};
+
+/* 计数线程: 在互斥锁内给共享计数加1 */
+static void threadbench_count(void *arg)
+{
+    struct threadbench_shared *shared = arg;
+    uint32_t round = 0;
+    while (round++ < THREADBENCH_ROUNDS)
+    {
+        umutex_lock(&shared->lock);
+        shared->counter++;
+        umutex_unlock(&shared->lock);
+    }
+}
+
+/* 读文件线程: 把文件反复从头读到尾, 大部分时间在等硬盘 */
+static void threadbench_read(void *arg)
+{
+    struct threadbench_shared *shared = arg;
+    char *buf = malloc(SECTOR_SIZE);
+    uint32_t pass = 0;
+    while (buf != NULL && pass++ < THREADBENCH_READ_PASSES)
+    {
+        int32_t fd = open((char *)shared->path, O_RDONLY);
+        if (fd == -1)
+            break;
+        int32_t bytes;
+        while ((bytes = (int32_t)read(fd, buf, SECTOR_SIZE)) > 0)
+            shared->read_bytes += bytes;
+        close(fd);
+    }
+    free(buf);
+}
+
+/* 主线程的计算任务 */
+static void threadbench_compute(void)
+{
+    volatile uint32_t sum = 0;
+    uint32_t i = 0;
+    while (i++ < THREADBENCH_SPINS)
+        sum += i;
+}
+
+/**
+ * @brief buildin_threadbench测试clone出的线程. 先让THREADBENCH_THREADS个线程在共享的互斥锁内给共享计数加1,
+ *        检查计数; 给出文件时, 再比较主线程依次读文件和计算, 与读文件交给另一个线程同时计算的耗时
+ */
+void buildin_threadbench(uint32_t argc, char **argv)
+{
+    if (argc > 2)
+    {
+        printf("threadbench: only support 1 argument!\n");
+        return;
+    }
+    if (argc == 2)
+        make_clear_abs_path(argv[1], final_path);
+
+    // 在子进程中创建线程, shell本身不受影响
+    int32_t pid = fork();
+    if (pid == 0)
+    {
+        struct threadbench_shared *shared = malloc(sizeof(struct threadbench_shared));
+        if (shared == NULL)
+        {
+            printf("threadbench: malloc failed\n");
+            exit(-1);
+        }
+        umutex_init(&shared->lock);
+        shared->counter = 0;
+        shared->path = final_path;
+        shared->read_bytes = 0;
+
+        int32_t status;
+        int16_t tids[THREADBENCH_THREADS];
+        uint32_t thread = 0;
+        while (thread < THREADBENCH_THREADS)
+        {
+            if ((tids[thread] = clone(threadbench_count, shared)) == -1)
+            {
+                printf("threadbench: clone failed\n");
+                break;
+            }
+            thread++;
+        }
+        while (thread-- > 0)
+            thread_join(tids[thread], &status);
+        printf("threadbench: %d threads x %d rounds, counter %d, %s\n", THREADBENCH_THREADS, THREADBENCH_ROUNDS,
+               shared->counter, shared->counter == THREADBENCH_THREADS * THREADBENCH_ROUNDS ? "PASS" : "FAIL");
+
+        if (argc == 2)
+        {
+            uint32_t start = smpbench_now_ms();
+            threadbench_read(shared);
+            threadbench_compute();
+            uint32_t serial_ms = smpbench_now_ms() - start;
+
+            shared->read_bytes = 0;
+            start = smpbench_now_ms();
+            int16_t tid = clone(threadbench_read, shared);
+            if (tid != -1)
+            {
+                threadbench_compute();
+                thread_join(tid, &status);
+            }
+            uint32_t overlap_ms = smpbench_now_ms() - start;
+            printf("threadbench: read %d bytes, read then compute %d ms, read in a thread while computing %d ms\n",
+                   shared->read_bytes, serial_ms, overlap_ms);
+        }
+        free(shared);
+        exit(0);
+    }
+    else if (pid == -1)
+    {
+        printf("threadbench: fork failed\n");
+        return;
+    }
+    int32_t status;
+    wait(&status);
+}
+
+#define FORKBENCH_PARKED 128 // 第二轮中停车进程里一直阻塞着的线程数, 用来增加系统中的任务数
+#define FORKBENCH_BATCH 16   // 每批同时存在的子进程数
+#define FORKBENCH_ROUNDS 32  // 批数
+
+/* 父子进程共享的状态: 停车进程在ready上通知线程已就位, 计时结束后gate置1放行 */
+struct forkbench_shared
+{
+    uint32_t gate;
+    uint32_t ready;
+};
+
+/* 被停住的线程: 在futex上等gate变为非0 */
+static void forkbench_park(void *arg)
+{
+    uint32_t *gate = arg;
+    while (*(volatile uint32_t *)gate == 0)
+        futex_wait(gate, 0);
+}
+
+/**
+ * @brief forkbench_park_proc在单独的停车进程中clone出parked个一直阻塞的线程, 通知ready后自己也在gate上等,
+ *        放行后回收这些线程并退出. 线程不在被计时进程的地址空间里, 两轮fork复制的页表相同
+ */
+static void forkbench_park_proc(struct forkbench_shared *shared, uint32_t parked)
+{
+    int16_t *tids = malloc(parked * sizeof(int16_t));
+    uint32_t thread = 0;
+    while (tids != NULL && thread < parked && (tids[thread] = clone(forkbench_park, &shared->gate)) != -1)
+        thread++;
+
+    shared->ready = 1;
+    futex_wake(&shared->ready, 1);
+    forkbench_park(&shared->gate);
+
+    int32_t status;
+    while (thread-- > 0)
+        thread_join(tids[thread], &status);
+    free(tids);
+    exit(0);
+}
+
+/**
+ * @brief forkbench_run先fork出带parked个阻塞线程的停车进程(parked为0时不创建), 再分FORKBENCH_ROUNDS批
+ *        fork立即exit的子进程并wait回收. 停车进程在计时结束前不会退出, 不会被计时中的wait回收
+ *
+ * @return uint32_t fork和回收所有子进程的耗时(毫秒), 不含创建和回收停车进程的时间
+ */
+static uint32_t forkbench_run(struct forkbench_shared *shared, uint32_t parked)
+{
+    shared->gate = 0;
+    shared->ready = 0;
+    int32_t status;
+    int32_t parker = 0;
+    if (parked > 0)
+    {
+        parker = fork();
+        if (parker == 0)
+            forkbench_park_proc(shared, parked);
+        else if (parker == -1)
+        {
+            printf("forkbench: fork failed\n");
+            return 0;
+        }
+        while (*(volatile uint32_t *)&shared->ready == 0)
+            futex_wait(&shared->ready, 0);
+    }
+
+    uint32_t start = smpbench_now_ms();
+    uint32_t round = 0;
+    while (round++ < FORKBENCH_ROUNDS)
+    {
+        uint32_t child = 0;
+        while (child < FORKBENCH_BATCH)
+        {
+            int32_t pid = fork();
+            if (pid == 0)
+                exit(0);
+            else if (pid == -1)
+                break;
+            child++;
+        }
+        while (child-- > 0)
+            wait(&status);
+    }
+    uint32_t elapsed = smpbench_now_ms() - start;
+
+    if (parker > 0)
+    {
+        shared->gate = 1;
+        futex_wake(&shared->gate, parked + 1);
+        wait(&status);
+    }
+    return elapsed;
+}
+
+/**
+ * @brief buildin_forkbench测试fork, exit, wait的吞吐. 分别在系统中只有少量任务和另有FORKBENCH_PARKED个
+ *        阻塞线程时fork并回收同样数量的子进程, wait和exit与系统中的任务总数无关时两次耗时应相近
+ */
+void buildin_forkbench(uint32_t argc, char **argv)
+{
+    if (argc != 1)
+    {
+        printf("forkbench: no argument support!\n");
+        return;
+    }
+
+    int32_t pid = fork();
+    if (pid == 0)
+    {
+        struct forkbench_shared *shared = mmap_shared(sizeof(struct forkbench_shared));
+        if (shared == NULL)
+        {
+            printf("forkbench: mmap_shared failed\n");
+            exit(-1);
+        }
+        uint32_t idle_ms = forkbench_run(shared, 0);
+        uint32_t busy_ms = forkbench_run(shared, FORKBENCH_PARKED);
+        printf("forkbench: %d forks reaped, %d ms alone, %d ms with %d parked threads\n",
+               FORKBENCH_ROUNDS * FORKBENCH_BATCH, idle_ms, busy_ms, FORKBENCH_PARKED);
+        exit(0);
+    }
+    else if (pid == -1)
+    {
+        printf("forkbench: fork failed\n");
+        return;
+    }
+    int32_t status;
+    wait(&status);
+}
+
+#define SWITCHBENCH_SWITCHES 16384 // 每组测试中所有进程让出cpu的总次数
+
+/* 各组测试同时运行的进程数 */
+static const uint32_t switchbench_procs[] = {2, 8, 32, 64};
+
+/**
+ * @brief switchbench_run让procs个子进程一共让出cpu SWITCHBENCH_SWITCHES次. 子进程都fork好后才同时开始,
+ *        计时不含fork的时间
+ *
+ * @return uint32_t 从开始让出cpu到全部回收的耗时(毫秒)
+ */
+static uint32_t switchbench_run(uint32_t *gate, uint32_t procs)
+{
+    *gate = 0;
+    uint32_t rounds = SWITCHBENCH_SWITCHES / procs;
+    uint32_t child = 0;
+    while (child < procs)
+    {
+        int32_t pid = fork();
+        if (pid == 0)
+        {
+            while (*(volatile uint32_t *)gate == 0)
+                futex_wait(gate, 0);
+            uint32_t round = 0;
+            while (round++ < rounds)
+                sched_yield();
+            exit(0);
+        }
+        else if (pid == -1)
+        {
+            printf("switchbench: fork failed\n");
+            break;
+        }
+        child++;
+    }
+
+    uint32_t start = smpbench_now_ms();
+    *gate = 1;
+    futex_wake(gate, child);
+    int32_t status;
+    while (child-- > 0)
+        wait(&status);
+    return smpbench_now_ms() - start;
+}
+
+/**
+ * @brief buildin_switchbench测试上下文切换的开销是否随就绪任务数增长. 每组的总切换次数相同,
+ *        入队, 出队和唤醒与任务数无关时各组耗时应相近
+ */
+void buildin_switchbench(uint32_t argc, char **argv)
+{
+    if (argc != 1)
+    {
+        printf("switchbench: no argument support!\n");
+        return;
+    }
+
+    int32_t pid = fork();
+    if (pid == 0)
+    {
+        uint32_t *gate = mmap_shared(sizeof(uint32_t));
+        if (gate == NULL)
+        {
+            printf("switchbench: mmap_shared failed\n");
+            exit(-1);
+        }
+        uint32_t idx = 0;
+        while (idx < sizeof(switchbench_procs) / sizeof(switchbench_procs[0]))
+        {
+            uint32_t procs = switchbench_procs[idx++];
+            printf("switchbench: %d procs, %d yields: %d ms\n", procs, SWITCHBENCH_SWITCHES, switchbench_run(gate, procs));
+        }
+        exit(0);
+    }
+    else if (pid == -1)
+    {
+        printf("switchbench: fork failed\n");
+        return;
+    }
+    int32_t status;
+    wait(&status);
+}
+
+/**
+ * @brief buildin_membench在内核中测试逐字节, rep movs/stos和SSE2非临时存储几种实现每个cpu周期处理的字节数
+ */
+void buildin_membench(uint32_t argc, char **argv)
+{
+    if (argc != 1)
+    {
+        printf("membench: no argument support!\n");
+        return;
+    }
+    if (mem_bench() == -1)
+    {
+        printf("membench: failed, or kernel built without BENCH=1\n");
+    }
+}
+
+#define COWBENCH_PAGES 64 // 子进程写入的共享页数
+
+/**
+ * @brief buildin_cowbench测量写时复制缺页的处理耗时. 父进程先写满COWBENCH_PAGES页, fork后子进程
+ *        逐页写一个字节, 每一页都触发一次复制. 统计由内核在缺页处理中用rdtsc记录
+ */
+void buildin_cowbench(uint32_t argc, char **argv)
+{
+    if (argc != 1)
+    {
+        printf("cowbench: no argument support!\n");
+        return;
+    }
+    uint8_t *buf = malloc(COWBENCH_PAGES * 4096);
+    if (buf == NULL)
+    {
+        printf("cowbench: malloc failed\n");
+        return;
+    }
+    memset(buf, 1, COWBENCH_PAGES * 4096);
+
+    if (cow_stat(1) == -1)
+    {
+        printf("cowbench: kernel built without BENCH=1\n");
+        free(buf);
+        return;
+    }
+    int32_t pid = fork();
+    if (pid == 0)
+    {
+        uint32_t page = 0;
+        while (page < COWBENCH_PAGES)
+        {
+            buf[page++ * 4096] = 2;
+        }
+        cow_stat(0);
+        exit(0);
+    }
+    else if (pid == -1)
+    {
+        printf("cowbench: fork failed\n");
+    }
+    else
+    {
+        int32_t status;
+        wait(&status);
+    }
+    free(buf);
+}
+
+#define TLBBENCH_WALKS 200 // 遍历根目录的次数
+#define TLBBENCH_FORKS 200 // fork, exit, wait的次数
+
+/* 打开根目录, 对每个目录项stat一次, 返回目录项数. 全是文件系统元数据的操作, 访问大量内核堆上的inode和目录缓存 */
+static uint32_t tlbbench_walk(void)
+{
+    char path[MAX_PATH_LEN];
+    struct stat file_stat;
+    uint32_t entries = 0;
+    dir_t *dir = opendir("/");
+    if (dir == NULL)
+        return 0;
+    dir_entry_t *de = NULL;
+    while ((de = readdir(dir)))
+    {
+        path[0] = '/';
+        path[1] = 0;
+        strcat(path, de->filename);
+        stat(path, &file_stat);
+        entries++;
+    }
+    closedir(dir);
+    return entries;
+}
+
+/**
+ * @brief buildin_tlbbench测量对tlb敏感的两类内核操作的耗时: 反复遍历根目录并stat每一项,
+ *        以及反复fork后立即exit并wait. 两者都频繁访问内核堆上的数据结构和页表,
+ *        内核空间用大页映射时占用的tlb项少, 耗时应当更短
+ */
+void buildin_tlbbench(uint32_t argc, char **argv)
+{
+    if (argc != 1)
+    {
+        printf("tlbbench: no argument support!\n");
+        return;
+    }
+
+    uint32_t round = 0, entries = 0;
+    uint32_t start = smpbench_now_ms();
+    for (round = 0; round < TLBBENCH_WALKS; round++)
+        entries = tlbbench_walk();
+    uint32_t walk_ms = smpbench_now_ms() - start;
+
+    int32_t status;
+    start = smpbench_now_ms();
+    for (round = 0; round < TLBBENCH_FORKS; round++)
+    {
+        int32_t pid = fork();
+        if (pid == 0)
+            exit(0);
+        else if (pid == -1)
+        {
+            printf("tlbbench: fork failed\n");
+            break;
+        }
+        wait(&status);
+    }
+    uint32_t fork_ms = smpbench_now_ms() - start;
+
+    printf("tlbbench: %d walks of / (%d entries) in %d ms, %d fork+exit+wait in %d ms\n",
+           TLBBENCH_WALKS, entries, walk_ms, round, fork_ms);
+}
+
+#define MALLOCBENCH_ROUNDS 200 // 轮数
+#define MALLOCBENCH_LIVE 64    // 每轮同时持有的内存块数
+
+/* 每轮依次分配MALLOCBENCH_LIVE块大小不同的内存, 再全部释放, 返回耗时(毫秒) */
+static uint32_t mallocbench_run(void *(*alloc)(uint32_t), void (*release)(void *))
+{
+    void *ptrs[MALLOCBENCH_LIVE];
+    uint32_t round = 0, idx = 0;
+    uint32_t start = smpbench_now_ms();
+    for (round = 0; round < MALLOCBENCH_ROUNDS; round++)
+    {
+        for (idx = 0; idx < MALLOCBENCH_LIVE; idx++)
+        {
+            // 8到1024字节之间变化, 覆盖常见的小对象
+            ptrs[idx] = alloc(8 << ((round + idx) % 8));
+            if (ptrs[idx] != NULL)
+                *(uint32_t *)ptrs[idx] = idx;
+        }
+        for (idx = 0; idx < MALLOCBENCH_LIVE; idx++)
+            release(ptrs[idx]);
+    }
+    return smpbench_now_ms() - start;
+}
+
+/**
+ * @brief buildin_mallocbench比较用户态分配器和每次都陷入内核的sys_malloc: 用两者分别执行同样的分配释放序列,
+ *        前者只在堆不够时调用sbrk, 后者每次分配释放都要进内核获取内存池的锁
+ */
+void buildin_mallocbench(uint32_t argc, char **argv)
+{
+    if (argc != 1)
+    {
+        printf("mallocbench: no argument support!\n");
+        return;
+    }
+    uint32_t user_ms = mallocbench_run(malloc, free);
+    uint32_t syscall_ms = mallocbench_run(malloc_syscall, free_syscall);
+    printf("mallocbench: %d malloc/free pairs, user-space %d ms, syscall %d ms\n",
+           MALLOCBENCH_ROUNDS * MALLOCBENCH_LIVE, user_ms, syscall_ms);
+}
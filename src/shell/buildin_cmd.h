@@ -14,4 +14,15 @@ char *buildin_cd(uint32_t argc, char **argv);
 void buildin_pwd(uint32_t argc, char **argv);
 void buildin_echo(uint32_t argc, char **argv);
 void make_default_path(char *path, char *final_path);
+void buildin_schedbench(uint32_t argc, char **argv);
+void buildin_smpbench(uint32_t argc, char **argv);
+void buildin_lockstress(uint32_t argc, char **argv);
+void buildin_futexbench(uint32_t argc, char **argv);
+void buildin_threadbench(uint32_t argc, char **argv);
+void buildin_forkbench(uint32_t argc, char **argv);
+void buildin_switchbench(uint32_t argc, char **argv);
+void buildin_membench(uint32_t argc, char **argv);
+void buildin_cowbench(uint32_t argc, char **argv);
+void buildin_tlbbench(uint32_t argc, char **argv);
+void buildin_mallocbench(uint32_t argc, char **argv);
 #endif
\ No newline at end of file
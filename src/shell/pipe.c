@@ -5,24 +5,26 @@
 #include "ioqueue.h"
 #include "thread.h"
 
+/**
+ * @brief sys_fd_redirect把描述符old_local_fd重定向到new_local_fd所指的文件.
+ *        new_local_fd小于3时表示恢复为对应的控制台文件(标准输入, 标准输出, 标准错误), 否则等价于dup2(new_local_fd, old_local_fd)
+ */
 void sys_fd_redirect(uint32_t old_local_fd, uint32_t new_local_fd)
 {
-    task_status_t *pcb = running_thread();
-
+    struct file *file;
     if (new_local_fd < 3)
-        pcb->fd_table[old_local_fd] = new_local_fd;
+        file = &console_files[new_local_fd];
     else
-    {
-        uint32_t new_global_fd = pcb->fd_table[new_local_fd];
-        pcb->fd_table[old_local_fd] = new_global_fd;
-    }
+        file = fd2file(new_local_fd);
+    if (file != NULL)
+        fd_replace(old_local_fd, file);
 }
 
 // 判断文件描述符fd是否指向管道
-bool is_pipe(uint32_t fd)
+bool is_pipe(int32_t fd)
 {
-    uint32_t file_table_idx = fd_local2global(fd);
-    return file_table[file_table_idx].fd_flag == PIPE_FLAG;
+    struct file *file = fd2file(fd);
+    return file != NULL && file->fd_flag == PIPE_FLAG;
 }
 
 /**
@@ -34,24 +36,39 @@ bool is_pipe(uint32_t fd)
  */
 int32_t sys_pipe(int32_t pipe_fd[2])
 {
-    // 得到文件表的idx
-    int32_t global_fd = get_free_slot_in_global();
+    // 从文件表中分配文件结构, 管道的两端共享它
+    struct file *file = file_alloc();
+    if (file == NULL)
+        return -1;
 
     // 申请一页内核内存做环形缓冲区
-    file_table[global_fd].fd_inode = get_kernel_pages(1);
-    if (file_table[global_fd].fd_inode == NULL)
+    file->fd_inode = get_kernel_pages(1);
+    if (file->fd_inode == NULL)
+    {
+        file_put(file);
         return -1;
+    }
 
     // 初始化环形缓存区
-    ioqueue_init((struct ioqueue *)file_table[global_fd].fd_inode);
+    ioqueue_init((struct ioqueue *)file->fd_inode);
 
     // 将fd_flag复用管道标志，标记该内存属于管道
-    file_table[global_fd].fd_flag = PIPE_FLAG;
+    file->fd_flag = PIPE_FLAG;
 
-    // 把fd_pos复用为管道打开数
-    file_table[global_fd].fd_pos = 2;
-    pipe_fd[0] = pcb_fd_install(global_fd);
-    pipe_fd[1] = pcb_fd_install(global_fd);
+    // 两个描述符各持有一个引用
+    pipe_fd[0] = pcb_fd_install(file);
+    if (pipe_fd[0] == -1)
+    {
+        file_put(file);
+        return -1;
+    }
+    pipe_fd[1] = pcb_fd_install(file_get(file));
+    if (pipe_fd[1] == -1)
+    {
+        sys_close(pipe_fd[0]);
+        file_put(file);
+        return -1;
+    }
     return 0;
 }
 
@@ -60,11 +77,8 @@ uint32_t pipe_read(int32_t fd, void *buf, uint32_t count)
 {
     char *buffer = buf;
     uint32_t bytes_read = 0;
-    // 把文件描述符转化成文件表下标
-    uint32_t global_fd = fd_local2global(fd);
-
     // 获取管道的环形缓存区
-    struct ioqueue *ioq = (struct ioqueue *)file_table[global_fd].fd_inode;
+    struct ioqueue *ioq = (struct ioqueue *)fd2file(fd)->fd_inode;
 
     // 选择较小的数据读取量，避免阻塞
     uint32_t ioq_len = ioq_length(ioq);
@@ -83,9 +97,7 @@ uint32_t pipe_read(int32_t fd, void *buf, uint32_t count)
 uint32_t pipe_write(int32_t fd, const void *buf, uint32_t count)
 {
     uint32_t bytes_write = 0;
-    // 得到文件表下标
-    uint32_t global_fd = fd_local2global(fd);
-    struct ioqueue *ioq = (struct ioqueue *)file_table[global_fd].fd_inode;
+    struct ioqueue *ioq = (struct ioqueue *)fd2file(fd)->fd_inode;
 
     // 选择较小的数据写入量，避免阻塞
     uint32_t ioq_left = bufsize - ioq_length(ioq);
@@ -4,10 +4,9 @@
 #include "global.h"
 
 #define PIPE_FLAG 0xFFFF
-bool is_pipe(uint32_t local_fd);
+bool is_pipe(int32_t fd);
 int32_t sys_pipe(int32_t pipefd[2]);
 uint32_t pipe_read(int32_t fd, void *buf, uint32_t count);
 uint32_t pipe_write(int32_t fd, const void *buf, uint32_t count);
-uint32_t fd_local2global(uint32_t local_fd);
 void sys_fd_redirect(uint32_t old_local_fd, uint32_t new_local_fd);
 #endif
\ No newline at end of file
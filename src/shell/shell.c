@@ -133,6 +133,18 @@ static void help()
        touch: create a file\n\
        echo: display a line of text\n\
        date: display current time\n\
+       sync: write cached filesystem metadata to disk\n\
+       schedbench: measure wakeup-to-run latency under mixed cpu/io load\n\
+       smpbench: measure how cpu-bound children scale across processors\n\
+       lockstress: hammer mutex, semaphore and spinlock from many processes\n\
+       futexbench: compare a futex mutex with a pipe lock under contention\n\
+       threadbench: run threads sharing one address space, overlap file reads with compute\n\
+       forkbench: measure fork/exit/wait throughput with and without many other tasks\n\
+       switchbench: measure context switch cost as the number of runnable tasks grows\n\
+       membench: report bytes per cycle of memset, memcpy and memcmp implementations\n\
+       cowbench: measure copy-on-write fault latency after fork\n\
+       tlbbench: time a filesystem metadata walk and fork/exit/wait, both sensitive to tlb misses\n\
+       mallocbench: compare the user-space malloc with the syscall allocator\n\
  shortcut key:\n\
        ctrl+l: clear screen\n\
        ctrl+u: clear input\n\n");
@@ -174,6 +186,30 @@ static void cmd_execute(uint32_t argc, char **argv)
     {
         debug();
     }
+    else if (!strcmp("sync", argv[0]))
+        sync();
+    else if (!strcmp("schedbench", argv[0]))
+        buildin_schedbench(argc, argv);
+    else if (!strcmp("smpbench", argv[0]))
+        buildin_smpbench(argc, argv);
+    else if (!strcmp("lockstress", argv[0]))
+        buildin_lockstress(argc, argv);
+    else if (!strcmp("futexbench", argv[0]))
+        buildin_futexbench(argc, argv);
+    else if (!strcmp("threadbench", argv[0]))
+        buildin_threadbench(argc, argv);
+    else if (!strcmp("forkbench", argv[0]))
+        buildin_forkbench(argc, argv);
+    else if (!strcmp("switchbench", argv[0]))
+        buildin_switchbench(argc, argv);
+    else if (!strcmp("membench", argv[0]))
+        buildin_membench(argc, argv);
+    else if (!strcmp("cowbench", argv[0]))
+        buildin_cowbench(argc, argv);
+    else if (!strcmp("tlbbench", argv[0]))
+        buildin_tlbbench(argc, argv);
+    else if (!strcmp("mallocbench", argv[0]))
+        buildin_mallocbench(argc, argv);
     else
     { // 如果是外部命令,需要从磁盘上加载
         int32_t pid = fork();
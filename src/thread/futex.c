@@ -0,0 +1,150 @@
+#include "futex.h"
+#include "thread.h"
+#include "memory.h"
+#include "interrupt.h"
+#include "global.h"
+#include "debug.h"
+
+static struct futex_bucket futex_queues[FUTEX_HASH_SIZE];
+
+/* 初始化所有等待队列 */
+void futex_init(void)
+{
+   uint32_t idx = 0;
+   while (idx < FUTEX_HASH_SIZE)
+   {
+      spin_init(&futex_queues[idx].lock);
+      list_init(&futex_queues[idx].waiters);
+      idx++;
+   }
+}
+
+/**
+ * @brief futex_key检查用户地址uaddr可以作为futex使用: 位于用户空间, 4字节对齐, 所在页已映射.
+ *        可以的话求出查找等待队列的键. 私有页fork后是写时复制的只读页, 物理页会在之后的写缺页中更换,
+ *        所以只有共享页用物理地址, 私有页用(地址空间, 虚拟地址)
+ *
+ * @param uaddr 用户空间的字
+ * @param key 求出的键
+ * @return bool 地址合法返回true
+ */
+static bool futex_key(uint32_t *uaddr, struct futex_key *key)
+{
+   uint32_t vaddr = (uint32_t)uaddr;
+   if (vaddr == 0 || vaddr >= 0xc0000000 || (vaddr & 3) != 0)
+   {
+      return false;
+   }
+   if (!(*pde_ptr(vaddr) & PG_P_1) || !(*pte_ptr(vaddr) & PG_P_1))
+   {
+      return false;
+   }
+   if (*pte_ptr(vaddr) & PG_SHARED)
+   {
+      key->mm = NULL;
+      key->addr = addr_v2p(vaddr);
+   }
+   else
+   {
+      key->mm = running_thread()->mm;
+      key->addr = vaddr;
+   }
+   return true;
+}
+
+/* 键key所在的等待队列 */
+static struct futex_bucket *futex_hash(struct futex_key *key)
+{
+   return &futex_queues[((key->addr >> 2) ^ ((uint32_t)key->mm >> 6)) & (FUTEX_HASH_SIZE - 1)];
+}
+
+/**
+ * @brief sys_futex_wait若*uaddr仍等于val, 则睡眠直到有人对同一个字调用futex_wake.
+ *        检查和入队都在等待队列的自旋锁内完成, 唤醒者也要先拿这把锁, 所以用户态在检查之后修改字并唤醒不会被漏掉
+ *
+ * @param uaddr 用户空间的字
+ * @param val 调用者上次看到的值
+ * @return int32_t 被唤醒返回0; *uaddr已不等于val或地址非法返回-1, 调用者应重新检查
+ */
+int32_t sys_futex_wait(uint32_t *uaddr, uint32_t val)
+{
+   struct futex_q q;
+   if (!futex_key(uaddr, &q.key))
+   {
+      return -1;
+   }
+
+   struct futex_bucket *bucket = futex_hash(&q.key);
+   q.task = running_thread();
+
+   enum intr_status old_status = spin_lock_irqsave(&bucket->lock);
+   if (*(volatile uint32_t *)uaddr != val)
+   {
+      spin_unlock_irqrestore(&bucket->lock, old_status);
+      return -1;
+   }
+   list_append(&bucket->waiters, &q.tag);
+   thread_block_spin(TASK_BLOCKED, &bucket->lock);
+   spin_unlock_irqrestore(&bucket->lock, old_status);
+   return 0;
+}
+
+/**
+ * @brief sys_futex_wake唤醒最多nr_wake个在uaddr上等待的任务, 先等待的先唤醒
+ *
+ * @return int32_t 唤醒的任务数, 地址非法返回-1
+ */
+int32_t sys_futex_wake(uint32_t *uaddr, uint32_t nr_wake)
+{
+   struct futex_key key;
+   if (!futex_key(uaddr, &key))
+   {
+      return -1;
+   }
+
+   struct futex_bucket *bucket = futex_hash(&key);
+   int32_t woken = 0;
+   enum intr_status old_status = spin_lock_irqsave(&bucket->lock);
+   struct list_elem *elem = bucket->waiters.head.next;
+   while (elem != &bucket->waiters.tail && (uint32_t)woken < nr_wake)
+   {
+      struct futex_q *q = elem2entry(struct futex_q, tag, elem);
+      elem = elem->next;
+      if (q->key.mm == key.mm && q->key.addr == key.addr)
+      {
+         list_remove(&q->tag);
+         thread_unblock(q->task);
+         woken++;
+      }
+   }
+   spin_unlock_irqrestore(&bucket->lock, old_status);
+   return woken;
+}
+
+/**
+ * @brief futex_wake_group唤醒地址空间mm中所有在futex上等待的任务. 主线程退出时调用, 让同组的线程返回用户态后退出
+ *
+ * @param mm 正在退出的线程组的地址空间
+ */
+void futex_wake_group(struct mm_struct *mm)
+{
+   uint32_t idx = 0;
+   while (idx < FUTEX_HASH_SIZE)
+   {
+      struct futex_bucket *bucket = &futex_queues[idx];
+      enum intr_status old_status = spin_lock_irqsave(&bucket->lock);
+      struct list_elem *elem = bucket->waiters.head.next;
+      while (elem != &bucket->waiters.tail)
+      {
+         struct futex_q *q = elem2entry(struct futex_q, tag, elem);
+         elem = elem->next;
+         if (q->task->mm == mm)
+         {
+            list_remove(&q->tag);
+            thread_unblock(q->task);
+         }
+      }
+      spin_unlock_irqrestore(&bucket->lock, old_status);
+      idx++;
+   }
+}
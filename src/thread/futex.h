@@ -0,0 +1,44 @@
+#ifndef __THREAD_FUTEX_H
+#define __THREAD_FUTEX_H
+#include "stdint.h"
+#include "list.h"
+#include "sync.h"
+
+/**
+ * futex(fast userspace mutex)
+ *
+ * 锁的状态放在用户内存的一个32位字中, 没有竞争时用户态用原子指令完成加锁解锁, 不进入内核.
+ * 只有需要睡眠或唤醒别人时才调用futex_wait/futex_wake. 等待者按字的键散列到FUTEX_HASH_SIZE个等待队列中.
+ * 共享页(例如mmap_shared分配的页)上的字以物理地址为键, 不同进程只要映射了同一个物理页, 就能在同一个字上同步;
+ * 私有页上的字以(地址空间, 虚拟地址)为键, fork之后写时复制换了物理页, 键也不会变
+ */
+
+#define FUTEX_HASH_SIZE 64 // 等待队列的个数, 须是2的幂
+
+/* 一个等待队列 */
+struct futex_bucket
+{
+   struct spinlock lock; // 保护waiters
+   struct list waiters;  // struct futex_q组成的链表
+};
+
+/* 等待队列的键 */
+struct futex_key
+{
+   struct mm_struct *mm; // 私有页为字所在的地址空间, 共享页为NULL
+   uint32_t addr;        // 私有页为字的虚拟地址, 共享页为字的物理地址
+};
+
+/* 一个等待者, 放在等待者的内核栈上 */
+struct futex_q
+{
+   struct list_elem tag;      // 用于加入futex_bucket.waiters
+   struct task_struct *task;  // 等待的任务
+   struct futex_key key;      // 等待的字
+};
+
+void futex_init(void);
+int32_t sys_futex_wait(uint32_t *uaddr, uint32_t val);
+int32_t sys_futex_wake(uint32_t *uaddr, uint32_t nr_wake);
+void futex_wake_group(struct mm_struct *mm);
+#endif
@@ -3,10 +3,12 @@
 #include "global.h"
 #include "debug.h"
 #include "interrupt.h"
+#include "stdio-kernel.h"
 
 /* 初始化信号量 */
-void sema_init(struct semaphore *psema, uint8_t value)
+void sema_init(struct semaphore *psema, uint32_t value)
 {
+   spin_init(&psema->lock);
    psema->value = value;       // 为信号量赋初值
    list_init(&psema->waiters); // 初始化信号量的等待队列
 }
@@ -22,11 +24,11 @@ void lock_init(struct lock *plock)
    sema_init(&plock->semaphore, 1); // 信号量初值为1, 所以信号量来回变换只有两个值，一个是0，一个是1
 }
 
-/* 信号量down操作 */
-void sema_down(struct semaphore *psema)
+/* 信号量down操作, io为真时阻塞算作等待I/O */
+static void sema_down_common(struct semaphore *psema, bool io)
 {
-   /* 关中断来保证原子操作 */
-   enum intr_status old_status = intr_disable();
+   /* 关中断并持有信号量的自旋锁来保证原子操作, 前者防本cpu上的中断, 后者防其它cpu */
+   enum intr_status old_status = spin_lock_irqsave(&psema->lock);
 
    while (psema->value == 0) //  未来的我，你觉得为什么此处，要使用while循环，而不是if.(与本系统无关)
    {                         // 若value为0,表示已经被别人持有
@@ -36,43 +38,82 @@ void sema_down(struct semaphore *psema)
       {
          PANIC("sema_down: thread blocked has been in waiters_list\n");
       }
-      /* 若信号量的值等于0,则当前线程把自己加入该锁的等待队列,然后阻塞自己 */
+      /* 若信号量的值等于0,则当前线程把自己加入该锁的等待队列,然后阻塞自己.
+       * 阻塞状态在释放自旋锁之前设置, sema_up拿到自旋锁时看到的一定是已阻塞的线程 */
       list_append(&psema->waiters, &running_thread()->general_tag);
-      thread_block(TASK_BLOCKED); // 阻塞线程,直到被唤醒
+      /* 真正阻塞时才标记等待I/O, 由thread_unblock提升优先级后清除 */
+      running_thread()->io_wait = io;
+      thread_block_spin(TASK_BLOCKED, &psema->lock); // 阻塞线程,直到被唤醒
    }
 
-   /* 若value为1或被唤醒后,会执行下面的代码,也就是获得了锁。*/
+   /* 若value大于0或被唤醒后,会执行下面的代码,也就是获得了信号量。*/
    psema->value--;
-   ASSERT(psema->value == 0);
    /* 恢复之前的中断状态 */
-   intr_set_status(old_status);
+   spin_unlock_irqrestore(&psema->lock, old_status);
+}
+
+/* 信号量down操作 */
+void sema_down(struct semaphore *psema)
+{
+   sema_down_common(psema, false);
+}
+
+/* 等待硬盘等I/O完成的信号量down操作, 阻塞后被唤醒时按交互型任务提升优先级 */
+void sema_down_io(struct semaphore *psema)
+{
+   sema_down_common(psema, true);
+}
+
+/* 信号量down操作的非阻塞版本: 信号量为0时不等待, 返回false */
+bool sema_try_down(struct semaphore *psema)
+{
+   enum intr_status old_status = spin_lock_irqsave(&psema->lock);
+   bool acquired = psema->value > 0;
+   if (acquired)
+   {
+      psema->value--;
+   }
+   spin_unlock_irqrestore(&psema->lock, old_status);
+   return acquired;
 }
 
 /* 信号量的up操作 */
 void sema_up(struct semaphore *psema)
 {
    /* 关中断,保证原子操作 */
-   enum intr_status old_status = intr_disable();
-   ASSERT(psema->value == 0);
+   enum intr_status old_status = spin_lock_irqsave(&psema->lock);
    if (!list_empty(&psema->waiters))
    {
       struct task_struct *thread_blocked = elem2entry(struct task_struct, general_tag, list_pop(&psema->waiters));
       thread_unblock(thread_blocked);
    }
    psema->value++;
-   ASSERT(psema->value == 1);
    /* 恢复之前的中断状态 */
-   intr_set_status(old_status);
+   spin_unlock_irqrestore(&psema->lock, old_status);
+}
+
+/* 锁的持有者是否正在别的cpu上运行. 是的话它很快会释放锁, 自旋等待比睡眠后再被唤醒代价小 */
+static bool lock_holder_running(struct lock *plock, struct task_struct *cur)
+{
+   struct task_struct *holder = plock->holder;
+   return holder != NULL && holder->status == TASK_RUNNING && holder->cpu != cur->cpu;
 }
 
 /* 获取锁plock */
 void lock_acquire(struct lock *plock)
 {
+   struct task_struct *cur = running_thread();
    /* 排除曾经自己已经持有锁但还未将其释放的情况。*/
-   if (plock->holder != running_thread())
+   if (plock->holder != cur)
    {
+      /* 自适应自旋: 持有者在运行就先等一会, 持有者睡眠或自旋次数用完才去睡眠 */
+      uint32_t spins = 0;
+      while (lock_holder_running(plock, cur) && spins++ < MUTEX_SPIN_LIMIT)
+      {
+         asm volatile("rep; nop" ::: "memory");
+      }
       sema_down(&plock->semaphore); // 对信号量P操作,原子操作
-      plock->holder = running_thread();
+      plock->holder = cur;
       ASSERT(plock->holder_repeat_nr == 0);
       plock->holder_repeat_nr = 1;
    }
@@ -82,6 +123,25 @@ void lock_acquire(struct lock *plock)
    }
 }
 
+/* 尝试获取锁plock, 锁被别的任务持有时不等待, 返回false. 用于不能睡眠的场合, 例如idle线程 */
+bool lock_try_acquire(struct lock *plock)
+{
+   struct task_struct *cur = running_thread();
+   if (plock->holder == cur)
+   {
+      plock->holder_repeat_nr++;
+      return true;
+   }
+   if (!sema_try_down(&plock->semaphore))
+   {
+      return false;
+   }
+   plock->holder = cur;
+   ASSERT(plock->holder_repeat_nr == 0);
+   plock->holder_repeat_nr = 1;
+   return true;
+}
+
 /* 释放锁plock */
 void lock_release(struct lock *plock)
 {
@@ -97,3 +157,123 @@ void lock_release(struct lock *plock)
    plock->holder_repeat_nr = 0;
    sema_up(&plock->semaphore); // 信号量的V操作,也是原子操作
 }
+
+/* 初始化自旋锁 */
+void spin_init(struct spinlock *lock)
+{
+   lock->owner = 0;
+   lock->next = 0;
+}
+
+/* 获取自旋锁: lock xadd原子地领取号码并把next加1, 然后等owner叫到自己 */
+void spin_lock(struct spinlock *lock)
+{
+   uint16_t ticket = 1;
+   asm volatile("lock; xaddw %0, %1"
+                : "+r"(ticket), "+m"(lock->next)
+                :
+                : "memory");
+   while (lock->owner != ticket)
+   {
+      asm volatile("rep; nop" ::: "memory"); // 即pause, 告诉cpu这是自旋等待
+   }
+}
+
+/* 释放自旋锁, 只有持有者会写owner. x86的普通写不会与之前的读写重排, 编译器屏障即可 */
+void spin_unlock(struct spinlock *lock)
+{
+   asm volatile("" ::: "memory");
+   lock->owner++;
+}
+
+/* 关中断后获取自旋锁, 返回关中断前的状态. 中断处理程序也要用的锁必须这样获取, 否则本cpu上的中断会自己等自己 */
+enum intr_status spin_lock_irqsave(struct spinlock *lock)
+{
+   enum intr_status old_status = intr_disable();
+   spin_lock(lock);
+   return old_status;
+}
+
+/* 释放自旋锁, 并恢复中断状态为old_status */
+void spin_unlock_irqrestore(struct spinlock *lock, enum intr_status old_status)
+{
+   spin_unlock(lock);
+   intr_set_status(old_status);
+}
+
+/* 初始化读写锁 */
+void rwlock_init(struct rwlock *rw)
+{
+   spin_init(&rw->lock);
+   rw->readers = 0;
+   rw->writer = NULL;
+   rw->writers_waiting = 0;
+   list_init(&rw->read_waiters);
+   list_init(&rw->write_waiters);
+}
+
+/* 获取读锁. 有写者持有或等待时排队 */
+void read_lock(struct rwlock *rw)
+{
+   enum intr_status old_status = spin_lock_irqsave(&rw->lock);
+   while (rw->writer != NULL || rw->writers_waiting > 0)
+   {
+      ASSERT(rw->writer != running_thread());
+      list_append(&rw->read_waiters, &running_thread()->general_tag);
+      thread_block_spin(TASK_BLOCKED, &rw->lock);
+   }
+   rw->readers++;
+   spin_unlock_irqrestore(&rw->lock, old_status);
+}
+
+/* 释放读锁, 最后一个读者离开时唤醒一个写者 */
+void read_unlock(struct rwlock *rw)
+{
+   enum intr_status old_status = spin_lock_irqsave(&rw->lock);
+   ASSERT(rw->readers > 0);
+   if (--rw->readers == 0 && !list_empty(&rw->write_waiters))
+   {
+      thread_unblock(elem2entry(struct task_struct, general_tag, list_pop(&rw->write_waiters)));
+   }
+   spin_unlock_irqrestore(&rw->lock, old_status);
+}
+
+/* 获取写锁. 等待期间计入writers_waiting, 被唤醒后仍算等待者, 直到真正拿到锁, 其间新来的读者不能插队 */
+void write_lock(struct rwlock *rw)
+{
+   struct task_struct *cur = running_thread();
+   enum intr_status old_status = spin_lock_irqsave(&rw->lock);
+   ASSERT(rw->writer != cur);
+   if (rw->writer != NULL || rw->readers > 0)
+   {
+      rw->writers_waiting++;
+      do
+      {
+         list_append(&rw->write_waiters, &cur->general_tag);
+         thread_block_spin(TASK_BLOCKED, &rw->lock);
+      } while (rw->writer != NULL || rw->readers > 0);
+      rw->writers_waiting--;
+   }
+   rw->writer = cur;
+   spin_unlock_irqrestore(&rw->lock, old_status);
+}
+
+/* 释放写锁. 优先唤醒下一个写者, 没有写者等待时唤醒全部读者 */
+void write_unlock(struct rwlock *rw)
+{
+   enum intr_status old_status = spin_lock_irqsave(&rw->lock);
+   ASSERT(rw->writer == running_thread());
+   rw->writer = NULL;
+   if (!list_empty(&rw->write_waiters))
+   {
+      thread_unblock(elem2entry(struct task_struct, general_tag, list_pop(&rw->write_waiters)));
+   }
+   else
+   {
+      while (!list_empty(&rw->read_waiters))
+      {
+         thread_unblock(elem2entry(struct task_struct, general_tag, list_pop(&rw->read_waiters)));
+      }
+   }
+   spin_unlock_irqrestore(&rw->lock, old_status);
+}
@@ -6,32 +6,71 @@
 #include "list.h"
 #include "stdint.h"
 #include "thread.h"
+#include "interrupt.h"
+
+/* 自旋锁, 用于多处理器之间的互斥. 等待时不阻塞, 持有期间不能睡眠.
+ * 排队自旋锁(ticket lock): 申请者领取next作为号码, 等owner叫到自己的号, 按申请顺序获得锁, 不会饿死 */
+struct spinlock
+{
+   volatile uint16_t owner; // 当前持有者的号码
+   volatile uint16_t next;  // 下一个申请者领到的号码, 与owner相等时锁空闲
+};
 
 /* 信号量结构 */
 // 信号量是一种同步机制，信号量就是一个计数器 p = --, v = ++
 struct semaphore
 {
-   uint8_t value;
+   struct spinlock lock; // 保护value和waiters
+   uint32_t value;
    struct list waiters; // 记录再此信号量上等待的所有线程（这些线程都被阻塞了）
 };
 
 /* 锁结构 */
 struct lock
 {
-   struct task_struct *holder; // 锁的持有者
-   struct semaphore semaphore; // 用二元信号量实现锁
-   uint32_t holder_repeat_nr;  // 锁的持有者重复申请锁的次数， 此变量存在的意义在于当线程进入临界区后仍然有可能获得本锁
+   struct task_struct *volatile holder; // 锁的持有者
+   struct semaphore semaphore;          // 用二元信号量实现锁
+   uint32_t holder_repeat_nr;           // 锁的持有者重复申请锁的次数， 此变量存在的意义在于当线程进入临界区后仍然有可能获得本锁
 };
 
+/* 读写锁, 写者优先: 读者之间可以并行, 写者与其它任何持有者互斥.
+ * 只要有写者在等待, 新来的读者就要排队, 避免源源不断的读者把写者饿死. 不可递归获取 */
+struct rwlock
+{
+   struct spinlock lock;        // 保护下面各字段
+   uint32_t readers;            // 持有读锁的任务数
+   struct task_struct *writer;  // 持有写锁的任务, 没有为NULL
+   uint32_t writers_waiting;    // 等待写锁的任务数, 不为0时读者不能进入
+   struct list read_waiters;    // 等待读锁的任务
+   struct list write_waiters;   // 等待写锁的任务
+};
+
+/* 锁的持有者正在别的cpu上运行时, 申请者先自旋等待最多MUTEX_SPIN_LIMIT次, 仍未释放再睡眠 */
+#define MUTEX_SPIN_LIMIT 1000
+
 typedef struct lock mutex_t;
 typedef struct lock lock_t;
 typedef struct semaphore semaphore_t;
+typedef struct rwlock rwlock_t;
 
-void sema_init(struct semaphore *psema, uint8_t value);
+void sema_init(struct semaphore *psema, uint32_t value);
 void sema_down(struct semaphore *psema);
+void sema_down_io(struct semaphore *psema);
+bool sema_try_down(struct semaphore *psema);
 void sema_up(struct semaphore *psema);
 void lock_init(struct lock *plock);
 void lock_acquire(struct lock *plock);
+bool lock_try_acquire(struct lock *plock);
 void lock_release(struct lock *plock);
+void spin_init(struct spinlock *lock);
+void spin_lock(struct spinlock *lock);
+void spin_unlock(struct spinlock *lock);
+enum intr_status spin_lock_irqsave(struct spinlock *lock);
+void spin_unlock_irqrestore(struct spinlock *lock, enum intr_status old_status);
+void rwlock_init(struct rwlock *rw);
+void read_lock(struct rwlock *rw);
+void read_unlock(struct rwlock *rw);
+void write_lock(struct rwlock *rw);
+void write_unlock(struct rwlock *rw);
 
 #endif
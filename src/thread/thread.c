@@ -10,40 +10,75 @@
 #include "stdio.h"
 #include "file.h"
 #include "fs.h"
-
-/* pid的位图,最大支持1024个pid */
-uint8_t pid_bitmap_bits[128] = {0};
-
-/* pid池 */
-struct pid_pool
+#include "stdio-kernel.h"
+#include "timer.h"
+#include "smp.h"
+#include "fpu.h"
+#include "sync.h"
+#include "bench.h"
+
+/* pid池, pid在1到PID_MAX-1之间循环分配, 刚释放的pid要等一轮之后才会再用.
+ * 每个pid占map中的一位; full的每一位对应map的一个字, 该字的32个pid都已使用时为1, 查找时整字跳过.
+ * 只用自旋锁保护, 分配和释放都不会睡眠 */
+#define PID_WORDS (PID_MAX / 32)
+static struct pid_pool
 {
-   struct bitmap pid_bitmap; // pid位图
-   uint32_t pid_start;       // 起始pid
-   struct lock pid_lock;     // 分配pid锁
+   uint32_t map[PID_WORDS];        // 每个pid一位, 1表示已使用
+   uint32_t full[PID_WORDS / 32];  // 每个map字一位, 1表示该字已满
+   uint32_t last_pid;              // 上次分配的pid, 下次从它之后开始找
+   struct spinlock lock;
 } pid_pool;
 
 struct task_struct *main_thread;     // 主线程PCB
-struct task_struct *idle_thread;     // idle线程
-struct list thread_ready_list;       // 就绪队列
 struct list thread_all_list;         // 所有任务队列
+static struct list pid_hash[PID_HASH_SIZE]; // 按pid散列的全部任务, pid2thread只查一个桶
 static struct list_elem *thread_tag; // 用于保存队列中的线程结点
 
+/* 就绪队列, 每个优先级一个. ready_bitmap的第i位为1表示第i级队列非空,
+ * 选下一个任务时用bsf找到最低的1位, 即最高的非空优先级, 与就绪任务数无关 */
+static struct list ready_queues[PRIO_LEVELS];
+static uint32_t ready_bitmap;
+bool need_resched; // 唤醒了比当前任务优先级更高的任务, 下一次时钟中断时立即调度
+
 extern void switch_to(struct task_struct *cur, struct task_struct *next);
 extern void init(void);
-/* 系统空闲时运行的线程 */
-static void idle(void *arg)
+/**
+ * @brief cpu_idle是各cpu的idle线程的主循环. 有就绪任务时调度出去, 否则释放大内核锁后hlt,
+ *        让其它cpu可以进入内核, 被中断唤醒后重新获取大内核锁
+ */
+void cpu_idle(void)
 {
    while (1)
    {
       thread_block(TASK_BLOCKED);
-      // 执行hlt时必须要保证目前处在开中断的情况下
+      /* 没有就绪任务, 趁空闲预先清零一批物理页. 期间有任务被唤醒就回去调度 */
+      zero_pool_refill();
+      if (need_resched)
+      {
+         continue;
+      }
+      /* 关中断后检查最近的定时器, 若还早就停止周期性时钟中断, 空闲期间不再每10毫秒醒来一次 */
+      intr_disable();
+      tick_nohz_idle_enter();
+      unlock_kernel();
+      // 执行hlt时必须要保证目前处在开中断的情况下, sti的下一条指令执行完才响应中断, 所以不会错过唤醒
       asm volatile("sti; hlt"
                    :
                    :
                    : "memory");
+      intr_disable();
+      lock_kernel();
+      tick_nohz_idle_exit();
+      intr_enable();
    }
 }
 
+/* 系统空闲时运行的线程 */
+static void idle(void *arg)
+{
+   cpu_idle();
+}
+
 /* 获取当前线程pcb指针 */
 struct task_struct *running_thread()
 {
@@ -62,33 +97,88 @@ static void kernel_thread(thread_func *function, void *func_arg)
    function(func_arg);
 }
 
-/* 初始化pid池 */
+/* 返回x中最低的1所在的位, x不能为0 */
+static inline uint32_t pid_bsf(uint32_t x)
+{
+   uint32_t bit;
+   asm("bsf %1, %0"
+       : "=r"(bit)
+       : "rm"(x));
+   return bit;
+}
+
+/* 初始化pid池, 0号pid不使用 */
 static void pid_pool_init(void)
 {
-   pid_pool.pid_start = 1;
-   pid_pool.pid_bitmap.bits = pid_bitmap_bits;
-   pid_pool.pid_bitmap.btmp_bytes_len = 128;
-   bitmap_init(&pid_pool.pid_bitmap);
-   lock_init(&pid_pool.pid_lock);
+   memset(&pid_pool, 0, sizeof(pid_pool));
+   pid_pool.map[0] = 1;
+   pid_pool.last_pid = 0;
+   spin_init(&pid_pool.lock);
 }
 
-/* 分配pid */
+/* 从start开始往后找空闲的pid, 到PID_MAX为止, 没有返回-1 */
+static int32_t pid_find_from(uint32_t start)
+{
+   if (start >= PID_MAX)
+   {
+      return -1;
+   }
+   /* 先看start所在的字中start及以后的位 */
+   uint32_t word = start / 32;
+   uint32_t free_bits = ~pid_pool.map[word] & (~0u << (start % 32));
+   if (free_bits != 0)
+   {
+      return word * 32 + pid_bsf(free_bits);
+   }
+   /* 再用full找后面第一个未满的字 */
+   word++;
+   while (word < PID_WORDS)
+   {
+      uint32_t summary = word / 32;
+      uint32_t not_full = ~pid_pool.full[summary] & (~0u << (word % 32));
+      if (not_full != 0)
+      {
+         word = summary * 32 + pid_bsf(not_full);
+         return word * 32 + pid_bsf(~pid_pool.map[word]);
+      }
+      word = (summary + 1) * 32;
+   }
+   return -1;
+}
+
+/* 分配pid, 从上次分配的pid之后找, 到头后回到开头 */
 static pid_t allocate_pid(void)
 {
-   lock_acquire(&pid_pool.pid_lock);
-   int32_t bit_idx = bitmap_scan(&pid_pool.pid_bitmap, 1);
-   bitmap_set(&pid_pool.pid_bitmap, bit_idx, 1);
-   lock_release(&pid_pool.pid_lock);
-   return (bit_idx + pid_pool.pid_start);
+   enum intr_status old_status = spin_lock_irqsave(&pid_pool.lock);
+   int32_t pid = pid_find_from(pid_pool.last_pid + 1);
+   if (pid == -1)
+   {
+      pid = pid_find_from(1);
+   }
+   if (pid == -1)
+   {
+      PANIC("allocate_pid: no free pid");
+   }
+   uint32_t word = pid / 32;
+   pid_pool.map[word] |= 1u << (pid % 32);
+   if (pid_pool.map[word] == 0xffffffff)
+   {
+      pid_pool.full[word / 32] |= 1u << (word % 32);
+   }
+   pid_pool.last_pid = pid;
+   spin_unlock_irqrestore(&pid_pool.lock, old_status);
+   return pid;
 }
 
 /* 释放pid */
 void release_pid(pid_t pid)
 {
-   lock_acquire(&pid_pool.pid_lock);
-   int32_t bit_idx = pid - pid_pool.pid_start;
-   bitmap_set(&pid_pool.pid_bitmap, bit_idx, 0);
-   lock_release(&pid_pool.pid_lock);
+   ASSERT(pid > 0 && pid < PID_MAX);
+   enum intr_status old_status = spin_lock_irqsave(&pid_pool.lock);
+   uint32_t word = pid / 32;
+   pid_pool.map[word] &= ~(1u << (pid % 32));
+   pid_pool.full[word / 32] &= ~(1u << (word % 32));
+   spin_unlock_irqrestore(&pid_pool.lock, old_status);
 }
 
 /* fork进程时为其分配pid,因为allocate_pid已经是静态的,别的文件无法调用.
@@ -118,6 +208,7 @@ void init_thread(struct task_struct *pthread, char *name, int prio)
 {
    memset(pthread, 0, sizeof(*pthread));
    pthread->pid = allocate_pid();
+   pthread->tgid = pthread->pid;
    strcpy(pthread->name, name);
 
    if (pthread == main_thread)
@@ -133,20 +224,23 @@ void init_thread(struct task_struct *pthread, char *name, int prio)
    pthread->priority = prio;
    pthread->ticks = prio;
    pthread->elapsed_ticks = 0;
+   pthread->static_level = pthread->level = PRIO_DEFAULT;
+   pthread->io_wait = false;
+#ifdef CONFIG_BENCH
+   pthread->wake_tsc = 0;
+#endif
+   pthread->cpu = 0;
+   pthread->fpu_state = NULL;
+   pthread->fpu_cpu = 0;
+   /* 新任务第一次上cpu时由switch_to返回, 此时cpu的大内核锁已由换下的任务持有 */
+   pthread->lock_depth = 1;
    pthread->pgdir = NULL;
-   /* 标准输入输出错误先空出来 */
-   pthread->fd_table[0] = 0;
-   pthread->fd_table[1] = 1;
-   pthread->fd_table[2] = 2;
-   /* 其余的全置为-1 */
-   uint8_t fd_idx = 3;
-   while (fd_idx < MAX_FILES_OPEN_PER_PROC)
-   {
-      pthread->fd_table[fd_idx] = -1;
-      fd_idx++;
-   }
+   /* 文件描述符表在第一次打开文件时才分配, 之前只有指向控制台的0, 1, 2 */
+   pthread->files = NULL;
    pthread->cwd_inode_no = 0;         // 以根目录做为默认工作路径
    pthread->parent_pid = -1;          // -1表示没有父进程
+   list_init(&pthread->children);
+   list_init(&pthread->zombies);
    pthread->stack_magic = 0x19870916; // 自定义的魔数
 }
 
@@ -158,15 +252,11 @@ struct task_struct *thread_start(char *name, int prio, thread_func function, voi
    init_thread(thread, name, prio);
    thread_create(thread, function, func_arg);
 
-   /* 确保之前不在队列中 */
-   ASSERT(!elem_find(&thread_ready_list, &thread->general_tag));
    /* 加入就绪线程队列 */
-   list_append(&thread_ready_list, &thread->general_tag);
+   ready_enqueue(thread);
 
-   /* 确保之前不在队列中 */
-   ASSERT(!elem_find(&thread_all_list, &thread->all_list_tag));
    /* 加入全部线程队列 */
-   list_append(&thread_all_list, &thread->all_list_tag);
+   task_register(thread);
 
    return thread;
 }
@@ -179,10 +269,73 @@ static void make_main_thread(void)
    main_thread = running_thread();
    init_thread(main_thread, "main", 31);
 
-   /* main函数是当前线程,当前线程不在thread_ready_list中,
+   /* main函数是当前线程,当前线程不在就绪队列中,
     * 所以只将其加在thread_all_list中. */
-   ASSERT(!elem_find(&thread_all_list, &main_thread->all_list_tag));
-   list_append(&thread_all_list, &main_thread->all_list_tag);
+   task_register(main_thread);
+}
+
+/* 把pthread加入其优先级对应的就绪队列尾 */
+void ready_enqueue(struct task_struct *pthread)
+{
+   ASSERT(pthread->level < PRIO_LEVELS);
+   struct list *queue = &ready_queues[pthread->level];
+   ASSERT(!elem_find(queue, &pthread->general_tag));
+   list_append(queue, &pthread->general_tag);
+   ready_bitmap |= (1 << pthread->level);
+}
+
+/* 若pthread在就绪队列中,将其从中删除 */
+void ready_remove(struct task_struct *pthread)
+{
+   struct list *queue = &ready_queues[pthread->level];
+   if (elem_find(queue, &pthread->general_tag))
+   {
+      list_remove(&pthread->general_tag);
+      if (list_empty(queue))
+      {
+         ready_bitmap &= ~(1 << pthread->level);
+      }
+   }
+}
+
+/* 任务能否在编号为cpu的cpu上运行: 与它共享地址空间的线程正在别的cpu上运行时不能 */
+static bool task_runnable_on(struct task_struct *pthread, uint8_t cpu)
+{
+   struct mm_struct *mm = pthread->mm;
+   return mm == NULL || mm->running == 0 || mm->cpu == cpu;
+}
+
+/* 弹出能在编号为cpu的cpu上运行的, 优先级最高的就绪任务, 没有返回NULL.
+ * 多数时候就是最高优先级队列的第一个任务, 只有与别的cpu上的线程同组时才跳过 */
+static struct task_struct *ready_dequeue(uint8_t cpu)
+{
+   uint32_t pending = ready_bitmap;
+   while (pending != 0)
+   {
+      uint32_t level;
+      asm("bsf %1, %0"
+          : "=r"(level)
+          : "rm"(pending));
+      pending &= ~(1 << level);
+      struct list *queue = &ready_queues[level];
+      struct list_elem *elem = queue->head.next;
+      while (elem != &queue->tail)
+      {
+         struct task_struct *pthread = elem2entry(struct task_struct, general_tag, elem);
+         if (task_runnable_on(pthread, cpu))
+         {
+            list_remove(elem);
+            thread_tag = elem;
+            if (list_empty(queue))
+            {
+               ready_bitmap &= ~(1 << level);
+            }
+            return pthread;
+         }
+         elem = elem->next;
+      }
+   }
+   return NULL;
 }
 
 /* 实现任务调度 */
@@ -191,12 +344,31 @@ void schedule()
    ASSERT(intr_get_status() == INTR_OFF);
 
    struct task_struct *cur = running_thread();
-   if (cur->status == TASK_RUNNING)
+   struct cpu_info *cpu = this_cpu();
+   if (cur == cpu->idle)
+   { // idle线程只属于本cpu, 不进共享的就绪队列, 没有其它就绪任务时直接选它
+      if (cur->status == TASK_RUNNING)
+      {
+         cur->ticks = cur->priority;
+         cur->status = TASK_READY;
+      }
+   }
+   else if (cur->status == TASK_RUNNING)
    { // 若此线程只是cpu时间片到了,将其加入到就绪队列尾
-      ASSERT(!elem_find(&thread_ready_list, &cur->general_tag));
-      list_append(&thread_ready_list, &cur->general_tag);
-      cur->ticks = cur->priority; // 重新将当前线程的ticks再重置为其priority;
+      if (cur->ticks == 0)
+      {
+         cur->ticks = cur->priority; // 重新将当前线程的ticks再重置为其priority;
+         /* 用完了整个时间片, 说明是计算型任务, 降一级. 中途阻塞的任务保留剩余的时间片,
+          * 下次运行时继续消耗, 所以在时间片用完前主动阻塞也逃不过降级 */
+         if (cur->level < MLFQ_BOTTOM)
+         {
+            cur->level++;
+         }
+      }
+      /* 否则是被唤醒的高优先级任务抢占, 保留剩余的时间片 */
+      cur->io_wait = false;
       cur->status = TASK_READY;
+      ready_enqueue(cur);
    }
    else
    {
@@ -204,22 +376,39 @@ void schedule()
       不需要将其加入队列,因为当前线程不在就绪队列中。*/
    }
 
-   /* 如果就绪队列中没有可运行的任务,就唤醒idle */
-   if (list_empty(&thread_ready_list))
+   need_resched = false;
+   thread_tag = NULL; // thread_tag清空
+   if (cur->mm != NULL)
    {
-      thread_unblock(idle_thread);
+      cur->mm->running--;
+   }
+   /* 将最高优先级队列中的第一个就绪线程弹出,准备将其调度上cpu. 如果就绪队列中没有可运行的任务,就运行本cpu的idle */
+   struct task_struct *next = ready_dequeue(cur->cpu);
+   if (next == NULL)
+   {
+      next = cpu->idle;
    }
-
-   ASSERT(!list_empty(&thread_ready_list));
-   thread_tag = NULL; // thread_tag清空
-   /* 将thread_ready_list队列中的第一个就绪线程弹出,准备将其调度上cpu. */
-   thread_tag = list_pop(&thread_ready_list);
-   struct task_struct *next = elem2entry(struct task_struct, general_tag, thread_tag);
    next->status = TASK_RUNNING;
+   next->cpu = cur->cpu;
+   if (next->mm != NULL)
+   {
+      next->mm->running++;
+      next->mm->cpu = next->cpu;
+   }
+   cpu->curr = next;
+#ifdef CONFIG_BENCH
+   if (next->wake_tsc != 0)
+   {
+      bench_sched_latency(next);
+   }
+#endif
 
    /* 击活任务页表等 */
    process_activate(next);
 
+   /* 按需保存换下任务的浮点状态, 置上TS让换上的任务用到浮点时再恢复 */
+   fpu_switch(cur, next);
+
    switch_to(cur, next);
 }
 
@@ -236,6 +425,20 @@ void thread_block(enum task_status stat)
    intr_set_status(old_status);
 }
 
+/**
+ * @brief thread_block_spin与thread_block相同, 但在换下cpu前才释放自旋锁lock, 被唤醒后重新获取.
+ *        调用者持有lock检查条件后睡眠, 唤醒者也要持有lock才能改变条件, 所以不会丢失唤醒
+ */
+void thread_block_spin(enum task_status stat, struct spinlock *lock)
+{
+   ASSERT(((stat == TASK_BLOCKED) || (stat == TASK_WAITING) || (stat == TASK_HANGING)));
+   ASSERT(intr_get_status() == INTR_OFF);
+   running_thread()->status = stat;
+   spin_unlock(lock);
+   schedule();
+   spin_lock(lock);
+}
+
 /* 将线程pthread解除阻塞 */
 void thread_unblock(struct task_struct *pthread)
 {
@@ -243,25 +446,84 @@ void thread_unblock(struct task_struct *pthread)
    ASSERT(((pthread->status == TASK_BLOCKED) || (pthread->status == TASK_WAITING) || (pthread->status == TASK_HANGING)));
    if (pthread->status != TASK_READY)
    {
-      // ASSERT(!elem_find(&thread_ready_list, &pthread->general_tag));
-      if (elem_find(&thread_ready_list, &pthread->general_tag))
+      if (elem_find(&ready_queues[pthread->level], &pthread->general_tag))
       {
          PANIC("thread_unblock: blocked thread in ready_list\n");
       }
-      list_push(&thread_ready_list, &pthread->general_tag); // 放到队列的最前面,使其尽快得到调度
+      /* 等待键盘, 管道, 硬盘的是交互型任务, 提升PRIO_WAKE_BOOST级使其尽快得到调度,
+       * 但最多比静态优先级高PRIO_WAKE_BOOST级. 等待锁等其它事件的任务保持原来的级别 */
+      if (pthread->io_wait)
+      {
+         uint8_t top = pthread->static_level > PRIO_WAKE_BOOST ? pthread->static_level - PRIO_WAKE_BOOST : 0;
+         pthread->level = pthread->level > top + PRIO_WAKE_BOOST ? pthread->level - PRIO_WAKE_BOOST : top;
+         pthread->io_wait = false;
+      }
+#ifdef CONFIG_BENCH
+      pthread->wake_tsc = rdtsc();
+#endif
+      ready_enqueue(pthread);
       pthread->status = TASK_READY;
+      /* 比当前任务优先级高, 下一次时钟中断时抢占当前任务 */
+      if (pthread->level < running_thread()->level)
+      {
+         need_resched = true;
+      }
+      /* 有cpu空闲时把它叫醒来运行这个任务 */
+      smp_wake_idle();
    }
    intr_set_status(old_status);
 }
 
+/* 当前任务所在线程组的主线程是否正在退出. 是的话当前任务不应再睡眠等待, 应尽快返回用户态退出 */
+bool thread_group_exiting(void)
+{
+   struct task_struct *cur = running_thread();
+   return cur->mm != NULL && cur->mm->group_exit && cur->pid != cur->tgid;
+}
+
+/* 与thread_block相同, 但这次阻塞是在等待I/O, 被唤醒时按交互型任务提升优先级 */
+void thread_block_io(enum task_status stat)
+{
+   enum intr_status old_status = intr_disable();
+   running_thread()->io_wait = true;
+   thread_block(stat);
+   intr_set_status(old_status);
+}
+
+/* 把被降级的任务恢复到静态优先级, 在就绪队列中的要换到对应的队列 */
+static bool thread_age(struct list_elem *pelem, int arg)
+{
+   struct task_struct *pthread = elem2entry(struct task_struct, all_list_tag, pelem);
+   if (pthread->level > pthread->static_level)
+   {
+      if (pthread->status == TASK_READY)
+      {
+         ready_remove(pthread);
+         pthread->level = pthread->static_level;
+         ready_enqueue(pthread);
+      }
+      else
+      {
+         pthread->level = pthread->static_level;
+      }
+   }
+   return false;
+}
+
+/* 优先级老化, 由时钟中断每MLFQ_AGING_TICKS调用一次 */
+void thread_aging(void)
+{
+   ASSERT(intr_get_status() == INTR_OFF);
+   list_traversal(&thread_all_list, thread_age, 0);
+}
+
 /* 主动让出cpu,换其它线程运行 */
 void thread_yield(void)
 {
    struct task_struct *cur = running_thread();
    enum intr_status old_status = intr_disable();
-   ASSERT(!elem_find(&thread_ready_list, &cur->general_tag));
-   list_append(&thread_ready_list, &cur->general_tag);
    cur->status = TASK_READY;
+   ready_enqueue(cur);
    schedule();
    intr_set_status(old_status);
 }
@@ -352,17 +614,28 @@ void thread_exit(struct task_struct *thread_over, bool need_schedule)
    thread_over->status = TASK_DIED;
 
    /* 如果thread_over不是当前线程,就有可能还在就绪队列中,将其从中删除 */
-   if (elem_find(&thread_ready_list, &thread_over->general_tag))
-   {
-      list_remove(&thread_over->general_tag);
-   }
+   ready_remove(thread_over);
    if (thread_over->pgdir)
    { // 如是进程,回收进程的页目录表
       mfree_page(PF_KERNEL, thread_over->pgdir, 1);
    }
 
-   /* 从all_thread_list中去掉此任务 */
+   /* 进程的文件已在exit时关闭, 这里处理打开过文件的内核线程 */
+   if (thread_over->files)
+   {
+      files_release(thread_over);
+   }
+
+   /* 进程的浮点保存区已在exit时释放, 这里处理用过浮点的内核线程 */
+   fpu_release(thread_over);
+
+   /* 从all_thread_list, pid哈希表和父进程的zombies中去掉此任务 */
    list_remove(&thread_over->all_list_tag);
+   list_remove(&thread_over->pid_tag);
+   if (thread_over->sibling_tag.owner != NULL)
+   {
+      list_remove(&thread_over->sibling_tag);
+   }
 
    /* 回收pcb所在的页,主线程的pcb不在堆中,跨过 */
    if (thread_over != main_thread)
@@ -381,27 +654,38 @@ void thread_exit(struct task_struct *thread_over, bool need_schedule)
    }
 }
 
-/* 比对任务的pid */
-static bool pid_check(struct list_elem *pelem, int32_t pid)
+/* 根据pid找pcb,若找到则返回该pcb,否则返回NULL */
+struct task_struct *pid2thread(int32_t pid)
 {
-   struct task_struct *pthread = elem2entry(struct task_struct, all_list_tag, pelem);
-   if (pthread->pid == pid)
+   struct list *bucket = &pid_hash[pid & (PID_HASH_SIZE - 1)];
+   struct list_elem *pelem = bucket->head.next;
+   while (pelem != &bucket->tail)
    {
-      return true;
+      struct task_struct *pthread = elem2entry(struct task_struct, pid_tag, pelem);
+      if (pthread->pid == pid)
+      {
+         return pthread;
+      }
+      pelem = pelem->next;
    }
-   return false;
+   return NULL;
 }
 
-/* 根据pid找pcb,若找到则返回该pcb,否则返回NULL */
-struct task_struct *pid2thread(int32_t pid)
+/**
+ * @brief task_register把新建的任务加入thread_all_list和pid哈希表, 有父进程时挂到父进程所在线程组
+ *        主线程的children上. 调用时pid, tgid和parent_pid都已确定
+ */
+void task_register(struct task_struct *pthread)
 {
-   struct list_elem *pelem = list_traversal(&thread_all_list, pid_check, pid);
-   if (pelem == NULL)
+   ASSERT(!elem_find(&thread_all_list, &pthread->all_list_tag));
+   list_append(&thread_all_list, &pthread->all_list_tag);
+   list_append(&pid_hash[pthread->pid & (PID_HASH_SIZE - 1)], &pthread->pid_tag);
+   if (pthread->parent_pid != (uint32_t)-1)
    {
-      return NULL;
+      struct task_struct *parent = pid2thread(pthread->parent_pid);
+      ASSERT(parent != NULL && parent->pid == parent->tgid);
+      list_append(&parent->children, &pthread->sibling_tag);
    }
-   struct task_struct *thread = elem2entry(struct task_struct, all_list_tag, pelem);
-   return thread;
 }
 
 /* 初始化线程环境 */
@@ -409,8 +693,18 @@ void thread_init(void)
 {
    put_str("thread_init start\n");
 
-   list_init(&thread_ready_list);
+   uint32_t level = 0;
+   while (level < PRIO_LEVELS)
+   {
+      list_init(&ready_queues[level++]);
+   }
+   ready_bitmap = 0;
    list_init(&thread_all_list);
+   uint32_t bucket = 0;
+   while (bucket < PID_HASH_SIZE)
+   {
+      list_init(&pid_hash[bucket++]);
+   }
    pid_pool_init();
 
    /* 先创建第一个用户进程:init */
@@ -419,8 +713,12 @@ void thread_init(void)
    /* 将当前main函数创建为线程 */
    make_main_thread();
 
-   /* 创建idle线程 */
-   idle_thread = thread_start("idle", 10, idle, NULL);
+   /* 创建bsp的idle线程, idle不在就绪队列中, 由schedule在没有就绪任务时直接选中 */
+   struct task_struct *idle_thread = thread_start("idle", 10, idle, NULL);
+   ready_remove(idle_thread);
+   idle_thread->static_level = idle_thread->level = PRIO_IDLE;
+   cpus[0].idle = idle_thread;
+   cpus[0].curr = main_thread;
 
    put_str("thread_init done\n");
 }
\ No newline at end of file
@@ -5,9 +5,20 @@
 #include "bitmap.h"
 #include "memory.h"
 
-#define MAX_FILES_OPEN_PER_PROC 8
+/* 调度优先级, 共PRIO_LEVELS级, 数值越小优先级越高, 每一级有自己的就绪队列 */
+#define PRIO_LEVELS 32
+#define PRIO_DEFAULT 16                // 普通任务的静态优先级
+#define PRIO_IDLE (PRIO_LEVELS - 1)    // idle线程独占最低一级
+#define PRIO_WAKE_BOOST 4              // 等待I/O的任务被唤醒时提升的级数, 让交互任务尽快运行
+
+/* 多级反馈队列: 用完时间片的任务降一级, 最低降到MLFQ_BOTTOM;
+ * 每隔MLFQ_AGING_TICKS个时钟嘀嗒, 所有被降级的任务回到静态优先级, 避免计算型任务饿死 */
+#define MLFQ_BOTTOM (PRIO_IDLE - 1)
+#define MLFQ_AGING_TICKS 100
+
 /* 自定义通用函数类型,它将在很多线程函数中做为形参类型 */
 typedef void thread_func(void *);
+struct spinlock;
 typedef int16_t pid_t;
 
 /* 进程或线程的状态 */
@@ -100,15 +111,25 @@ struct task_struct
    pid_t pid;
    enum task_status status;
    char name[16];
-   uint8_t priority;
-   uint8_t ticks; // 每次在处理器上执行的时间嘀嗒数
+   uint8_t priority; // 时间片长度
+   uint8_t ticks;    // 每次在处理器上执行的时间嘀嗒数
+
+   uint8_t static_level; // 静态调度优先级
+   uint8_t level;        // 动态调度优先级, 即所在的就绪队列; 等待I/O后被唤醒时提升, 用完时间片后降低
+   bool io_wait;         // 正在等待键盘, 管道或硬盘
+#ifdef CONFIG_BENCH
+   uint64_t wake_tsc;    // 被唤醒时的时间戳计数器, 用于统计唤醒到运行的延迟
+#endif
+
+   uint8_t cpu;         // 正在或最近一次运行此任务的cpu编号
+   uint32_t lock_depth; // 大内核锁的嵌套深度, 为0表示在用户态或idle的hlt中, 不持有大内核锁
 
    /* 此任务自上cpu运行后至今占用了多少cpu嘀嗒数,
     * 也就是此任务执行了多久*/
    uint32_t elapsed_ticks;
 
-   // 文件描述符数组
-   int32_t fd_table[MAX_FILES_OPEN_PER_PROC];
+   // 文件描述符表, 在内核堆中按需分配; 为NULL时只有0, 1, 2三个指向控制台的描述符
+   struct files_struct *files;
 
    /* general_tag是用于线程就绪队列中的结点 */
    struct list_elem general_tag;
@@ -116,11 +137,20 @@ struct task_struct
    /* all_list_tag是用于线程队列thread_all_list中的结点 */
    struct list_elem all_list_tag;
 
-   uint32_t *pgdir; // 进程自己页表的虚拟地址
+   struct list_elem pid_tag;     // pid哈希表中的结点
+   struct list_elem sibling_tag; // 父进程的children或zombies中的结点, 没有父进程时不在任何链表中
+   struct list children;         // 还在运行的子进程和clone出的线程, 只挂在线程组的主线程上
+   struct list zombies;          // 已经exit, 等待wait回收的子进程和线程
+
+   uint32_t *pgdir; // 进程自己页表的虚拟地址, 同一线程组的任务相同
+
+   struct mm_struct *mm; // 用户地址空间, 同一线程组的任务共享; 内核线程为NULL
 
-   struct virtual_addr userprog_vaddr; // 用户进程的虚拟地址
+   pid_t tgid;      // 线程组id, 即组内主线程的pid; 普通进程等于自己的pid
+   uint32_t ustack; // clone出的线程的用户栈的起始虚拟地址, 主线程为0
 
-   struct mem_block_desc u_block_desc[DESC_CNT]; // 用户内存块描述符数组
+   void *fpu_state; // 浮点和SSE寄存器的保存区, 在内核堆中分配, 从未用过浮点时为NULL
+   uint8_t fpu_cpu; // 最近一次把此任务的浮点状态装进寄存器的cpu编号
 
    uint32_t cwd_inode_no; // 进程所在的工作目录的inode编号
 
@@ -132,24 +162,34 @@ struct task_struct
 };
 
 #define TASK_NAME_LEN 16
+#define PID_HASH_SIZE 256 // pid哈希表的桶数, 须是2的幂
+#define PID_MAX 32768     // pid的上限(不含), pid_t是int16_t, 最大只能到32767; 须是1024的倍数
 typedef struct task_struct task_status_t;
 typedef struct task_struct task_struct_t;
-extern struct list thread_ready_list;
 extern struct list thread_all_list;
+extern bool need_resched;
 
 void thread_create(struct task_struct *pthread, thread_func function, void *func_arg);
 void init_thread(struct task_struct *pthread, char *name, int prio);
 struct task_struct *thread_start(char *name, int prio, thread_func function, void *func_arg);
 struct task_struct *running_thread(void);
 void schedule(void);
+void ready_enqueue(struct task_struct *pthread);
+void ready_remove(struct task_struct *pthread);
+void thread_block_io(enum task_status stat);
+bool thread_group_exiting(void);
+void thread_aging(void);
 void thread_init(void);
+void cpu_idle(void);
 void thread_block(enum task_status stat);
+void thread_block_spin(enum task_status stat, struct spinlock *lock);
 void thread_unblock(struct task_struct *pthread);
 void thread_yield(void);
 pid_t fork_pid(void);
 void sys_ps(void);
 void release_pid(pid_t pid);
 task_status_t *pid2thread(int32_t pid);
+void task_register(struct task_struct *pthread);
 void sys_exit(int32_t status);
 int16_t sys_wait(int32_t *status);
 void thread_exit(struct task_struct *thread_over, bool need_schedule);
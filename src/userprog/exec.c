@@ -1,4 +1,5 @@
 #include "exec.h"
+#include "fpu.h"
 #include "thread.h"
 #include "stdio-kernel.h"
 #include "fs.h"
@@ -191,6 +192,57 @@ done:
     return ret;
 }
 
+#define EXEC_ARG_MAX (PG_SIZE / 2) // 参数串和argv数组在新用户栈上最多占用的字节数, 其余留作栈空间
+
+/**
+ * @brief exec_save_args把argv的argc个参数串依次复制到一页内核内存中, 各以'\0'结尾.
+ *        参数可能在旧程序的数据段, 堆或栈中, 加载新程序和重置堆之前要先保存
+ *
+ * @return char* 保存参数的内核页, 参数放到栈上超过EXEC_ARG_MAX字节或内存不足时返回NULL
+ */
+static char *exec_save_args(const char *argv[], uint32_t argc)
+{
+    uint32_t len = 0, idx;
+    for (idx = 0; idx < argc; idx++)
+        len += strlen(argv[idx]) + 1;
+    if (len + sizeof(uint32_t) + (argc + 1) * sizeof(char *) > EXEC_ARG_MAX)
+        return NULL;
+
+    char *saved = get_kernel_pages(1);
+    if (saved == NULL)
+        return NULL;
+    len = 0;
+    for (idx = 0; idx < argc; idx++)
+    {
+        strcpy(saved + len, argv[idx]);
+        len += strlen(argv[idx]) + 1;
+    }
+    return saved;
+}
+
+/**
+ * @brief exec_push_args把保存的argc个参数串复制到新程序的用户栈顶, 下面放以NULL结尾的argv数组
+ *
+ * @return char** 栈上argv数组的地址, 也是新程序的初始栈顶
+ */
+static char **exec_push_args(const char *saved, uint32_t argc)
+{
+    uint32_t len = 0, idx;
+    for (idx = 0; idx < argc; idx++)
+        len += strlen(saved + len) + 1;
+    char *str = (char *)(0xC0000000 - len);
+    memcpy(str, saved, len);
+
+    char **uargv = (char **)(((uint32_t)str & ~(sizeof(char *) - 1)) - (argc + 1) * sizeof(char *));
+    for (idx = 0; idx < argc; idx++)
+    {
+        uargv[idx] = str;
+        str += strlen(str) + 1;
+    }
+    uargv[argc] = NULL;
+    return uargv;
+}
+
 /**
  * @brief sys_execv是execv系统调用的实现函数. 用于将path指向的程序加载到内存中, 而后
  *        用该程序替换当前程序
@@ -206,29 +258,55 @@ int32_t sys_execv(const char *path, const char *argv[])
     while (argv[argc++])
         ;
     argc--;
+    // 还有clone出的线程在使用地址空间时不能替换它
+    if (running_thread()->mm->users > 1)
+    {
+        printk("%s: %s has other threads\n", __func__, running_thread()->name);
+        return -1;
+    }
+
+    char *saved_args = exec_save_args(argv, argc);
+    if (saved_args == NULL)
+    {
+        printk("%s: arguments of %s too long\n", __func__, path);
+        return -1;
+    }
+
     // 加载程序到内存
     int32_t entry_point = load(path);
     if (entry_point == -1)
     {
         printk("%s: load %s into memory failed!\n", __func__, path);
+        mfree_page(PF_KERNEL, saved_args, 1);
+        return -1;
+    }
+    // 新程序从空的堆开始, 用户态分配器的状态随之清零, 不会继承旧程序的空闲链表和锁
+    if (user_heap_reset() == -1)
+    {
+        printk("%s: no memory for the heap of %s\n", __func__, path);
+        mfree_page(PF_KERNEL, saved_args, 1);
         return -1;
     }
+    char **uargv = exec_push_args(saved_args, argc);
+    mfree_page(PF_KERNEL, saved_args, 1);
 
     // 修改进程信息
     task_status_t *cur = running_thread();
     // 修改进程名
     memcpy(cur->name, path, TASK_NAME_LEN);
     cur->name[TASK_NAME_LEN - 1] = 0;
+    // 新程序从初始的浮点状态开始
+    fpu_release(cur);
 
     // 伪装中断返回, 从而使得能够执行用户进程
     intr_stack_t *intr_0_stack = (intr_stack_t *)((uint32_t)cur + PG_SIZE - sizeof(intr_stack_t));
     // 传参, 参数放在ebx和ecx中
-    intr_0_stack->ebx = (int32_t)argv;
+    intr_0_stack->ebx = (int32_t)uargv;
     intr_0_stack->ecx = argc;
     // 修改终端返回地址
     intr_0_stack->eip = (void *)entry_point;
-    // 修改用户进程的栈地址为用户空间最高处
-    intr_0_stack->esp = (void *)(0xC0000000);
+    // 用户栈从参数下方开始
+    intr_0_stack->esp = (void *)uargv;
 
     // 直接中断返回, 不知道为什么这里跳转到intr_exit之后, 在popa的时候缺页中断0x0E
     // 运行到这里ss指向TSS, esp指向是对的, 猜测和TSS有关
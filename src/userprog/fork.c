@@ -7,6 +7,7 @@
 #include "string.h"
 #include "file.h"
 #include "pipe.h"
+#include "fpu.h"
 extern void intr_exit(void);
 
 /**
@@ -26,24 +27,27 @@ static int32_t copy_pcb_vaddrbitmap_stack0(task_status_t *child_thread, task_sta
     child_thread->elapsed_ticks = 0;
     child_thread->status = TASK_READY;
     child_thread->ticks = child_thread->priority;
-    child_thread->parent_pid = parent_thread->pid;
-    child_thread->general_tag.prev = child_thread->general_tag.next = NULL;
-    child_thread->all_list_tag.prev = child_thread->all_list_tag.next = NULL;
-    // 初始化子进程的内存块描述符，（空闲块链表），管理的是进程的堆
-    block_desc_init(child_thread->u_block_desc);
-
+    child_thread->tgid = child_thread->pid;         // 子进程自成一个线程组
+    child_thread->parent_pid = parent_thread->tgid; // 由线程fork出的子进程也属于整个线程组
+    child_thread->ustack = 0;
+    child_thread->fpu_state = NULL; // 由copy_process按父进程的浮点状态另行分配
+    child_thread->lock_depth = 1; // 子进程第一次上cpu时持有大内核锁, 从intr_exit返回用户态时释放
+    elem_init(&child_thread->general_tag);
+    elem_init(&child_thread->all_list_tag);
+    elem_init(&child_thread->pid_tag);
+    elem_init(&child_thread->sibling_tag);
+    list_init(&child_thread->children);
+    list_init(&child_thread->zombies);
+
+    // 子进程有自己的地址空间, 其中的内存块描述符（空闲块链表）为空，管理的是进程的堆
     // 复制父进程虚拟地址池的位图, 因为每个进程的虚拟内存都是独立的, 所以需要单独复制
-    // 复制父进程的内存池的位图
-    uint32_t bitmap_pg_cnt = DIV_ROUND_UP((0xc0000000 - USER_VADDR_START) / PG_SIZE / 8, PG_SIZE); // 计算虚拟地址位图需要的页框数
-    void *vaddr_btmp = get_kernel_pages(bitmap_pg_cnt);
-    if (vaddr_btmp == NULL)
+    child_thread->mm = mm_create();
+    if (child_thread->mm == NULL)
         return -1;
-
-    // 因为上面直接复制了整个父进程PCB, 所以child_thread->userprog_vaddr依旧指向父进程的bitmap
-    // 这里逐字节的复制, 然后再转换下类型
-    memcpy(vaddr_btmp, child_thread->userprog_vaddr.vaddr_bitmap.bits, bitmap_pg_cnt * PG_SIZE);
-
-    child_thread->userprog_vaddr.vaddr_bitmap.bits = vaddr_btmp;
+    struct virtual_addr *parent_vaddr = &parent_thread->mm->userprog_vaddr;
+    memcpy(child_thread->mm->userprog_vaddr.vaddr_bitmap.bits, parent_vaddr->vaddr_bitmap.bits, parent_vaddr->vaddr_bitmap.btmp_bytes_len);
+    // 堆中的页随位图一起复制, 堆的末尾也相同
+    child_thread->mm->brk = parent_thread->mm->brk;
 
     // prepare for name
     ASSERT(strlen(child_thread->name) < 16);
@@ -63,10 +67,10 @@ static int32_t copy_pcb_vaddrbitmap_stack0(task_status_t *child_thread, task_sta
  */
 static void copy_body_stack3(task_status_t *child_thread, task_status_t *parent_thread, void *buf_page)
 {
-    uint8_t *vaddr_btmp = parent_thread->userprog_vaddr.vaddr_bitmap.bits;               // 父进程位图地址
-    uint32_t btmp_bytes_len = parent_thread->userprog_vaddr.vaddr_bitmap.btmp_bytes_len; // 父进程位图长度
+    uint8_t *vaddr_btmp = parent_thread->mm->userprog_vaddr.vaddr_bitmap.bits;               // 父进程位图地址
+    uint32_t btmp_bytes_len = parent_thread->mm->userprog_vaddr.vaddr_bitmap.btmp_bytes_len; // 父进程位图长度
 
-    uint32_t vaddr_start = parent_thread->userprog_vaddr.vaddr_start; // 父进程起始虚拟地址
+    uint32_t vaddr_start = parent_thread->mm->userprog_vaddr.vaddr_start; // 父进程起始虚拟地址
     uint32_t idx_byte = 0;                                            // 字节
     uint32_t idx_bit = 0;                                             // 位
     uint32_t prog_vaddr = 0;
@@ -114,13 +118,15 @@ static void copy_body_stack3(task_status_t *child_thread, task_status_t *parent_
  */
 static void copy_page_tables(task_status_t *child_thread, task_status_t *parent_thread)
 {
-    uint8_t *vaddr_btmp = parent_thread->userprog_vaddr.vaddr_bitmap.bits;               // 父进程位图地址
-    uint32_t btmp_bytes_len = parent_thread->userprog_vaddr.vaddr_bitmap.btmp_bytes_len; // 父进程位图长度
+    uint8_t *vaddr_btmp = parent_thread->mm->userprog_vaddr.vaddr_bitmap.bits;               // 父进程位图地址
+    uint32_t btmp_bytes_len = parent_thread->mm->userprog_vaddr.vaddr_bitmap.btmp_bytes_len; // 父进程位图长度
 
-    uint32_t vaddr_start = parent_thread->userprog_vaddr.vaddr_start; // 父进程起始虚拟地址
+    uint32_t vaddr_start = parent_thread->mm->userprog_vaddr.vaddr_start; // 父进程起始虚拟地址
     uint32_t idx_byte = 0;                                            // 字节
     uint32_t idx_bit = 0;                                             // 位
     uint32_t prog_vaddr = 0;
+    struct tlb_gather tlb; // 父进程中被去掉写权限的页, 最后统一刷新tlb
+    tlb_gather_init(&tlb);
 
     while (idx_byte < btmp_bytes_len) // 逐字节遍历位图
     {
@@ -133,13 +139,14 @@ static void copy_page_tables(task_status_t *child_thread, task_status_t *parent_
                 if (vaddr_btmp[idx_byte] & (BITMAP_MASK << idx_bit)) // 确定该位有内容
                 {
                     prog_vaddr = vaddr_start + (idx_byte * 8 + idx_bit) * PG_SIZE;
-                    full_childProcess_pageTable(child_thread, parent_thread, prog_vaddr);
+                    full_childProcess_pageTable(child_thread, parent_thread, prog_vaddr, &tlb);
                 }
                 idx_bit++;
             }
         }
         idx_byte++;
     }
+    tlb_gather_flush(&tlb);
 }
 
 /**
@@ -175,29 +182,6 @@ static int32_t build_child_stack(task_status_t *child_thread)
     return 0;
 }
 
-/**
- * @brief 更新子进程pcb中fd_table所有打开文件的索引数
- *
- * @param pcb 需要更新的pcb
- */
-static void update_inode_open_cnts(task_status_t *pcb)
-{
-    int32_t local_fd = 3, global_fd = 0;
-    while (local_fd < MAX_FILES_OPEN_PER_PROC)
-    {
-        global_fd = pcb->fd_table[local_fd];
-        ASSERT(global_fd < MAX_FILE_OPEN)
-        if (global_fd != -1)
-        {
-            if (is_pipe(local_fd))
-                file_table[global_fd].fd_pos++;
-            else
-                file_table[global_fd].fd_inode->i_open_cnts++;
-        }
-        local_fd++;
-    }
-}
-
 /**
  * @brief copy_process用于将父进程中的信息复制给子进程
  *
@@ -213,7 +197,7 @@ static int32_t copy_process(task_status_t *child_thread, task_status_t *parent_t
     //     return -1;
 
     // b. 复制父进程的pcb（4kb大小）, 虚拟地址位图，内核栈给子进程
-    if (copy_pcb_vaddrbitmap_stack0(child_thread, parent_thread) == 1)
+    if (copy_pcb_vaddrbitmap_stack0(child_thread, parent_thread) == -1)
         return -1;
 
     // c. 为子进程创建页表
@@ -230,8 +214,13 @@ static int32_t copy_process(task_status_t *child_thread, task_status_t *parent_t
     // 因为fork()是内核提供的，在0x80号中断，是系统调用
     build_child_stack(child_thread);
 
-    // f.更新文件计数
-    update_inode_open_cnts(child_thread);
+    // f.复制文件描述符表, 子进程与父进程共享打开的文件结构
+    if (files_dup(child_thread) == -1)
+        return -1;
+
+    // g.复制父进程的浮点寄存器状态
+    if (fpu_fork(child_thread, parent_thread) == -1)
+        return -1;
 
     //  mfree_page(PF_KERNEL, buf_page, 1);
     return 0;
@@ -257,10 +246,76 @@ pid_t sys_fork(void)
         return -1;
 
     // 插入到就绪队列中
-    ASSERT(!elem_find(&thread_ready_list, &child_thread->general_tag));
-    list_append(&thread_ready_list, &child_thread->general_tag);
-    ASSERT(!elem_find(&thread_all_list, &child_thread->all_list_tag))
-    list_append(&thread_all_list, &child_thread->all_list_tag);
+    ready_enqueue(child_thread);
+    task_register(child_thread);
+
+    return child_thread->pid;
+}
+
+/**
+ * @brief sys_clone是clone系统调用的实现函数. 创建一个与当前进程共享地址空间(页目录, 虚拟地址位图, 堆)
+ *        和文件描述符表的线程. 新线程有自己的用户栈, 从entry开始在用户态执行, 栈上依次是返回地址0, func, arg,
+ *        所以entry像普通函数一样收到func和arg两个参数. entry不能返回, 执行完要调用exit
+ *
+ * @param entry 新线程在用户态执行的第一条指令
+ * @param func entry的第一个参数
+ * @param arg entry的第二个参数
+ * @return pid_t 成功返回新线程的id, 失败返回-1
+ */
+pid_t sys_clone(void *entry, void *func, void *arg)
+{
+    task_status_t *parent_thread = running_thread();
+    ASSERT(INTR_OFF == intr_get_status() && parent_thread->pgdir != NULL);
+
+    // 新线程的用户栈, 在共享的虚拟地址池中分配, 各线程的栈互不重叠
+    void *ustack = get_user_pages(USER_THREAD_STACK_PAGES);
+    if (ustack == NULL)
+        return -1;
+    task_status_t *child_thread = get_kernel_pages(1);
+    if (child_thread == NULL)
+    {
+        mfree_page(PF_USER, ustack, USER_THREAD_STACK_PAGES);
+        return -1;
+    }
+
+    // 复制PCB整页, 其中有进入系统调用时保存的中断栈, 新线程从这里返回用户态
+    memcpy(child_thread, parent_thread, PG_SIZE);
+    if (files_share(child_thread) == -1)
+    {
+        mfree_page(PF_KERNEL, child_thread, 1);
+        mfree_page(PF_USER, ustack, USER_THREAD_STACK_PAGES);
+        return -1;
+    }
+    child_thread->mm->users++;
+    child_thread->pid = fork_pid();
+    child_thread->tgid = parent_thread->tgid;
+    child_thread->parent_pid = parent_thread->tgid; // 退出后由组内线程wait回收, 主线程exit时也会回收
+    child_thread->ustack = (uint32_t)ustack;
+    child_thread->fpu_state = NULL; // 新线程从初始的浮点状态开始
+    child_thread->elapsed_ticks = 0;
+    child_thread->status = TASK_READY;
+    child_thread->ticks = child_thread->priority;
+    child_thread->lock_depth = 1; // 与fork出的子进程一样, 第一次上cpu时持有大内核锁
+    elem_init(&child_thread->general_tag);
+    elem_init(&child_thread->all_list_tag);
+    elem_init(&child_thread->pid_tag);
+    elem_init(&child_thread->sibling_tag);
+    list_init(&child_thread->children);
+    list_init(&child_thread->zombies);
+
+    // 在新线程的用户栈上构造entry(func, arg)的调用现场
+    uint32_t *esp3 = (uint32_t *)((uint32_t)ustack + USER_THREAD_STACK_PAGES * PG_SIZE);
+    *--esp3 = (uint32_t)arg;
+    *--esp3 = (uint32_t)func;
+    *--esp3 = 0; // 返回地址, entry不会返回
+
+    intr_stack_t *intr_0_stack = (intr_stack_t *)((uint32_t)child_thread + PG_SIZE - sizeof(intr_stack_t));
+    intr_0_stack->eip = entry;
+    intr_0_stack->esp = esp3;
+    build_child_stack(child_thread);
+
+    ready_enqueue(child_thread);
+    task_register(child_thread);
 
     return child_thread->pid;
 }
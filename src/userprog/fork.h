@@ -2,6 +2,8 @@
 #define __USERPROG_FORK_H
 
 #include "thread.h"
+
+#define USER_THREAD_STACK_PAGES 4 // clone出的线程的用户栈大小, 以页为单位
 /* fork子进程,只能由用户进程通过系统调用fork调用,
    内核线程不可直接调用,原因是要从0级栈中获得esp3等 */
 
@@ -11,5 +13,6 @@
  * @return pid_t 父进程返回子进程的pid; 子进程返回0
  */
 pid_t sys_fork(void);
+pid_t sys_clone(void *entry, void *func, void *arg);
 
 #endif
\ No newline at end of file
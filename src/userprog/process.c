@@ -10,7 +10,6 @@
 #include "console.h"
 
 extern void intr_exit(void);
-extern struct list thread_ready_list; // 就绪队列
 extern struct list thread_all_list;   // 全部进程队列
 
 /* 构建用户进程初始上下文信息 */
@@ -35,6 +34,9 @@ void start_process(void *filename_)
 
    // 为用户进程分配内存栈
    proc_stack->esp = (void *)((uint32_t)get_a_page(PF_USER, USER_STACK3_VADDR) + PG_SIZE);
+   // 映射堆的第一页, 给用户态的malloc存放状态
+   if (user_heap_reset() == -1)
+      PANIC("start_process: no memory for user heap");
 
    proc_stack->ss = SELECTOR_U_DATA;
    asm volatile("movl %0, %%esp; jmp intr_exit"
@@ -125,14 +127,60 @@ uint32_t *create_page_dir(void)
    return page_dir_vaddr;
 }
 
-/* 创建用户进程虚拟地址位图 */
-void create_user_vaddr_bitmap(struct task_struct *user_prog)
+// 在内核堆中申请内存, 用户进程调用时也从内核堆中分配, 地址空间的描述由内核管理
+static void *mm_kmalloc(uint32_t size)
 {
-   user_prog->userprog_vaddr.vaddr_start = USER_VADDR_START;
+   struct task_struct *cur = running_thread();
+   uint32_t *cur_pagedir_bak = cur->pgdir;
+   cur->pgdir = NULL;
+   void *vaddr = sys_malloc(size);
+   cur->pgdir = cur_pagedir_bak;
+   return vaddr;
+}
+
+// 释放mm_kmalloc申请的内存
+static void mm_kfree(void *vaddr)
+{
+   struct task_struct *cur = running_thread();
+   uint32_t *cur_pagedir_bak = cur->pgdir;
+   cur->pgdir = NULL;
+   sys_free(vaddr);
+   cur->pgdir = cur_pagedir_bak;
+}
+
+/**
+ * @brief mm_create创建一个空的用户地址空间: 虚拟地址位图全为0, 堆中没有内存块, 使用者计数为1
+ *
+ * @return struct mm_struct* 失败返回NULL
+ */
+struct mm_struct *mm_create(void)
+{
+   struct mm_struct *mm = mm_kmalloc(sizeof(struct mm_struct));
+   if (mm == NULL)
+      return NULL;
    uint32_t bitmap_pg_cnt = DIV_ROUND_UP((0xc0000000 - USER_VADDR_START) / PG_SIZE / 8, PG_SIZE);
-   user_prog->userprog_vaddr.vaddr_bitmap.bits = get_kernel_pages(bitmap_pg_cnt);
-   user_prog->userprog_vaddr.vaddr_bitmap.btmp_bytes_len = (0xc0000000 - USER_VADDR_START) / PG_SIZE / 8;
-   bitmap_init(&user_prog->userprog_vaddr.vaddr_bitmap);
+   mm->userprog_vaddr.vaddr_bitmap.bits = get_kernel_pages(bitmap_pg_cnt);
+   if (mm->userprog_vaddr.vaddr_bitmap.bits == NULL)
+   {
+      mm_kfree(mm);
+      return NULL;
+   }
+   mm->userprog_vaddr.vaddr_start = USER_VADDR_START;
+   mm->userprog_vaddr.vaddr_bitmap.btmp_bytes_len = (0xc0000000 - USER_VADDR_START) / PG_SIZE / 8;
+   bitmap_init(&mm->userprog_vaddr.vaddr_bitmap);
+   mm->brk = USER_HEAP_START;
+   mm->group_exit = false;
+   block_desc_init(mm->u_block_desc);
+   mm->users = 1;
+   return mm;
+}
+
+/* 释放地址空间的虚拟地址位图和mm_struct本身. 其中映射的物理页和页表须由调用者先回收 */
+void mm_destroy(struct mm_struct *mm)
+{
+   uint32_t bitmap_pg_cnt = DIV_ROUND_UP(mm->userprog_vaddr.vaddr_bitmap.btmp_bytes_len, PG_SIZE);
+   mfree_page(PF_KERNEL, mm->userprog_vaddr.vaddr_bitmap.bits, bitmap_pg_cnt);
+   mm_kfree(mm);
 }
 
 /* 创建用户进程 */
@@ -141,16 +189,13 @@ void process_execute(void *filename, char *name)
    /* pcb内核的数据结构,由内核来维护进程信息,因此要在内核内存池中申请 */
    struct task_struct *thread = get_kernel_pages(1);
    init_thread(thread, name, default_prio);
-   create_user_vaddr_bitmap(thread);
+   thread->mm = mm_create();
    thread_create(thread, start_process, filename);
    thread->pgdir = create_page_dir();
-   block_desc_init(thread->u_block_desc);
 
    enum intr_status old_status = intr_disable();
-   ASSERT(!elem_find(&thread_ready_list, &thread->general_tag));
-   list_append(&thread_ready_list, &thread->general_tag);
+   ready_enqueue(thread);
 
-   ASSERT(!elem_find(&thread_all_list, &thread->all_list_tag));
-   list_append(&thread_all_list, &thread->all_list_tag);
+   task_register(thread);
    intr_set_status(old_status);
 }
@@ -16,10 +16,14 @@
 #define USER_STACK3_VADDR (0xc0000000 - 0x1000)
 // 用户进程的起始虚拟地址
 #define USER_VADDR_START 0x8048000
+// 用户堆的范围, 由sbrk扩展. 进程创建和exec时由user_heap_reset清空, 只映射第一页, 存放用户态分配器的状态(见lib/umalloc.h)
+#define USER_HEAP_START 0x40000000
+#define USER_HEAP_END 0x80000000
 void process_execute(void *filename, char *name);
 void start_process(void *filename_);
 void process_activate(struct task_struct *p_thread);
 void page_dir_activate(struct task_struct *p_thread);
 uint32_t *create_page_dir(void);
-void create_user_vaddr_bitmap(struct task_struct *user_prog);
+struct mm_struct *mm_create(void);
+void mm_destroy(struct mm_struct *mm);
 #endif
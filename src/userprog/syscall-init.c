@@ -13,16 +13,39 @@
 #include "stdio.h"
 #include "pipe.h"
 #include "timer.h"
-#define syscall_nr 32
+#include "file.h"
+#include "stdio-kernel.h"
+#include "sync.h"
+#include "journal.h"
+#include "futex.h"
+#include "bench.h"
+#define syscall_nr 64
 typedef void *syscall;
 syscall syscall_table[syscall_nr];
 
-/* 返回当前任务的pid */
+/* 返回当前进程的pid, clone出的线程返回所在线程组的id, 即主线程的pid */
 uint32_t sys_getpid(void)
 {
-   return running_thread()->pid;
+   return running_thread()->tgid;
 }
 
+/* 打印调试信息: 物理页引用计数, 当前分区的位图I/O和日志统计 */
+void sys_debug(void)
+{
+   Debugmem();
+   printk("\n");
+   bitmap_io_report(cur_part);
+   journal_report(cur_part);
+}
+
+#ifndef CONFIG_BENCH
+/* 内核不带性能测试(未用BENCH=1构建)时, 性能测试和统计的系统调用都返回-1 */
+static int32_t sys_bench_disabled(void)
+{
+   return -1;
+}
+#endif
+
 /* 初始化系统调用 */
 void syscall_init(void)
 {
@@ -55,7 +78,29 @@ void syscall_init(void)
    syscall_table[SYS_PIPE] = sys_pipe;
    syscall_table[SYS_GETCHAR] = get_char;
    syscall_table[SYS_FD_REDIRECT] = sys_fd_redirect;
-   syscall_table[SYS_DATE] = sys_date; // 有bug
-   syscall_table[SYS_DEBUG] = Debugmem;
+   syscall_table[SYS_DATE] = sys_date;
+   syscall_table[SYS_DEBUG] = sys_debug;
+   syscall_table[SYS_SYNC] = sys_sync;
+   syscall_table[SYS_DUP] = sys_dup;
+   syscall_table[SYS_DUP2] = sys_dup2;
+   syscall_table[SYS_CLOCK_GETTIME] = sys_clock_gettime;
+   syscall_table[SYS_FUTEX_WAIT] = sys_futex_wait;
+   syscall_table[SYS_FUTEX_WAKE] = sys_futex_wake;
+   syscall_table[SYS_MMAP_SHARED] = sys_mmap_shared;
+   syscall_table[SYS_CLONE] = sys_clone;
+   syscall_table[SYS_SCHED_YIELD] = thread_yield;
+   syscall_table[SYS_SBRK] = sys_sbrk;
+   syscall_table[SYS_THREAD_JOIN] = sys_thread_join;
+#ifdef CONFIG_BENCH
+   syscall_table[SYS_SCHED_STAT] = sys_sched_stat;
+   syscall_table[SYS_LOCK_STRESS] = sys_lock_stress;
+   syscall_table[SYS_MEM_BENCH] = sys_mem_bench;
+   syscall_table[SYS_COW_STAT] = sys_cow_stat;
+#else
+   syscall_table[SYS_SCHED_STAT] = sys_bench_disabled;
+   syscall_table[SYS_LOCK_STRESS] = sys_bench_disabled;
+   syscall_table[SYS_MEM_BENCH] = sys_bench_disabled;
+   syscall_table[SYS_COW_STAT] = sys_bench_disabled;
+#endif
    put_str("syscall_init done\n");
 }
@@ -3,6 +3,7 @@
 #include "global.h"
 #include "string.h"
 #include "print.h"
+#include "smp.h"
 
 /* 任务状态段tss结构 */
 struct tss
@@ -35,12 +36,17 @@ struct tss
    uint32_t trace;
    uint32_t io_base;
 };
-static struct tss tss;
+/* 每个cpu一个tss, 进入中断时各自从中取得当前任务的0级栈 */
+static struct tss tss[NR_CPUS];
 
-/* 更新tss中esp0字段的值为pthread的0级栈*/
+/* cpu 0的tss描述符在gdt的第4项, 其它cpu的依次放在用户代码段和数据段之后, 即第7项开始 */
+#define TSS_GDT_INDEX(cpu) ((cpu) == 0 ? 4 : 6 + (cpu))
+#define GDT_DESC_CNT (7 + NR_CPUS - 1)
+
+/* 更新pthread所在cpu的tss中esp0字段的值为pthread的0级栈*/
 void update_tss_esp(struct task_struct *pthread)
 {
-   tss.esp0 = (uint32_t *)((uint32_t)pthread + PG_SIZE);
+   tss[pthread->cpu].esp0 = (uint32_t *)((uint32_t)pthread + PG_SIZE);
 }
 
 /* 创建gdt描述符 */
@@ -57,27 +63,35 @@ static struct gdt_desc make_gdt_desc(uint32_t *desc_addr, uint32_t limit, uint8_
    return desc;
 }
 
+/* 在当前cpu上加载gdt, 并把第cpu号tss载入tr寄存器. ap启动时也要调用 */
+void tss_load(uint8_t cpu)
+{
+   /* gdt 16位的limit 32位的段基址 */
+   uint64_t gdt_operand = ((8 * GDT_DESC_CNT - 1) | ((uint64_t)(uint32_t)0xc0000900 << 16));
+   asm volatile("lgdt %0" : : "m"(gdt_operand));
+   asm volatile("ltr %w0" : : "r"((uint16_t)((TSS_GDT_INDEX(cpu) << 3) + (TI_GDT << 2) + RPL0)));
+}
+
 /* 在gdt中创建tss并重新加载gdt, 初始化tss当然是为了进程的运行 */
 void tss_init()
 {
    put_str("tss_init start\n");
-   uint32_t tss_size = sizeof(tss);
-   memset(&tss, 0, tss_size);
-   tss.ss0 = SELECTOR_K_STACK;
-   tss.io_base = tss_size;
-
-   /* gdt段基址为0x900,把tss放到第4个位置,也就是0x900+0x20的位置 */
+   uint32_t tss_size = sizeof(struct tss);
+   uint32_t cpu = 0;
+   for (cpu = 0; cpu < NR_CPUS; cpu++)
+   {
+      memset(&tss[cpu], 0, tss_size);
+      tss[cpu].ss0 = SELECTOR_K_STACK;
+      tss[cpu].io_base = tss_size;
 
-   /* 在gdt中添加dpl为0的TSS描述符 */
-   *((struct gdt_desc *)0xc0000920) = make_gdt_desc((uint32_t *)&tss, tss_size - 1, TSS_ATTR_LOW, TSS_ATTR_HIGH);
+      /* gdt段基址为0x900, 在gdt中添加dpl为0的TSS描述符, cpu 0的在0x900+0x20的位置 */
+      *((struct gdt_desc *)0xc0000900 + TSS_GDT_INDEX(cpu)) = make_gdt_desc((uint32_t *)&tss[cpu], tss_size - 1, TSS_ATTR_LOW, TSS_ATTR_HIGH);
+   }
 
    /* 在gdt中添加dpl为3的数据段和代码段描述符 */
    *((struct gdt_desc *)0xc0000928) = make_gdt_desc((uint32_t *)0, 0xfffff, GDT_CODE_ATTR_LOW_DPL3, GDT_ATTR_HIGH);
    *((struct gdt_desc *)0xc0000930) = make_gdt_desc((uint32_t *)0, 0xfffff, GDT_DATA_ATTR_LOW_DPL3, GDT_ATTR_HIGH);
 
-   /* gdt 16位的limit 32位的段基址 */
-   uint64_t gdt_operand = ((8 * 7 - 1) | ((uint64_t)(uint32_t)0xc0000900 << 16)); // 7个描述符大小
-   asm volatile("lgdt %0" : : "m"(gdt_operand));
-   asm volatile("ltr %w0" : : "r"(SELECTOR_TSS));
+   tss_load(0);
    put_str("tss_init and ltr done\n");
 }
@@ -9,16 +9,44 @@
 #include "fs.h"
 #include "file.h"
 #include "pipe.h"
+#include "process.h"
+#include "fpu.h"
+#include "fork.h"
+#include "futex.h"
+#include "ioqueue.h"
+
+extern struct ioqueue kbd_buf;
+
 /**
  * @brief  释放用户进程资源
  *       1. 页表中对应的物理页
  *       2. 虚拟内存池占物理页
  *       3. 关闭打开的文件
+ *       地址空间还有同组的其它线程在用时, 只回收本线程的用户栈, 页表和物理页由最后退出的线程回收
  *
- * @param release_thread 要被释放的用户进程的pcb
+ * @param release_thread 要被释放的用户进程的pcb, 必须是当前任务
  */
 static void release_prog_resource(struct task_struct *release_thread)
 {
+    struct mm_struct *mm = release_thread->mm;
+
+    // 关闭进程打开的文件, 释放文件描述符表
+    files_release(release_thread);
+
+    // 释放浮点寄存器的保存区
+    fpu_release(release_thread);
+
+    if (mm->users > 1)
+    {
+        if (release_thread->ustack != 0)
+            mfree_page(PF_USER, (void *)release_thread->ustack, USER_THREAD_STACK_PAGES);
+        mm->users--;
+        mm->running--; // 本任务不再计入, 同组的线程可以到别的cpu上运行了
+        release_thread->mm = NULL;
+        release_thread->pgdir = NULL; // 页目录是共享的, 回收pcb时不能释放
+        return;
+    }
+
     // 1. 页表中对应的物理页
     uint32_t *pgdir_vaddr = release_thread->pgdir;
     uint16_t user_pde_nr = 768, pde_idx = 0; // 用户页目录项总数以及索引
@@ -65,100 +93,145 @@ static void release_prog_resource(struct task_struct *release_thread)
     }
 
     // 回收用户虚拟内存池池占用的物理内存
-    uint32_t bitmap_pg_cnt = (release_thread->userprog_vaddr.vaddr_bitmap.btmp_bytes_len) / PG_SIZE;
-    uint8_t *user_vaddr_pool_bitmap = release_thread->userprog_vaddr.vaddr_bitmap.bits;
-    mfree_page(PF_KERNEL, user_vaddr_pool_bitmap, bitmap_pg_cnt);
+    mm->running--;
+    release_thread->mm = NULL;
+    mm_destroy(mm);
+}
+
+/* 线程组的主线程. 子进程和clone出的线程都挂在父进程所在线程组的主线程上 */
+static struct task_struct *group_leader(struct task_struct *pthread)
+{
+    return pthread->pid == pthread->tgid ? pthread : pid2thread(pthread->tgid);
+}
 
-    // 关闭进程打开的文件
-    uint8_t fd_idx = 3;
-    while (fd_idx < MAX_FILES_OPEN_PER_PROC)
+/* 在leader的children或zombies中找第一个子进程. 同组的线程也挂在主线程上, 它们由thread_join回收, 这里跳过 */
+static struct task_struct *find_child(struct task_struct *leader, struct list *plist)
+{
+    list_elem_t *elem = plist->head.next;
+    while (elem != &plist->tail)
     {
-        if (release_thread->fd_table[fd_idx] != -1)
-        {
-            if (is_pipe(fd_idx))
-            {
-                uint32_t global_fd = fd_local2global(fd_idx);
-                if (--file_table[global_fd].fd_pos == 0)
-                {
-                    mfree_page(PF_KERNEL, file_table[global_fd].fd_inode, 1);
-                    file_table[global_fd].fd_inode = NULL;
-                }
-            }
-            else
-                sys_close(fd_idx);
-        }
-        fd_idx++;
+        struct task_struct *pthread = elem2entry(struct task_struct, sibling_tag, elem);
+        if (pthread->tgid != leader->tgid)
+            return pthread;
+        elem = elem->next;
+    }
+    return NULL;
+}
+
+/* 唤醒leader所在线程组中在wait或exit里等待的任务. 不知道是哪个线程在等, 全部唤醒, 它们会重新检查.
+ * 组内的其它线程都在主线程的children中, 只需遍历children */
+static void wake_group_waiters(struct task_struct *leader)
+{
+    if (leader->status == TASK_WAITING)
+        thread_unblock(leader);
+    list_elem_t *elem = leader->children.head.next;
+    while (elem != &leader->children.tail)
+    {
+        struct task_struct *pthread = elem2entry(struct task_struct, sibling_tag, elem);
+        if (pthread->tgid == leader->tgid && pthread->status == TASK_WAITING)
+            thread_unblock(pthread);
+        elem = elem->next;
     }
 }
 
 /**
- * @brief find_child用于查找parent_pid所表示的线程的所有子线程
- *
- * @param elem 表示线程的tag
- * @param parent_pid 父进程pid
- * @return true elem表示的线程是parent_pid表示的父进程的子线程
- * @return false elem表示的线程不是parent_pid表示的父进程的子线程
+ * @brief group_exit_check在每次中断或系统调用返回前调用. 主线程正在退出时, 同组的其它线程在返回用户态前退出.
+ *        lock_depth为1说明是从用户态进入的最外层, 中断嵌套时不处理
  */
-static bool find_child(list_elem_t *pelem, int32_t ppid)
+void group_exit_check(void)
 {
-    task_status_t *pcb = elem2entry(task_status_t, all_list_tag, pelem);
-    if (pcb->parent_pid == ppid) // 若该任务的parent_pid为ppid,返回
-        return true;             // list_traversal只有在回调函数返回true时才会停止继续遍历,所以在此返回true
-    return false;                // 让list_traversal继续传递下一个元素
+    struct task_struct *cur = running_thread();
+    if (cur->lock_depth == 1 && thread_group_exiting())
+        sys_exit(0);
 }
 
 /**
- * @brief find_hanging_child用于查找parent_pid指定的父进程的所有状态为TASK_HANGING的子进程
+ * @brief thread_group_join由主线程在exit时调用, 等待同组的其它线程全部退出并回收它们的pcb,
+ *        这之后地址空间只剩主线程在用, 才能整个释放. 先把线程组标记为正在退出, 并唤醒在futex, 键盘,
+ *        wait和thread_join中睡眠的线程, 它们返回用户态前会在group_exit_check中退出
  *
- * @param elem 表示线程的tag
- * @param parent_pid 父线程pid
- * @return true elem表示的线程是parent_pid表示的父进程的子线程, 并且是TASK_HANGING状态
- * @return false elem表示的线程不是parent_pid表示的父进程的子线程, 并且是TASK_HANGING状态
+ * @param leader 主线程, 即当前任务
  */
-static bool find_hanging_child(list_elem_t *pelem, int32_t ppid)
+static void thread_group_join(struct task_struct *leader)
 {
-    struct task_struct *pthread = elem2entry(struct task_struct, all_list_tag, pelem);
-    if (pthread->parent_pid == ppid && pthread->status == TASK_HANGING)
-        return true;
-    return false;
+    leader->mm->group_exit = true;
+    futex_wake_group(leader->mm);
+    ioq_wake_group(&kbd_buf, leader->mm);
+    wake_group_waiters(leader);
+
+    while (1)
+    {
+        // 回收已经退出的线程
+        list_elem_t *elem = leader->zombies.head.next;
+        while (elem != &leader->zombies.tail)
+        {
+            struct task_struct *pthread = elem2entry(struct task_struct, sibling_tag, elem);
+            elem = elem->next; // thread_exit会把pthread从zombies中去掉, 先取下一个
+            if (pthread->tgid == leader->tgid)
+                thread_exit(pthread, false);
+        }
+
+        // 还有线程在运行就等它们退出
+        bool alive = false;
+        elem = leader->children.head.next;
+        while (elem != &leader->children.tail && !alive)
+        {
+            struct task_struct *pthread = elem2entry(struct task_struct, sibling_tag, elem);
+            alive = pthread->tgid == leader->tgid;
+            elem = elem->next;
+        }
+        if (!alive)
+            return;
+        thread_block(TASK_WAITING);
+    }
 }
 
 /**
- * @brief init_adopt_a_child用于将pid表示的进程过继给init
+ * @brief init_adopt_children用于将leader的所有子进程过继给init, 其中已经退出的仍然等待init回收
  *
- * @param elem 表示线程的tag
- * @param pid 需要过继的线程的pid
- * @return true 当前进程是要过继的进程
- * @return false 当前进程不是要过继的进程
+ * @param leader 要退出的进程, 其线程组中的其它线程已经回收
  */
-static bool init_adopt_achild(struct list_elem *pelem, int32_t pid)
+static void init_adopt_children(struct task_struct *leader)
 {
-    task_status_t *pcb = elem2entry(task_status_t, all_list_tag, pelem);
-    if (pcb->parent_pid == pid)
-        pcb->parent_pid = 1;
-    return false;
+    struct task_struct *init = pid2thread(1);
+    while (!list_empty(&leader->children))
+    {
+        list_elem_t *elem = list_pop(&leader->children);
+        struct task_struct *pthread = elem2entry(struct task_struct, sibling_tag, elem);
+        pthread->parent_pid = 1;
+        list_append(&init->children, elem);
+    }
+    if (list_empty(&leader->zombies))
+        return;
+    while (!list_empty(&leader->zombies))
+    {
+        list_elem_t *elem = list_pop(&leader->zombies);
+        struct task_struct *pthread = elem2entry(struct task_struct, sibling_tag, elem);
+        pthread->parent_pid = 1;
+        list_append(&init->zombies, elem);
+    }
+    wake_group_waiters(init);
 }
 
 /**
- * @brief sys_wait是wait系统调用的实现函数. 用于让父进程等待子进程调用exit退出, 并将子进程的返回值保存到status中
+ * @brief sys_wait是wait系统调用的实现函数. 用于让父进程等待子进程调用exit退出, 并将子进程的返回值保存到status中.
+ *        子进程属于整个线程组, 组内任一线程都可以等待; clone出的线程不是子进程, 由thread_join回收
  *
  * @param status 子进程的退出状态, 输出参数
  * @return pid_t 若等待成功, 则返回子进程的pid; 若等待失败, 则返回-1
  */
 int16_t sys_wait(int32_t *status)
 {
-    task_status_t *parent_pcb = running_thread();
+    task_status_t *cur = running_thread();
+    task_status_t *parent_pcb = group_leader(cur);
 
     while (1)
     {
-        // 检测是否已经有运行完毕的子进程
-        list_elem_t *child_elem = list_traversal(&thread_all_list, find_hanging_child, parent_pcb->pid);
-
-        // 若有挂起(运行结束)的子进程
-        if (child_elem != NULL)
+        // 若有挂起(运行结束)的子进程, 它们在exit时已移到zombies中
+        task_status_t *child_pcb = find_child(parent_pcb, &parent_pcb->zombies);
+        if (child_pcb != NULL)
         {
-            task_status_t *child_pcb = elem2entry(task_status_t, all_list_tag, child_elem);
-            *status = child_pcb->status;
+            *status = child_pcb->exit_status;
             uint16_t child_pid = child_pcb->pid;
             // 释放子进程的PCB, 页目录表
             thread_exit(child_pcb, false);
@@ -167,9 +240,8 @@ int16_t sys_wait(int32_t *status)
             return child_pid;
         }
 
-        // 判断是否有子进程
-        child_elem = list_traversal(&thread_all_list, find_child, parent_pcb->pid);
-        if (child_elem == NULL)
+        // 判断是否有子进程, 主线程正在退出时不再等待
+        if (find_child(parent_pcb, &parent_pcb->children) == NULL || thread_group_exiting())
             return -1;
         // 仍有子进程运行, 此时阻塞父进程
         thread_block(TASK_WAITING);
@@ -177,7 +249,38 @@ int16_t sys_wait(int32_t *status)
 }
 
 /**
- * @brief sys_exit是exit系统调用的实现函数. 用于主动结束调用的进程
+ * @brief sys_thread_join等待同组中id为tid的线程退出, 并回收它的pcb
+ *
+ * @param tid clone返回的线程id
+ * @param status 线程的退出状态, 输出参数
+ * @return int16_t 成功返回tid; tid不是同组的其它线程, 或主线程正在退出时返回-1
+ */
+int16_t sys_thread_join(int16_t tid, int32_t *status)
+{
+    task_status_t *cur = running_thread();
+    task_status_t *leader = group_leader(cur);
+
+    while (1)
+    {
+        task_status_t *pthread = pid2thread(tid);
+        if (pthread == NULL || pthread == cur || pthread == leader || pthread->tgid != cur->tgid)
+            return -1;
+        // 退出的线程在主线程的zombies中
+        if (elem_find(&leader->zombies, &pthread->sibling_tag))
+        {
+            *status = pthread->exit_status;
+            thread_exit(pthread, false);
+            return tid;
+        }
+        if (thread_group_exiting())
+            return -1;
+        thread_block(TASK_WAITING);
+    }
+}
+
+/**
+ * @brief sys_exit是exit系统调用的实现函数. 用于主动结束调用的进程. clone出的线程调用时只结束它自己,
+ *        主线程调用时先等同组的其它线程退出, 再释放整个进程
  */
 void sys_exit(int32_t status)
 {
@@ -186,18 +289,24 @@ void sys_exit(int32_t status)
     if (child_pcb->parent_pid == -1)
         PANIC("sys_exit: child_pcb->parent_pid is -1\n");
 
-    // 把child_thread的所有子进程过继给init
-    list_traversal(&thread_all_list, init_adopt_achild, child_pcb->pid);
+    if (child_pcb->pid == child_pcb->tgid)
+    {
+        thread_group_join(child_pcb);
+        // 把child_thread的所有子进程过继给init
+        init_adopt_children(child_pcb);
+    }
 
     // 回收进程资源
     release_prog_resource(child_pcb);
 
-    // 唤醒
+    // 从父进程的children移到zombies, wait直接从zombies中取
     task_status_t *parent_pcb = pid2thread(child_pcb->parent_pid);
+    list_remove(&child_pcb->sibling_tag);
+    list_append(&parent_pcb->zombies, &child_pcb->sibling_tag);
 
-    if (parent_pcb->status == TASK_WAITING)
-        thread_unblock(parent_pcb);
+    // 唤醒在wait中等待的父进程, 或在exit中等待的主线程
+    wake_group_waiters(parent_pcb);
 
     // 线程把自己挂起，等待父进程回收pcb
     thread_block(TASK_HANGING);
-}
\ No newline at end of file
+}
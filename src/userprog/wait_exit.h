@@ -3,4 +3,6 @@
 #include "stdint.h"
 int16_t sys_wait(int32_t *status);
 void sys_exit(int32_t status);
+int16_t sys_thread_join(int16_t tid, int32_t *status);
+void group_exit_check(void);
 #endif
\ No newline at end of file